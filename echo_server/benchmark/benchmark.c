@@ -10,9 +10,10 @@
 #include "sel4bench.h"
 #include "fence.h"
 #include "bench.h"
+#include "bench_events.h"
+#include "trace.h"
 #include "util.h"
 
-#define MAGIC_CYCLES 150
 #define ULONG_MAX 0xfffffffffffffffful
 #define UINT_MAX 0xfffffffful
 
@@ -22,11 +23,48 @@
 #define STOP 2
 
 #define INIT 3
+#define PMU_ROTATE 4
+#define PMU_SETUP 5
+
+/* The benchmarked PDs are children of this PD, so we hold their TCBs */
+#define PD_ETH_ID       1
+#define PD_MUX_RX_ID    2
+#define PD_MUX_TX_ID    3
+#define PD_LWIP0_ID     4
+#define PD_LWIP1_ID     5
+#define PD_IDLE_ID      6
+
+/* pktgen.system puts the packet generator in place of the second client */
+#ifdef CONFIG_PKTGEN
+#define CLIENT1_NAME "pktgen"
+#else
+#define CLIENT1_NAME "lwip1"
+#endif
 
 uintptr_t uart_base;
 uintptr_t cyclecounters_vaddr;
+uintptr_t results_vaddr;
+
+/* Trace rings of the PDs in the RX/TX pipeline, mapped read only */
+uintptr_t trace_eth;
+uintptr_t trace_mux_rx;
+uintptr_t trace_mux_tx;
+uintptr_t trace_lwip0;
+uintptr_t trace_lwip1;
+
+static const struct {
+    sel4cp_pd id;
+    const char *name;
+} bench_pds[] = {
+    { PD_ETH_ID, "eth" },
+    { PD_MUX_RX_ID, "mux_rx" },
+    { PD_MUX_TX_ID, "mux_tx" },
+    { PD_LWIP0_ID, "lwip0" },
+    { PD_LWIP1_ID, CLIENT1_NAME },
+    { PD_IDLE_ID, "benchIdle" },
+};
 
-struct bench *b = (void *)(uintptr_t)0x5010000;
+_Static_assert(ARRAY_SIZE(bench_pds) <= BENCH_MAX_PDS, "Too many PDs for the results region");
 
 ccnt_t counter_values[8];
 counter_bitfield_t benchmark_bf;
@@ -35,15 +73,6 @@ counter_bitfield_t benchmark_bf;
 benchmark_track_kernel_entry_t *log_buffer;
 #endif
 
-char *counter_names[] = {
-    "L1 i-cache misses",
-    "L1 d-cache misses",
-    "L1 i-tlb misses",
-    "L1 d-tlb misses",
-    "Instructions",
-    "Branch mispredictions",
-};
-
 event_id_t benchmarking_events[] = {
     SEL4BENCH_EVENT_CACHE_L1I_MISS,
     SEL4BENCH_EVENT_CACHE_L1D_MISS,
@@ -53,11 +82,33 @@ event_id_t benchmarking_events[] = {
     SEL4BENCH_EVENT_BRANCH_MISPREDICT,
 };
 
+/*
+ * There are usually more events configured than the PMU has counters, so
+ * the events are split into groups of n_counters that take turns on the
+ * counters. The client notifies us every few milliseconds during a
+ * measurement to rotate to the next group.
+ */
+struct pmu_state {
+    event_id_t events[BENCH_MAX_EVENTS];
+    int n_events;
+    seL4_Word n_counters;
+    int n_groups;
+    int group;
+    /* Events counted so far, and cycles each group was on the counters */
+    uint64_t counts[BENCH_MAX_EVENTS];
+    uint64_t group_cycles[BENCH_MAX_EVENTS];
+    ccnt_t group_start;
+    ccnt_t start;
+} pmu;
+
 #ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
 static void
 sel4cp_benchmark_start(void)
 {
     seL4_BenchmarkResetThreadUtilisation(TCB_CAP);
+    for (int i = 0; i < ARRAY_SIZE(bench_pds); i++) {
+        seL4_BenchmarkResetThreadUtilisation(BASE_TCB_CAP + bench_pds[i].id);
+    }
     seL4_BenchmarkResetLog(); 
 }
 
@@ -73,6 +124,110 @@ sel4cp_benchmark_stop(uint64_t *total, uint64_t* idle, uint64_t *kernel, uint64_
     *kernel = buffer[BENCHMARK_TOTAL_KERNEL_UTILISATION];
     *entries = buffer[BENCHMARK_TOTAL_NUMBER_KERNEL_ENTRIES];
 }
+
+/**
+ * Collect the utilisation of every benchmarked PD since the measurement
+ * started.
+ *
+ * @param results filled in with a record per PD.
+ */
+static void
+sel4cp_benchmark_pd_util(struct bench_results *results)
+{
+    uint64_t *buffer = (uint64_t *)&seL4_GetIPCBuffer()->msg[0];
+
+    for (int i = 0; i < ARRAY_SIZE(bench_pds); i++) {
+        struct bench_pd_util *pd = &results->pds[i];
+        seL4_BenchmarkGetThreadUtilisation(BASE_TCB_CAP + bench_pds[i].id);
+
+        const char *name = bench_pds[i].name;
+        int n = 0;
+        for (; name[n] && n < BENCH_PD_NAME_LEN - 1; n++) {
+            pd->name[n] = name[n];
+        }
+        pd->name[n] = 0;
+
+        pd->total = buffer[BENCHMARK_TCB_UTILISATION];
+        pd->kernel = buffer[BENCHMARK_TCB_KERNEL_UTILISATION];
+        pd->entries = buffer[BENCHMARK_TCB_NUMBER_KERNEL_ENTRIES];
+        pd->schedules = buffer[BENCHMARK_TCB_NUMBER_SCHEDULES];
+    }
+    results->num_pds = ARRAY_SIZE(bench_pds);
+}
+#endif
+
+#ifdef CONFIG_PACKET_TRACE
+typedef struct trace_source {
+    const char *name;
+    uintptr_t *ring;
+    /* Head of the ring when the measurement started */
+    uint64_t start;
+} trace_source_t;
+
+static trace_source_t trace_sources[] = {
+    { "eth", &trace_eth },
+    { "mux_rx", &trace_mux_rx },
+    { "mux_tx", &trace_mux_tx },
+    { "lwip0", &trace_lwip0 },
+    { CLIENT1_NAME, &trace_lwip1 },
+};
+
+static void
+puthex(uint64_t val)
+{
+    char buffer[17];
+    int i = 16;
+    buffer[i] = 0;
+    do {
+        buffer[--i] = hexchar(val & 0xf);
+        val >>= 4;
+    } while (val);
+    print(&buffer[i]);
+}
+
+static void
+trace_start(void)
+{
+    for (int i = 0; i < ARRAY_SIZE(trace_sources); i++) {
+        trace_ring_t *ring = (trace_ring_t *)*trace_sources[i].ring;
+        trace_sources[i].start = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+}
+
+/*
+ * Dump the records written since the measurement started, for
+ * tools/trace_report.py. Each ring is dumped as a "trace <name> <count>"
+ * line followed by one "<stage> <id> <cycles>" line per record, in hex.
+ * Records overwritten since the start are lost.
+ */
+static void
+trace_dump(void)
+{
+    for (int i = 0; i < ARRAY_SIZE(trace_sources); i++) {
+        trace_ring_t *ring = (trace_ring_t *)*trace_sources[i].ring;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t start = trace_sources[i].start;
+        if (head - start > TRACE_CAPACITY) {
+            start = head - TRACE_CAPACITY;
+        }
+
+        print("trace ");
+        print(trace_sources[i].name);
+        print(" ");
+        puthex(head - start);
+        print("\n");
+        for (uint64_t n = start; n != head; n++) {
+            trace_record_t *record = &ring->records[n & (TRACE_CAPACITY - 1)];
+            puthex(record->stage);
+            print(" ");
+            puthex(record->id);
+            print(" ");
+            puthex(record->cycles);
+            print("\n");
+        }
+    }
+    print("trace end\n");
+}
 #endif
 
 #ifdef CONFIG_BENCHMARK_TRACK_KERNEL_ENTRIES
@@ -131,14 +286,207 @@ static inline void seL4_BenchmarkTrackDumpSummary(benchmark_track_kernel_entry_t
 #endif
 
 
+/**
+ * Put a group of events on the counters and start counting them.
+ *
+ * @param group index of the group.
+ */
+static void
+pmu_start_group(int group)
+{
+    counter_bitfield_t mask = 0;
+    int first = group * pmu.n_counters;
+
+    for (seL4_Word i = 0; i < pmu.n_counters && first + i < pmu.n_events; i++) {
+        sel4bench_set_count_event(i, pmu.events[first + i]);
+        mask |= BIT(i);
+    }
+
+    pmu.group = group;
+    benchmark_bf = mask;
+    sel4bench_start_counters(mask);
+    pmu.group_start = sel4bench_get_cycle_count();
+}
+
+/**
+ * Stop the counters and add what they counted to the current group.
+ *
+ * @return the cycle count when the counters were read.
+ */
+static ccnt_t
+pmu_accumulate(void)
+{
+    ccnt_t now = sel4bench_get_counters(benchmark_bf, &counter_values[0]);
+    sel4bench_stop_counters(benchmark_bf);
+
+    int first = pmu.group * pmu.n_counters;
+    for (seL4_Word i = 0; i < pmu.n_counters && first + i < pmu.n_events; i++) {
+        pmu.counts[first + i] += counter_values[i];
+    }
+    pmu.group_cycles[pmu.group] += now - pmu.group_start;
+
+    return now;
+}
+
+/**
+ * Select the events to count, taking effect from the next measurement.
+ *
+ * @param events PMU event numbers.
+ * @param n_events number of events, at most BENCH_MAX_EVENTS.
+ */
+static void
+pmu_set_events(const event_id_t *events, int n_events)
+{
+    for (int i = 0; i < n_events; i++) {
+        pmu.events[i] = events[i];
+    }
+    pmu.n_events = n_events;
+    pmu.n_groups = DIV_ROUND_UP(n_events, pmu.n_counters);
+}
+
+static void
+pmu_start(void)
+{
+    sel4bench_stop_counters(benchmark_bf);
+    sel4bench_reset_counters();
+    THREAD_MEMORY_RELEASE();
+
+    for (int i = 0; i < BENCH_MAX_EVENTS; i++) {
+        pmu.counts[i] = 0;
+        pmu.group_cycles[i] = 0;
+    }
+
+    pmu_start_group(0);
+    pmu.start = pmu.group_start;
+}
+
+static void
+pmu_rotate(void)
+{
+    pmu_accumulate();
+
+    /* Setting the events resets the counters, so with a single group this
+       just starts it again from zero */
+    if (pmu.n_groups > 1) {
+        pmu_start_group((pmu.group + 1) % pmu.n_groups);
+    } else {
+        pmu_start_group(pmu.group);
+    }
+}
+
+/**
+ * Stop counting and scale each group's counts up to the whole measurement.
+ *
+ * @param results filled in with the event counts.
+ */
+static void
+pmu_stop(struct bench_results *results)
+{
+    ccnt_t now = pmu_accumulate();
+    uint64_t cycles = now - pmu.start;
+
+    results->cycles = cycles;
+    results->num_events = pmu.n_events;
+    for (int i = 0; i < pmu.n_events; i++) {
+        struct bench_event_count *event = &results->events[i];
+        uint64_t group_cycles = pmu.group_cycles[i / pmu.n_counters];
+
+        event->event = pmu.events[i];
+        event->count = pmu.counts[i];
+        event->cycles = group_cycles;
+        if (group_cycles) {
+            /* Scale by cycles / group_cycles in 16.16 fixed point */
+            uint64_t scale = (cycles << 16) / group_cycles;
+            event->estimate = (pmu.counts[i] * scale) >> 16;
+        } else {
+            event->estimate = 0;
+        }
+    }
+}
+
+/**
+ * Stop a measurement. The counters and utilisation figures are dumped to
+ * the console, and the per-PD utilisation is left in the results region
+ * for the utilization socket to return.
+ */
+static void
+benchmark_stop(void)
+{
+    struct bench_results *results = (struct bench_results *)results_vaddr;
+    results->num_pds = 0;
+
+    pmu_stop(results);
+
+    #ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
+    uint64_t total;
+    uint64_t kernel;
+    uint64_t entries;
+    uint64_t idle;
+    sel4cp_benchmark_stop(&total, &idle, &kernel, &entries);
+    sel4cp_benchmark_pd_util(results);
+    /* Dump the counters */
+    print("{\n");
+    for (int i = 0; i < results->num_events; i++) {
+        struct bench_event_count *event = &results->events[i];
+        const char *name = bench_event_name(event->event);
+        if (name) {
+            print(name);
+        } else {
+            puthex64(event->event);
+        }
+        print(": ");
+        puthex64(event->estimate);
+        print(" (");
+        puthex64(event->count);
+        print(" in ");
+        puthex64(event->cycles);
+        print(" cycles)\n");
+    }
+
+    print("KernelUtilisation");
+    print(": ");
+    puthex64(kernel);
+    print("\n");
+    print("KernelEntries");
+    print(": ");
+    puthex64(entries);
+    print("\n");
+
+    for (int i = 0; i < results->num_pds; i++) {
+        struct bench_pd_util *pd = &results->pds[i];
+        print(pd->name);
+        print(": total ");
+        puthex64(pd->total);
+        print(" kernel ");
+        puthex64(pd->kernel);
+        print(" entries ");
+        puthex64(pd->entries);
+        print("\n");
+    }
+    print("}\n");
+    #endif
+
+    #ifdef CONFIG_BENCHMARK_TRACK_KERNEL_ENTRIES
+    entries = seL4_BenchmarkFinalizeLog();
+    print("KernelEntries");
+    print(": ");
+    puthex64(entries);
+    seL4_BenchmarkTrackDumpSummary(log_buffer, entries);
+    #endif
+
+    #ifdef CONFIG_PACKET_TRACE
+    trace_dump();
+    #endif
+}
+
 void notified(sel4cp_channel ch) 
 {
     switch(ch) {
+        case PMU_ROTATE:
+            pmu_rotate();
+            break;
         case START:
-            sel4bench_reset_counters();
-            THREAD_MEMORY_RELEASE();
-
-            sel4bench_start_counters(benchmark_bf);
+            pmu_start();
 
             #ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
             sel4cp_benchmark_start();
@@ -148,73 +496,71 @@ void notified(sel4cp_channel ch)
             seL4_BenchmarkResetLog();
             #endif
 
-            break;
-        case STOP:
-            sel4bench_get_counters(benchmark_bf, &counter_values[0]);
-            sel4bench_stop_counters(benchmark_bf);
-
-            #ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
-            uint64_t total;
-            uint64_t kernel;
-            uint64_t entries;
-            uint64_t idle;
-            sel4cp_benchmark_stop(&total, &idle, &kernel, &entries);
-            /* Dump the counters */
-            print("{\n");
-            for (int i = 0; i < ARRAY_SIZE(benchmarking_events); i++) {
-                print(counter_names[i]);
-                print(": ");
-                puthex64(counter_values[i]);
-                print("\n");
-            }
-
-            print("KernelUtilisation");
-            print(": ");
-            puthex64(kernel);
-            print("\n");
-            print("KernelEntries");
-            print(": ");
-            puthex64(entries);
-            print("\n");
-            print("}\n");
-            #endif
-
-            #ifdef CONFIG_BENCHMARK_TRACK_KERNEL_ENTRIES
-            entries = seL4_BenchmarkFinalizeLog();
-            print("KernelEntries");
-            print(": ");
-            puthex64(entries);
-            seL4_BenchmarkTrackDumpSummary(log_buffer, entries);
+            #ifdef CONFIG_PACKET_TRACE
+            trace_start();
             #endif
 
             break;
         default:
             print("Bench thread notified on unexpected channel\n");
+            break;
     }
 }
 
-void init(void)
+seL4_MessageInfo_t
+protected(sel4cp_channel ch, sel4cp_msginfo msginfo)
 {
-    sel4bench_init();
-    seL4_Word n_counters = sel4bench_get_num_counters();
-    int n_chunks = DIV_ROUND_UP(ARRAY_SIZE(benchmarking_events), n_counters);
-
-
-    counter_bitfield_t mask = 0;
-
-    for (seL4_Word i = 0; i < n_counters; i++) {
-        seL4_Word counter = i;
-        if (counter >= ARRAY_SIZE(benchmarking_events)) {
+    switch (ch) {
+        case STOP:
+            /* Called, so the results are ready when the caller resumes */
+            benchmark_stop();
             break;
+        case PMU_SETUP: {
+            /* The label holds the number of events, the MRs the events */
+            int n_events = sel4cp_msginfo_get_label(msginfo);
+            event_id_t events[BENCH_MAX_EVENTS];
+            if (n_events > BENCH_MAX_EVENTS) {
+                print("Bench: too many PMU events\n");
+                return sel4cp_msginfo_new(1, 0);
+            }
+            for (int i = 0; i < n_events; i++) {
+                events[i] = sel4cp_mr_get(i);
+            }
+            if (n_events) {
+                pmu_set_events(events, n_events);
+            } else {
+                pmu_set_events(benchmarking_events, ARRAY_SIZE(benchmarking_events));
+            }
+            sel4cp_mr_set(0, pmu.n_groups);
+            return sel4cp_msginfo_new(0, 1);
         }
-        sel4bench_set_count_event(i, benchmarking_events[counter]);
-        mask |= BIT(i);
+        default:
+            print("Bench thread received ppc on unexpected channel\n");
     }
+    return sel4cp_msginfo_new(0, 0);
+}
 
-    sel4bench_reset_counters();
-    sel4bench_start_counters(mask);
+void
+fault(sel4cp_pd pd, sel4cp_msginfo msginfo)
+{
+    print("Bench: fault in child PD ");
+    puthex64(pd);
+    print(", label ");
+    puthex64(sel4cp_msginfo_get_label(msginfo));
+    print("\n");
+}
 
-    benchmark_bf = mask;
+void init(void)
+{
+    sel4bench_init();
+    pmu.n_counters = sel4bench_get_num_counters();
+    if (pmu.n_counters > ARRAY_SIZE(counter_values)) {
+        pmu.n_counters = ARRAY_SIZE(counter_values);
+    }
+    pmu_set_events(benchmarking_events, ARRAY_SIZE(benchmarking_events));
+
+    sel4bench_reset_counters();
+    pmu_start_group(0);
 
     /* Notify the idle thread that the sel4bench library is initialised. */
     sel4cp_notify(INIT);
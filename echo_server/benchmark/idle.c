@@ -13,41 +13,129 @@
 #include "util.h"
 
 #define INIT 3
-#define MAGIC_CYCLES 150
 #define ULONG_MAX 0xfffffffffffffffful
 
+/* Gaps measured to calibrate the idle loop */
+#define CALIBRATION_GAPS 4096
+/* Gaps longer than this many times the usual gap are not counted as idle */
+#define THRESHOLD_FACTOR 4
+
+#define IDLE_NAME "benchIdle"
+
 uintptr_t cyclecounters_vaddr;
 
-struct bench *b = (void *)(uintptr_t)0x5010000;
+struct bench *benches = (void *)(uintptr_t)0x5010000;
+struct bench *b;
 
-void count_idle(void)
+_Static_assert(BENCH_MAX_CORES * sizeof(struct bench) <= 0x1000,
+               "Idle counts must fit the cyclecounters region");
+
+/*
+ * The idle PD of core 0 is named benchIdle, and the idle PD of any other
+ * core n is named benchIdle<n>.
+ */
+static int idle_core(void)
+{
+    int core = 0;
+    for (const char *c = sel4cp_name + sizeof(IDLE_NAME) - 1; *c >= '0' && *c <= '9'; c++) {
+        core = core * 10 + *c - '0';
+    }
+    return core;
+}
+
+static inline int gap_bucket(uint64_t gap)
+{
+    int bucket = gap ? 63 - __builtin_clzl(gap) : 0;
+    return bucket < BENCH_GAP_BUCKETS ? bucket : BENCH_GAP_BUCKETS - 1;
+}
+
+/*
+ * Take the time and return the gap since it was last taken.
+ */
+static inline uint64_t idle_gap(void)
+{
+    b->ts = (uint64_t)sel4bench_get_cycle_count();
+    uint64_t diff;
+
+    /* Handle overflow: This thread needs to run at least 2 times
+       within any ULONG_MAX cycles period to detect overflows */
+    if (b->ts < b->prev) {
+        diff = ULONG_MAX - b->prev + b->ts + 1;
+        b->overflows++;
+    } else {
+        diff = b->ts - b->prev;
+    }
+    b->prev = b->ts;
+    b->gaps[gap_bucket(diff)]++;
+
+    return diff;
+}
+
+/*
+ * Run the idle loop without counting to find what an iteration costs,
+ * and from the spread of the gaps how long a gap can be before it must
+ * include time spent elsewhere. Most of the gaps are uninterrupted while
+ * the system boots, so the threshold is taken from the 99th percentile.
+ */
+static void calibrate(void)
 {
+    uint64_t iteration = ULONG_MAX;
+
     b->prev = sel4bench_get_cycle_count();
+    for (int i = 0; i < BENCH_GAP_BUCKETS; i++) {
+        b->gaps[i] = 0;
+    }
+    for (int i = 0; i < CALIBRATION_GAPS; i++) {
+        uint64_t diff = idle_gap();
+        if (diff < iteration) {
+            iteration = diff;
+        }
+    }
+
+    int bucket = 0;
+    uint64_t seen = b->gaps[0];
+    while (seen < CALIBRATION_GAPS * 99 / 100 && bucket < BENCH_GAP_BUCKETS - 1) {
+        seen += b->gaps[++bucket];
+    }
+
+    b->iteration = iteration;
+    b->threshold = THRESHOLD_FACTOR << (bucket + 1);
+    if (b->threshold < 2 * iteration) {
+        b->threshold = 2 * iteration;
+    }
+
+    for (int i = 0; i < BENCH_GAP_BUCKETS; i++) {
+        b->gaps[i] = 0;
+    }
+}
+
+void count_idle(void)
+{
+    calibrate();
+
     b->ccount = 0;
     b->overflows = 0;
+    b->preemptions = 0;
+    b->slow = 0;
+    const uint64_t threshold = b->threshold;
+    const uint64_t slow = 2 * b->iteration;
+    COMPILER_MEMORY_FENCE();
+    b->calibrated = 1;
 
     while (1) {
+        uint64_t diff = idle_gap();
 
-        b->ts = (uint64_t)sel4bench_get_cycle_count();
-        uint64_t diff;
-
-        /* Handle overflow: This thread needs to run at least 2 times
-           within any ULONG_MAX cycles period to detect overflows */
-        if (b->ts < b->prev) {
-            diff = ULONG_MAX - b->prev + b->ts + 1;
-            b->overflows++;
-        } else {
-            diff = b->ts - b->prev;
-        }
-
-        if (diff < MAGIC_CYCLES) {
+        if (diff < threshold) {
             COMPILER_MEMORY_FENCE();
 
             b->ccount += diff;
+            if (diff > slow) {
+                b->slow++;
+            }
             COMPILER_MEMORY_FENCE();
+        } else {
+            b->preemptions++;
         }
-
-        b->prev = b->ts;
     }
 }
 
@@ -65,6 +153,21 @@ void notified(sel4cp_channel ch)
 
 void init(void)
 {
-    /* Nothing to set up as benchmark.c initialises the sel4bench library for us. */
-    return;
-}
\ No newline at end of file
+    int core = idle_core();
+    if (core >= BENCH_MAX_CORES) {
+        sel4cp_dbg_puts("Idle thread on a core without an idle count\n");
+        return;
+    }
+    b = &benches[core];
+
+    /*
+     * On core 0 benchmark.c initialises the sel4bench library for us and
+     * notifies us when it has. The other cores have no benchmark PD, so
+     * their idle PDs set up their own cycle counter and start counting
+     * straight away.
+     */
+    if (core) {
+        sel4bench_init();
+        count_idle();
+    }
+}
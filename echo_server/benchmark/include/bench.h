@@ -5,9 +5,104 @@
 
 #pragma once
 
+/*
+ * Idle cycle counts, one per core with an idle PD. The idle loop reads the
+ * cycle counter over and over, and counts a gap between two reads as idle
+ * time unless it is long enough that something else must have run. The
+ * cost of an iteration is calibrated when the idle PD starts, and the
+ * gaps seen are kept in a log2 histogram so the accounting can be checked.
+ */
+#define BENCH_MAX_CORES 4
+#define BENCH_GAP_BUCKETS 32
+
 struct bench {
-    uint64_t ccount;
+    /* Kept to their own cache lines as each core writes its own */
+    uint64_t ccount __attribute__((aligned(64)));
     uint64_t prev;
     uint64_t ts;
     uint64_t overflows;
+    /* Set once the idle loop of this core is calibrated and counting */
+    uint64_t calibrated;
+    /* Cycles an uninterrupted iteration of the idle loop takes */
+    uint64_t iteration;
+    /* Gaps at least this long are not counted as idle */
+    uint64_t threshold;
+    /* Gaps not counted as idle */
+    uint64_t preemptions;
+    /* Gaps counted as idle that took more than two iterations */
+    uint64_t slow;
+    /* Gaps seen of 2^i to 2^(i+1) - 1 cycles */
+    uint64_t gaps[BENCH_GAP_BUCKETS];
+};
+
+/*
+ * Bound on the idle cycles miscounted by a core. Around a preemption up to
+ * an iteration of idle time is lost, and a slow gap counted as idle may
+ * hide up to the threshold of time spent elsewhere.
+ */
+static inline uint64_t bench_idle_error(const struct bench *b, uint64_t preemptions, uint64_t slow)
+{
+    return preemptions * b->iteration + slow * b->threshold;
+}
+
+#ifdef CONFIG_SDDF_HOST
+#include <time.h>
+
+/* The host build counts nanoseconds instead of cycles */
+static inline uint64_t bench_cycle_count(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#else
+/* Read the PMU cycle counter. Benchmark configurations give user level
+ * access to the PMU, this faults in others. */
+static inline uint64_t bench_cycle_count(void)
+{
+    uint64_t cycles;
+    asm volatile("mrs %0, PMCCNTR_EL0" : "=r"(cycles));
+    return cycles;
+}
+#endif
+
+/* Utilisation of each protection domain over a measurement, filled in by
+ * the benchmark PD when it is called to stop a measurement. */
+#define BENCH_MAX_PDS 8
+#define BENCH_PD_NAME_LEN 16
+
+struct bench_pd_util {
+    char name[BENCH_PD_NAME_LEN];
+    /* Cycles the PD ran for, including kernel time spent on its behalf */
+    uint64_t total;
+    /* Cycles spent in the kernel on behalf of the PD */
+    uint64_t kernel;
+    /* Number of kernel entries made by the PD */
+    uint64_t entries;
+    /* Number of times the PD was scheduled */
+    uint64_t schedules;
+};
+
+/* Events counted over a measurement. There are more events than hardware
+ * counters, so they are counted in groups taking turns on the counters and
+ * each count is scaled up to an estimate over the whole measurement. */
+#define BENCH_MAX_EVENTS 16
+
+struct bench_event_count {
+    uint64_t event;
+    /* Events counted while the event's group was on the counters */
+    uint64_t count;
+    /* Cycles the event's group was on the counters for */
+    uint64_t cycles;
+    /* Count scaled up to the whole measurement */
+    uint64_t estimate;
+};
+
+struct bench_results {
+    uint64_t num_pds;
+    struct bench_pd_util pds[BENCH_MAX_PDS];
+    /* Cycles the measurement lasted, as seen by the PMU */
+    uint64_t cycles;
+    uint64_t num_events;
+    struct bench_event_count events[BENCH_MAX_EVENTS];
 };
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * PMU events that can be selected by name in the ipbench SETUP arguments,
+ * and profiles naming a set of them. The codes are the ARMv8 common event
+ * numbers, which the Cortex-A53 implements.
+ */
+
+struct bench_event_name {
+    const char *name;
+    uint32_t event;
+};
+
+static const struct bench_event_name bench_event_names[] = {
+    { "l1i_miss", 0x01 },
+    { "l1i_tlb_miss", 0x02 },
+    { "l1d_miss", 0x03 },
+    { "l1d_access", 0x04 },
+    { "l1d_tlb_miss", 0x05 },
+    { "loads", 0x06 },
+    { "stores", 0x07 },
+    { "instructions", 0x08 },
+    { "exceptions", 0x09 },
+    { "branches", 0x0c },
+    { "branch_mispredict", 0x10 },
+    { "cycles", 0x11 },
+    { "branch_predicted", 0x12 },
+    { "mem_access", 0x13 },
+    { "l1i_access", 0x14 },
+    { "l1d_writeback", 0x15 },
+    { "l2_access", 0x16 },
+    { "l2_miss", 0x17 },
+    { "l2_writeback", 0x18 },
+    { "bus_access", 0x19 },
+    { "bus_cycles", 0x1d },
+};
+
+struct bench_profile {
+    const char *name;
+    /* Comma separated event names */
+    const char *events;
+};
+
+static const struct bench_profile bench_profiles[] = {
+    { "default", "l1i_miss,l1d_miss,l1i_tlb_miss,l1d_tlb_miss,instructions,branch_mispredict" },
+    { "cache", "l1i_access,l1i_miss,l1d_access,l1d_miss,l1d_writeback,l2_access,l2_miss,l2_writeback" },
+    { "tlb", "l1i_tlb_miss,l1d_tlb_miss,instructions" },
+    { "branch", "branches,branch_predicted,branch_mispredict,instructions" },
+    { "memory", "mem_access,loads,stores,bus_access,bus_cycles" },
+};
+
+/**
+ * Look up the name of a PMU event.
+ *
+ * @return the name, or NULL for an event without one.
+ */
+static inline const char *bench_event_name(uint32_t event)
+{
+    for (int i = 0; i < sizeof(bench_event_names) / sizeof(bench_event_names[0]); i++) {
+        if (bench_event_names[i].event == event) {
+            return bench_event_names[i].name;
+        }
+    }
+    return NULL;
+}
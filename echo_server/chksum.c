@@ -0,0 +1,203 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Internet checksum for lwIP, installed as LWIP_CHKSUM in cc.h. It
+ * returns the same non-inverted sum as lwip_standard_chksum(): 16-bit
+ * words are formed from byte pairs counted from the start of the buffer,
+ * loaded in host order.
+ *
+ * On aarch64 the bulk of the buffer is summed with NEON, 64 bytes at a
+ * time, by pairwise adding 16-bit lanes into 32-bit accumulators. The
+ * loads do not need to be aligned, and because pairs are counted from the
+ * start of the buffer, an odd start address needs no special treatment.
+ * Elsewhere, and for the last few bytes, a portable version sums aligned
+ * 64-bit words.
+ *
+ * sddf_chksum_copy() is installed as LWIP_CHKSUM_COPY, and returns the
+ * same sum for the data it copies, so that lwIP and the GSO path in
+ * lwip.c do not need a separate pass over the payload to checksum it.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lwip/opt.h"
+#include "lwip/def.h"
+#include "lwip/inet_chksum.h"
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CHKSUM_NEON 1
+#endif
+
+/* Each 64 byte block adds at most 2 * 2 * 0xffff to a 32-bit lane, so
+ * the lanes are widened to 64 bits after this many blocks */
+#define NEON_BLOCKS_PER_FOLD 16384
+
+static inline u16_t fold(u64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+/**
+ * Portable checksum, with the same head and tail handling as lwIP's
+ * algorithm 3 but summing 64-bit words.
+ */
+static u16_t chksum_words(const u8_t *pb, int len)
+{
+    u64_t sum = 0;
+    u16_t t = 0;
+    /* An odd start is summed as if it were even, and swapped at the end */
+    int odd = (mem_ptr_t)pb & 1;
+
+    if (odd && len > 0) {
+        ((u8_t *)&t)[1] = *pb++;
+        len--;
+    }
+
+    while (((mem_ptr_t)pb & 7) && len > 1) {
+        sum += *(const u16_t *)(const void *)pb;
+        pb += 2;
+        len -= 2;
+    }
+
+    while (len > 7) {
+        u64_t word = *(const u64_t *)(const void *)pb;
+        sum += word;
+        /* Add back the carry */
+        sum += sum < word;
+        pb += 8;
+        len -= 8;
+    }
+
+    sum = fold(sum);
+
+    while (len > 1) {
+        sum += *(const u16_t *)(const void *)pb;
+        pb += 2;
+        len -= 2;
+    }
+
+    if (len > 0) {
+        ((u8_t *)&t)[0] = *pb;
+    }
+
+    sum = fold(sum + t);
+    if (odd) {
+        sum = SWAP_BYTES_IN_WORD(sum);
+    }
+
+    return sum;
+}
+
+#ifdef CHKSUM_NEON
+static inline uint32x4_t sum_lanes(uint32x4_t acc, const u8_t *pb)
+{
+    return vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(pb)));
+}
+
+static inline uint32x4_t copy_lanes(uint32x4_t acc, u8_t *dst, const u8_t *src)
+{
+    uint8x16_t data = vld1q_u8(src);
+    vst1q_u8(dst, data);
+    return vpadalq_u16(acc, vreinterpretq_u16_u8(data));
+}
+
+u16_t sddf_chksum(const void *dataptr, int len)
+{
+    const u8_t *pb = dataptr;
+    uint64x2_t acc = vdupq_n_u64(0);
+
+    while (len >= 64) {
+        uint32x4_t acc0 = vdupq_n_u32(0);
+        uint32x4_t acc1 = vdupq_n_u32(0);
+        int blocks = LWIP_MIN(len / 64, NEON_BLOCKS_PER_FOLD);
+
+        len -= blocks * 64;
+        for (; blocks; blocks--) {
+            /* Two accumulators, so consecutive adds do not wait on each other */
+            acc0 = sum_lanes(acc0, pb);
+            acc1 = sum_lanes(acc1, pb + 16);
+            acc0 = sum_lanes(acc0, pb + 32);
+            acc1 = sum_lanes(acc1, pb + 48);
+            pb += 64;
+        }
+        acc = vpadalq_u32(acc, acc0);
+        acc = vpadalq_u32(acc, acc1);
+    }
+
+    if (len >= 16) {
+        uint32x4_t acc0 = vdupq_n_u32(0);
+        for (; len >= 16; len -= 16) {
+            acc0 = sum_lanes(acc0, pb);
+            pb += 16;
+        }
+        acc = vpadalq_u32(acc, acc0);
+    }
+
+    /* pb is an even number of bytes from the start, so the tail pairs up
+     * the same way */
+    return fold(vaddvq_u64(acc) + chksum_words(pb, len));
+}
+
+u16_t sddf_chksum_copy(void *dst, const void *src, u16_t len)
+{
+    u8_t *d = dst;
+    const u8_t *s = src;
+    int left = len;
+    /* At most 1024 blocks, so the 32-bit lanes cannot overflow */
+    uint32x4_t acc0 = vdupq_n_u32(0);
+    uint32x4_t acc1 = vdupq_n_u32(0);
+
+    for (; left >= 64; left -= 64) {
+        acc0 = copy_lanes(acc0, d, s);
+        acc1 = copy_lanes(acc1, d + 16, s + 16);
+        acc0 = copy_lanes(acc0, d + 32, s + 32);
+        acc1 = copy_lanes(acc1, d + 48, s + 48);
+        d += 64;
+        s += 64;
+    }
+    for (; left >= 16; left -= 16) {
+        acc0 = copy_lanes(acc0, d, s);
+        d += 16;
+        s += 16;
+    }
+
+    uint64x2_t acc = vpaddlq_u32(acc0);
+    acc = vpadalq_u32(acc, acc1);
+
+    memcpy(d, s, left);
+    return fold(vaddvq_u64(acc) + chksum_words(s, left));
+}
+#else
+u16_t sddf_chksum(const void *dataptr, int len)
+{
+    return chksum_words(dataptr, len);
+}
+
+u16_t sddf_chksum_copy(void *dst, const void *src, u16_t len)
+{
+    u8_t *d = dst;
+    const u8_t *s = src;
+    int words = len & ~7;
+    u64_t sum = 0;
+
+    for (int i = 0; i < words; i += 8) {
+        u64_t word;
+        memcpy(&word, s + i, sizeof(word));
+        memcpy(d + i, &word, sizeof(word));
+        sum += word;
+        sum += sum < word;
+    }
+
+    memcpy(d + words, s + words, len - words);
+    return fold((u64_t)fold(sum) + chksum_words(s + words, len - words));
+}
+#endif
@@ -9,11 +9,12 @@
 #include <sel4/sel4.h>
 #include "eth.h"
 #include "shared_ringbuffer.h"
+#include "trace.h"
 #include "util.h"
 
 #define IRQ_CH 1
-#define TX_CH  2
 #define RX_CH  2
+#define TX_CH  3
 #define INIT   4
 
 #define MDC_FREQ    20000000UL
@@ -29,6 +30,7 @@ uintptr_t rx_free;
 uintptr_t rx_used;
 uintptr_t tx_free;
 uintptr_t tx_used;
+uintptr_t trace_buffer;
 uintptr_t uart_base;
 
 /* Make the minimum frame buffer 2k. This is a bit of a waste of memory, but ensures alignment */
@@ -54,12 +56,16 @@ typedef struct {
     unsigned int head;
     volatile struct descriptor *descr;
     uintptr_t phys;
-    void **cookies;
+    /* Client descriptor of the buffer in each slot. These are copies, the
+     * client may reuse a ring slot as soon as we have dequeued from it. */
+    buff_desc_t *descs;
 } ring_ctx_t;
 
 ring_ctx_t rx;
 ring_ctx_t tx;
 unsigned int tx_lengths[TX_COUNT];
+/* Frames dropped without being sent */
+unsigned int tx_dropped;
 
 /* Pointers to shared_ringbuffers */
 ring_handle_t rx_ring;
@@ -142,20 +148,14 @@ enable_irqs(volatile struct enet_regs *eth, uint32_t mask)
 }
 
 static uintptr_t 
-alloc_rx_buf(size_t buf_size, void **cookie)
+alloc_rx_buf(size_t buf_size, buff_desc_t *desc)
 {
-    uintptr_t addr;
-    unsigned int len;
-
     /* Try to grab a buffer from the free ring */
-    if (driver_dequeue(rx_ring.free_ring, &addr, &len, cookie)) {
-        print("RX Free ring is empty\n");
+    if (dequeue(rx_ring.free_ring, &desc->encoded_addr, &desc->len, &desc->cookie)) {
         return 0;
     }
 
-    uintptr_t phys = getPhysAddr(addr);
-
-    return getPhysAddr(addr);
+    return getPhysAddr(desc->encoded_addr);
 }
 
 static void fill_rx_bufs()
@@ -164,8 +164,8 @@ static void fill_rx_bufs()
     __sync_synchronize();
     while (ring->remain > 0) {
         /* request a buffer */
-        void *cookie = NULL;
-        uintptr_t phys = alloc_rx_buf(MAX_PACKET_SIZE, &cookie);
+        buff_desc_t desc;
+        uintptr_t phys = alloc_rx_buf(MAX_PACKET_SIZE, &desc);
         if (!phys) {
             break;
         }
@@ -176,7 +176,7 @@ static void fill_rx_bufs()
             new_tail = 0;
             stat |= WRAP;
         }
-        ring->cookies[idx] = cookie;
+        ring->descs[idx] = desc;
         update_ring_slot(ring, idx, phys, 0, stat);
         ring->tail = new_tail;
         /* There is a race condition if add/remove is not synchronized. */
@@ -188,6 +188,15 @@ static void fill_rx_bufs()
         /* Make sure rx is enabled */
         eth->rdar = RDAR_RDAR;
     }
+
+    /* Have the multiplexer tell us when it has more buffers */
+    if (ring->remain > 0) {
+        request_signal(rx_ring.free_ring);
+        if (!ring_empty(rx_ring.free_ring)) {
+            cancel_signal(rx_ring.free_ring);
+            fill_rx_bufs();
+        }
+    }
 }
 
 static void
@@ -208,7 +217,7 @@ handle_rx(volatile struct enet_regs *eth)
             break;
         }
 
-        void *cookie = ring->cookies[head];
+        buff_desc_t *desc = &ring->descs[head];
         /* Go to next buffer, handle roll-over. */
         if (++head == ring->cnt) {
             head = 0;
@@ -218,8 +227,7 @@ handle_rx(volatile struct enet_regs *eth)
         /* There is a race condition here if add/remove is not synchronized. */
         ring->remain++;
 
-        buff_desc_t *desc = (buff_desc_t *)cookie;
-
+        TRACE(TRACE_DRV_RX, TRACE_BUF_ID(desc->encoded_addr));
         enqueue_used(&rx_ring, desc->encoded_addr, d->len, desc->cookie);
         num++;
     }
@@ -235,10 +243,12 @@ static void
 complete_tx(volatile struct enet_regs *eth)
 {
     unsigned int cnt_org;
-    void *cookie;
+    buff_desc_t *desc;
     ring_ctx_t *ring = &tx;
     unsigned int head = ring->head;
     unsigned int cnt = 0;
+    bool notify_client = false;
+    bool freed = false;
 
     while (head != ring->tail) {
         if (0 == cnt) {
@@ -249,7 +259,7 @@ complete_tx(volatile struct enet_regs *eth)
                 return;
             }
             cnt_org = cnt;
-            cookie = ring->cookies[head];
+            desc = &ring->descs[head];
         }
 
         volatile struct descriptor *d = &(ring->descr[head]);
@@ -275,16 +285,32 @@ complete_tx(volatile struct enet_regs *eth)
             /* race condition if add/remove is not synchronized. */
             ring->remain += cnt_org;
             /* give the buffer back */
-            buff_desc_t *desc = (buff_desc_t *)cookie;
-
+            TRACE(TRACE_DRV_TX_DONE, TRACE_BUF_ID(desc->encoded_addr));
             enqueue_free(&tx_ring, desc->encoded_addr, desc->len, desc->cookie);
+            freed = true;
+
+            /* The client holds references to the rest of a scatter-gather
+             * frame until it learns the frame has been sent. */
+            if (cnt_org > 1) {
+                notify_client = true;
+            }
         }
     }
+
+    /* The client may be holding frames back until buffers are returned */
+    if (freed && require_signal(tx_ring.free_ring)) {
+        cancel_signal(tx_ring.free_ring);
+        notify_client = true;
+    }
+
+    if (notify_client) {
+        sel4cp_notify(TX_CH);
+    }
 }
 
 static void
 raw_tx(volatile struct enet_regs *eth, unsigned int num, uintptr_t *phys,
-                  unsigned int *len, void *cookie)
+                  unsigned int *len, buff_desc_t *desc)
 {
     ring_ctx_t *ring = &tx;
 
@@ -303,6 +329,7 @@ raw_tx(volatile struct enet_regs *eth, unsigned int num, uintptr_t *phys,
 
     unsigned int tail = ring->tail;
     unsigned int tail_new = tail;
+    uint16_t first_stat = 0;
 
     unsigned int i = num;
     while (i-- > 0) {
@@ -316,10 +343,22 @@ raw_tx(volatile struct enet_regs *eth, unsigned int num, uintptr_t *phys,
             tail_new = 0;
             stat |= WRAP;
         }
+
+        /* Hand the first descriptor of a multi-descriptor frame to the
+         * hardware last, so it never starts on a partially built frame. */
+        if (idx == tail && num > 1) {
+            first_stat = stat;
+            stat &= ~TXD_READY;
+        }
         update_ring_slot(ring, idx, *phys++, *len++, stat);
     }
 
-    ring->cookies[tail] = cookie;
+    if (first_stat) {
+        __sync_synchronize();
+        ring->descr[tail].stat = first_stat;
+    }
+
+    ring->descs[tail] = *desc;
     tx_lengths[tail] = num;
     ring->tail = tail_new;
     /* There is a race condition here if add/remove is not synchronized. */
@@ -357,17 +396,63 @@ handle_eth(volatile struct enet_regs *eth)
     }
 }
 
+/**
+ * Take a frame that cannot be sent off the TX ring, and give it back as
+ * complete_tx() gives back a sent frame: through its first descriptor.
+ *
+ * @param num number of descriptors making up the frame.
+ */
+static void
+drop_tx(unsigned int num)
+{
+    buff_desc_t frame_desc;
+    for (unsigned int i = 0; i < num; i++) {
+        buff_desc_t desc;
+        dequeue(tx_ring.used_ring, &desc.encoded_addr, &desc.len, &desc.cookie);
+        if (i == 0) {
+            frame_desc = desc;
+        }
+    }
+    enqueue_free(&tx_ring, frame_desc.encoded_addr, frame_desc.len, frame_desc.cookie);
+    tx_dropped++;
+
+    /* The client holds references to the rest of the frame until it is
+     * given back */
+    cancel_signal(tx_ring.free_ring);
+    sel4cp_notify(TX_CH);
+}
+
 static void 
 handle_tx(volatile struct enet_regs *eth)
 {
-    uintptr_t buffer = 0;
-    unsigned int len = 0;
-    void *cookie = NULL;
-
-    // We need to put in an empty condition here. 
-    while ((tx.remain > 1) && !driver_dequeue(tx_ring.used_ring, &buffer, &len, &cookie)) {
-        uintptr_t phys = getPhysAddr(buffer);
-        raw_tx(eth, 1, &phys, &len, cookie);
+    uintptr_t phys[BUFF_DESC_MAX_CHAIN];
+    unsigned int len[BUFF_DESC_MAX_CHAIN];
+    unsigned int num;
+
+    /* Only take a frame once all of its descriptors are in the ring */
+    while ((num = ring_chain_length(tx_ring.used_ring))) {
+        if (num > BUFF_DESC_MAX_CHAIN) {
+            print("TX frame has too many fragments, dropped");
+            drop_tx(num);
+            continue;
+        }
+        if (tx.remain <= num) {
+            break;
+        }
+
+        /* The first descriptor identifies the frame on completion */
+        buff_desc_t frame_desc;
+        for (unsigned int i = 0; i < num; i++) {
+            buff_desc_t desc;
+            dequeue(tx_ring.used_ring, &desc.encoded_addr, &desc.len, &desc.cookie);
+            phys[i] = getPhysAddr(desc.encoded_addr);
+            len[i] = desc.len;
+            if (i == 0) {
+                frame_desc = desc;
+            }
+        }
+        TRACE(TRACE_DRV_TX, TRACE_BUF_ID(frame_desc.encoded_addr));
+        raw_tx(eth, num, phys, len, &frame_desc);
     }
 }
 
@@ -385,7 +470,7 @@ eth_setup(void)
     rx.tail = 0;
     rx.head = 0;
     rx.phys = shared_dma_paddr;
-    rx.cookies = (void **)rx_cookies;
+    rx.descs = (buff_desc_t *)rx_cookies;
     rx.descr = (volatile struct descriptor *)hw_ring_buffer_vaddr;
 
     tx.cnt = TX_COUNT;
@@ -393,7 +478,7 @@ eth_setup(void)
     tx.tail = 0;
     tx.head = 0;
     tx.phys = shared_dma_paddr + (sizeof(struct descriptor) * RX_COUNT);
-    tx.cookies = (void **)tx_cookies;
+    tx.descs = (buff_desc_t *)tx_cookies;
     tx.descr = (volatile struct descriptor *)(hw_ring_buffer_vaddr + (sizeof(struct descriptor) * RX_COUNT));
 
     /* Perform reset */
@@ -449,11 +534,21 @@ eth_setup(void)
     /* Size of max eth packet size */
     eth->mrbr = MAX_PACKET_SIZE;
 
-    eth->rcr = RCR_MAX_FL(1518) | RCR_RGMII_EN | RCR_MII_MODE;
+    /* The RX multiplexer filters on the MAC addresses of its clients. The
+     * FCS is stripped, so received lengths end with the payload and any
+     * padding. */
+#ifdef CONFIG_ETH_LOOPBACK
+    /* Send every frame straight back to ourselves, for the packet generator.
+     * Internal loopback needs the MAC in MII mode at 10/100 speed. */
+    eth->rcr = RCR_MAX_FL(1518) | RCR_MII_MODE | RCR_PROM | RCR_LOOP | RCR_CRCFWD;
+    eth->tcr = TCR_FDEN;
+#else
+    eth->rcr = RCR_MAX_FL(1518) | RCR_RGMII_EN | RCR_MII_MODE | RCR_PROM | RCR_CRCFWD;
     eth->tcr = TCR_FDEN;
 
     /* set speed */
     eth->ecr |= ECR_SPEED;
+#endif
 
     /* Set Enable  in ECR */
     eth->ecr |= ECR_ETHEREN;
@@ -517,6 +612,7 @@ void notified(sel4cp_channel ch)
 {
     switch(ch) {
         case IRQ_CH:
+            TRACE(TRACE_IRQ, TRACE_NO_ID);
             handle_eth(eth);
             have_signal = true;
             signal_msg = seL4_MessageInfo_new(IRQAckIRQ, 0, 0, 0);
@@ -525,6 +621,10 @@ void notified(sel4cp_channel ch)
         case INIT:
             init_post();
             break;
+        case RX_CH:
+            /* Free buffers have been returned */
+            fill_rx_bufs();
+            break;
         case TX_CH:
             handle_tx(eth);
             break;
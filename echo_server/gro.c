@@ -0,0 +1,279 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Software generic receive offload. Within one batch of received frames,
+ * in-order TCP segments of the same flow are chained together behind the
+ * first segment's headers and handed to lwIP as a single segment, so
+ * tcp_input() demultiplexes and acknowledges once per batch instead of
+ * once per frame.
+ *
+ * The headers of a merged segment are patched for length only. Their
+ * checksums are not recomputed, so this relies on the hardware validating
+ * checksums on receive.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lwip/opt.h"
+#include "lwip/def.h"
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include "gro.h"
+
+#if CHECKSUM_CHECK_IP || CHECKSUM_CHECK_TCP
+#error "GRO does not recompute checksums, leave RX checksum checking to hardware"
+#endif
+
+/* Number of flows that can be merged concurrently within a batch */
+#define GRO_MAX_FLOWS 4
+/* Maximum number of frames merged into a single segment */
+#define GRO_MAX_SEGS 44
+/* Maximum IP length of a merged segment */
+#define GRO_MAX_SIZE (0xffff - SIZEOF_ETH_HDR)
+
+typedef struct gro_flow {
+    /* Frames making up the segment, the first still holds its headers */
+    struct pbuf *segs[GRO_MAX_SEGS];
+    unsigned int count;
+    /* Flow identification */
+    ip4_addr_p_t src;
+    ip4_addr_p_t dest;
+    u16_t src_port;
+    u16_t dest_port;
+    /* Sequence number expected from the next segment */
+    u32_t next_seq;
+    /* Total IP length of the merged segment */
+    u32_t ip_len;
+} gro_flow_t;
+
+static gro_flow_t flows[GRO_MAX_FLOWS];
+
+static inline struct ip_hdr *gro_iphdr(struct pbuf *p)
+{
+    return (struct ip_hdr *)((u8_t *)p->payload + SIZEOF_ETH_HDR);
+}
+
+static inline struct tcp_hdr *gro_tcphdr(struct pbuf *p)
+{
+    struct ip_hdr *iphdr = gro_iphdr(p);
+    return (struct tcp_hdr *)((u8_t *)iphdr + IPH_HL_BYTES(iphdr));
+}
+
+/**
+ * Deliver a flow's merged segment to lwIP.
+ *
+ * @param netif network interface the frames were received on.
+ * @param flow flow to deliver.
+ */
+static void gro_flow_flush(struct netif *netif, gro_flow_t *flow)
+{
+    struct pbuf *head = flow->segs[0];
+
+    if (flow->count > 1) {
+        /* Link the frames back to front so each tot_len is set once */
+        u16_t tot_len = 0;
+        for (int i = flow->count - 1; i >= 0; i--) {
+            struct pbuf *p = flow->segs[i];
+            p->next = (i + 1 < flow->count) ? flow->segs[i + 1] : NULL;
+            tot_len += p->len;
+            p->tot_len = tot_len;
+        }
+
+        IPH_LEN_SET(gro_iphdr(head), lwip_htons(flow->ip_len));
+    }
+
+    flow->count = 0;
+
+    if (netif->input(head, netif) != ERR_OK) {
+        pbuf_free(head);
+    }
+}
+
+/**
+ * Check whether a frame is a TCP segment that may be merged with others.
+ *
+ * @param p received frame.
+ * @param payload_len set to the length of the segment's TCP payload.
+ *
+ * @return true if the frame can be merged.
+ */
+static bool gro_mergeable(struct pbuf *p, u16_t *payload_len)
+{
+    if (p->len < SIZEOF_ETH_HDR + IP_HLEN + TCP_HLEN) {
+        return false;
+    }
+
+    struct eth_hdr *ethhdr = (struct eth_hdr *)p->payload;
+    if (ethhdr->type != PP_HTONS(ETHTYPE_IP)) {
+        return false;
+    }
+
+    /* No options or fragments, and the whole datagram in the frame. Padding
+       or an FCS may follow it. */
+    struct ip_hdr *iphdr = gro_iphdr(p);
+    u16_t ip_len = lwip_ntohs(IPH_LEN(iphdr));
+    if (IPH_V(iphdr) != 4 || IPH_HL_BYTES(iphdr) != IP_HLEN || IPH_PROTO(iphdr) != IP_PROTO_TCP ||
+        (IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK | IP_MF)) || SIZEOF_ETH_HDR + ip_len > p->len) {
+        return false;
+    }
+
+    /* Only plain data segments, a PSH ends the merged segment */
+    struct tcp_hdr *tcphdr = gro_tcphdr(p);
+    u8_t flags = lwip_ntohs(tcphdr->_hdrlen_rsvd_flags) & 0xff;
+    u16_t hdr_len = IP_HLEN + TCPH_HDRLEN_BYTES(tcphdr);
+    if ((flags & ~TCP_PSH) != TCP_ACK || TCPH_HDRLEN_BYTES(tcphdr) < TCP_HLEN || hdr_len >= ip_len) {
+        return false;
+    }
+
+    *payload_len = ip_len - hdr_len;
+    return true;
+}
+
+/**
+ * Try to append a segment to a flow being merged.
+ *
+ * @return true if the segment was appended.
+ */
+static bool gro_flow_append(gro_flow_t *flow, struct pbuf *p, u16_t payload_len)
+{
+    struct tcp_hdr *head_tcphdr = gro_tcphdr(flow->segs[0]);
+    struct tcp_hdr *tcphdr = gro_tcphdr(p);
+    u16_t hdr_len = TCPH_HDRLEN_BYTES(tcphdr);
+
+    if (flow->count == GRO_MAX_SEGS || flow->ip_len + payload_len > GRO_MAX_SIZE ||
+        lwip_ntohl(tcphdr->seqno) != flow->next_seq ||
+        tcphdr->ackno != head_tcphdr->ackno ||
+        hdr_len != TCPH_HDRLEN_BYTES(head_tcphdr) ||
+        memcmp(tcphdr + 1, head_tcphdr + 1, hdr_len - TCP_HLEN)) {
+        return false;
+    }
+
+    /* Carry the latest window and push over to the merged header */
+    head_tcphdr->wnd = tcphdr->wnd;
+    if (TCPH_FLAGS(tcphdr) & TCP_PSH) {
+        TCPH_SET_FLAG(head_tcphdr, TCP_PSH);
+    }
+
+    pbuf_remove_header(p, SIZEOF_ETH_HDR + IP_HLEN + hdr_len);
+    flow->segs[flow->count++] = p;
+    flow->next_seq += payload_len;
+    flow->ip_len += payload_len;
+
+    return true;
+}
+
+/**
+ * Find the flow being merged that a TCP segment belongs to.
+ *
+ * @return the flow, or NULL if none of its segments are held.
+ */
+static gro_flow_t *gro_flow_find(struct ip_hdr *iphdr, struct tcp_hdr *tcphdr)
+{
+    for (int i = 0; i < GRO_MAX_FLOWS; i++) {
+        gro_flow_t *flow = &flows[i];
+        if (flow->count && flow->src_port == tcphdr->src && flow->dest_port == tcphdr->dest &&
+            ip4_addr_cmp(&flow->src, &iphdr->src) && ip4_addr_cmp(&flow->dest, &iphdr->dest)) {
+            return flow;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Deliver the segment held for the flow of a frame that cannot be merged,
+ * so that a FIN, RST, ACK or reordered segment reaches lwIP after the data
+ * sent before it.
+ */
+static void gro_flush_before(struct netif *netif, struct pbuf *p)
+{
+    if (p->len < SIZEOF_ETH_HDR + IP_HLEN ||
+        ((struct eth_hdr *)p->payload)->type != PP_HTONS(ETHTYPE_IP)) {
+        return;
+    }
+
+    /* Only the first fragment of a datagram has the TCP header */
+    struct ip_hdr *iphdr = gro_iphdr(p);
+    if (IPH_V(iphdr) != 4 || IPH_PROTO(iphdr) != IP_PROTO_TCP || (IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK)) ||
+        p->len < SIZEOF_ETH_HDR + IPH_HL_BYTES(iphdr) + TCP_HLEN) {
+        return;
+    }
+
+    gro_flow_t *flow = gro_flow_find(iphdr, gro_tcphdr(p));
+    if (flow) {
+        gro_flow_flush(netif, flow);
+    }
+}
+
+void gro_receive(struct netif *netif, struct pbuf *p)
+{
+    u16_t payload_len;
+
+    if (!gro_mergeable(p, &payload_len)) {
+        gro_flush_before(netif, p);
+        if (netif->input(p, netif) != ERR_OK) {
+            pbuf_free(p);
+        }
+        return;
+    }
+
+    /* Drop what follows the datagram, so the lengths of the merged segment
+       add up */
+    struct ip_hdr *iphdr = gro_iphdr(p);
+    pbuf_realloc(p, SIZEOF_ETH_HDR + lwip_ntohs(IPH_LEN(iphdr)));
+
+    struct tcp_hdr *tcphdr = gro_tcphdr(p);
+    gro_flow_t *free_flow = gro_flow_find(iphdr, tcphdr);
+
+    if (free_flow) {
+        if (gro_flow_append(free_flow, p, payload_len)) {
+            if (TCPH_FLAGS(tcphdr) & TCP_PSH) {
+                gro_flow_flush(netif, free_flow);
+            }
+            return;
+        }
+
+        /* Keep the flow in order, then start again from this segment */
+        gro_flow_flush(netif, free_flow);
+    } else {
+        for (int i = 0; i < GRO_MAX_FLOWS && !free_flow; i++) {
+            if (!flows[i].count) {
+                free_flow = &flows[i];
+            }
+        }
+    }
+
+    if (!free_flow || (TCPH_FLAGS(tcphdr) & TCP_PSH)) {
+        if (netif->input(p, netif) != ERR_OK) {
+            pbuf_free(p);
+        }
+        return;
+    }
+
+    free_flow->segs[0] = p;
+    free_flow->count = 1;
+    free_flow->src = iphdr->src;
+    free_flow->dest = iphdr->dest;
+    free_flow->src_port = tcphdr->src;
+    free_flow->dest_port = tcphdr->dest;
+    free_flow->next_seq = lwip_ntohl(tcphdr->seqno) + payload_len;
+    free_flow->ip_len = lwip_ntohs(IPH_LEN(iphdr));
+}
+
+void gro_flush(struct netif *netif)
+{
+    for (int i = 0; i < GRO_MAX_FLOWS; i++) {
+        if (flows[i].count) {
+            gro_flow_flush(netif, &flows[i]);
+        }
+    }
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Checks the ETHARP_TABLE_HASH neighbour table of lwIP (etharp.c), and
+ * measures how the cost of resolving the destination of an outgoing
+ * packet grows with the number of neighbours. Built by `make arp_bench`
+ * in this directory.
+ *
+ * Neighbours are learnt from ARP requests passed to ethernet_input()
+ * through a dummy netif. The check fills the table past ARP_TABLE_SIZE
+ * and expects the least recently updated dynamic entries to be recycled,
+ * static entries to stay, and entries to age out. The benchmark reports
+ * the time of etharp_output() to random neighbours, with a per-destination
+ * hint as a pcb keeps it and with no hint, and the time of scanning the
+ * table as etharp_output() did without the hash table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/etharp.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/prot/iana.h"
+#include "lwip/prot/ip4.h"
+#include "netif/ethernet.h"
+
+#include "harness.h"
+
+#if !ETHARP_TABLE_HASH || !LWIP_NETIF_HWADDRHINT
+#error "ETHARP_TABLE_HASH and LWIP_NETIF_HWADDRHINT are not enabled in lwipopts.h"
+#endif
+
+#define PACKETS 4096
+#define ROUNDS 200
+#define EVICTED 16
+
+static const int neighbour_counts[] = { 16, 128, ARP_TABLE_SIZE };
+
+static struct netif netif;
+static ip4_addr_t local_ip;
+static struct eth_addr last_dest;
+static unsigned int transmitted;
+
+static struct {
+    ip4_addr_t ipaddr;
+    struct netif_hint hint;
+} packets[PACKETS];
+
+static err_t bench_linkoutput(struct netif *netif, struct pbuf *p)
+{
+    memcpy(&last_dest, ((struct eth_hdr *)p->payload)->dest.addr, ETH_HWADDR_LEN);
+    transmitted++;
+    return ERR_OK;
+}
+
+static err_t bench_netif_init(struct netif *netif)
+{
+    netif->output = etharp_output;
+    netif->linkoutput = bench_linkoutput;
+    netif->mtu = 1500;
+    netif->hwaddr_len = ETH_HWADDR_LEN;
+    memset(netif->hwaddr, 0x02, ETH_HWADDR_LEN);
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP;
+    return ERR_OK;
+}
+
+static void neighbour_ip(int i, ip4_addr_t *addr)
+{
+    IP4_ADDR(addr, 10, 1 + (i >> 16), (i >> 8) & 0xff, i & 0xff);
+}
+
+static void neighbour_mac(int i, struct eth_addr *addr)
+{
+    u8_t mac[ETH_HWADDR_LEN] = { 0x02, 0, 0, (u8_t)(i >> 16), (u8_t)(i >> 8), (u8_t)i };
+    memcpy(addr->addr, mac, ETH_HWADDR_LEN);
+}
+
+/**
+ * Pass an ARP request for our address from neighbour i, which adds or
+ * refreshes its entry.
+ */
+static void learn(int i)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, SIZEOF_ETH_HDR + SIZEOF_ETHARP_HDR, PBUF_POOL);
+    struct eth_hdr *ethhdr = (struct eth_hdr *)p->payload;
+    struct etharp_hdr *hdr = (struct etharp_hdr *)((u8_t *)ethhdr + SIZEOF_ETH_HDR);
+    ip4_addr_t sipaddr;
+
+    memset(p->payload, 0, p->len);
+    memset(ethhdr->dest.addr, 0xff, ETH_HWADDR_LEN);
+    neighbour_mac(i, &ethhdr->src);
+    ethhdr->type = PP_HTONS(ETHTYPE_ARP);
+
+    hdr->hwtype = PP_HTONS(LWIP_IANA_HWTYPE_ETHERNET);
+    hdr->proto = PP_HTONS(ETHTYPE_IP);
+    hdr->hwlen = ETH_HWADDR_LEN;
+    hdr->protolen = sizeof(ip4_addr_t);
+    hdr->opcode = PP_HTONS(ARP_REQUEST);
+    neighbour_mac(i, &hdr->shwaddr);
+    neighbour_ip(i, &sipaddr);
+    IPADDR_WORDALIGNED_COPY_FROM_IP4_ADDR_T(&hdr->sipaddr, &sipaddr);
+    IPADDR_WORDALIGNED_COPY_FROM_IP4_ADDR_T(&hdr->dipaddr, &local_ip);
+
+    ethernet_input(p, &netif);
+}
+
+static int known(int i)
+{
+    ip4_addr_t ipaddr;
+    struct eth_addr *eth_ret, mac;
+    const ip4_addr_t *ip_ret;
+
+    neighbour_ip(i, &ipaddr);
+    neighbour_mac(i, &mac);
+    return etharp_find_addr(&netif, &ipaddr, &eth_ret, &ip_ret) >= 0 &&
+           memcmp(eth_ret, &mac, ETH_HWADDR_LEN) == 0;
+}
+
+/**
+ * Send a packet to ipaddr with the given hint, or none.
+ *
+ * @return whether it went out to neighbour i.
+ */
+static int send_to(struct pbuf *p, const ip4_addr_t *ipaddr, struct netif_hint *hint, int i)
+{
+    struct eth_addr mac;
+    netif.hints = hint;
+    etharp_output(&netif, p, ipaddr);
+    pbuf_remove_header(p, SIZEOF_ETH_HDR);
+    netif.hints = NULL;
+    neighbour_mac(i, &mac);
+    return memcmp(&last_dest, &mac, ETH_HWADDR_LEN) == 0;
+}
+
+/**
+ * @return NULL if the table behaved, or what went wrong.
+ */
+static const char *check(struct pbuf *p)
+{
+    struct eth_addr mac;
+    ip4_addr_t ipaddr;
+
+    /* A static entry, then a full table of dynamic ones */
+    neighbour_ip(ARP_TABLE_SIZE + EVICTED, &ipaddr);
+    neighbour_mac(ARP_TABLE_SIZE + EVICTED, &mac);
+    if (etharp_add_static_entry(&ipaddr, &mac) != ERR_OK) {
+        return "the static entry was not added";
+    }
+    for (int i = 0; i < ARP_TABLE_SIZE - 1; i++) {
+        learn(i);
+    }
+    for (int i = 0; i < ARP_TABLE_SIZE - 1; i++) {
+        if (!known(i)) {
+            return "a learnt neighbour is missing";
+        }
+    }
+
+    /* Refreshing neighbour 0 makes neighbour 1 the least recently updated */
+    learn(0);
+    for (int i = ARP_TABLE_SIZE - 1; i < ARP_TABLE_SIZE - 1 + EVICTED; i++) {
+        learn(i);
+    }
+    if (!known(0) || !known(ARP_TABLE_SIZE + EVICTED)) {
+        return "a refreshed or static entry was recycled";
+    }
+    for (int i = 1; i < ARP_TABLE_SIZE - 1 + EVICTED; i++) {
+        if (known(i) != (i > EVICTED)) {
+            return "the wrong entries were recycled";
+        }
+    }
+
+    /* Output finds the entry through the hash table, then the hint */
+    struct netif_hint hint = { 0 };
+    for (int pass = 0; pass < 2; pass++) {
+        neighbour_ip(ARP_TABLE_SIZE / 2, &ipaddr);
+        if (!send_to(p, &ipaddr, &hint, ARP_TABLE_SIZE / 2)) {
+            return "a packet went to the wrong neighbour";
+        }
+    }
+    /* A hint for another destination is not used */
+    neighbour_ip(ARP_TABLE_SIZE / 2 + 1, &ipaddr);
+    if (!send_to(p, &ipaddr, &hint, ARP_TABLE_SIZE / 2 + 1)) {
+        return "a stale hint was used";
+    }
+    /* An unknown neighbour is asked for */
+    neighbour_ip(1, &ipaddr);
+    memset(mac.addr, 0xff, ETH_HWADDR_LEN);
+    if (etharp_output(&netif, p, &ipaddr) != ERR_OK || memcmp(&last_dest, &mac, ETH_HWADDR_LEN) != 0) {
+        return "no ARP request went out for an unknown neighbour";
+    }
+
+    /* Dynamic entries age out, the static one stays */
+    for (int t = 0; t < ARP_MAXAGE; t++) {
+        etharp_tmr();
+    }
+    for (int i = 0; i < ARP_TABLE_SIZE - 1 + EVICTED; i++) {
+        if (known(i)) {
+            return "an entry did not age out";
+        }
+    }
+    if (!known(ARP_TABLE_SIZE + EVICTED)) {
+        return "the static entry aged out";
+    }
+    neighbour_ip(ARP_TABLE_SIZE + EVICTED, &ipaddr);
+    etharp_remove_static_entry(&ipaddr);
+    return NULL;
+}
+
+static void build_packets(int count)
+{
+    for (int i = 0; i < PACKETS; i++) {
+        neighbour_ip(rand() % count, &packets[i].ipaddr);
+        packets[i].hint.addr_hint = 0;
+    }
+}
+
+static double time_output(struct pbuf *p, int hinted)
+{
+    uint64_t start = now_ns();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < PACKETS; i++) {
+            netif.hints = hinted ? &packets[i].hint : NULL;
+            etharp_output(&netif, p, &packets[i].ipaddr);
+            pbuf_remove_header(p, SIZEOF_ETH_HDR);
+        }
+    }
+    netif.hints = NULL;
+    return (double)(now_ns() - start) / (ROUNDS * PACKETS);
+}
+
+/**
+ * Time scanning the table for each packet's neighbour, the least
+ * etharp_output() did per packet without the hash table.
+ *
+ * @return the time per lookup in ns, or a negative value if a scan did
+ *         not find the neighbour.
+ */
+static double time_scan(void)
+{
+    uint64_t start = now_ns();
+    for (int i = 0; i < PACKETS; i++) {
+        size_t e;
+        ip4_addr_t *ipaddr;
+        struct netif *entry_netif;
+        struct eth_addr *eth_ret;
+        for (e = 0; e < ARP_TABLE_SIZE; e++) {
+            if (etharp_get_entry(e, &ipaddr, &entry_netif, &eth_ret) && entry_netif == &netif &&
+                ip4_addr_cmp(ipaddr, &packets[i].ipaddr)) {
+                break;
+            }
+        }
+        if (e == ARP_TABLE_SIZE) {
+            return -1;
+        }
+    }
+    return (double)(now_ns() - start) / PACKETS;
+}
+
+int main(void)
+{
+    IP4_ADDR(&local_ip, 10, 0, 0, 1);
+    harness_init(&netif, &local_ip, 8, bench_netif_init, ethernet_input);
+
+    struct pbuf *p = pbuf_alloc(PBUF_IP, IP_HLEN, PBUF_RAM);
+    memset(p->payload, 0, IP_HLEN);
+
+    const char *failure = check(p);
+    if (failure != NULL) {
+        printf("arp_bench: %s\n", failure);
+        return 1;
+    }
+
+    printf("%12s %14s %14s %14s\n", "neighbours", "hinted ns", "hashed ns", "scan ns");
+    for (size_t c = 0; c < sizeof(neighbour_counts) / sizeof(neighbour_counts[0]); c++) {
+        int count = neighbour_counts[c];
+        for (int i = 0; i < count; i++) {
+            learn(i);
+        }
+        build_packets(count);
+
+        double scan_ns = time_scan();
+        if (scan_ns < 0) {
+            printf("arp_bench: a neighbour was missing with %d neighbours\n", count);
+            return 1;
+        }
+        unsigned int sent = transmitted;
+        double hinted_ns = time_output(p, 1);
+        double hashed_ns = time_output(p, 0);
+        if (transmitted - sent != 2 * ROUNDS * PACKETS) {
+            printf("arp_bench: packets were not sent with %d neighbours\n", count);
+            return 1;
+        }
+
+        printf("%12d %14.1f %14.1f %14.1f\n", count, hinted_ns, hashed_ns, scan_ns);
+    }
+
+    pbuf_free(p);
+    return 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Checks the congestion control algorithms of lwIP (LWIP_TCP_CC,
+ * tcp_cc.c), then compares bulk transfers with NewReno and CUBIC over
+ * links with a long round trip. Built by `make cc_bench` in this directory.
+ *
+ * The check drives the congestion control operations of a pcb directly,
+ * acknowledging one window per simulated round trip, and follows cwnd
+ * after a loss: NewReno halves it and grows it by a segment per round
+ * trip, while CUBIC cuts it to 0.7, climbs back to the window of the loss
+ * within K = cbrt(0.3 * w_max / C) seconds, levels off there and then
+ * grows past it.
+ *
+ * The comparison runs lwIP against itself, as sack_test does: a sender on
+ * one netif sends to a receiver on another, through simulated links with
+ * a rate, a delay and random losses of data frames. Each link's
+ * bandwidth-delay product is about 70 segments, under TCP_WND, so the
+ * congestion window sets the rate.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include "harness.h"
+#include "link.h"
+
+#if !LWIP_TCP_CC
+#error "LWIP_TCP_CC is not enabled in lwipopts.h"
+#endif
+
+#define PORT 5001
+#define WRITE_CHUNK 16384
+#define BENCH_BYTES (8 * 1024 * 1024)
+#define TIME_LIMIT_US (600 * 1000000ULL)
+#define CHECK_MSS 1460
+#define CHECK_RTT_MS 100
+
+static const struct {
+    unsigned int rtt_ms, mbps;
+} paths[] = { { 20, 40 }, { 100, 8 }, { 200, 4 } };
+static const double loss_rates[] = { 0, 0.0001, 0.001 };
+
+/* A sender on netif_a sends to a receiver on netif_b */
+static struct netif netif_a, netif_b;
+static ip4_addr_t ip_a, ip_b;
+static struct link data_link, ack_link;
+
+static struct flow {
+    u32_t total, written, received;
+    bool corrupted;
+    double loss;
+} flow;
+
+static u8_t pattern(u32_t offset)
+{
+    return (u8_t)(offset * 7 + (offset >> 9));
+}
+
+/**
+ * Acknowledge a window of data in ACKs of two segments, and let a round
+ * trip pass.
+ */
+static void ack_window(struct tcp_pcb *pcb)
+{
+    tcpwnd_size_t wnd = pcb->cwnd;
+    for (tcpwnd_size_t acked = 0; acked < wnd; acked += 2 * CHECK_MSS) {
+        TCP_CC(pcb)->on_ack(pcb, 2 * CHECK_MSS);
+    }
+    now_us += CHECK_RTT_MS * 1000;
+}
+
+/**
+ * Lose a segment with cwnd at 100 segments, and follow cwnd for ms.
+ * @return cwnd at the end, in segments
+ */
+static double after_loss(struct tcp_pcb *pcb, const struct tcp_cc_ops *cc, u32_t ms)
+{
+    tcp_set_cc(pcb, cc);
+    pcb->mss = CHECK_MSS;
+    pcb->snd_wnd = 1000 * CHECK_MSS;
+    pcb->cwnd = 100 * CHECK_MSS;
+    pcb->ssthresh = pcb->cwnd;
+    pcb->sa = 0;
+    pcb->flags = 0;
+
+    TCP_CC(pcb)->on_loss(pcb);
+    /* fast recovery ends with cwnd at ssthresh */
+    pcb->cwnd = pcb->ssthresh;
+    for (u32_t t = 0; t < ms; t += CHECK_RTT_MS) {
+        ack_window(pcb);
+    }
+    return (double)pcb->cwnd / CHECK_MSS;
+}
+
+/**
+ * @return NULL if the algorithms follow their curves, or what went wrong.
+ */
+static const char *check(void)
+{
+    struct tcp_pcb *pcb = tcp_new();
+    /* K for CUBIC to regain 30 of 100 segments, with C = 0.4 */
+    const u32_t k_ms = 4217;
+    const char *failure = NULL;
+
+    if (after_loss(pcb, &tcp_cc_newreno, 0) != 50) {
+        failure = "NewReno did not halve cwnd on a loss";
+    } else if (after_loss(pcb, &tcp_cc_newreno, 10 * CHECK_RTT_MS) != 60) {
+        failure = "NewReno did not grow cwnd by a segment per round trip";
+    } else if (after_loss(pcb, &tcp_cc_cubic, 0) != 70) {
+        failure = "CUBIC did not cut cwnd to 0.7 on a loss";
+    } else if (after_loss(pcb, &tcp_cc_cubic, k_ms / 2) < 95) {
+        failure = "CUBIC did not climb quickly back towards the last maximum";
+    } else if (after_loss(pcb, &tcp_cc_cubic, k_ms) < 98 || pcb->cwnd > 101 * CHECK_MSS) {
+        failure = "CUBIC did not level off at the last maximum";
+    } else if (after_loss(pcb, &tcp_cc_cubic, k_ms + 3000) < 105) {
+        failure = "CUBIC did not grow past the last maximum";
+    } else {
+        /* Losing again below the last maximum gives way to other flows */
+        pcb->cwnd = 90 * CHECK_MSS;
+        TCP_CC(pcb)->on_loss(pcb);
+        if (pcb->cc_state.cubic.w_max >= 90 * CHECK_MSS) {
+            failure = "CUBIC did not lower its maximum on a loss below it";
+        }
+    }
+    tcp_abort(pcb);
+    return failure;
+}
+
+/* Lose data frames from the sender at random */
+static bool data_frame_lost(const u8_t *frame)
+{
+    return link_tcp_payload(frame) > 0 && link_random() < flow.loss;
+}
+
+static void send_more(struct tcp_pcb *pcb)
+{
+    static u8_t chunk[WRITE_CHUNK];
+
+    while (flow.written < flow.total) {
+        u32_t len = LWIP_MIN(LWIP_MIN(tcp_sndbuf(pcb), WRITE_CHUNK), flow.total - flow.written);
+        if (len == 0) {
+            break;
+        }
+        for (u32_t i = 0; i < len; i++) {
+            chunk[i] = pattern(flow.written + i);
+        }
+        if (tcp_write(pcb, chunk, len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+            break;
+        }
+        flow.written += len;
+    }
+    tcp_output(pcb);
+}
+
+static err_t sender_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+    send_more(pcb);
+    return ERR_OK;
+}
+
+static err_t sender_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    send_more(pcb);
+    return ERR_OK;
+}
+
+static err_t receiver_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    if (p == NULL) {
+        return ERR_OK;
+    }
+    for (struct pbuf *q = p; q != NULL; q = q->next) {
+        const u8_t *data = q->payload;
+        for (u16_t i = 0; i < q->len; i++) {
+            if (data[i] != pattern(flow.received + i)) {
+                flow.corrupted = true;
+            }
+        }
+        flow.received += q->len;
+    }
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t receiver_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    tcp_recv(pcb, receiver_recv);
+    return ERR_OK;
+}
+
+/**
+ * Transfer bytes from the sender, using cc, to the receiver.
+ * @return the simulated time the transfer took, in microseconds
+ */
+static uint64_t transfer(u32_t bytes, const struct tcp_cc_ops *cc, double loss)
+{
+    memset(&flow, 0, sizeof(flow));
+    flow.total = bytes;
+    flow.loss = loss;
+    data_link.count = ack_link.count = 0;
+
+    struct tcp_pcb *pcb = tcp_new();
+    tcp_set_cc(pcb, cc);
+    tcp_bind(pcb, &ip_a, 0);
+    tcp_sent(pcb, sender_sent);
+    tcp_connect(pcb, &ip_b, PORT, sender_connected);
+
+    uint64_t start = now_us;
+    while (flow.received < flow.total && now_us - start < TIME_LIMIT_US) {
+        uint64_t next = LWIP_MIN(link_next_due(&data_link), link_next_due(&ack_link));
+        u32_t sleep = sys_timeouts_sleeptime();
+        if (sleep != SYS_TIMEOUTS_SLEEPTIME_INFINITE && (now_us / 1000 + sleep) * 1000 < next) {
+            next = (now_us / 1000 + sleep) * 1000;
+        }
+        if (next > now_us) {
+            now_us = next;
+        }
+        link_deliver(&data_link);
+        link_deliver(&ack_link);
+        sys_check_timeouts();
+    }
+
+    uint64_t elapsed = now_us - start;
+    tcp_abort(pcb);
+    /* The receiver's pcb is aborted by the RST */
+    now_us += 2 * data_link.delay_us;
+    while (ack_link.count > 0 || data_link.count > 0) {
+        link_deliver(&data_link);
+        link_deliver(&ack_link);
+        now_us += data_link.delay_us;
+    }
+    return elapsed;
+}
+
+int main(void)
+{
+    IP4_ADDR(&ip_a, 10, 0, 0, 1);
+    IP4_ADDR(&ip_b, 10, 0, 1, 1);
+    harness_init(&netif_a, &ip_a, 24, link_netif_init, ip_input);
+    harness_netif_add(&netif_b, &ip_b, 24, link_netif_init, ip_input);
+    netif_a.flags |= NETIF_FLAG_GSO;
+    netif_b.flags |= NETIF_FLAG_GSO;
+    /* Frames routed out of netif_b go to the receiver, and the other way */
+    data_link.lose = data_frame_lost;
+    link_connect(&data_link, &netif_b, &netif_b);
+    link_connect(&ack_link, &netif_a, &netif_a);
+
+    const char *failure = check();
+    if (failure != NULL) {
+        printf("cc_bench: %s\n", failure);
+        return 1;
+    }
+
+    struct tcp_pcb *listener = tcp_new();
+    tcp_bind(listener, &ip_b, PORT);
+    listener = tcp_listen(listener);
+    tcp_accept(listener, receiver_accept);
+
+    printf("%8s %12s %8s %16s %16s\n", "RTT ms", "link Mbit/s", "loss %", "NewReno Mbit/s", "CUBIC Mbit/s");
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        data_link.mbps = ack_link.mbps = paths[i].mbps;
+        data_link.delay_us = ack_link.delay_us = paths[i].rtt_ms * 1000 / 2;
+        for (size_t j = 0; j < sizeof(loss_rates) / sizeof(loss_rates[0]); j++) {
+            double mbps[2];
+            for (int cubic = 0; cubic <= 1; cubic++) {
+                link_seed(1);
+                uint64_t us = transfer(BENCH_BYTES, cubic ? &tcp_cc_cubic : &tcp_cc_newreno, loss_rates[j]);
+                if (flow.received != flow.total || flow.corrupted) {
+                    printf("cc_bench: a transfer over %u ms with %.2f%% loss did not arrive intact\n",
+                           paths[i].rtt_ms, loss_rates[j] * 100);
+                    return 1;
+                }
+                mbps[cubic] = (double)flow.total * 8 / us;
+            }
+            printf("%8u %12u %8.2f %16.2f %16.2f\n", paths[i].rtt_ms, paths[i].mbps, loss_rates[j] * 100,
+                   mbps[0], mbps[1]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Checks that software GRO (gro.c) merges the TCP segments of a batch
+ * whatever follows the IP datagram in each frame: nothing, as the host
+ * simulation passes them, an FCS, as a MAC that keeps it does, or the
+ * padding of frames under the Ethernet minimum. Built by `make gro_test`
+ * in this directory.
+ *
+ * Each batch is passed to gro_receive() and gro_flush() as lwip.c passes
+ * the frames of the RX ring, and the netif input records what reaches
+ * lwIP. A batch of in-order segments must arrive as one segment, with IP
+ * and pbuf lengths that add up and the payload intact, and none of the
+ * trailers in it.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include "gro.h"
+#include "harness.h"
+
+#define ETH_MIN_FRAME 60
+#define ETH_FCS_LEN 4
+#define SEGMENTS 8
+#define MAX_PAYLOAD 1460
+#define STREAM_SIZE (SEGMENTS * MAX_PAYLOAD)
+
+/* What follows the IP datagram in a frame */
+enum trailer {
+    NONE,
+    FCS,
+    PADDING,
+};
+
+static const char *trailer_names[] = { "none", "FCS", "padding" };
+
+static struct netif netif;
+static unsigned int failures;
+
+/* What reached lwIP in a batch */
+static unsigned int segments;
+static unsigned int bad_lengths;
+static u8_t stream[STREAM_SIZE];
+static unsigned int stream_len;
+
+static void expect(bool ok, const char *what)
+{
+    if (!ok) {
+        printf("gro_test: %s\n", what);
+        failures++;
+    }
+}
+
+/* The byte at offset k of the TCP stream */
+static u8_t pattern(unsigned int k)
+{
+    return (u8_t)(k * 13 + 5);
+}
+
+static err_t record_input(struct pbuf *p, struct netif *inp)
+{
+    static u8_t frame[0x10000];
+    u16_t len = pbuf_copy_partial(p, frame, p->tot_len, 0);
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)(frame + SIZEOF_ETH_HDR);
+    const struct tcp_hdr *tcphdr = (const struct tcp_hdr *)((const u8_t *)iphdr + IP_HLEN);
+    u16_t hdr_len = SIZEOF_ETH_HDR + IP_HLEN + TCPH_HDRLEN_BYTES(tcphdr);
+
+    segments++;
+    if (len < hdr_len || SIZEOF_ETH_HDR + lwip_ntohs(IPH_LEN(iphdr)) != len ||
+        stream_len + len - hdr_len > STREAM_SIZE) {
+        bad_lengths++;
+    } else {
+        memcpy(stream + stream_len, frame + hdr_len, len - hdr_len);
+        stream_len += len - hdr_len;
+    }
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+/**
+ * Build a frame holding the TCP segment of the stream at seq.
+ * @return the frame, with the trailer after the datagram
+ */
+static struct pbuf *build_frame(u32_t seq, u16_t payload_len, enum trailer trailer)
+{
+    u16_t ip_len = IP_HLEN + TCP_HLEN + payload_len;
+    u16_t len = SIZEOF_ETH_HDR + ip_len;
+    if (trailer == FCS) {
+        len += ETH_FCS_LEN;
+    } else if (trailer == PADDING && len < ETH_MIN_FRAME) {
+        len = ETH_MIN_FRAME;
+    }
+
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_RAM);
+    u8_t *frame = p->payload;
+    /* The trailer is anything but the stream */
+    memset(frame, 0xee, len);
+
+    struct eth_hdr *ethhdr = (struct eth_hdr *)frame;
+    ethhdr->type = PP_HTONS(ETHTYPE_IP);
+
+    struct ip_hdr *iphdr = (struct ip_hdr *)(frame + SIZEOF_ETH_HDR);
+    memset(iphdr, 0, IP_HLEN);
+    IPH_VHL_SET(iphdr, 4, IP_HLEN / 4);
+    IPH_LEN_SET(iphdr, lwip_htons(ip_len));
+    IPH_TTL_SET(iphdr, 64);
+    IPH_PROTO_SET(iphdr, IP_PROTO_TCP);
+    IP4_ADDR(&iphdr->src, 10, 0, 0, 2);
+    IP4_ADDR(&iphdr->dest, 10, 0, 0, 1);
+
+    struct tcp_hdr *tcphdr = (struct tcp_hdr *)((u8_t *)iphdr + IP_HLEN);
+    memset(tcphdr, 0, TCP_HLEN);
+    tcphdr->src = PP_HTONS(40000);
+    tcphdr->dest = PP_HTONS(5001);
+    tcphdr->seqno = lwip_htonl(seq);
+    tcphdr->ackno = lwip_htonl(1);
+    tcphdr->wnd = PP_HTONS(0xffff);
+    TCPH_HDRLEN_FLAGS_SET(tcphdr, TCP_HLEN / 4, TCP_ACK);
+
+    u8_t *payload = (u8_t *)tcphdr + TCP_HLEN;
+    for (u16_t k = 0; k < payload_len; k++) {
+        payload[k] = pattern(seq + k);
+    }
+    return p;
+}
+
+/**
+ * Pass a batch of segments of payload_len bytes to GRO, each frame with
+ * the trailer, or alternating with none.
+ */
+static void check_batch(u16_t payload_len, enum trailer trailer, bool alternate)
+{
+    char trailers[32], what[160];
+
+    segments = 0;
+    bad_lengths = 0;
+    stream_len = 0;
+    for (unsigned int i = 0; i < SEGMENTS; i++) {
+        enum trailer t = alternate && i % 2 ? NONE : trailer;
+        gro_receive(&netif, build_frame(i * payload_len, payload_len, t));
+    }
+    gro_flush(&netif);
+
+    bool intact = stream_len == SEGMENTS * payload_len;
+    for (unsigned int k = 0; intact && k < stream_len; k++) {
+        intact = stream[k] == pattern(k);
+    }
+    snprintf(trailers, sizeof(trailers), "%s%s", trailer_names[trailer], alternate ? " on every other" : "");
+    printf("%8u %20s %8u\n", payload_len, trailers, segments);
+
+    if (segments != 1 || bad_lengths || !intact) {
+        snprintf(what, sizeof(what), "%u segments of %u bytes with %s trailer arrived as %u, %s", SEGMENTS,
+                 payload_len, trailers, segments,
+                 bad_lengths ? "with lengths that do not add up" : intact ? "intact" : "with the payload corrupted");
+        expect(false, what);
+    }
+}
+
+int main(void)
+{
+    ip4_addr_t addr;
+    IP4_ADDR(&addr, 10, 0, 0, 1);
+    harness_init(&netif, &addr, 24, harness_netif_init, record_input);
+
+    printf("%8s %20s %8s\n", "payload", "trailer", "segments");
+    u16_t sizes[] = { 1, 6, 100, MAX_PAYLOAD };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (enum trailer t = NONE; t <= PADDING; t++) {
+            check_batch(sizes[i], t, false);
+        }
+        check_batch(sizes[i], FCS, true);
+    }
+
+    /* A frame cut short of its IP length is passed on as it is */
+    struct pbuf *p = build_frame(0, 100, NONE);
+    pbuf_realloc(p, p->tot_len - 10);
+    segments = 0;
+    bad_lengths = 0;
+    stream_len = 0;
+    gro_receive(&netif, p);
+    gro_flush(&netif);
+    expect(segments == 1 && bad_lengths == 1, "a truncated frame was not passed on as it was");
+
+    return failures ? 1 : 0;
+}
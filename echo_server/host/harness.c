@@ -0,0 +1,63 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "lwip/init.h"
+#include "lwip/def.h"
+
+#include "harness.h"
+
+unsigned int harness_transmitted;
+
+void sel4cp_dbg_putc(int c)
+{
+    putchar(c);
+}
+
+void sel4cp_dbg_puts(const char *s)
+{
+    fputs(s, stdout);
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static err_t harness_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+    harness_transmitted++;
+    return ERR_OK;
+}
+
+err_t harness_netif_init(struct netif *netif)
+{
+    netif->output = harness_output;
+    netif->mtu = 1500;
+    netif->flags = NETIF_FLAG_LINK_UP;
+    return ERR_OK;
+}
+
+void harness_netif_add(struct netif *netif, const ip4_addr_t *addr, int prefix_len,
+                       netif_init_fn init, netif_input_fn input)
+{
+    ip4_addr_t netmask, gw;
+    ip4_addr_set_u32(&netmask, lwip_htonl(prefix_len ? 0xffffffffUL << (32 - prefix_len) : 0));
+    ip4_addr_set_zero(&gw);
+    netif_add(netif, addr, &netmask, &gw, NULL, init, input);
+    netif_set_up(netif);
+}
+
+void harness_init(struct netif *netif, const ip4_addr_t *addr, int prefix_len,
+                  netif_init_fn init, netif_input_fn input)
+{
+    lwip_init();
+    harness_netif_add(netif, addr, prefix_len, init, input);
+    netif_set_default(netif);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/*
+ * What the host checks and benchmarks share: the debug output of the seL4
+ * Core Platform, a clock, and the netifs they pass lwIP traffic through.
+ */
+
+#include <stdint.h>
+
+#include "lwip/ip4_addr.h"
+#include "lwip/netif.h"
+
+/* Datagrams output by netifs set up with harness_netif_init() */
+extern unsigned int harness_transmitted;
+
+/**
+ * @return the host's monotonic clock, in nanoseconds.
+ */
+uint64_t now_ns(void);
+
+/**
+ * Set up a netif whose output only counts each datagram in
+ * harness_transmitted. For netif_add().
+ */
+err_t harness_netif_init(struct netif *netif);
+
+/**
+ * Initialise lwIP, and add a netif as the default.
+ *
+ * @param netif netif to add.
+ * @param addr address of the netif.
+ * @param prefix_len length of the network prefix of addr.
+ * @param init netif init function, as for netif_add().
+ * @param input ip_input for an IP netif, or ethernet_input.
+ */
+void harness_init(struct netif *netif, const ip4_addr_t *addr, int prefix_len,
+                  netif_init_fn init, netif_input_fn input);
+
+/**
+ * Add another netif after harness_init(), and set it up.
+ *
+ * @param netif netif to add.
+ * @param addr address of the netif.
+ * @param prefix_len length of the network prefix of addr.
+ * @param init netif init function, as for netif_add().
+ * @param input ip_input for an IP netif, or ethernet_input.
+ */
+void harness_netif_add(struct netif *netif, const ip4_addr_t *addr, int prefix_len,
+                       netif_init_fn init, netif_input_fn input);
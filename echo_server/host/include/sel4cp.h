@@ -0,0 +1,82 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/*
+ * The parts of the seL4 Core Platform interface used by the lwIP PD, for
+ * running it as a Linux process. Notifications and protected procedure
+ * calls are delivered by sim.c, and cache maintenance is a no-op as the
+ * simulated driver shares the host's coherent memory.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef unsigned int sel4cp_channel;
+typedef unsigned int sel4cp_pd;
+typedef uint64_t seL4_CPtr;
+typedef uint64_t seL4_Word;
+
+typedef struct seL4_MessageInfo {
+    uint64_t label;
+    uint16_t count;
+} seL4_MessageInfo_t;
+
+typedef seL4_MessageInfo_t sel4cp_msginfo;
+
+#define BASE_OUTPUT_NOTIFICATION_CAP 10
+#define BASE_ENDPOINT_CAP 74
+#define BASE_IRQ_CAP 138
+#define BASE_TCB_CAP 202
+
+/* libsel4cp calls this signal, which is taken by libc */
+#define signal sel4cp_signal
+
+extern char sel4cp_name[16];
+extern bool have_signal;
+extern seL4_CPtr signal;
+extern seL4_MessageInfo_t signal_msg;
+
+/* Entry points of the PD */
+void init(void);
+void notified(sel4cp_channel ch);
+sel4cp_msginfo protected(sel4cp_channel ch, sel4cp_msginfo msginfo);
+
+void sel4cp_dbg_putc(int c);
+void sel4cp_dbg_puts(const char *s);
+void sel4cp_notify(sel4cp_channel ch);
+sel4cp_msginfo sel4cp_ppcall(sel4cp_channel ch, sel4cp_msginfo msginfo);
+void sel4cp_mr_set(uint8_t mr, uint64_t value);
+uint64_t sel4cp_mr_get(uint8_t mr);
+
+static inline void sel4cp_irq_ack(sel4cp_channel ch)
+{
+}
+
+static inline seL4_MessageInfo_t seL4_MessageInfo_new(uint64_t label, uint64_t caps, uint64_t extra, uint64_t count)
+{
+    return (seL4_MessageInfo_t) { .label = label, .count = count };
+}
+
+static inline sel4cp_msginfo sel4cp_msginfo_new(uint64_t label, uint16_t count)
+{
+    return seL4_MessageInfo_new(label, 0, 0, count);
+}
+
+static inline uint64_t sel4cp_msginfo_get_label(sel4cp_msginfo msginfo)
+{
+    return msginfo.label;
+}
+
+static inline int seL4_ARM_VSpace_Clean_Data(seL4_CPtr vspace, seL4_Word start, seL4_Word end)
+{
+    return 0;
+}
+
+static inline int seL4_ARM_VSpace_Invalidate_Data(seL4_CPtr vspace, seL4_Word start, seL4_Word end)
+{
+    return 0;
+}
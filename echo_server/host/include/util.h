@@ -0,0 +1,45 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Host version of include/util.h, printing to stdout instead of the UART */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+
+#ifdef __GNUC__
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#else
+#define likely(x)   (!!(x))
+#define unlikely(x) (!!(x))
+#endif
+
+static void
+putC(uint8_t ch)
+{
+    putchar(ch);
+}
+
+static void
+print(const char *s)
+{
+    fputs(s, stdout);
+}
+
+static char
+hexchar(unsigned int v)
+{
+    return v < 10 ? '0' + v : ('a' - 10) + v;
+}
+
+static void
+puthex64(uint64_t val)
+{
+    printf("0x%016lx", (unsigned long)val);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <string.h>
+
+#include "lwip/def.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include "link.h"
+
+uint64_t now_us;
+
+static uint64_t rand_state = 1;
+
+u32_t sys_now(void)
+{
+    return (u32_t)(now_us / 1000);
+}
+
+double link_random(void)
+{
+    rand_state = rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (double)(rand_state >> 11) / (double)(1ULL << 53);
+}
+
+void link_seed(uint64_t seed)
+{
+    rand_state = seed;
+}
+
+u16_t link_tcp_payload(const u8_t *frame)
+{
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)frame;
+    const struct tcp_hdr *tcphdr = (const struct tcp_hdr *)(frame + IPH_HL_BYTES(iphdr));
+    return lwip_ntohs(IPH_LEN(iphdr)) - IPH_HL_BYTES(iphdr) - TCPH_HDRLEN_BYTES(tcphdr);
+}
+
+static void link_send(struct link *link, const u8_t *frame, u16_t len)
+{
+    if (link->count == LINK_QUEUE) {
+        return;
+    }
+    uint64_t start = link->busy_until > now_us ? link->busy_until : now_us;
+    link->busy_until = start + (uint64_t)len * 8 / link->mbps;
+
+    unsigned int tail = (link->head + link->count++) % LINK_QUEUE;
+    link->frames[tail].due = link->busy_until + link->delay_us;
+    link->frames[tail].len = len;
+    memcpy(link->frames[tail].data, frame, len);
+}
+
+static void link_send_tcp(struct link *link, const u8_t *frame, u16_t len)
+{
+    if (link->lose == NULL || !link->lose(frame)) {
+        link_send(link, frame, len);
+    }
+}
+
+/* Cut a TCP_GSO segment into frames, as lwip_eth_send_gso() does */
+static void link_send_packet(struct link *link, struct netif *netif, const u8_t *packet, u16_t len)
+{
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)packet;
+    u16_t ip_hlen = IPH_HL_BYTES(iphdr);
+
+    if (IPH_PROTO(iphdr) != IP_PROTO_TCP) {
+        link_send(link, packet, len);
+        return;
+    }
+    if (len <= netif->mtu) {
+        link_send_tcp(link, packet, len);
+        return;
+    }
+
+    const struct tcp_hdr *tcphdr = (const struct tcp_hdr *)(packet + ip_hlen);
+    u16_t hdr_len = ip_hlen + TCPH_HDRLEN_BYTES(tcphdr);
+    u16_t max_payload = netif->mtu - hdr_len;
+    u16_t payload_len = len - hdr_len;
+    u32_t seqno = lwip_ntohl(tcphdr->seqno);
+    u8_t flags = TCPH_FLAGS(tcphdr);
+    u8_t frame[LINK_FRAME_SIZE];
+
+    for (u16_t offset = 0; offset < payload_len; offset += max_payload) {
+        u16_t frame_len = LWIP_MIN(max_payload, payload_len - offset);
+        memcpy(frame, packet, hdr_len);
+        memcpy(frame + hdr_len, packet + hdr_len + offset, frame_len);
+        struct ip_hdr *frame_iphdr = (struct ip_hdr *)frame;
+        struct tcp_hdr *frame_tcphdr = (struct tcp_hdr *)(frame + ip_hlen);
+        IPH_LEN_SET(frame_iphdr, lwip_htons(hdr_len + frame_len));
+        frame_tcphdr->seqno = lwip_htonl(seqno + offset);
+        if (offset + frame_len < payload_len) {
+            TCPH_FLAGS_SET(frame_tcphdr, flags & ~(TCP_PSH | TCP_FIN));
+        }
+        link_send_tcp(link, frame, hdr_len + frame_len);
+    }
+}
+
+static err_t link_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+    static u8_t packet[0x10000];
+    u16_t len = pbuf_copy_partial(p, packet, p->tot_len, 0);
+    link_send_packet(netif->state, netif, packet, len);
+    return ERR_OK;
+}
+
+err_t link_netif_init(struct netif *netif)
+{
+    netif->output = link_output;
+    netif->mtu = 1500;
+    netif->flags = NETIF_FLAG_LINK_UP;
+    return ERR_OK;
+}
+
+void link_connect(struct link *link, struct netif *from, struct netif *to)
+{
+    from->state = link;
+    link->to = to;
+}
+
+void link_deliver(struct link *link)
+{
+    while (link->count > 0 && link->frames[link->head].due <= now_us) {
+        struct pbuf *p = pbuf_alloc(PBUF_RAW, link->frames[link->head].len, PBUF_POOL);
+        if (p != NULL) {
+            pbuf_take(p, link->frames[link->head].data, link->frames[link->head].len);
+            link->to->input(p, link->to);
+        }
+        link->head = (link->head + 1) % LINK_QUEUE;
+        link->count--;
+    }
+}
+
+uint64_t link_next_due(struct link *link)
+{
+    return link->count > 0 ? link->frames[link->head].due : UINT64_MAX;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/*
+ * A simulated link for running lwIP against itself: frames output by one
+ * netif queue behind each other at the link's rate, and reach the other
+ * netif's input after its delay. TCP_GSO segments are cut into frames as
+ * lwip_eth_send_gso() does, when the sending netif sets NETIF_FLAG_GSO.
+ *
+ * Time is simulated too. The link provides sys_now() from now_us, which
+ * the tool moves on to the next frame or timeout that is due.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/netif.h"
+
+#define LINK_QUEUE 4096
+#define LINK_FRAME_SIZE 1514
+
+struct link {
+    struct {
+        uint64_t due;
+        u16_t len;
+        u8_t data[LINK_FRAME_SIZE];
+    } frames[LINK_QUEUE];
+    unsigned int head, count;
+    uint64_t busy_until;
+    unsigned int mbps, delay_us;
+    struct netif *to;
+    /* Decides whether to drop a TCP frame (at its IP header), if set */
+    bool (*lose)(const u8_t *frame);
+};
+
+/* The simulated time, in microseconds */
+extern uint64_t now_us;
+
+/**
+ * Have the output of a netif go over a link to another netif. The netif
+ * must have been added with link_netif_init().
+ *
+ * @param link link to send over.
+ * @param from netif that outputs onto the link.
+ * @param to netif the link delivers to.
+ */
+void link_connect(struct link *link, struct netif *from, struct netif *to);
+
+/**
+ * Set up a netif whose output goes over the link given to link_connect().
+ * For netif_add().
+ */
+err_t link_netif_init(struct netif *netif);
+
+/**
+ * Deliver the frames that are due by now_us.
+ */
+void link_deliver(struct link *link);
+
+/**
+ * @return when the next frame is due, or UINT64_MAX if there is none.
+ */
+uint64_t link_next_due(struct link *link);
+
+/**
+ * @return the length of the TCP payload of a frame.
+ */
+u16_t link_tcp_payload(const u8_t *frame);
+
+/**
+ * @return a pseudo-random number in [0, 1), the same sequence after every
+ * link_seed() with the same seed.
+ */
+double link_random(void);
+
+void link_seed(uint64_t seed);
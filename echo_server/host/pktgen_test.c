@@ -0,0 +1,519 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Runs the packet generator PD (pktgen.c, unmodified) through its steps
+ * over a simulated NIC in loopback, and checks its rate and pacing logic
+ * and what it measures. Built by `make pktgen_test` in this directory.
+ *
+ * The test takes the place of the multiplexers, the ENET driver and the
+ * GPT. Frames the generator queues go out on a simulated link at
+ * LINK_MBPS, with the preamble and gap between frames, and come back on
+ * the generator's RX ring LINK_DELAY_NS after they are sent, without the
+ * FCS, as the driver strips it. Time is simulated: the GPT counter is
+ * moved on to the next timer interrupt or frame, so the run is the same
+ * every time and takes the steps' full length in simulated time only.
+ *
+ * The link drops and swaps some frames, and the generator's report of
+ * each step must match what the link did, counting bytes the same way
+ * for the frames it sent and the ones that came back. Paced steps must
+ * keep within a tick's worth of frames of their rate for the whole step,
+ * and steps at line rate must keep the link busy.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sel4cp.h>
+
+#include "mux.h"
+#include "shared_ringbuffer.h"
+
+#include "harness.h"
+
+/* Channels of the generator, as in pktgen.c */
+#define TIMER 1
+#define RX_CH 2
+#define INIT 4
+#define TX_CH 6
+
+/* GPT registers, as in pktgen.c */
+#define GPT_SR 2
+#define GPT_IR 3
+#define GPT_OCR1 4
+#define GPT_CNT 9
+#define GPT_SIZE 0x10000
+
+#define LINK_MBPS 1000
+#define LINK_DELAY_NS 20000
+#define LINK_QUEUE 4096
+/* FCS, preamble and the gap between frames, which pktgen does not queue */
+#define WIRE_OVERHEAD 24
+#define ETH_MAX_FRAME 1518
+
+/* The link drops every DROP_EVERY-th frame of a step, and sends every
+ * SWAP_EVERY-th frame ahead of the one before it */
+#define DROP_EVERY 997
+#define SWAP_EVERY 1009
+
+#define TICK_NS 1000000ULL
+#define NS_IN_S 1000000000ULL
+#define TIME_LIMIT_NS (60 * NS_IN_S)
+/* Share of line rate the unpaced steps must reach */
+#define LINE_RATE_MIN 0.95
+
+/* Layout of the start of a test frame, as pktgen_hdr_t in pktgen.c */
+#define HDR_STEP 18
+#define HDR_SEQ 22
+
+/* Memory regions of the generator, defined in pktgen.c */
+extern uintptr_t rx_free;
+extern uintptr_t rx_used;
+extern uintptr_t tx_free;
+extern uintptr_t tx_used;
+extern uintptr_t shared_dma_vaddr;
+extern uintptr_t gpt_regs;
+
+static ring_buffer_t rings[4];
+static uint8_t dma[DMA_SIZE] __attribute__((aligned(BUF_SIZE)));
+static uint32_t gpt[GPT_SIZE / sizeof(uint32_t)];
+
+/* The seL4 Core Platform state the PD uses */
+char sel4cp_name[16] = "pktgen";
+bool have_signal = false;
+seL4_CPtr signal;
+seL4_MessageInfo_t signal_msg;
+static uint64_t mrs[64];
+
+static const uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x03 };
+
+static uint64_t now;
+/* Channels the generator has notifications waiting on */
+static uint64_t pd_pending;
+/* Whether the generator has notified the TX multiplexer */
+static bool tx_notified;
+static bool failed;
+
+static struct {
+    ring_handle_t rx_ring;
+    ring_handle_t tx_ring;
+    /* RX buffers the driver holds */
+    uintptr_t rx_buffers[NUM_BUFFERS];
+    unsigned int rx_count;
+} nic;
+
+/* The simulated link */
+static struct {
+    struct {
+        /* When the frame is on the wire, and when it is back */
+        uint64_t sent, arrives;
+        uintptr_t tx_addr;
+        unsigned int len;
+        uint8_t data[ETH_MAX_FRAME];
+    } frames[LINK_QUEUE];
+    /* Frames from head + done on still hold their TX buffer */
+    unsigned int head, done, count;
+    uint64_t busy_until;
+} wire;
+
+/* What the link did with the frames of the current step */
+static struct {
+    unsigned int step;
+    uint64_t sent;
+    uint64_t delivered;
+    uint64_t dropped;
+    uint64_t reordered;
+    uint64_t highest_seq;
+    /* When each frame was queued by the generator, by sequence number */
+    uint64_t *queued_at;
+    uint64_t queued_size;
+} seen;
+
+/* The generator's report of a step */
+typedef struct report {
+    unsigned int step, size;
+    uint64_t rate, tx, rx, lost, reordered, foreign, tx_pps, rx_pps, tx_mbps, rx_mbps;
+} report_t;
+
+/* The console, which the generator prints its reports on */
+static FILE *console;
+static char *console_text;
+static size_t console_len, console_read;
+static bool generator_done;
+
+void sel4cp_mr_set(uint8_t mr, uint64_t value)
+{
+    mrs[mr] = value;
+}
+
+uint64_t sel4cp_mr_get(uint8_t mr)
+{
+    return mrs[mr];
+}
+
+void sel4cp_notify(sel4cp_channel ch)
+{
+    switch (ch) {
+        case RX_CH:
+            /* The driver takes its RX buffers back when it needs them */
+            break;
+        case TX_CH:
+            tx_notified = true;
+            break;
+        default:
+            fprintf(stderr, "pktgen_test: notification on unexpected channel %u\n", ch);
+            break;
+    }
+}
+
+sel4cp_msginfo sel4cp_ppcall(sel4cp_channel ch, sel4cp_msginfo msginfo)
+{
+    switch (ch) {
+        case INIT:
+            mrs[0] = (mac[0] << 24) | (mac[1] << 16) | (mac[2] << 8) | mac[3];
+            mrs[1] = (mac[4] << 24) | (mac[5] << 16);
+            mrs[2] = 1;
+            return sel4cp_msginfo_new(0, 3);
+        case TX_CH:
+            mrs[0] = 0;
+            mrs[1] = TX_BUFFERS_PER_CLIENT;
+            return sel4cp_msginfo_new(0, 2);
+        default:
+            fprintf(stderr, "pktgen_test: ppcall on unexpected channel %u\n", ch);
+            return sel4cp_msginfo_new(0, 0);
+    }
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t wire_ns(unsigned int len)
+{
+    return (uint64_t)(len + WIRE_OVERHEAD) * 8 * 1000 / LINK_MBPS;
+}
+
+static void start_step(unsigned int step)
+{
+    seen.step = step;
+    seen.sent = 0;
+    seen.delivered = 0;
+    seen.dropped = 0;
+    seen.reordered = 0;
+    seen.highest_seq = 0;
+}
+
+/**
+ * Put the frames the generator has queued on the link, as the TX
+ * multiplexer and driver would when notified.
+ */
+static void transmit(void)
+{
+    uintptr_t addr;
+    unsigned int len;
+    void *cookie;
+
+    while (wire.count < LINK_QUEUE && !dequeue_used(&nic.tx_ring, &addr, &len, &cookie)) {
+        const uint8_t *frame = (const uint8_t *)addr;
+        unsigned int step = get32(frame + HDR_STEP);
+        uint64_t seq = get64(frame + HDR_SEQ);
+        if (step != seen.step) {
+            start_step(step);
+        }
+        if (seq >= seen.queued_size) {
+            seen.queued_size = seq * 2 + 1024;
+            seen.queued_at = realloc(seen.queued_at, seen.queued_size * sizeof(uint64_t));
+        }
+        seen.queued_at[seq] = now;
+        seen.sent++;
+
+        uint64_t start = wire.busy_until > now ? wire.busy_until : now;
+        wire.busy_until = start + wire_ns(len);
+
+        unsigned int tail = (wire.head + wire.count++) % LINK_QUEUE;
+        wire.frames[tail].sent = wire.busy_until;
+        wire.frames[tail].arrives = wire.busy_until + LINK_DELAY_NS;
+        wire.frames[tail].tx_addr = addr;
+        wire.frames[tail].len = len;
+        memcpy(wire.frames[tail].data, frame, len);
+
+        /* Send the frame ahead of the one before, if that is still in flight */
+        unsigned int before = (tail + LINK_QUEUE - 1) % LINK_QUEUE;
+        if (seq && seq % SWAP_EVERY == 0 && wire.count > 1 &&
+            get64(wire.frames[before].data + HDR_SEQ) == seq - 1 &&
+            get32(wire.frames[before].data + HDR_STEP) == step) {
+            uint8_t data[ETH_MAX_FRAME];
+            unsigned int before_len = wire.frames[before].len;
+            memcpy(data, wire.frames[before].data, before_len);
+            memcpy(wire.frames[before].data, wire.frames[tail].data, len);
+            wire.frames[before].len = len;
+            memcpy(wire.frames[tail].data, data, before_len);
+            wire.frames[tail].len = before_len;
+        }
+    }
+}
+
+/**
+ * Hand back the TX buffers of the frames that are on the wire by now, as
+ * the driver and TX multiplexer would.
+ */
+static void complete_transmits(void)
+{
+    bool returned = false;
+    while (wire.done < wire.count && wire.frames[(wire.head + wire.done) % LINK_QUEUE].sent <= now) {
+        unsigned int i = (wire.head + wire.done++) % LINK_QUEUE;
+        enqueue_free(&nic.tx_ring, wire.frames[i].tx_addr, BUF_SIZE, NULL);
+        returned = true;
+    }
+    if (returned && require_signal(nic.tx_ring.free_ring)) {
+        cancel_signal(nic.tx_ring.free_ring);
+        pd_pending |= 1ULL << TX_CH;
+    }
+}
+
+static uintptr_t alloc_rx_buffer(void)
+{
+    if (!nic.rx_count) {
+        uintptr_t addr;
+        unsigned int len;
+        void *cookie;
+        while (!dequeue_free(&nic.rx_ring, &addr, &len, &cookie)) {
+            nic.rx_buffers[nic.rx_count++] = addr;
+        }
+    }
+    return nic.rx_count ? nic.rx_buffers[--nic.rx_count] : 0;
+}
+
+/**
+ * Pass the frames that are back by now to the generator, as the RX
+ * multiplexer would, dropping some on the way.
+ */
+static void deliver(void)
+{
+    while (wire.count && wire.frames[wire.head].arrives <= now) {
+        unsigned int i = wire.head;
+        wire.head = (wire.head + 1) % LINK_QUEUE;
+        wire.count--;
+        wire.done--;
+
+        const uint8_t *frame = wire.frames[i].data;
+        uint64_t seq = get64(frame + HDR_SEQ);
+        if (get32(frame + HDR_STEP) == seen.step) {
+            if (seq % DROP_EVERY == DROP_EVERY - 1) {
+                seen.dropped++;
+                continue;
+            }
+            if (seen.delivered++ && seq < seen.highest_seq) {
+                seen.reordered++;
+            } else {
+                seen.highest_seq = seq;
+            }
+        }
+
+        uintptr_t buffer = alloc_rx_buffer();
+        if (!buffer || ring_full(nic.rx_ring.used_ring)) {
+            printf("pktgen_test: the generator kept all the RX buffers\n");
+            failed = true;
+            return;
+        }
+        memcpy((void *)buffer, frame, wire.frames[i].len);
+        enqueue_used(&nic.rx_ring, buffer, wire.frames[i].len, NULL);
+        pd_pending |= 1ULL << RX_CH;
+    }
+}
+
+/**
+ * @return when the GPT interrupt is due, or UINT64_MAX if it is off.
+ */
+static uint64_t timer_due(void)
+{
+    if (!(gpt[GPT_IR] & 1)) {
+        return UINT64_MAX;
+    }
+    return now + (uint32_t)(gpt[GPT_OCR1] - (uint32_t)now);
+}
+
+/**
+ * Check a step's report against what the link did, and print it.
+ */
+static void check_step(const report_t *r)
+{
+    const char *problem = NULL;
+    double line_share = (double)r->tx_pps * wire_ns(r->size - 4) / NS_IN_S;
+
+    if (r->step != seen.step || r->tx != seen.sent) {
+        problem = "frames it sent";
+    } else if (r->rx != seen.delivered || r->lost != seen.dropped) {
+        problem = "frames that came back";
+    } else if (r->reordered != seen.reordered) {
+        problem = "frames that came back out of order";
+    } else if (r->foreign) {
+        problem = "frames of its own as foreign";
+    } else if (r->tx && labs((long)(r->rx_mbps * r->tx) - (long)(r->tx_mbps * r->rx)) > (long)r->tx) {
+        /* Every frame is counted in bytes the same way both ways */
+        problem = "bytes that came back";
+    }
+    if (problem != NULL) {
+        printf("pktgen_test: step %u miscounted the %s: tx=%lu rx=%lu lost=%lu reordered=%lu foreign=%lu "
+               "tx_mbps=%lu rx_mbps=%lu, the link carried %lu, delivered %lu, dropped %lu and reordered %lu\n",
+               r->step, problem, (unsigned long)r->tx, (unsigned long)r->rx, (unsigned long)r->lost,
+               (unsigned long)r->reordered, (unsigned long)r->foreign, (unsigned long)r->tx_mbps,
+               (unsigned long)r->rx_mbps, (unsigned long)seen.sent,
+               (unsigned long)seen.delivered, (unsigned long)seen.dropped, (unsigned long)seen.reordered);
+        failed = true;
+        return;
+    }
+
+    if (r->rate) {
+        /* Frame i must be queued within a tick of when the rate has it
+           due, from when the first frame went */
+        double slack = (double)r->rate * TICK_NS / NS_IN_S + 2;
+        for (uint64_t i = 0; i < r->tx; i++) {
+            double due = (double)(seen.queued_at[i] - seen.queued_at[0]) * r->rate / NS_IN_S;
+            if (i + 1 > due + slack || i + 1 < due - slack) {
+                printf("pktgen_test: step %u queued frame %lu at %.3f ms, %s its rate of %lu/s\n", r->step,
+                       (unsigned long)i, (double)(seen.queued_at[i] - seen.queued_at[0]) / TICK_NS,
+                       i + 1 > due ? "ahead of" : "behind", (unsigned long)r->rate);
+                failed = true;
+                return;
+            }
+        }
+        if (r->tx_pps < r->rate * 99 / 100 || r->tx_pps > r->rate) {
+            printf("pktgen_test: step %u sent %lu frames/s at a rate of %lu/s\n", r->step,
+                   (unsigned long)r->tx_pps, (unsigned long)r->rate);
+            failed = true;
+            return;
+        }
+    } else if (line_share < LINE_RATE_MIN) {
+        printf("pktgen_test: step %u sent %lu frames/s, %.1f%% of line rate\n", r->step,
+               (unsigned long)r->tx_pps, line_share * 100);
+        failed = true;
+        return;
+    }
+
+    printf("%6u %10lu %10lu %8.1f %8lu %10lu\n", r->size, (unsigned long)r->rate, (unsigned long)r->tx_pps,
+           line_share * 100, (unsigned long)r->lost, (unsigned long)r->reordered);
+}
+
+/**
+ * Check the reports the generator has printed since the last call.
+ */
+static void read_console(void)
+{
+    fflush(console);
+    while (console_read < console_len) {
+        char *line = console_text + console_read;
+        char *end = memchr(line, '\n', console_len - console_read);
+        if (end == NULL) {
+            return;
+        }
+        *end = 0;
+        console_read += end - line + 1;
+
+        report_t r;
+        if (sscanf(line, "pktgen: step=%u size=%u rate=%lu tx=%lu rx=%lu lost=%lu reordered=%lu foreign=%lu "
+                   "tx_pps=%lu rx_pps=%lu tx_mbps=%lu rx_mbps=%lu", &r.step, &r.size, &r.rate, &r.tx, &r.rx,
+                   &r.lost, &r.reordered, &r.foreign, &r.tx_pps, &r.rx_pps, &r.tx_mbps, &r.rx_mbps) == 12) {
+            check_step(&r);
+        } else if (!strcmp(line, "pktgen: done")) {
+            generator_done = true;
+        }
+        *end = '\n';
+    }
+}
+
+/**
+ * Deliver a notification to the generator, with its console read back,
+ * followed by the notification it deferred to the end of its handler.
+ */
+static void pd_notified(sel4cp_channel ch)
+{
+    FILE *out = stdout;
+    stdout = console;
+    notified(ch);
+    if (have_signal) {
+        have_signal = false;
+        sel4cp_notify(signal - BASE_OUTPUT_NOTIFICATION_CAP);
+    }
+    stdout = out;
+
+    read_console();
+    if (tx_notified) {
+        tx_notified = false;
+        transmit();
+    }
+}
+
+int main(void)
+{
+    console = open_memstream(&console_text, &console_len);
+
+    rx_free = (uintptr_t)&rings[0];
+    rx_used = (uintptr_t)&rings[1];
+    tx_free = (uintptr_t)&rings[2];
+    tx_used = (uintptr_t)&rings[3];
+    shared_dma_vaddr = (uintptr_t)dma;
+    gpt_regs = (uintptr_t)gpt;
+
+    /* The multiplexers initialise the client rings and own the RX buffers */
+    ring_init(&nic.rx_ring, (ring_buffer_t *)rx_free, (ring_buffer_t *)rx_used, NULL, 1);
+    ring_init(&nic.tx_ring, (ring_buffer_t *)tx_free, (ring_buffer_t *)tx_used, NULL, 1);
+    for (int i = 0; i < NUM_BUFFERS - 1; i++) {
+        nic.rx_buffers[nic.rx_count++] = (uintptr_t)dma + BUF_SIZE * i;
+    }
+
+    FILE *out = stdout;
+    stdout = console;
+    init();
+    stdout = out;
+    pd_notified(INIT);
+
+    printf("%6s %10s %10s %8s %8s %10s\n", "size", "rate", "tx/s", "line %", "lost", "reordered");
+    while (!generator_done && !failed) {
+        uint64_t next = timer_due();
+        if (wire.done < wire.count && wire.frames[(wire.head + wire.done) % LINK_QUEUE].sent < next) {
+            next = wire.frames[(wire.head + wire.done) % LINK_QUEUE].sent;
+        }
+        if (wire.count && wire.frames[wire.head].arrives < next) {
+            next = wire.frames[wire.head].arrives;
+        }
+        if (next > TIME_LIMIT_NS) {
+            printf("pktgen_test: the generator did not finish its steps\n");
+            return 1;
+        }
+
+        now = next;
+        gpt[GPT_CNT] = (uint32_t)now;
+        complete_transmits();
+        deliver();
+        if (timer_due() <= now) {
+            gpt[GPT_SR] = 1;
+            pd_pending |= 1ULL << TIMER;
+        }
+
+        uint64_t pending = pd_pending;
+        pd_pending = 0;
+        for (sel4cp_channel ch = 0; pending; ch++, pending >>= 1) {
+            if (pending & 1) {
+                pd_notified(ch);
+            }
+        }
+    }
+
+    return failed;
+}
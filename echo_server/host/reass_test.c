@@ -0,0 +1,387 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Checks the IP_REASS_HASH and IP_REASS_COPY reassembly of lwIP
+ * (ip4_frag.c), then times it with several datagrams in reassembly at
+ * once. Built by `make reass_test` in this directory.
+ *
+ * Fragments of UDP datagrams are passed to ip4_input() in PBUF_REF pbufs
+ * over a pool of receive buffers, as lwip.c passes frames from the RX
+ * ring. The test sends fragments in order, in reverse, shuffled, with
+ * duplicates and overlaps, and interleaved between datagrams, and expects
+ * every datagram to arrive once and intact. It expects the receive
+ * buffers to be released as soon as each fragment is queued, a flood of
+ * incomplete datagrams to hold no more than IP_REASS_MAX_PBUFS pool
+ * pbufs, and the datagrams to time out.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/ip.h"
+#include "lwip/ip4_frag.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/udp.h"
+
+#include "harness.h"
+
+#if !IP_REASS_HASH || !IP_REASS_COPY
+#error "IP_REASS_HASH and IP_REASS_COPY are not enabled in lwipopts.h"
+#endif
+
+#define RX_BUFFERS 64
+#define RX_BUF_SIZE 2048
+#define FRAG_DATA 1480
+#define PORT 7
+#define MAX_FRAGS 64
+#define CONCURRENT 48
+#define FLOOD 10000
+#define BENCH_DATAGRAMS 20000
+
+static struct netif netif;
+static ip4_addr_t local_ip;
+static unsigned int failures;
+
+/* The receive buffers, handed to lwIP in PBUF_REF pbufs */
+static struct rx_buffer {
+    struct pbuf_custom custom;
+    bool in_use;
+    u8_t data[RX_BUF_SIZE];
+} rx_buffers[RX_BUFFERS];
+static int rx_outstanding;
+
+/* What the UDP pcb should receive next */
+static unsigned int delivered;
+static unsigned int corrupted;
+static bool checking = true;
+
+struct fragment {
+    u16_t offset;
+    u16_t len;
+    bool more;
+};
+
+static void rx_free(struct pbuf *p)
+{
+    struct rx_buffer *buffer = (struct rx_buffer *)p;
+    buffer->in_use = false;
+    rx_outstanding--;
+}
+
+/* The byte at offset k of the IP payload of datagram id, after the UDP
+   header */
+static u8_t pattern(u16_t id, int k)
+{
+    return (u8_t)(id * 7 + k);
+}
+
+static void test_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    u8_t data[0x10000];
+    u16_t id = lwip_ntohs(IPH_ID(ip4_current_header()));
+    u16_t len = pbuf_copy_partial(p, data, p->tot_len, 0);
+    bool intact = len == p->tot_len && len == (uintptr_t)arg;
+
+    for (int k = 0; checking && intact && k < len; k++) {
+        intact = data[k] == pattern(id, k);
+    }
+    if (!intact) {
+        corrupted++;
+    }
+    delivered++;
+    pbuf_free(p);
+}
+
+/**
+ * Build one fragment of datagram id, with payload_len bytes of UDP data,
+ * from src.
+ * @return the length of the frame
+ */
+static u16_t build_fragment(u8_t *frame, u32_t src, u16_t id, u8_t proto, u16_t payload_len,
+                            const struct fragment *frag)
+{
+    struct ip_hdr *iphdr = (struct ip_hdr *)frame;
+    u8_t *payload = frame + IP_HLEN;
+    memset(iphdr, 0, IP_HLEN);
+    IPH_VHL_SET(iphdr, 4, IP_HLEN / 4);
+    IPH_LEN_SET(iphdr, lwip_htons(IP_HLEN + frag->len));
+    IPH_ID_SET(iphdr, lwip_htons(id));
+    IPH_OFFSET_SET(iphdr, lwip_htons((frag->offset / 8) | (frag->more ? IP_MF : 0)));
+    IPH_TTL_SET(iphdr, 64);
+    IPH_PROTO_SET(iphdr, proto);
+    ip4_addr_set_u32(&iphdr->src, lwip_htonl(src));
+    ip4_addr_copy(iphdr->dest, local_ip);
+
+    /* The UDP header comes first in the IP payload, then the pattern */
+    struct udp_hdr udphdr = { 0 };
+    udphdr.src = lwip_htons(PORT);
+    udphdr.dest = lwip_htons(PORT);
+    udphdr.len = lwip_htons(UDP_HLEN + payload_len);
+    for (int k = 0; k < frag->len; k++) {
+        int at = frag->offset + k;
+        payload[k] = at < UDP_HLEN ? ((u8_t *)&udphdr)[at] : pattern(id, at - UDP_HLEN);
+    }
+    return IP_HLEN + frag->len;
+}
+
+/* Pass a frame to ip4_input() from a receive buffer, as lwip.c does */
+static void input_frame(const u8_t *frame, u16_t len)
+{
+    struct rx_buffer *buffer = NULL;
+    for (int i = 0; i < RX_BUFFERS; i++) {
+        if (!rx_buffers[i].in_use) {
+            buffer = &rx_buffers[i];
+            break;
+        }
+    }
+    if (buffer == NULL) {
+        if (failures++ < 10) {
+            printf("reass_test: out of receive buffers\n");
+        }
+        return;
+    }
+    buffer->in_use = true;
+    rx_outstanding++;
+
+    memcpy(buffer->data, frame, len);
+    struct pbuf *p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &buffer->custom, buffer->data, RX_BUF_SIZE);
+    netif.input(p, &netif);
+}
+
+static void input_fragment(u32_t src, u16_t id, u8_t proto, u16_t payload_len, const struct fragment *frag)
+{
+    u8_t frame[RX_BUF_SIZE];
+    input_frame(frame, build_fragment(frame, src, id, proto, payload_len, frag));
+}
+
+/* Cut a datagram with payload_len bytes of UDP data into fragments */
+static int cut(u16_t payload_len, struct fragment *frags)
+{
+    int total = UDP_HLEN + payload_len, n = 0;
+    for (int offset = 0; offset < total; offset += FRAG_DATA) {
+        frags[n].offset = offset;
+        frags[n].len = total - offset < FRAG_DATA ? total - offset : FRAG_DATA;
+        frags[n].more = offset + FRAG_DATA < total;
+        n++;
+    }
+    return n;
+}
+
+static void shuffle(struct fragment *frags, int n)
+{
+    for (int i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        struct fragment t = frags[i];
+        frags[i] = frags[j];
+        frags[j] = t;
+    }
+}
+
+static void expect(bool ok, const char *what)
+{
+    if (!ok && failures++ < 10) {
+        printf("reass_test: %s (%u delivered, %u corrupted)\n", what, delivered, corrupted);
+    }
+}
+
+static int pool_pbufs_free(void)
+{
+    struct pbuf *list = NULL, *p;
+    int n = 0;
+    while ((p = pbuf_alloc(PBUF_RAW, 1, PBUF_POOL)) != NULL) {
+        p->next = list;
+        list = p;
+        n++;
+    }
+    while (list != NULL) {
+        p = list;
+        list = p->next;
+        p->next = NULL;
+        pbuf_free(p);
+    }
+    return n;
+}
+
+static void test(struct udp_pcb *pcb)
+{
+    struct fragment frags[2 * MAX_FRAGS];
+    u16_t id = 1;
+    int n;
+    int pool_free = pool_pbufs_free();
+
+    /* In order, in reverse and shuffled */
+    for (int order = 0; order < 3; order++) {
+        u16_t len = 8000 + order * 333;
+        pcb->recv_arg = (void *)(uintptr_t)len;
+        n = cut(len, frags);
+        if (order == 1) {
+            for (int i = 0; i < n / 2; i++) {
+                struct fragment t = frags[i];
+                frags[i] = frags[n - 1 - i];
+                frags[n - 1 - i] = t;
+            }
+        } else if (order == 2) {
+            shuffle(frags, n);
+        }
+        delivered = 0;
+        for (int i = 0; i < n; i++) {
+            input_fragment(0x0a000002, id, IP_PROTO_UDP, len, &frags[i]);
+            expect(rx_outstanding == 0, "a receive buffer was held");
+        }
+        expect(delivered == 1 && !corrupted, "a datagram was not reassembled");
+        id++;
+    }
+
+    /* Duplicates are dropped, and so is a fragment overlapping those
+       already queued */
+    for (int round = 0; round < 100; round++) {
+        u16_t len = 3000 + rand() % 58000;
+        pcb->recv_arg = (void *)(uintptr_t)len;
+        n = cut(len, frags);
+        shuffle(frags, n);
+        /* Hold back the fragment that completes the datagram, so that the
+           duplicates and the overlap arrive while it is in reassembly */
+        struct fragment last = frags[n - 1];
+        int extra = n - 1;
+        for (int i = 0; i < n - 1; i++) {
+            if (rand() % 3 == 0) {
+                frags[extra++] = frags[i];
+            }
+        }
+        shuffle(frags, extra);
+        frags[extra] = frags[0];
+        frags[extra].offset += 8;
+        frags[extra].more = true;
+        frags[++extra] = last;
+        extra++;
+        delivered = 0;
+        for (int i = 0; i < extra; i++) {
+            input_fragment(0x0a000002, id, IP_PROTO_UDP, len, &frags[i]);
+        }
+        expect(delivered == 1 && !corrupted, "a datagram with duplicates was not reassembled once");
+        id++;
+    }
+
+    /* Interleaved datagrams, and one with the same addresses and ID but
+       another protocol, which is never completed */
+    static struct fragment all[CONCURRENT * MAX_FRAGS];
+    static u16_t all_id[CONCURRENT * MAX_FRAGS];
+    u16_t len = 6000;
+    pcb->recv_arg = (void *)(uintptr_t)len;
+    int total = 0;
+    for (int d = 0; d < CONCURRENT; d++) {
+        n = cut(len, &all[total]);
+        for (int i = 0; i < n; i++) {
+            all_id[total + i] = id + d;
+        }
+        total += n;
+    }
+    n = cut(len, frags);
+    input_fragment(0x0a000002, id, IP_PROTO_UDP + 1, len, &frags[n - 1]);
+    for (int i = total - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        struct fragment t = all[i];
+        u16_t t_id = all_id[i];
+        all[i] = all[j];
+        all_id[i] = all_id[j];
+        all[j] = t;
+        all_id[j] = t_id;
+    }
+    delivered = 0;
+    for (int i = 0; i < total; i++) {
+        input_fragment(0x0a000002, all_id[i], IP_PROTO_UDP, len, &all[i]);
+    }
+    expect(delivered == CONCURRENT && !corrupted, "interleaved datagrams were not reassembled");
+    id += CONCURRENT;
+
+    /* A flood of first fragments from many sources holds no receive
+       buffers and a bounded number of pool pbufs */
+    n = cut(len, frags);
+    for (int i = 0; i < FLOOD; i++) {
+        input_fragment(0x0b000000 + i, id, IP_PROTO_UDP, len, &frags[0]);
+    }
+    expect(rx_outstanding == 0, "the flood held receive buffers");
+    expect(pool_free - pool_pbufs_free() <= IP_REASS_MAX_PBUFS, "the flood held too many pool pbufs");
+
+    /* and does not stop a new datagram from being reassembled */
+    delivered = 0;
+    for (int i = 0; i < n; i++) {
+        input_fragment(0x0a000003, id, IP_PROTO_UDP, len, &frags[i]);
+    }
+    expect(delivered == 1 && !corrupted, "a datagram was not reassembled after the flood");
+    id++;
+
+    /* The incomplete datagrams time out */
+    for (int t = 0; t <= IP_REASS_MAXAGE; t++) {
+        ip_reass_tmr();
+    }
+    expect(pool_pbufs_free() == pool_free, "incomplete datagrams did not time out");
+}
+
+/* Reassemble datagrams with `concurrent` of them interleaved at a time */
+static void bench(int concurrent)
+{
+    static u8_t frames[CONCURRENT][MAX_FRAGS][IP_HLEN + FRAG_DATA];
+    static u16_t frame_len[CONCURRENT][MAX_FRAGS];
+    struct fragment frags[MAX_FRAGS];
+    u16_t len = 6000;
+    int n = cut(len, frags);
+    for (int d = 0; d < concurrent; d++) {
+        for (int i = 0; i < n; i++) {
+            frame_len[d][i] = build_fragment(frames[d][i], 0x0c000000 + d, d, IP_PROTO_UDP, len, &frags[i]);
+        }
+    }
+
+    int datagrams = (BENCH_DATAGRAMS + concurrent - 1) / concurrent * concurrent;
+    delivered = 0;
+    checking = false;
+    uint64_t start = now_ns();
+    for (int done = 0; done < datagrams; done += concurrent) {
+        for (int i = 0; i < n; i++) {
+            for (int d = 0; d < concurrent; d++) {
+                input_frame(frames[d][i], frame_len[d][i]);
+            }
+        }
+    }
+    uint64_t ns = now_ns() - start;
+    checking = true;
+    expect(delivered == (unsigned int)datagrams && !corrupted, "bench datagrams were not reassembled");
+    printf("%12d %14.1f\n", concurrent, (double)ns / (datagrams * n));
+}
+
+int main(void)
+{
+    IP4_ADDR(&local_ip, 10, 0, 0, 1);
+    /* The netif only outputs ICMP time exceeded for datagrams that timed out */
+    harness_init(&netif, &local_ip, 8, harness_netif_init, ip_input);
+
+    for (int i = 0; i < RX_BUFFERS; i++) {
+        rx_buffers[i].custom.custom_free_function = rx_free;
+    }
+
+    struct udp_pcb *pcb = udp_new();
+    udp_bind(pcb, IP_ADDR_ANY, PORT);
+    udp_recv(pcb, test_recv, NULL);
+
+    srand(1);
+    test(pcb);
+    if (failures) {
+        return 1;
+    }
+
+    pcb->recv_arg = (void *)(uintptr_t)6000;
+    printf("%12s %14s\n", "datagrams", "ns/fragment");
+    int counts[] = { 1, 16, CONCURRENT };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        bench(counts[i]);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Checks the shared ring buffers (shared_ringbuffer.h) with a producer and
+ * a consumer on two threads, as a driver and a client on two cores, and
+ * times them. Built by `make ring_test` in this directory.
+ *
+ * The producer takes buffers from the free ring, stamps each with a
+ * sequence number and passes it on the used ring. The consumer checks the
+ * stamps and returns the buffers on the free ring. Every buffer must arrive
+ * once, in order, and only while it is on the ring it comes from.
+ *
+ * A side that finds its ring empty sleeps on a notification, with the
+ * request_signal()/require_signal() handshake eth.c uses, and the other
+ * side notifies it after a batch of enqueues when it asked. A side that
+ * sleeps for a second while its ring holds buffers has missed a wakeup.
+ * The producer sends in rounds and waits for every buffer to come back
+ * between them, since a missed wakeup only stalls the rings once the
+ * other side goes idle. Each side pauses for random lengths of time, so that the handshake is
+ * run from both ends at every point.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared_ringbuffer.h"
+
+#include "harness.h"
+
+#define BUFFERS 256
+#define MAX_BATCH 16
+#define MESSAGES 1000000
+#define WAKEUP_TIMEOUT_S 1
+
+/* Where a buffer is */
+enum {
+    ON_FREE,
+    PRODUCER,
+    ON_USED,
+    CONSUMER,
+};
+
+/* One side of the rings, and the notification it sleeps on */
+struct side {
+    ring_handle_t ring;
+    /* The ring this side reads from */
+    ring_buffer_t *in;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool notified;
+    /* Spin for up to this many iterations after each buffer, 0 for none */
+    unsigned int pause;
+    unsigned int seed;
+    uint64_t sleeps;
+};
+
+static ring_buffer_t free_ring, used_ring;
+static struct side producer, consumer;
+static int owner[BUFFERS];
+static const char *failure;
+
+static void fail(const char *what)
+{
+    if (__atomic_exchange_n(&failure, what, __ATOMIC_SEQ_CST) != NULL) {
+        return;
+    }
+    /* Wake both sides, so they see the failure */
+    struct side *sides[] = { &producer, &consumer };
+    for (int i = 0; i < 2; i++) {
+        pthread_mutex_lock(&sides[i]->lock);
+        sides[i]->notified = true;
+        pthread_cond_signal(&sides[i]->cond);
+        pthread_mutex_unlock(&sides[i]->lock);
+    }
+}
+
+static bool failed(void)
+{
+    return __atomic_load_n(&failure, __ATOMIC_SEQ_CST) != NULL;
+}
+
+/* Move a buffer on, failing if it is not where it should be */
+static bool move(uintptr_t addr, int from, int to)
+{
+    if (addr >= BUFFERS) {
+        fail("a buffer that was never enqueued came off a ring");
+        return false;
+    }
+    if (!__atomic_compare_exchange_n(&owner[addr], &from, to, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        fail("a buffer was taken off a ring it was not on");
+        return false;
+    }
+    return true;
+}
+
+/* Set a side's notification, as sel4cp_notify() would */
+static void notify_side(struct side *side)
+{
+    pthread_mutex_lock(&side->lock);
+    side->notified = true;
+    pthread_cond_signal(&side->cond);
+    pthread_mutex_unlock(&side->lock);
+}
+
+static void notify_producer(void)
+{
+    notify_side(&producer);
+}
+
+static void notify_consumer(void)
+{
+    notify_side(&consumer);
+}
+
+/* After a batch of enqueues, notify the peer if it asked */
+static void signal_peer(struct side *side, ring_buffer_t *out)
+{
+    if (require_signal(out)) {
+        cancel_signal(out);
+        notify(&side->ring);
+    }
+}
+
+static void pause_side(struct side *side)
+{
+    if (!side->pause) {
+        return;
+    }
+    unsigned int spins = rand_r(&side->seed) % side->pause;
+    for (volatile unsigned int i = 0; i < spins; i++) {
+    }
+    if (rand_r(&side->seed) % 64 == 0) {
+        sched_yield();
+    }
+}
+
+/**
+ * Wait for the side's ring to hold want buffers, as a PD would between
+ * notifications.
+ */
+static void wait_for_work(struct side *side, int want)
+{
+    pause_side(side);
+    request_signal(side->in);
+    pause_side(side);
+    if (ring_size(side->in) >= want) {
+        cancel_signal(side->in);
+        return;
+    }
+
+    side->sleeps++;
+    pthread_mutex_lock(&side->lock);
+    while (!side->notified) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += WAKEUP_TIMEOUT_S;
+        if (pthread_cond_timedwait(&side->cond, &side->lock, &ts) == ETIMEDOUT &&
+            !side->notified && ring_size(side->in) >= want) {
+            pthread_mutex_unlock(&side->lock);
+            fail(side == &producer ? "the producer missed a wakeup" : "the consumer missed a wakeup");
+            return;
+        }
+    }
+    side->notified = false;
+    pthread_mutex_unlock(&side->lock);
+}
+
+static void *produce(void *arg)
+{
+    struct side *side = &producer;
+    uint64_t seq = 0;
+    uint64_t round_end = 0;
+
+    while (seq < MESSAGES && !failed()) {
+        if (seq == round_end) {
+            /* Go idle until every buffer is back, so that a wakeup missed
+               by either side leaves both asleep */
+            while (ring_size(&free_ring) < BUFFERS && !failed()) {
+                wait_for_work(side, BUFFERS);
+            }
+            round_end = seq + 1 + rand_r(&side->seed) % (BUFFERS * 4);
+        }
+        unsigned int batch = 1 + rand_r(&side->seed) % MAX_BATCH;
+        unsigned int sent = 0;
+        while (sent < batch && seq < round_end && seq < MESSAGES) {
+            uintptr_t addr;
+            unsigned int len;
+            void *cookie;
+            if (dequeue_free(&side->ring, &addr, &len, &cookie)) {
+                break;
+            }
+            if (!move(addr, ON_FREE, PRODUCER)) {
+                return NULL;
+            }
+            pause_side(side);
+            move(addr, PRODUCER, ON_USED);
+            enqueue_used(&side->ring, addr, (unsigned int)seq, (void *)(uintptr_t)seq);
+            seq++;
+            sent++;
+        }
+        if (sent) {
+            signal_peer(side, &used_ring);
+        } else if (seq < round_end) {
+            wait_for_work(side, 1);
+        }
+    }
+    return NULL;
+}
+
+static void *consume(void *arg)
+{
+    struct side *side = &consumer;
+    uint64_t seq = 0;
+
+    while (seq < MESSAGES && !failed()) {
+        unsigned int batch = 1 + rand_r(&side->seed) % MAX_BATCH;
+        unsigned int received = 0;
+        while (received < batch) {
+            uintptr_t addr;
+            unsigned int len;
+            void *cookie;
+            if (dequeue_used(&side->ring, &addr, &len, &cookie)) {
+                break;
+            }
+            if (!move(addr, ON_USED, CONSUMER)) {
+                return NULL;
+            }
+            if ((uintptr_t)cookie != seq || len != (unsigned int)seq) {
+                fail((uintptr_t)cookie < seq ? "a buffer arrived twice" : "a buffer was lost");
+                return NULL;
+            }
+            pause_side(side);
+            move(addr, CONSUMER, ON_FREE);
+            enqueue_free(&side->ring, addr, 0, NULL);
+            seq++;
+            received++;
+        }
+        if (received) {
+            signal_peer(side, &free_ring);
+        } else if (seq < MESSAGES) {
+            wait_for_work(side, 1);
+        }
+    }
+    return NULL;
+}
+
+static void init_side(struct side *side, ring_buffer_t *in, notify_fn notify_peer, unsigned int pause,
+                      unsigned int seed)
+{
+    side->in = in;
+    pthread_mutex_init(&side->lock, NULL);
+    pthread_cond_init(&side->cond, NULL);
+    side->notified = false;
+    side->pause = pause;
+    side->seed = seed;
+    side->sleeps = 0;
+    ring_init(&side->ring, &free_ring, &used_ring, notify_peer, 0);
+}
+
+/**
+ * Pass MESSAGES buffers from the producer to the consumer.
+ * @return NULL if every buffer arrived as it should, or what went wrong.
+ */
+static const char *run(unsigned int producer_pause, unsigned int consumer_pause, double *ns)
+{
+    ring_handle_t init;
+    ring_init(&init, &free_ring, &used_ring, NULL, 1);
+    for (int i = 0; i < BUFFERS; i++) {
+        owner[i] = ON_FREE;
+        enqueue_free(&init, i, 0, NULL);
+    }
+    failure = NULL;
+    init_side(&producer, &free_ring, notify_consumer, producer_pause, 1);
+    init_side(&consumer, &used_ring, notify_producer, consumer_pause, 2);
+
+    uint64_t start = now_ns();
+    pthread_t threads[2];
+    pthread_create(&threads[0], NULL, produce, NULL);
+    pthread_create(&threads[1], NULL, consume, NULL);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    *ns = (double)(now_ns() - start) / MESSAGES;
+
+    if (failure != NULL) {
+        return failure;
+    }
+    if (!ring_empty(&used_ring) || ring_size(&free_ring) != BUFFERS) {
+        return "buffers were left off the free ring";
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        unsigned int producer_pause, consumer_pause;
+    } runs[] = {
+        { "none", 0, 0 },
+        { "producer", 500, 0 },
+        { "consumer", 0, 500 },
+        { "both", 500, 500 },
+    };
+
+    printf("%10s %10s %16s %16s\n", "pauses", "ns/buffer", "producer sleeps", "consumer sleeps");
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        double ns;
+        const char *error = run(runs[i].producer_pause, runs[i].consumer_pause, &ns);
+        if (error != NULL) {
+            printf("ring_test: with pauses in %s, %s\n", runs[i].name, error);
+            return 1;
+        }
+        printf("%10s %10.1f %16llu %16llu\n", runs[i].name, ns, (unsigned long long)producer.sleeps,
+               (unsigned long long)consumer.sleeps);
+    }
+
+    return 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Checks the SACK loss recovery of lwIP (LWIP_TCP_SACK_IN, tcp_in.c and
+ * tcp_out.c), then compares bulk transfers over a lossy link with and
+ * without it. Built by `make sack_test` in this directory.
+ *
+ * lwIP talks to itself: a sender on one netif connects to a receiver on
+ * another, and each netif's output goes through a simulated link with a
+ * rate, a delay and losses, to the other. The link cuts TCP_GSO segments
+ * into frames, as lwip.c does, when the sender's netif sets
+ * NETIF_FLAG_GSO. The check drops chosen data frames, and expects the
+ * transfer to arrive intact with exactly the dropped frames retransmitted
+ * and no retransmission timeout. The comparison drops frames at random,
+ * and reports the goodput and retransmissions of the sender with SACK
+ * and with SACK turned off on its pcb.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include "harness.h"
+#include "link.h"
+
+#if !LWIP_TCP_SACK_IN
+#error "LWIP_TCP_SACK_IN is not enabled in lwipopts.h"
+#endif
+
+#define PORT 5001
+#define LINK_MBPS 100
+#define LINK_DELAY_US 10000
+#define WRITE_CHUNK 16384
+#define CHECK_BYTES (2 * 1024 * 1024)
+#define BENCH_BYTES (8 * 1024 * 1024)
+#define TIME_LIMIT_US (600 * 1000000ULL)
+
+/* The data frames the check drops, counted in new data sent */
+static const unsigned int check_drops[] = { 40, 45, 47, 48, 300, 301, 700 };
+static const double loss_rates[] = { 0, 0.001, 0.005, 0.01, 0.02 };
+
+/* A sender on netif_a sends to a receiver on netif_b */
+static struct netif netif_a, netif_b;
+static ip4_addr_t ip_a, ip_b;
+static struct link data_link, ack_link;
+
+static struct flow {
+    struct tcp_pcb *sender;
+    u32_t total, written, received;
+    bool corrupted;
+    /* data frames, dropped at check_drops in a check or else at random */
+    bool check;
+    double loss;
+    unsigned int sent_new, dropped, drop_next;
+    u32_t snd_max;
+    bool snd_max_valid;
+    u32_t retransmitted, dropped_bytes;
+    unsigned int rtos;
+} flow;
+
+static u8_t pattern(u32_t offset)
+{
+    return (u8_t)(offset * 7 + (offset >> 9));
+}
+
+/**
+ * Decide whether to drop a frame from the sender, and count the data
+ * retransmitted.
+ */
+static bool data_frame_lost(const u8_t *frame)
+{
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)frame;
+    const struct tcp_hdr *tcphdr = (const struct tcp_hdr *)(frame + IPH_HL_BYTES(iphdr));
+    u16_t len = link_tcp_payload(frame);
+    u32_t seqno = lwip_ntohl(tcphdr->seqno);
+
+    if (len == 0) {
+        return false;
+    }
+    if (flow.snd_max_valid && TCP_SEQ_LT(seqno, flow.snd_max)) {
+        flow.retransmitted += len;
+        return false;
+    }
+    flow.snd_max = seqno + len;
+    flow.snd_max_valid = true;
+    flow.sent_new++;
+
+    bool lost;
+    if (flow.check) {
+        lost = flow.drop_next < sizeof(check_drops) / sizeof(check_drops[0]) &&
+               check_drops[flow.drop_next] == flow.sent_new;
+        flow.drop_next += lost;
+    } else {
+        lost = link_random() < flow.loss;
+    }
+    if (lost) {
+        flow.dropped++;
+        flow.dropped_bytes += len;
+    }
+    return lost;
+}
+
+static void send_more(struct tcp_pcb *pcb)
+{
+    static u8_t chunk[WRITE_CHUNK];
+
+    while (flow.written < flow.total) {
+        u32_t len = LWIP_MIN(LWIP_MIN(tcp_sndbuf(pcb), WRITE_CHUNK), flow.total - flow.written);
+        if (len == 0) {
+            break;
+        }
+        for (u32_t i = 0; i < len; i++) {
+            chunk[i] = pattern(flow.written + i);
+        }
+        if (tcp_write(pcb, chunk, len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+            break;
+        }
+        flow.written += len;
+    }
+    tcp_output(pcb);
+}
+
+static err_t sender_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+    send_more(pcb);
+    return ERR_OK;
+}
+
+static err_t sender_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    if (arg == NULL) {
+        /* compare against the sender without SACK */
+        tcp_clear_flags(pcb, TF_SACK);
+    }
+    send_more(pcb);
+    return ERR_OK;
+}
+
+static err_t receiver_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    if (p == NULL) {
+        return ERR_OK;
+    }
+    for (struct pbuf *q = p; q != NULL; q = q->next) {
+        const u8_t *data = q->payload;
+        for (u16_t i = 0; i < q->len; i++) {
+            if (data[i] != pattern(flow.received + i)) {
+                flow.corrupted = true;
+            }
+        }
+        flow.received += q->len;
+    }
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t receiver_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    tcp_recv(pcb, receiver_recv);
+    return ERR_OK;
+}
+
+/**
+ * Transfer bytes from the sender to the receiver, dropping the data frames
+ * of check_drops if check is set, or else each with probability loss.
+ * @return the simulated time the transfer took, in microseconds
+ */
+static uint64_t transfer(u32_t bytes, bool sack, bool gso, bool check, double loss)
+{
+    memset(&flow, 0, sizeof(flow));
+    flow.total = bytes;
+    flow.check = check;
+    flow.loss = loss;
+    data_link.count = ack_link.count = 0;
+    netif_b.flags = (u8_t)((netif_b.flags & ~NETIF_FLAG_GSO) | (gso ? NETIF_FLAG_GSO : 0));
+
+    struct tcp_pcb *pcb = tcp_new();
+    tcp_bind(pcb, &ip_a, 0);
+    tcp_arg(pcb, sack ? pcb : NULL);
+    tcp_sent(pcb, sender_sent);
+    flow.sender = pcb;
+    tcp_connect(pcb, &ip_b, PORT, sender_connected);
+
+    uint64_t start = now_us;
+    bool in_rto = false;
+    while (flow.received < flow.total && now_us - start < TIME_LIMIT_US) {
+        uint64_t next = LWIP_MIN(link_next_due(&data_link), link_next_due(&ack_link));
+        u32_t sleep = sys_timeouts_sleeptime();
+        if (sleep != SYS_TIMEOUTS_SLEEPTIME_INFINITE && (now_us / 1000 + sleep) * 1000 < next) {
+            next = (now_us / 1000 + sleep) * 1000;
+        }
+        if (next > now_us) {
+            now_us = next;
+        }
+        link_deliver(&data_link);
+        link_deliver(&ack_link);
+        sys_check_timeouts();
+
+        if ((pcb->flags & TF_RTO) && !in_rto) {
+            flow.rtos++;
+        }
+        in_rto = (pcb->flags & TF_RTO) != 0;
+    }
+
+    uint64_t elapsed = now_us - start;
+    tcp_abort(pcb);
+    /* The receiver's pcb is aborted by the RST */
+    now_us += 2 * LINK_DELAY_US;
+    while (ack_link.count > 0 || data_link.count > 0) {
+        link_deliver(&data_link);
+        link_deliver(&ack_link);
+        now_us += LINK_DELAY_US;
+    }
+    return elapsed;
+}
+
+/**
+ * @return NULL if the transfer recovered as expected, or what went wrong.
+ */
+static const char *check(bool gso)
+{
+    transfer(CHECK_BYTES, true, gso, true, 0);
+    if (flow.received != flow.total || flow.corrupted) {
+        return "the data did not arrive intact";
+    }
+    if (flow.dropped != sizeof(check_drops) / sizeof(check_drops[0])) {
+        return "the frames to drop were not sent";
+    }
+    if (flow.rtos != 0) {
+        return "the retransmission timer fired";
+    }
+    if (flow.retransmitted != flow.dropped_bytes) {
+        printf("sack_test: retransmitted %u bytes for %u dropped\n", (unsigned int)flow.retransmitted,
+               (unsigned int)flow.dropped_bytes);
+        return "SACKed data was retransmitted";
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    IP4_ADDR(&ip_a, 10, 0, 0, 1);
+    IP4_ADDR(&ip_b, 10, 0, 1, 1);
+    harness_init(&netif_a, &ip_a, 24, link_netif_init, ip_input);
+    harness_netif_add(&netif_b, &ip_b, 24, link_netif_init, ip_input);
+    /* Frames routed out of netif_b go to the receiver, and the other way */
+    data_link.mbps = ack_link.mbps = LINK_MBPS;
+    data_link.delay_us = ack_link.delay_us = LINK_DELAY_US;
+    data_link.lose = data_frame_lost;
+    link_connect(&data_link, &netif_b, &netif_b);
+    link_connect(&ack_link, &netif_a, &netif_a);
+
+    struct tcp_pcb *listener = tcp_new();
+    tcp_bind(listener, &ip_b, PORT);
+    listener = tcp_listen(listener);
+    tcp_accept(listener, receiver_accept);
+
+    for (int gso = 0; gso <= 1; gso++) {
+        const char *failure = check(gso);
+        if (failure != NULL) {
+            printf("sack_test: %s%s\n", gso ? "with TCP_GSO, " : "", failure);
+            return 1;
+        }
+    }
+
+    printf("%8s %14s %14s %14s %14s\n", "loss %", "Mbit/s", "rexmit %", "SACK Mbit/s", "SACK rexmit %");
+    for (size_t i = 0; i < sizeof(loss_rates) / sizeof(loss_rates[0]); i++) {
+        double mbps[2], rexmit[2];
+        for (int sack = 0; sack <= 1; sack++) {
+            link_seed(1);
+            uint64_t us = transfer(BENCH_BYTES, sack, true, false, loss_rates[i]);
+            if (flow.received != flow.total || flow.corrupted) {
+                printf("sack_test: a transfer with %.1f%% loss did not arrive intact\n", loss_rates[i] * 100);
+                return 1;
+            }
+            mbps[sack] = (double)flow.total * 8 / us;
+            rexmit[sack] = 100.0 * flow.retransmitted / flow.total;
+        }
+        printf("%8.1f %14.1f %14.2f %14.1f %14.2f\n", loss_rates[i] * 100, mbps[0], rexmit[0], mbps[1], rexmit[1]);
+    }
+
+    return 0;
+}
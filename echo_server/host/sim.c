@@ -0,0 +1,688 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Runs the lwIP PD (lwip.c, udp_echo_socket.c, utilization_socket.c and
+ * the ring library, unmodified) as a Linux process, so the stack can be
+ * profiled with the usual host tools.
+ *
+ * The PD's memory regions are mapped at the addresses eth.system gives
+ * them, and its notifications, protected procedure calls and timer are
+ * delivered by the main thread the way the seL4 Core Platform would. The
+ * driver and both multiplexers are replaced by a simulated NIC on a
+ * second thread, which sits on the PD's client rings and plays the part
+ * of a UDP echo load generator: it sends requests to the echo port,
+ * answers the stack's ARP requests, and measures the echoed replies.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "lwip/dhcp.h"
+#include "lwip/netif.h"
+#include "lwip/ip4_addr.h"
+
+#include <sel4cp.h>
+
+#include "bench.h"
+#include "echo.h"
+#include "mux.h"
+#include "shared_ringbuffer.h"
+#include "timer.h"
+
+/* Channels of the lwIP PD, as in lwip.c and utilization_socket.c */
+#define IRQ_CH 1
+#define RX_CH 2
+#define START_PMU 3
+#define INIT 4
+#define STOP_PMU 5
+#define TX_CH 6
+#define ROTATE_PMU 7
+#define SETUP_PMU 8
+
+/* Period of the timer interrupt, as in timer.c */
+#define LWIP_TICK_MS 10
+#define NS_IN_MS 1000000ULL
+#define NS_IN_S 1000000000ULL
+
+/* Replies not seen for this long are taken to be lost */
+#define LOSS_TIMEOUT_NS (100 * NS_IN_MS)
+
+#define ETH_HWADDR_LEN 6
+#define ETH_HDR_LEN 14
+#define ETHTYPE_IP 0x0800
+#define ETHTYPE_ARP 0x0806
+#define IP_HDR_LEN 20
+#define UDP_HDR_LEN 8
+#define IP_PROTO_UDP 17
+#define GEN_PORT 40000
+
+/* Memory regions of the PD, defined in lwip.c and utilization_socket.c */
+extern uintptr_t rx_free;
+extern uintptr_t rx_used;
+extern uintptr_t tx_free;
+extern uintptr_t tx_used;
+extern uintptr_t shared_dma_vaddr;
+extern uintptr_t trace_buffer;
+extern uintptr_t data_packet;
+extern uintptr_t cyclecounters_vaddr;
+extern uintptr_t bench_results_vaddr;
+
+static const struct {
+    uintptr_t *var;
+    uintptr_t vaddr;
+    size_t size;
+} regions[] = {
+    { &shared_dma_vaddr, 0x2400000, 0x200000 },
+    { &rx_free, 0x4000000, 0x200000 },
+    { &rx_used, 0x4200000, 0x200000 },
+    { &tx_free, 0x4400000, 0x200000 },
+    { &tx_used, 0x4600000, 0x200000 },
+    { &cyclecounters_vaddr, 0x5010000, 0x1000 },
+    { &data_packet, 0x5011000, 0x1000 },
+    { &bench_results_vaddr, 0x5012000, 0x1000 },
+    { &trace_buffer, 0x5100000, 0x21000 },
+};
+
+/* The seL4 Core Platform state the PD uses */
+char sel4cp_name[16] = "lwip0";
+bool have_signal = false;
+seL4_CPtr signal;
+seL4_MessageInfo_t signal_msg;
+static uint64_t mrs[64];
+
+/* Addresses of the stack and of the load generator */
+static const uint8_t stack_mac[ETH_HWADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t gen_mac[ETH_HWADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+#define STACK_IP "10.0.0.1"
+#define GEN_IP "10.0.0.2"
+
+static struct {
+    /* Request payload size, outstanding requests, requests per second
+     * (0 to keep the window full) and duration of the run */
+    unsigned int size;
+    unsigned int window;
+    uint64_t rate;
+    unsigned int seconds;
+} config = {
+    .size = 1024,
+    .window = 64,
+    .rate = 0,
+    .seconds = 5,
+};
+
+/* Notifications waiting for the PD and for the simulated NIC */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pd_cond;
+static pthread_cond_t nic_cond;
+static uint64_t pd_pending;
+static bool nic_pending;
+static bool finished;
+
+typedef struct gen_stats {
+    uint64_t sent;
+    uint64_t received;
+    uint64_t lost;
+    uint64_t bytes;
+    uint64_t rtt_min;
+    uint64_t rtt_max;
+    uint64_t rtt_total;
+    uint64_t arp_replies;
+} gen_stats_t;
+
+static struct {
+    ring_handle_t rx_ring;
+    ring_handle_t tx_ring;
+    /* RX buffers the NIC holds */
+    uintptr_t rx_buffers[NUM_BUFFERS];
+    unsigned int rx_count;
+    uint32_t stack_ip;
+    uint32_t gen_ip;
+    uint64_t next_seq;
+    uint64_t in_flight;
+    uint64_t last_reply;
+    uint64_t start;
+    gen_stats_t stats;
+} nic;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_IN_S + ts.tv_nsec;
+}
+
+static void deadline(struct timespec *ts, uint64_t ns)
+{
+    ts->tv_sec = ns / NS_IN_S;
+    ts->tv_nsec = ns % NS_IN_S;
+}
+
+void sel4cp_dbg_putc(int c)
+{
+    putchar(c);
+}
+
+void sel4cp_dbg_puts(const char *s)
+{
+    fputs(s, stdout);
+}
+
+void sel4cp_mr_set(uint8_t mr, uint64_t value)
+{
+    mrs[mr] = value;
+}
+
+uint64_t sel4cp_mr_get(uint8_t mr)
+{
+    return mrs[mr];
+}
+
+void sel4cp_notify(sel4cp_channel ch)
+{
+    switch (ch) {
+        case RX_CH:
+        case TX_CH:
+            pthread_mutex_lock(&lock);
+            nic_pending = true;
+            pthread_cond_signal(&nic_cond);
+            pthread_mutex_unlock(&lock);
+            break;
+        case START_PMU:
+        case ROTATE_PMU:
+            /* There is no PMU to program on the host */
+            break;
+        default:
+            fprintf(stderr, "sim: notification on unexpected channel %u\n", ch);
+            break;
+    }
+}
+
+sel4cp_msginfo sel4cp_ppcall(sel4cp_channel ch, sel4cp_msginfo msginfo)
+{
+    switch (ch) {
+        case INIT:
+            /* The RX multiplexer gives the client its MAC address and index */
+            mrs[0] = (stack_mac[0] << 24) | (stack_mac[1] << 16) | (stack_mac[2] << 8) | stack_mac[3];
+            mrs[1] = (stack_mac[4] << 24) | (stack_mac[5] << 16);
+            mrs[2] = 0;
+            return sel4cp_msginfo_new(0, 3);
+        case TX_CH:
+            /* The TX multiplexer gives the client its TX buffers */
+            mrs[0] = 0;
+            mrs[1] = TX_BUFFERS_PER_CLIENT;
+            return sel4cp_msginfo_new(0, 2);
+        case STOP_PMU:
+            /* No per-PD utilisation or PMU counts on the host */
+            memset((void *)bench_results_vaddr, 0, sizeof(struct bench_results));
+            return sel4cp_msginfo_new(0, 0);
+        case SETUP_PMU:
+            mrs[0] = 1;
+            return sel4cp_msginfo_new(0, 1);
+        default:
+            fprintf(stderr, "sim: ppcall on unexpected channel %u\n", ch);
+            return sel4cp_msginfo_new(0, 0);
+    }
+}
+
+/**
+ * Deliver a notification to the PD, followed by the notification it
+ * deferred to the end of its handler, if any.
+ */
+static void pd_notified(sel4cp_channel ch)
+{
+    notified(ch);
+    if (have_signal) {
+        have_signal = false;
+        sel4cp_notify(signal - BASE_OUTPUT_NOTIFICATION_CAP);
+    }
+}
+
+static void notify_pd(sel4cp_channel ch)
+{
+    pthread_mutex_lock(&lock);
+    pd_pending |= 1ULL << ch;
+    pthread_cond_signal(&pd_cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static uint16_t ip_chksum(const uint8_t *data, unsigned int len)
+{
+    uint32_t acc = 0;
+    for (unsigned int i = 0; i + 1 < len; i += 2) {
+        acc += (data[i] << 8) | data[i + 1];
+    }
+    while (acc >> 16) {
+        acc = (acc & 0xffff) + (acc >> 16);
+    }
+    return ~acc;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static void reclaim_rx_buffers(void)
+{
+    uintptr_t addr;
+    unsigned int len;
+    void *cookie;
+
+    while (!dequeue_free(&nic.rx_ring, &addr, &len, &cookie)) {
+        nic.rx_buffers[nic.rx_count++] = addr;
+    }
+}
+
+/**
+ * Take an RX buffer to receive a frame into.
+ *
+ * @return the buffer, 0 if the stack holds all of them.
+ */
+static uintptr_t alloc_rx_buffer(void)
+{
+    if (!nic.rx_count) {
+        reclaim_rx_buffers();
+    }
+    if (!nic.rx_count || ring_full(nic.rx_ring.used_ring)) {
+        /* Have the stack tell us when it returns buffers */
+        request_signal(nic.rx_ring.free_ring);
+        return 0;
+    }
+    cancel_signal(nic.rx_ring.free_ring);
+    return nic.rx_buffers[--nic.rx_count];
+}
+
+static void receive_frame(uintptr_t buffer, unsigned int len)
+{
+    enqueue_used(&nic.rx_ring, buffer, len, NULL);
+}
+
+static void fill_eth_hdr(uint8_t *frame, const uint8_t *dest, uint16_t type)
+{
+    memcpy(frame, dest, ETH_HWADDR_LEN);
+    memcpy(frame + ETH_HWADDR_LEN, gen_mac, ETH_HWADDR_LEN);
+    put16(frame + 2 * ETH_HWADDR_LEN, type);
+}
+
+/**
+ * Send an echo request to the stack.
+ *
+ * @return false if there is no RX buffer to send it in.
+ */
+static bool send_request(uint64_t now)
+{
+    uintptr_t buffer = alloc_rx_buffer();
+    if (!buffer) {
+        return false;
+    }
+
+    uint8_t *frame = (uint8_t *)buffer;
+    unsigned int udp_len = UDP_HDR_LEN + config.size;
+    unsigned int ip_len = IP_HDR_LEN + udp_len;
+
+    fill_eth_hdr(frame, stack_mac, ETHTYPE_IP);
+    uint8_t *ip = frame + ETH_HDR_LEN;
+    memset(ip, 0, IP_HDR_LEN);
+    ip[0] = 0x45;
+    put16(ip + 2, ip_len);
+    put16(ip + 4, nic.next_seq);
+    ip[8] = 64;
+    ip[9] = IP_PROTO_UDP;
+    put32(ip + 12, nic.gen_ip);
+    put32(ip + 16, nic.stack_ip);
+    put16(ip + 10, ip_chksum(ip, IP_HDR_LEN));
+
+    /* A zero UDP checksum is not checked */
+    uint8_t *udp = ip + IP_HDR_LEN;
+    put16(udp, GEN_PORT);
+    put16(udp + 2, UDP_ECHO_PORT);
+    put16(udp + 4, udp_len);
+    put16(udp + 6, 0);
+
+    uint8_t *payload = udp + UDP_HDR_LEN;
+    memset(payload, 0, config.size);
+    memcpy(payload, &nic.next_seq, sizeof(uint64_t));
+    memcpy(payload + sizeof(uint64_t), &now, sizeof(uint64_t));
+
+    receive_frame(buffer, ETH_HDR_LEN + ip_len);
+    nic.next_seq++;
+    nic.in_flight++;
+    nic.stats.sent++;
+    return true;
+}
+
+static bool answer_arp(const uint8_t *frame, unsigned int len)
+{
+    const uint8_t *arp = frame + ETH_HDR_LEN;
+    if (len < ETH_HDR_LEN + 28 || get16(arp + 6) != 1 || get32(arp + 24) != nic.gen_ip) {
+        return false;
+    }
+
+    uintptr_t buffer = alloc_rx_buffer();
+    if (!buffer) {
+        return false;
+    }
+
+    uint8_t *reply = (uint8_t *)buffer;
+    fill_eth_hdr(reply, frame + ETH_HWADDR_LEN, ETHTYPE_ARP);
+    uint8_t *hdr = reply + ETH_HDR_LEN;
+    memcpy(hdr, arp, 6);
+    put16(hdr + 6, 2);
+    memcpy(hdr + 8, gen_mac, ETH_HWADDR_LEN);
+    put32(hdr + 14, nic.gen_ip);
+    memcpy(hdr + 18, arp + 8, ETH_HWADDR_LEN + 4);
+
+    receive_frame(buffer, ETH_HDR_LEN + 28);
+    nic.stats.arp_replies++;
+    return true;
+}
+
+static void handle_reply(const uint8_t *frame, unsigned int len, uint64_t now)
+{
+    const uint8_t *ip = frame + ETH_HDR_LEN;
+    const uint8_t *udp = ip + IP_HDR_LEN;
+    if (len < ETH_HDR_LEN + IP_HDR_LEN + UDP_HDR_LEN + 2 * sizeof(uint64_t) ||
+        ip[9] != IP_PROTO_UDP || get16(udp) != UDP_ECHO_PORT) {
+        return;
+    }
+
+    uint64_t sent;
+    memcpy(&sent, udp + UDP_HDR_LEN + sizeof(uint64_t), sizeof(uint64_t));
+    uint64_t rtt = now - sent;
+
+    nic.stats.received++;
+    nic.stats.bytes += len;
+    nic.stats.rtt_total += rtt;
+    if (rtt < nic.stats.rtt_min) {
+        nic.stats.rtt_min = rtt;
+    }
+    if (rtt > nic.stats.rtt_max) {
+        nic.stats.rtt_max = rtt;
+    }
+    if (nic.in_flight) {
+        nic.in_flight--;
+    }
+    nic.last_reply = now;
+}
+
+/**
+ * "Transmit" the frames the stack has queued: gather each frame, act on
+ * it and hand its buffer back, as the TX multiplexer and driver would.
+ */
+static void process_tx(uint64_t now)
+{
+    bool notify = false;
+    unsigned int num;
+
+    while ((num = ring_chain_length(nic.tx_ring.used_ring))) {
+        uint8_t frame[BUF_SIZE];
+        unsigned int len = 0;
+        uintptr_t first_addr = 0;
+        unsigned int first_len = 0;
+        void *first_cookie = NULL;
+
+        for (unsigned int i = 0; i < num; i++) {
+            uintptr_t addr = 0;
+            unsigned int seg_len = 0;
+            void *cookie = NULL;
+            dequeue_used(&nic.tx_ring, &addr, &seg_len, &cookie);
+            if (i == 0) {
+                first_addr = addr;
+                first_len = seg_len;
+                first_cookie = cookie;
+            }
+            if (len + seg_len <= sizeof(frame)) {
+                memcpy(frame + len, (void *)addr, seg_len);
+                len += seg_len;
+            }
+        }
+
+        if (len >= ETH_HDR_LEN) {
+            uint16_t type = get16(frame + 2 * ETH_HWADDR_LEN);
+            if (type == ETHTYPE_ARP) {
+                answer_arp(frame, len);
+            } else if (type == ETHTYPE_IP) {
+                handle_reply(frame, len, now);
+            }
+        }
+
+        enqueue_free(&nic.tx_ring, first_addr, first_len, first_cookie);
+        /* The stack holds the rest of a scatter-gather frame until it is sent */
+        notify |= num > 1;
+    }
+
+    if (notify || require_signal(nic.tx_ring.free_ring)) {
+        cancel_signal(nic.tx_ring.free_ring);
+        notify_pd(TX_CH);
+    }
+}
+
+/**
+ * Send the requests that are due, keeping at most a window of them
+ * outstanding.
+ */
+static void generate(uint64_t now)
+{
+    uint64_t elapsed = now - nic.start;
+    uint64_t due = config.rate ? elapsed * config.rate / NS_IN_S : UINT64_MAX;
+
+    if (nic.in_flight && now - nic.last_reply > LOSS_TIMEOUT_NS) {
+        nic.stats.lost += nic.in_flight;
+        nic.in_flight = 0;
+        nic.last_reply = now;
+    }
+
+    while (nic.next_seq < due && nic.in_flight < config.window) {
+        if (!send_request(now)) {
+            break;
+        }
+    }
+}
+
+static void report(uint64_t elapsed)
+{
+    gen_stats_t *stats = &nic.stats;
+    double seconds = (double)elapsed / NS_IN_S;
+
+    printf("sim: size=%u window=%u rate=%lu seconds=%.2f\n", config.size, config.window,
+           (unsigned long)config.rate, seconds);
+    printf("sim: sent=%lu received=%lu lost=%lu outstanding=%lu arp_replies=%lu\n",
+           (unsigned long)stats->sent, (unsigned long)stats->received, (unsigned long)stats->lost,
+           (unsigned long)nic.in_flight, (unsigned long)stats->arp_replies);
+    printf("sim: throughput %.0f replies/s, %.2f Mbit/s\n", stats->received / seconds,
+           stats->bytes * 8 / seconds / 1e6);
+    if (stats->received) {
+        printf("sim: round trip ns min=%lu avg=%lu max=%lu\n", (unsigned long)stats->rtt_min,
+               (unsigned long)(stats->rtt_total / stats->received), (unsigned long)stats->rtt_max);
+    }
+}
+
+/**
+ * The simulated NIC and load generator.
+ */
+static void *nic_thread(void *arg)
+{
+    /* Let the stack come up and resolve our address first */
+    nic.start = now_ns() + 100 * NS_IN_MS;
+    nic.last_reply = nic.start;
+    nic.stats.rtt_min = UINT64_MAX;
+    uint64_t end = nic.start + config.seconds * NS_IN_S;
+
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= end) {
+            break;
+        }
+
+        size_t rx_before = ring_size(nic.rx_ring.used_ring);
+        process_tx(now);
+        if (now >= nic.start) {
+            generate(now);
+        }
+        if (ring_size(nic.rx_ring.used_ring) != rx_before) {
+            notify_pd(RX_CH);
+        }
+
+        /* Wait for the stack, or for the next request to be due */
+        struct timespec ts;
+        deadline(&ts, now + (config.rate ? NS_IN_S / config.rate : NS_IN_MS));
+        pthread_mutex_lock(&lock);
+        while (!nic_pending && pthread_cond_timedwait(&nic_cond, &lock, &ts) == 0) {
+        }
+        nic_pending = false;
+        pthread_mutex_unlock(&lock);
+    }
+
+    report(end - nic.start);
+
+    pthread_mutex_lock(&lock);
+    finished = true;
+    pthread_cond_signal(&pd_cond);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static void map_regions(void)
+{
+    for (size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+        void *addr = mmap((void *)regions[i].vaddr, regions[i].size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (addr != (void *)regions[i].vaddr) {
+            fprintf(stderr, "sim: cannot map memory region at %#lx\n", (unsigned long)regions[i].vaddr);
+            exit(1);
+        }
+        *regions[i].var = regions[i].vaddr;
+    }
+}
+
+/**
+ * Give the stack the generator's network instead of waiting on DHCP.
+ */
+static void configure_stack(void)
+{
+    struct netif *netif = netif_default;
+    ip4_addr_t ipaddr, netmask, gw;
+
+    dhcp_stop(netif);
+    ip4addr_aton(STACK_IP, &ipaddr);
+    ip4addr_aton("255.255.255.0", &netmask);
+    ip4addr_aton("0.0.0.0", &gw);
+    netif_set_addr(netif, &ipaddr, &netmask, &gw);
+
+    nic.stack_ip = lwip_ntohl(ip4_addr_get_u32(&ipaddr));
+    ip4addr_aton(GEN_IP, &ipaddr);
+    nic.gen_ip = lwip_ntohl(ip4_addr_get_u32(&ipaddr));
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s payload bytes] [-w window] [-r requests/s] [-d seconds]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:w:r:d:")) != -1) {
+        switch (opt) {
+            case 's':
+                config.size = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                config.window = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                config.rate = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                config.seconds = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (config.size < 2 * sizeof(uint64_t) ||
+        config.size > 1500 - IP_HDR_LEN - UDP_HDR_LEN || !config.window) {
+        usage(argv[0]);
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pd_cond, &attr);
+    pthread_cond_init(&nic_cond, &attr);
+
+    map_regions();
+
+    /* The multiplexers initialise the client rings and own the RX buffers */
+    ring_init(&nic.rx_ring, (ring_buffer_t *)rx_free, (ring_buffer_t *)rx_used, NULL, 1);
+    ring_init(&nic.tx_ring, (ring_buffer_t *)tx_free, (ring_buffer_t *)tx_used, NULL, 1);
+    for (int i = 0; i < NUM_BUFFERS - 1; i++) {
+        nic.rx_buffers[nic.rx_count++] = shared_dma_vaddr + BUF_SIZE * i;
+    }
+
+    init();
+    pd_notified(INIT);
+    configure_stack();
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, nic_thread, NULL);
+
+    uint64_t next_tick = now_ns() + LWIP_TICK_MS * NS_IN_MS;
+    for (;;) {
+        struct timespec ts;
+        deadline(&ts, next_tick);
+
+        pthread_mutex_lock(&lock);
+        while (!pd_pending && !finished && pthread_cond_timedwait(&pd_cond, &lock, &ts) == 0) {
+        }
+        uint64_t pending = pd_pending;
+        bool done = finished;
+        pd_pending = 0;
+        pthread_mutex_unlock(&lock);
+
+        if (done) {
+            break;
+        }
+        if (now_ns() >= next_tick) {
+            pd_notified(IRQ_CH);
+            next_tick += LWIP_TICK_MS * NS_IN_MS;
+        }
+        for (sel4cp_channel ch = 0; pending; ch++, pending >>= 1) {
+            if (pending & 1) {
+                pd_notified(ch);
+            }
+        }
+    }
+
+    pthread_join(thread, NULL);
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Measures how the cost of demultiplexing a TCP segment grows with the
+ * number of connections. Built by `make tcp_demux_bench` in this
+ * directory.
+ *
+ * For each connection count, established pcbs are registered with the
+ * stack, and pure ACKs for randomly chosen connections are passed to
+ * ip4_input() through a dummy netif. The benchmark reports the time per
+ * segment through the whole input path, and the time of the pcb lookup
+ * alone, both through the TCP_PCB_HASH tables and by walking
+ * tcp_active_pcbs as tcp_input() did without them.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include "harness.h"
+
+#if !TCP_PCB_HASH
+#error "TCP_PCB_HASH is not enabled in lwipopts.h"
+#endif
+
+#define LOCAL_PORT 5001
+#define SEQNO 1000
+#define ACKNO 2000
+#define SEGMENTS 4096
+#define ROUNDS 200
+
+static const int connection_counts[] = { 10, 1000, 10000 };
+
+static struct netif netif;
+static ip4_addr_t local_ip;
+
+static struct {
+    u8_t hdr[IP_HLEN + TCP_HLEN];
+    struct tcp_pcb *pcb;
+} segments[SEGMENTS];
+
+static void remote_addr(int i, ip_addr_t *addr)
+{
+    IP4_ADDR(ip_2_ip4(addr), 10, 128 + (i >> 16), (i >> 8) & 0xff, i & 0xff);
+}
+
+static u16_t remote_port(int i)
+{
+    return 1024 + i % 50000;
+}
+
+/**
+ * Register established connections from distinct remote addresses.
+ */
+static struct tcp_pcb *open_connections(int count)
+{
+    struct tcp_pcb *template = tcp_new();
+    struct tcp_pcb *pcbs = calloc(count, sizeof(struct tcp_pcb));
+
+    for (int i = 0; i < count; i++) {
+        struct tcp_pcb *pcb = &pcbs[i];
+        /* The pcb pool is far smaller than this, so copy a fresh pcb */
+        memcpy(pcb, template, sizeof(*pcb));
+        ip_addr_copy_from_ip4(pcb->local_ip, local_ip);
+        remote_addr(i, &pcb->remote_ip);
+        pcb->local_port = LOCAL_PORT;
+        pcb->remote_port = remote_port(i);
+        pcb->state = ESTABLISHED;
+        pcb->rcv_nxt = SEQNO;
+        pcb->rcv_ann_right_edge = SEQNO + pcb->rcv_wnd;
+        pcb->snd_nxt = pcb->lastack = pcb->snd_lbb = ACKNO;
+        pcb->snd_wl1 = SEQNO;
+        pcb->snd_wl2 = ACKNO;
+        TCP_REG_ACTIVE(pcb);
+    }
+
+    tcp_abort(template);
+    return pcbs;
+}
+
+static void close_connections(struct tcp_pcb *pcbs, int count)
+{
+    for (int i = 0; i < count; i++) {
+        TCP_RMV_ACTIVE(&pcbs[i]);
+    }
+    free(pcbs);
+}
+
+/**
+ * Build a pure ACK, which the connection accepts without replying.
+ */
+static void build_segments(struct tcp_pcb *pcbs, int count)
+{
+    for (int i = 0; i < SEGMENTS; i++) {
+        struct tcp_pcb *pcb = &pcbs[rand() % count];
+        struct ip_hdr *iphdr = (struct ip_hdr *)segments[i].hdr;
+        struct tcp_hdr *tcphdr = (struct tcp_hdr *)(iphdr + 1);
+
+        memset(segments[i].hdr, 0, sizeof(segments[i].hdr));
+        IPH_VHL_SET(iphdr, 4, IP_HLEN / 4);
+        IPH_LEN_SET(iphdr, lwip_htons(IP_HLEN + TCP_HLEN));
+        IPH_TTL_SET(iphdr, 64);
+        IPH_PROTO_SET(iphdr, IP_PROTO_TCP);
+        ip4_addr_copy(iphdr->src, *ip_2_ip4(&pcb->remote_ip));
+        ip4_addr_copy(iphdr->dest, local_ip);
+
+        tcphdr->src = lwip_htons(pcb->remote_port);
+        tcphdr->dest = lwip_htons(LOCAL_PORT);
+        tcphdr->seqno = lwip_htonl(SEQNO);
+        tcphdr->ackno = lwip_htonl(ACKNO);
+        TCPH_HDRLEN_FLAGS_SET(tcphdr, TCP_HLEN / 4, TCP_ACK);
+        tcphdr->wnd = lwip_htons(0xffff);
+
+        segments[i].pcb = pcb;
+    }
+}
+
+static double time_input(void)
+{
+    uint64_t start = now_ns();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < SEGMENTS; i++) {
+            struct pbuf *p = pbuf_alloc(PBUF_RAW, sizeof(segments[i].hdr), PBUF_POOL);
+            memcpy(p->payload, segments[i].hdr, sizeof(segments[i].hdr));
+            netif.input(p, &netif);
+        }
+    }
+    return (double)(now_ns() - start) / (ROUNDS * SEGMENTS);
+}
+
+static struct tcp_pcb *list_lookup(u16_t local_port, u16_t remote_port,
+                                   const ip_addr_t *local_ip, const ip_addr_t *remote_ip)
+{
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+        if (pcb->remote_port == remote_port && pcb->local_port == local_port &&
+            ip_addr_cmp(&pcb->remote_ip, remote_ip) && ip_addr_cmp(&pcb->local_ip, local_ip)) {
+            return pcb;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Time the lookup of every segment's pcb, by hashing or by walking the
+ * list.
+ *
+ * @return the time per lookup in ns, or a negative value if a lookup
+ *         found the wrong pcb.
+ */
+static double time_lookup(bool hashed)
+{
+    ip_addr_t local;
+    ip_addr_copy_from_ip4(local, local_ip);
+    int rounds = hashed ? ROUNDS : 1;
+
+    uint64_t start = now_ns();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < SEGMENTS; i++) {
+            struct tcp_pcb *expected = segments[i].pcb;
+            struct tcp_pcb *pcb;
+            if (hashed) {
+                pcb = tcp_pcb_hash_lookup(LOCAL_PORT, expected->remote_port, &local,
+                                          &expected->remote_ip, NETIF_NO_INDEX);
+            } else {
+                pcb = list_lookup(LOCAL_PORT, expected->remote_port, &local, &expected->remote_ip);
+            }
+            if (pcb != expected) {
+                return -1;
+            }
+        }
+    }
+    return (double)(now_ns() - start) / (rounds * SEGMENTS);
+}
+
+int main(void)
+{
+    IP4_ADDR(&local_ip, 10, 0, 0, 1);
+    harness_init(&netif, &local_ip, 8, harness_netif_init, ip_input);
+
+    printf("%12s %14s %14s %14s\n", "connections", "input ns/seg", "hash ns", "list ns");
+    for (size_t c = 0; c < sizeof(connection_counts) / sizeof(connection_counts[0]); c++) {
+        int count = connection_counts[c];
+        struct tcp_pcb *pcbs = open_connections(count);
+        build_segments(pcbs, count);
+
+        double hash_ns = time_lookup(true);
+        double list_ns = time_lookup(false);
+        if (hash_ns < 0 || list_ns < 0) {
+            printf("tcp_demux_bench: lookup found the wrong pcb with %d connections\n", count);
+            return 1;
+        }
+
+        double input_ns = time_input();
+        /* Anything sent means a segment did not find its connection */
+        if (harness_transmitted) {
+            printf("tcp_demux_bench: %u segments were not delivered to their connection\n", harness_transmitted);
+            return 1;
+        }
+
+        printf("%12d %14.1f %14.1f %14.1f\n", count, input_ns, hash_ns, list_ns);
+        close_connections(pcbs, count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Checks the TCP_TIMER_LISTS timers of lwIP (tcp.c), and measures how the
+ * cost of a TCP timer tick grows with the number of idle connections.
+ * Built by `make tcp_timer_bench` in this directory.
+ *
+ * For each connection count, established pcbs are registered with the
+ * stack. The check runs the timers off a simulated clock and expects the
+ * idle pcbs to leave tcp_timer_pcbs, a delayed ACK to go out
+ * TCP_ACK_DELAY_MS after the segment it acknowledges, and unacknowledged
+ * data to be retransmitted. The benchmark reports the time of tcp_tmr(),
+ * and of walking tcp_active_pcbs as tcp_fasttmr() and tcp_slowtmr() did
+ * without the timer lists.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include "harness.h"
+
+#if !TCP_TIMER_LISTS
+#error "TCP_TIMER_LISTS is not enabled in lwipopts.h"
+#endif
+
+#define LOCAL_PORT 5001
+#define SEQNO 1000
+#define ACKNO 2000
+#define TICKS 2000
+
+static const int connection_counts[] = { 10, 1000, 10000 };
+
+static struct netif netif;
+static ip4_addr_t local_ip;
+static u32_t now;
+
+u32_t sys_now(void)
+{
+    return now;
+}
+
+static err_t bench_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    if (p != NULL) {
+        tcp_recved(pcb, p->tot_len);
+        pbuf_free(p);
+    }
+    return ERR_OK;
+}
+
+/**
+ * Register established connections from distinct remote addresses.
+ */
+static struct tcp_pcb *open_connections(int count)
+{
+    struct tcp_pcb *template = tcp_new();
+    struct tcp_pcb *pcbs = calloc(count, sizeof(struct tcp_pcb));
+
+    for (int i = 0; i < count; i++) {
+        struct tcp_pcb *pcb = &pcbs[i];
+        /* The pcb pool is far smaller than this, so copy a fresh pcb */
+        memcpy(pcb, template, sizeof(*pcb));
+        ip_addr_copy_from_ip4(pcb->local_ip, local_ip);
+        IP4_ADDR(ip_2_ip4(&pcb->remote_ip), 10, 128 + (i >> 16), (i >> 8) & 0xff, i & 0xff);
+        pcb->local_port = LOCAL_PORT;
+        pcb->remote_port = 1024 + i % 50000;
+        pcb->state = ESTABLISHED;
+        pcb->rcv_nxt = SEQNO;
+        pcb->rcv_ann_right_edge = SEQNO + pcb->rcv_wnd;
+        pcb->snd_nxt = pcb->lastack = pcb->snd_lbb = ACKNO;
+        pcb->snd_wl1 = SEQNO;
+        pcb->snd_wl2 = ACKNO;
+        pcb->snd_wnd = pcb->snd_wnd_max = 0xffff;
+        pcb->cwnd = 10 * pcb->mss;
+        tcp_recv(pcb, bench_recv);
+        TCP_REG_ACTIVE(pcb);
+    }
+
+    tcp_abort(template);
+    return pcbs;
+}
+
+static void close_connections(struct tcp_pcb *pcbs, int count)
+{
+    for (int i = 0; i < count; i++) {
+        TCP_RMV_ACTIVE(&pcbs[i]);
+    }
+    free(pcbs);
+}
+
+/**
+ * Pass a segment from pcb's peer to ip4_input(), with len bytes of data.
+ */
+static void input_segment(struct tcp_pcb *pcb, u32_t seqno, u32_t ackno, u16_t len)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, IP_HLEN + TCP_HLEN + len, PBUF_POOL);
+    struct ip_hdr *iphdr = (struct ip_hdr *)p->payload;
+    struct tcp_hdr *tcphdr = (struct tcp_hdr *)(iphdr + 1);
+
+    memset(p->payload, 0, IP_HLEN + TCP_HLEN + len);
+    IPH_VHL_SET(iphdr, 4, IP_HLEN / 4);
+    IPH_LEN_SET(iphdr, lwip_htons(IP_HLEN + TCP_HLEN + len));
+    IPH_TTL_SET(iphdr, 64);
+    IPH_PROTO_SET(iphdr, IP_PROTO_TCP);
+    ip4_addr_copy(iphdr->src, *ip_2_ip4(&pcb->remote_ip));
+    ip4_addr_copy(iphdr->dest, local_ip);
+
+    tcphdr->src = lwip_htons(pcb->remote_port);
+    tcphdr->dest = lwip_htons(LOCAL_PORT);
+    tcphdr->seqno = lwip_htonl(seqno);
+    tcphdr->ackno = lwip_htonl(ackno);
+    TCPH_HDRLEN_FLAGS_SET(tcphdr, TCP_HLEN / 4, TCP_ACK | (len ? TCP_PSH : 0));
+    tcphdr->wnd = lwip_htons(0xffff);
+
+    netif.input(p, &netif);
+}
+
+static int timer_pcbs(void)
+{
+    int n = 0;
+    for (struct tcp_pcb *pcb = tcp_timer_pcbs; pcb != NULL; pcb = pcb->timer_next) {
+        n++;
+    }
+    return n;
+}
+
+/* Advance the clock to the given time, running the timeouts on the way */
+static void run_until(u32_t time)
+{
+    while ((s32_t)(time - now) > 0) {
+        u32_t sleep = sys_timeouts_sleeptime();
+        if (sleep == SYS_TIMEOUTS_SLEEPTIME_INFINITE || (s32_t)(time - now) < (s32_t)sleep) {
+            sleep = time - now;
+        }
+        now += sleep;
+        sys_check_timeouts();
+    }
+}
+
+/**
+ * @return NULL if the timers behaved, or what went wrong.
+ */
+static const char *check(struct tcp_pcb *pcbs, int count)
+{
+    /* The registered pcbs have had no chance to go idle yet */
+    run_until(now + 2 * TCP_TMR_INTERVAL);
+    if (timer_pcbs() != 0) {
+        return "idle pcbs stayed on tcp_timer_pcbs";
+    }
+
+    /* A data segment is acknowledged after TCP_ACK_DELAY_MS */
+    struct tcp_pcb *pcb = &pcbs[count / 2];
+    unsigned int sent = harness_transmitted;
+    input_segment(pcb, SEQNO, ACKNO, 100);
+    if (!(pcb->flags & TF_ACK_DELAY) || harness_transmitted != sent) {
+        return "data was acknowledged before the delay";
+    }
+    run_until(now + TCP_ACK_DELAY_MS - 1);
+    if (harness_transmitted != sent) {
+        return "the delayed ACK went out early";
+    }
+    run_until(now + 1);
+    if (harness_transmitted != sent + 1 || (pcb->flags & TF_ACK_DELAY)) {
+        return "the delayed ACK did not go out in time";
+    }
+
+    /* Unacknowledged data is retransmitted, and the pcb then goes idle
+       again once it is acknowledged */
+    pcb = &pcbs[count - 1];
+    static const char data[200];
+    if (tcp_write(pcb, data, sizeof(data), 0) != ERR_OK || tcp_output(pcb) != ERR_OK ||
+        harness_transmitted != sent + 2) {
+        return "tcp_write() data was not sent";
+    }
+    if (pcb->timer_pprev == NULL) {
+        return "a pcb with unacknowledged data is not on tcp_timer_pcbs";
+    }
+    run_until(now + 4 * pcb->rto * TCP_SLOW_INTERVAL);
+    if (harness_transmitted < sent + 3) {
+        return "unacknowledged data was not retransmitted";
+    }
+    input_segment(pcb, SEQNO, ACKNO + sizeof(data), 0);
+    run_until(now + 2 * TCP_TMR_INTERVAL);
+    if (pcb->unacked != NULL || timer_pcbs() != 0) {
+        return "an acknowledged pcb stayed on tcp_timer_pcbs";
+    }
+    return NULL;
+}
+
+/**
+ * Walk tcp_active_pcbs looking at what tcp_fasttmr() and tcp_slowtmr()
+ * first looked at for each pcb, the least they did per pcb without the
+ * timer lists.
+ */
+static unsigned int list_tick(void)
+{
+    unsigned int busy = 0;
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+        if ((pcb->flags & (TF_ACK_DELAY | TF_CLOSEPEND)) || pcb->refused_data != NULL ||
+            pcb->unacked != NULL || pcb->persist_backoff > 0 || ip_get_option(pcb, SOF_KEEPALIVE)) {
+            busy++;
+        }
+        ++pcb->polltmr;
+    }
+    return busy;
+}
+
+int main(void)
+{
+    IP4_ADDR(&local_ip, 10, 0, 0, 1);
+    harness_init(&netif, &local_ip, 8, harness_netif_init, ip_input);
+
+    printf("%12s %14s %14s\n", "connections", "tcp_tmr ns", "list ns");
+    for (size_t c = 0; c < sizeof(connection_counts) / sizeof(connection_counts[0]); c++) {
+        int count = connection_counts[c];
+        struct tcp_pcb *pcbs = open_connections(count);
+
+        const char *failure = check(pcbs, count);
+        if (failure != NULL) {
+            printf("tcp_timer_bench: with %d connections, %s\n", count, failure);
+            return 1;
+        }
+
+        uint64_t start = now_ns();
+        for (int tick = 0; tick < TICKS; tick++) {
+            tcp_tmr();
+        }
+        double tmr_ns = (double)(now_ns() - start) / TICKS;
+
+        unsigned int busy = 0;
+        start = now_ns();
+        for (int tick = 0; tick < TICKS; tick++) {
+            busy += list_tick();
+        }
+        double list_ns = (double)(now_ns() - start) / TICKS;
+        if (busy) {
+            printf("tcp_timer_bench: %u pcbs were not idle\n", busy);
+            return 1;
+        }
+
+        printf("%12d %14.1f %14.1f\n", count, tmr_ns, list_ns);
+        close_connections(pcbs, count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,382 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Checks the LWIP_TIMER_WHEEL timeouts of lwIP (timeouts.c) against a
+ * model of the sorted list they replace, then times them next to the
+ * model. Built by `make timeouts_test` in this directory.
+ *
+ * The test runs random sys_timeout(), sys_untimeout(),
+ * sys_restart_timeouts() and sys_check_timeouts() calls on both, on a
+ * clock that starts just before the u32_t wraparound and advances by
+ * random steps. Handlers add and cancel timeouts themselves. The order
+ * in which the handlers run, and sys_timeouts_sleeptime(), must match.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/memp.h"
+#include "lwip/timeouts.h"
+
+#include "harness.h"
+
+#if !LWIP_TIMER_WHEEL
+#error "LWIP_TIMER_WHEEL is not enabled in lwipopts.h"
+#endif
+
+#define TEST_ROUNDS 1000000
+#define MAX_TIMEOUTS 400
+#define HANDLERS 4
+#define ARGS 8
+#define LOG_SIZE 4096
+#define BENCH_TICKS 100000
+#define TICK_MS 10
+
+/* The sorted list of timeouts.c without LWIP_TIMER_WHEEL */
+struct model_timeo {
+    struct model_timeo *next;
+    u32_t time;
+    int handler;
+    int arg;
+};
+
+static struct model_timeo model_pool[MEMP_NUM_SYS_TIMEOUT];
+static struct model_timeo *model_free;
+static struct model_timeo *model_list;
+static int model_count;
+
+static u32_t now;
+static unsigned int failures;
+static bool in_model;
+
+static struct {
+    int handler;
+    int arg;
+    u32_t time;
+} wheel_log[LOG_SIZE], model_log[LOG_SIZE];
+static int wheel_logged, model_logged;
+
+static void model_timeout(u32_t msecs, int handler, int arg);
+static void model_untimeout(int handler, int arg);
+
+u32_t sys_now(void)
+{
+    return now;
+}
+
+static int pending(void)
+{
+    return model_count;
+}
+
+/*
+ * Handlers. Each records itself, and some add or cancel timeouts, on
+ * whichever implementation is running them.
+ */
+static void add_timeout(u32_t msecs, int handler, int arg);
+static void cancel_timeout(int handler, int arg);
+
+static void run_handler(int handler, void *arg)
+{
+    int a = (int)(mem_ptr_t)arg;
+    if (in_model) {
+        if (model_logged < LOG_SIZE) {
+            model_log[model_logged].handler = handler;
+            model_log[model_logged].arg = a;
+            model_log[model_logged].time = now;
+        }
+        model_logged++;
+    } else {
+        if (wheel_logged < LOG_SIZE) {
+            wheel_log[wheel_logged].handler = handler;
+            wheel_log[wheel_logged].arg = a;
+            wheel_log[wheel_logged].time = now;
+        }
+        wheel_logged++;
+    }
+
+    /* The follow-up depends only on the handler and arg, so both
+       implementations do the same. No handler adds to the number of
+       pending timeouts. */
+    switch (handler) {
+    case 1:
+        /* re-arm, possibly in the same tick, but not forever through a
+           long sleep */
+        if ((in_model ? model_logged : wheel_logged) < 64) {
+            add_timeout(1 + a % 3, 1, a);
+        }
+        break;
+    case 2:
+        cancel_timeout(3, a);
+        break;
+    case 3:
+        add_timeout(100 + a * 37, 0, a);
+        break;
+    }
+}
+
+static void handler0(void *arg) { run_handler(0, arg); }
+static void handler1(void *arg) { run_handler(1, arg); }
+static void handler2(void *arg) { run_handler(2, arg); }
+static void handler3(void *arg) { run_handler(3, arg); }
+
+static const sys_timeout_handler handlers[HANDLERS] = { handler0, handler1, handler2, handler3 };
+
+static void add_timeout(u32_t msecs, int handler, int arg)
+{
+    if (in_model) {
+        model_timeout(msecs, handler, arg);
+    } else {
+        sys_timeout(msecs, handlers[handler], (void *)(mem_ptr_t)arg);
+    }
+}
+
+static void cancel_timeout(int handler, int arg)
+{
+    if (in_model) {
+        model_untimeout(handler, arg);
+    } else {
+        sys_untimeout(handlers[handler], (void *)(mem_ptr_t)arg);
+    }
+}
+
+/*
+ * The model, which follows sys_timeout_abs(), sys_untimeout() and
+ * sys_check_timeouts() for the list.
+ */
+static void model_timeout(u32_t msecs, int handler, int arg)
+{
+    struct model_timeo *timeout = model_free;
+    model_free = timeout->next;
+    model_count++;
+
+    timeout->next = NULL;
+    timeout->time = now + msecs;
+    timeout->handler = handler;
+    timeout->arg = arg;
+
+    struct model_timeo **link = &model_list;
+    while (*link != NULL && (u32_t)(timeout->time - (*link)->time) <= 0x7fffffff) {
+        link = &(*link)->next;
+    }
+    timeout->next = *link;
+    *link = timeout;
+}
+
+static void model_untimeout(int handler, int arg)
+{
+    for (struct model_timeo **link = &model_list; *link != NULL; link = &(*link)->next) {
+        struct model_timeo *t = *link;
+        if (t->handler == handler && t->arg == arg) {
+            *link = t->next;
+            t->next = model_free;
+            model_free = t;
+            model_count--;
+            return;
+        }
+    }
+}
+
+static void model_check_timeouts(void)
+{
+    u32_t start = now;
+    while (model_list != NULL && (u32_t)(start - model_list->time) <= 0x7fffffff) {
+        struct model_timeo *t = model_list;
+        model_list = t->next;
+        t->next = model_free;
+        model_free = t;
+        model_count--;
+        run_handler(t->handler, (void *)(mem_ptr_t)t->arg);
+    }
+}
+
+static void model_restart_timeouts(void)
+{
+    if (model_list == NULL) {
+        return;
+    }
+    u32_t base = model_list->time;
+    for (struct model_timeo *t = model_list; t != NULL; t = t->next) {
+        t->time = t->time - base + now;
+    }
+}
+
+static u32_t model_sleeptime(void)
+{
+    if (model_list == NULL) {
+        return SYS_TIMEOUTS_SLEEPTIME_INFINITE;
+    }
+    if ((u32_t)(model_list->time - now) > 0x7fffffff) {
+        return 0;
+    }
+    return model_list->time - now;
+}
+
+static void model_init(void)
+{
+    model_list = NULL;
+    model_free = NULL;
+    model_count = 0;
+    for (int i = 0; i < MEMP_NUM_SYS_TIMEOUT; i++) {
+        model_pool[i].next = model_free;
+        model_free = &model_pool[i];
+    }
+}
+
+/* Run an operation on both, and compare what the handlers did */
+#define BOTH(wheel_call, model_call)                                    \
+    do {                                                                \
+        wheel_logged = model_logged = 0;                                \
+        in_model = false;                                               \
+        wheel_call;                                                     \
+        in_model = true;                                                \
+        model_call;                                                     \
+        in_model = false;                                               \
+        compare_logs(#wheel_call);                                      \
+    } while (0)
+
+static void compare_logs(const char *op)
+{
+    int n = wheel_logged < LOG_SIZE ? wheel_logged : LOG_SIZE;
+    bool same = wheel_logged == model_logged;
+    for (int i = 0; same && i < n; i++) {
+        same = wheel_log[i].handler == model_log[i].handler && wheel_log[i].arg == model_log[i].arg;
+    }
+    if (!same && failures++ < 10) {
+        printf("timeouts: %s at %u ran %d handlers, the list %d\n", op, now, wheel_logged, model_logged);
+    }
+
+    u32_t wheel_sleep = sys_timeouts_sleeptime();
+    u32_t model_sleep = model_sleeptime();
+    if (wheel_sleep != model_sleep && failures++ < 10) {
+        printf("timeouts: after %s at %u sleeptime %u, the list %u\n", op, now, wheel_sleep, model_sleep);
+    }
+}
+
+static u32_t random_msecs(void)
+{
+    switch (rand() % 8) {
+    case 0:
+        return 0;
+    case 1:
+        return rand() % (1 << 30);
+    case 2:
+        return rand() % (1 << 20);
+    default:
+        return rand() % 5000;
+    }
+}
+
+static void test(void)
+{
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        int handler = rand() % HANDLERS;
+        int arg = rand() % ARGS;
+        int op = rand() % 100;
+
+        if (op < 40) {
+            u32_t msecs = random_msecs();
+            if (pending() < MAX_TIMEOUTS) {
+                BOTH(sys_timeout(msecs, handlers[handler], (void *)(mem_ptr_t)arg),
+                     model_timeout(msecs, handler, arg));
+            }
+        } else if (op < 55) {
+            BOTH(sys_untimeout(handlers[handler], (void *)(mem_ptr_t)arg),
+                 model_untimeout(handler, arg));
+        } else if (op < 56) {
+            BOTH(sys_restart_timeouts(), model_restart_timeouts());
+        } else {
+            /* Mostly ticks, sometimes a long sleep */
+            now += (op < 98) ? rand() % (2 * TICK_MS) : rand() % (1 << 22);
+            BOTH(sys_check_timeouts(), model_check_timeouts());
+        }
+    }
+}
+
+/* Cancel and add again a timeout out of count, then tick, as TCP and ARP
+ * do for each connection */
+static void bench(int count)
+{
+    uint64_t wheel_ns = 0, model_ns = 0, start;
+
+    in_model = false;
+    for (int i = 0; i < count; i++) {
+        sys_timeout(1000 + rand() % 10000, handler0, (void *)(mem_ptr_t)(i + ARGS));
+    }
+    in_model = true;
+    for (int i = 0; i < count; i++) {
+        model_timeout(1000 + rand() % 10000, 0, i + ARGS);
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        in_model = pass;
+        u32_t saved = now;
+        start = now_ns();
+        for (int tick = 0; tick < BENCH_TICKS; tick++) {
+            int arg = rand() % count + ARGS;
+            if (in_model) {
+                model_untimeout(0, arg);
+                model_timeout(1000 + rand() % 10000, 0, arg);
+                model_check_timeouts();
+            } else {
+                sys_untimeout(handler0, (void *)(mem_ptr_t)arg);
+                sys_timeout(1000 + rand() % 10000, handler0, (void *)(mem_ptr_t)arg);
+                sys_check_timeouts();
+            }
+            now += TICK_MS;
+        }
+        if (in_model) {
+            model_ns = now_ns() - start;
+        } else {
+            wheel_ns = now_ns() - start;
+            now = saved;
+        }
+    }
+    in_model = false;
+
+    printf("timeouts: %4d pending  wheel %6.1f ns/tick  list %7.1f ns/tick\n",
+           count, (double)wheel_ns / BENCH_TICKS, (double)model_ns / BENCH_TICKS);
+
+    for (int i = 0; i < count; i++) {
+        sys_untimeout(handler0, (void *)(mem_ptr_t)(i + ARGS));
+        model_untimeout(0, i + ARGS);
+    }
+}
+
+int main(void)
+{
+    memp_init();
+    model_init();
+    srand(1);
+
+    /* Start before the wraparound of sys_now() */
+    now = 0xffffffff - 100000;
+    test();
+    printf("timeouts: %s\n", failures ? "FAILED" : "passed");
+    if (failures) {
+        return 1;
+    }
+
+    /* Drop what the test left, so that the bench sees only its own */
+    while (model_list != NULL) {
+        int handler = model_list->handler, arg = model_list->arg;
+        sys_untimeout(handlers[handler], (void *)(mem_ptr_t)arg);
+        model_untimeout(handler, arg);
+    }
+    if (sys_timeouts_sleeptime() != SYS_TIMEOUTS_SLEEPTIME_INFINITE) {
+        printf("timeouts: FAILED to cancel every timeout\n");
+        return 1;
+    }
+
+    int counts[] = { 16, 64, 256, 500 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        bench(counts[i]);
+    }
+
+    return 0;
+}
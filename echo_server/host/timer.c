@@ -0,0 +1,46 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Host version of timer.c. The lwIP timers run off the host's monotonic
+ * clock, and sim.c delivers the timer "interrupt" to the PD every tick.
+ */
+
+#include <time.h>
+
+#include "timer.h"
+#include "echo.h"
+
+static uint64_t start_ms;
+
+int timers_initialised = 0;
+
+static uint64_t host_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+u32_t sys_now(void)
+{
+    if (!timers_initialised) {
+        /* lwip_init() will call this when initialising its own timers,
+         * but the timer is not set up at this point so just return 0 */
+        return 0;
+    }
+    return host_ms() - start_ms;
+}
+
+void irq(sel4cp_channel ch)
+{
+    sys_check_timeouts();
+}
+
+void gpt_init(void)
+{
+    start_ms = host_ms();
+    timers_initialised = 1;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Measures how the cost of demultiplexing a UDP datagram grows with the
+ * number of bound pcbs. Built by `make udp_demux_bench` in this
+ * directory.
+ *
+ * Pcbs are bound to consecutive ports, each first bound to another port
+ * and then rebound, and datagrams for randomly chosen ports are passed to
+ * ip4_input() through a dummy netif. The benchmark reports the time per
+ * datagram through the whole input path with the UDP_PCB_HASH table, and
+ * the time of walking udp_pcbs to the datagram's pcb as udp_input() did
+ * without it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/udp.h"
+
+#include "harness.h"
+
+#if !UDP_PCB_HASH
+#error "UDP_PCB_HASH is not enabled in lwipopts.h"
+#endif
+
+#define FIRST_PORT 1024
+#define REMOTE_PORT 7
+#define DATAGRAMS 4096
+#define ROUNDS 200
+
+static const int pcb_counts[] = { 10, 100, 1000, 10000 };
+
+static struct netif netif;
+static ip4_addr_t local_ip;
+static ip4_addr_t remote_ip;
+static unsigned int misdelivered;
+static struct udp_pcb *expected_pcb;
+
+static struct {
+    u8_t hdr[IP_HLEN + UDP_HLEN];
+    struct udp_pcb *pcb;
+} datagrams[DATAGRAMS];
+
+static void bench_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    if (pcb != expected_pcb) {
+        misdelivered++;
+    }
+    pbuf_free(p);
+}
+
+/**
+ * Bind pcbs from, up to count, to consecutive ports. The pcbs are never
+ * removed, so each count adds to the pcbs of the previous one.
+ */
+static int bind_pcbs(struct udp_pcb *pcbs, int from, int count)
+{
+    struct udp_pcb *template = udp_new();
+
+    for (int i = from; i < count; i++) {
+        struct udp_pcb *pcb = &pcbs[i];
+        /* The pcb pool is far smaller than this, so copy a fresh pcb */
+        memcpy(pcb, template, sizeof(*pcb));
+        udp_recv(pcb, bench_recv, NULL);
+        /* Rebinding moves the pcb between hash buckets */
+        if (udp_bind(pcb, IP_ADDR_ANY, 0) != ERR_OK ||
+            udp_bind(pcb, IP_ADDR_ANY, FIRST_PORT + i) != ERR_OK) {
+            return -1;
+        }
+    }
+
+    udp_remove(template);
+    return 0;
+}
+
+static void build_datagrams(struct udp_pcb *pcbs, int count)
+{
+    for (int i = 0; i < DATAGRAMS; i++) {
+        struct udp_pcb *pcb = &pcbs[rand() % count];
+        struct ip_hdr *iphdr = (struct ip_hdr *)datagrams[i].hdr;
+        struct udp_hdr *udphdr = (struct udp_hdr *)(iphdr + 1);
+
+        memset(datagrams[i].hdr, 0, sizeof(datagrams[i].hdr));
+        IPH_VHL_SET(iphdr, 4, IP_HLEN / 4);
+        IPH_LEN_SET(iphdr, lwip_htons(IP_HLEN + UDP_HLEN));
+        IPH_TTL_SET(iphdr, 64);
+        IPH_PROTO_SET(iphdr, IP_PROTO_UDP);
+        ip4_addr_copy(iphdr->src, remote_ip);
+        ip4_addr_copy(iphdr->dest, local_ip);
+
+        udphdr->src = lwip_htons(REMOTE_PORT);
+        udphdr->dest = lwip_htons(pcb->local_port);
+        udphdr->len = lwip_htons(UDP_HLEN);
+
+        datagrams[i].pcb = pcb;
+    }
+}
+
+static double time_input(void)
+{
+    uint64_t start = now_ns();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < DATAGRAMS; i++) {
+            struct pbuf *p = pbuf_alloc(PBUF_RAW, sizeof(datagrams[i].hdr), PBUF_POOL);
+            memcpy(p->payload, datagrams[i].hdr, sizeof(datagrams[i].hdr));
+            expected_pcb = datagrams[i].pcb;
+            netif.input(p, &netif);
+        }
+    }
+    return (double)(now_ns() - start) / (ROUNDS * DATAGRAMS);
+}
+
+/**
+ * Time walking udp_pcbs to each datagram's pcb, the least udp_input()
+ * did per datagram without the hash table.
+ *
+ * @return the time per lookup in ns, or a negative value if a walk found
+ *         the wrong pcb.
+ */
+static double time_list_walk(void)
+{
+    uint64_t start = now_ns();
+    for (int i = 0; i < DATAGRAMS; i++) {
+        u16_t port = datagrams[i].pcb->local_port;
+        struct udp_pcb *pcb;
+        for (pcb = udp_pcbs; pcb != NULL && pcb->local_port != port; pcb = pcb->next);
+        if (pcb != datagrams[i].pcb) {
+            return -1;
+        }
+    }
+    return (double)(now_ns() - start) / DATAGRAMS;
+}
+
+int main(void)
+{
+    IP4_ADDR(&local_ip, 10, 0, 0, 1);
+    IP4_ADDR(&remote_ip, 10, 0, 0, 2);
+    harness_init(&netif, &local_ip, 8, harness_netif_init, ip_input);
+
+    int max = pcb_counts[sizeof(pcb_counts) / sizeof(pcb_counts[0]) - 1];
+    struct udp_pcb *pcbs = calloc(max, sizeof(struct udp_pcb));
+    int bound = 0;
+
+    printf("%12s %14s %14s\n", "pcbs", "input ns/dgram", "list ns");
+    for (size_t c = 0; c < sizeof(pcb_counts) / sizeof(pcb_counts[0]); c++) {
+        int count = pcb_counts[c];
+        if (bind_pcbs(pcbs, bound, count)) {
+            printf("udp_demux_bench: bind failed with %d pcbs\n", count);
+            return 1;
+        }
+        bound = count;
+        build_datagrams(pcbs, count);
+
+        double list_ns = time_list_walk();
+        if (list_ns < 0) {
+            printf("udp_demux_bench: list walk found the wrong pcb with %d pcbs\n", count);
+            return 1;
+        }
+
+        double input_ns = time_input();
+        /* Anything sent is a port unreachable for an undelivered datagram */
+        if (harness_transmitted || misdelivered) {
+            printf("udp_demux_bench: %u datagrams were not delivered, %u to the wrong pcb\n",
+                   harness_transmitted, misdelivered);
+            return 1;
+        }
+
+        printf("%12d %14.1f %14.1f\n", count, input_ns, list_ns);
+    }
+
+    return 0;
+}
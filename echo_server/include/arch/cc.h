@@ -44,6 +44,14 @@ typedef uintptr_t mem_ptr_t;
 
 #define LWIP_CHKSUM_ALGORITHM 3
 
+/* NEON checksum on aarch64, see chksum.c. lwip_standard_chksum() is
+ * still built from algorithm 3 as a reference. */
+u16_t sddf_chksum(const void *dataptr, int len);
+#define LWIP_CHKSUM sddf_chksum
+/* Copy and checksum in one pass, for LWIP_CHECKSUM_ON_COPY */
+u16_t sddf_chksum_copy(void *dst, const void *src, u16_t len);
+#define LWIP_CHKSUM_COPY(dst, src, len) sddf_chksum_copy(dst, src, len)
+
 #define PACK_STRUCT_STRUCT __attribute__((packed))
 #define PACK_STRUCT_BEGIN
 #define PACK_STRUCT_END
@@ -23,7 +23,7 @@
  * All stores before this point are completed, and all loads after this
  * point are delayed until after it.
  */
-#define THREAD_MEMORY_FENCE() __atomic_thread_fence(__ATOMIC_ACQ_REL)
+#define THREAD_MEMORY_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
 
 /* THREAD_MEMORY_RELEASE: Implements a fence which has the effect of
  * forcing all stores before this point to complete.
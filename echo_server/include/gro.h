@@ -0,0 +1,26 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+
+/**
+ * Hand a received frame to lwIP, holding back TCP segments that
+ * may be merged with later frames of the same batch.
+ *
+ * @param netif network interface the frame was received on.
+ * @param p received frame.
+ */
+void gro_receive(struct netif *netif, struct pbuf *p);
+
+/**
+ * Deliver all segments held back by gro_receive(). This must be
+ * called at the end of every batch of received frames.
+ *
+ * @param netif network interface the frames were received on.
+ */
+void gro_flush(struct netif *netif);
@@ -23,7 +23,7 @@
 #define LWIP_DHCP                       1
 
 #define MEM_ALIGNMENT                   4
-#define MEM_SIZE                        0x4000
+#define MEM_SIZE                        0x40000
 
 #define ETHARP_SUPPORT_STATIC_ENTRIES   1
 #define SYS_LIGHTWEIGHT_PROT            0
@@ -36,14 +36,58 @@
 #define CHECKSUM_CHECK_ICMP             0
 #define CHECKSUM_CHECK_ICMP6            0
 
+/* Checksum data while tcp_write() copies it, so tcp_output() only has
+ * to checksum the headers */
+#define LWIP_CHECKSUM_ON_COPY           1
+
+#define TCP_MSS 1460
 #define TCP_SND_QUEUELEN 2500
 #define MEMP_NUM_TCP_SEG TCP_SND_QUEUELEN
 #define TCP_SND_BUF (100 * TCP_MSS)
+/* Keep the low water mark within the u16_t window sanity check */
+#define TCP_SNDLOWAT (TCP_SND_BUF / 4)
 #define TCP_WND (100 * TCP_MSS)
 #define LWIP_WND_SCALE 1
 #define TCP_RCV_SCALE 10
 #define PBUF_POOL_SIZE 1000
 #define MEMP_NUM_SYS_TIMEOUT 512
+/* Keep the timeouts in a timing wheel rather than a sorted list */
+#define LWIP_TIMER_WHEEL 1
+
+/* Send TCP segments of several MSS, cut into frames in lwip_eth_send_gso() */
+#define TCP_GSO 1
+
+/* Negotiate SACK, send SACK blocks, and recover from loss by the SACK
+ * scoreboard (RFC 6675) instead of going back to the first lost segment */
+#define LWIP_TCP_SACK_OUT 1
+#define LWIP_TCP_SACK_IN 1
+
+/* Let each pcb pick its congestion control; NewReno unless tcp_set_cc() says
+ * otherwise, e.g. CUBIC for long fat paths */
+#define LWIP_TCP_CC 1
+
+/* Find the pcb of an incoming segment by hashing instead of walking the lists */
+#define TCP_PCB_HASH 1
+/* and likewise the pcb of an incoming datagram */
+#define UDP_PCB_HASH 1
+/* Only visit the TCP pcbs with timers running, and time delayed ACKs one by one */
+#define TCP_TIMER_LISTS 1
+
+/* A neighbour table for a large L2 segment, found by hashing, with the
+ * entry of each pcb's last destination cached in the pcb */
+#define ARP_TABLE_SIZE 512
+#define ETHARP_TABLE_HASH 1
+#define ETHARP_HASH_SIZE 256
+#define LWIP_NETIF_HWADDRHINT 1
+
+/* Reassemble IP datagrams through a hash table, in pool pbufs copied out
+ * of the RX buffers, so that a fragment flood cannot hold RX buffers and
+ * is bounded to a quarter of the pbuf pool */
+#define IP_REASS_HASH 1
+#define IP_REASS_HASH_SIZE 64
+#define IP_REASS_COPY 1
+#define IP_REASS_MAX_PBUFS (PBUF_POOL_SIZE / 4)
+#define MEMP_NUM_REASSDATA 64
 
 /* Set this to 0 for performance */
 #define LWIP_STATS 0
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/*
+ * Configuration shared by the RX and TX multiplexers and their clients.
+ * The rings of each client are listed in mux_rx.c, mux_tx.c and
+ * eth.system, so these need updating together with NUM_CLIENTS.
+ */
+
+/* Number of network stacks sharing the NIC */
+#define NUM_CLIENTS 2
+
+/* The shared DMA region holds NUM_BUFFERS receive buffers followed by
+ * NUM_BUFFERS transmit buffers, each BUF_SIZE bytes. */
+#define NUM_BUFFERS 512
+#define BUF_SIZE 2048
+#define DMA_SIZE (NUM_BUFFERS * 2 * BUF_SIZE)
+
+/* Transmit buffers owned by each client */
+#define TX_BUFFERS_PER_CLIENT ((NUM_BUFFERS - 1) / NUM_CLIENTS)
+
+/*
+ * Protected procedure calls offered to the clients.
+ *
+ * On its INIT channel, the RX multiplexer returns the client's MAC address
+ * in the ENET PALR/PAUR layout in MR0 and MR1, and the client's index in MR2.
+ *
+ * On its TX channel, the TX multiplexer returns the index of the client's
+ * first transmit buffer (counted from the first transmit buffer) in MR0 and
+ * the number of transmit buffers in MR1.
+ */
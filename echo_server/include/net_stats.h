@@ -0,0 +1,35 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Statistics of a client's traffic through its rings to the multiplexers. */
+typedef struct net_stats {
+    /* Frames taken off the RX ring */
+    uint64_t rx_frames;
+    /* Frames placed on the TX ring */
+    uint64_t tx_frames;
+    /* Most frames found waiting on the RX ring in one pass */
+    uint32_t rx_batch_max;
+    /* Descriptors on each ring when the statistics were read */
+    uint32_t rx_free;
+    uint32_t rx_used;
+    uint32_t tx_free;
+    uint32_t tx_used;
+} net_stats_t;
+
+/**
+ * Read the ring statistics.
+ *
+ * @param stats filled in with the current statistics.
+ */
+void net_get_stats(net_stats_t *stats);
+
+/**
+ * Restart the ring statistics.
+ */
+void net_reset_stats(void);
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "mux.h"
+
+/*
+ * Per-packet tracing of the RX/TX pipeline. With CONFIG_PACKET_TRACE
+ * defined (make PACKET_TRACE=1), every stage a frame passes through
+ * writes a (stage, packet id, cycle count) record into a trace ring in
+ * memory shared with the benchmark PD, which dumps the rings when a
+ * measurement stops. tools/trace_report.py turns a dump into per-stage
+ * latency breakdowns. Without CONFIG_PACKET_TRACE the TRACE() calls
+ * compile to nothing.
+ *
+ * A packet is identified by the index of the DMA buffer holding it, so
+ * RX buffers have ids 0 to NUM_BUFFERS - 1 and TX buffers the ids after.
+ * An echoed frame changes id when it is copied into a TX buffer.
+ *
+ * Records are stamped with the PMU cycle counter, which needs user access
+ * to the PMU (a benchmark kernel configuration). The cycle counters of
+ * different cores are not synchronised, so latencies across PDs are only
+ * meaningful when those PDs share a core.
+ */
+
+typedef enum trace_stage {
+    /* eth: ENET interrupt taken, no packet id */
+    TRACE_IRQ,
+    /* eth: frame received into an RX buffer */
+    TRACE_DRV_RX,
+    /* mux_rx: frame handed to a client */
+    TRACE_MUX_RX,
+    /* lwip: frame taken off the RX ring */
+    TRACE_CLI_RX,
+    /* lwip: UDP echo callback, id of the RX buffer */
+    TRACE_ECHO,
+    /* lwip: frame placed on the TX ring */
+    TRACE_CLI_TX,
+    /* mux_tx: frame forwarded to the driver */
+    TRACE_MUX_TX,
+    /* eth: frame handed to the hardware */
+    TRACE_DRV_TX,
+    /* eth: hardware finished sending the frame */
+    TRACE_DRV_TX_DONE,
+    TRACE_NUM_STAGES
+} trace_stage_t;
+
+#define TRACE_NO_ID 0xffffffff
+
+typedef struct trace_record {
+    uint64_t cycles;
+    uint32_t stage;
+    uint32_t id;
+} trace_record_t;
+
+/* Size of each PD's trace region in the system description */
+#define TRACE_REGION_SIZE 0x21000
+/* Records kept in a trace ring, older records are overwritten */
+#define TRACE_CAPACITY 8192
+
+typedef struct trace_ring {
+    /* Number of records ever written, only advanced by the PD tracing */
+    uint64_t head;
+    uint64_t pad;
+    trace_record_t records[TRACE_CAPACITY];
+} trace_ring_t;
+
+_Static_assert(sizeof(trace_ring_t) <= TRACE_REGION_SIZE, "Trace ring must fit its memory region");
+_Static_assert(!(TRACE_CAPACITY & (TRACE_CAPACITY - 1)), "Trace capacity must be a power of two");
+
+#ifdef CONFIG_PACKET_TRACE
+
+extern uintptr_t trace_buffer;
+extern uintptr_t shared_dma_vaddr;
+
+static inline uint64_t trace_cycles(void)
+{
+    uint64_t cycles;
+    asm volatile("mrs %0, PMCCNTR_EL0" : "=r"(cycles));
+    return cycles;
+}
+
+/**
+ * Record that a packet reached a stage of the pipeline.
+ *
+ * @param stage stage the packet reached.
+ * @param id packet id, TRACE_NO_ID if the record is not about a packet.
+ */
+static inline void trace(trace_stage_t stage, uint32_t id)
+{
+    trace_ring_t *ring = (trace_ring_t *)trace_buffer;
+    uint64_t head = ring->head;
+    trace_record_t *record = &ring->records[head & (TRACE_CAPACITY - 1)];
+
+    record->cycles = trace_cycles();
+    record->stage = stage;
+    record->id = id;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#define TRACE(stage, id) trace((stage), (id))
+
+#else
+
+#define TRACE(stage, id) do { } while (0)
+
+#endif /* CONFIG_PACKET_TRACE */
+
+/* Packet id of the DMA buffer holding addr */
+#define TRACE_BUF_ID(addr) ((uint32_t)(((uintptr_t)(addr) - shared_dma_vaddr) / BUF_SIZE))
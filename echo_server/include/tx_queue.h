@@ -0,0 +1,34 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Statistics of the software queue holding frames back while the driver
+ * has no free TX buffers. */
+typedef struct tx_queue_stats {
+    /* Frames currently waiting */
+    uint32_t depth;
+    /* Highest number of frames waiting at once */
+    uint32_t max_depth;
+    /* Frames that had to wait for a TX buffer */
+    uint64_t queued;
+    /* Frames dropped because the queue was full, or that the driver
+     * could never send */
+    uint64_t dropped;
+} tx_queue_stats_t;
+
+/**
+ * Read the TX queue statistics.
+ *
+ * @param stats filled in with the current statistics.
+ */
+void tx_queue_get_stats(tx_queue_stats_t *stats);
+
+/**
+ * Restart the TX queue statistics, keeping the current depth.
+ */
+void tx_queue_reset_stats(void);
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <sel4cp.h>
@@ -13,6 +14,12 @@
 
 #define SIZE 512
 
+/* Maximum number of descriptors a single packet may be split across */
+#define BUFF_DESC_MAX_CHAIN 8
+
+/* Descriptor flags */
+#define BUFF_DESC_MORE (1 << 0) /* the next descriptor belongs to the same packet */
+
 /* Function pointer to be used to 'notify' components on either end of the shared memory */
 typedef void (*notify_fn)(void);
 
@@ -20,6 +27,7 @@ typedef void (*notify_fn)(void);
 typedef struct buff_desc {
     uintptr_t encoded_addr; /* encoded dma addresses */
     unsigned int len; /* associated memory lengths */
+    unsigned int flags; /* BUFF_DESC_* flags */
     void *cookie; /* index into client side metadata */
 } buff_desc_t;
 
@@ -27,6 +35,8 @@ typedef struct buff_desc {
 typedef struct ring_buffer {
     uint32_t write_idx;
     uint32_t read_idx;
+    /* Set by the reader when it wants to be notified of the next enqueue */
+    bool notify_reader;
     buff_desc_t buffers[SIZE];
 } ring_buffer_t;
 
@@ -38,6 +48,23 @@ typedef struct ring_handle {
     notify_fn notify;
 } ring_handle_t;
 
+/*
+ * Each index is only written by one side of the ring, but read by both,
+ * possibly from another core. An index is published with a release store
+ * once the descriptors it covers have been written (or read, for the read
+ * index), and loaded with an acquire so those descriptors are only accessed
+ * after the index that hands them over.
+ */
+static inline uint32_t ring_load_idx(uint32_t *idx)
+{
+    return __atomic_load_n(idx, __ATOMIC_ACQUIRE);
+}
+
+static inline void ring_store_idx(uint32_t *idx, uint32_t val)
+{
+    __atomic_store_n(idx, val, __ATOMIC_RELEASE);
+}
+
 /**
  * Initialise the shared ring buffer.
  *
@@ -59,7 +86,7 @@ void ring_init(ring_handle_t *ring, ring_buffer_t *free, ring_buffer_t *used, no
  */
 static inline int ring_empty(ring_buffer_t *ring)
 {
-    return !((ring->write_idx - ring->read_idx) % SIZE);
+    return !((ring_load_idx(&ring->write_idx) - ring_load_idx(&ring->read_idx)) % SIZE);
 }
 
 /**
@@ -71,12 +98,12 @@ static inline int ring_empty(ring_buffer_t *ring)
  */
 static inline int ring_full(ring_buffer_t *ring)
 {
-    return !((ring->write_idx - ring->read_idx + 1) % SIZE);
+    return !((ring_load_idx(&ring->write_idx) - ring_load_idx(&ring->read_idx) + 1) % SIZE);
 }
 
 static inline int ring_size(ring_buffer_t *ring)
 {
-    return (ring->write_idx - ring->read_idx);
+    return (ring_load_idx(&ring->write_idx) - ring_load_idx(&ring->read_idx));
 }
 
 /**
@@ -90,33 +117,99 @@ static inline void notify(ring_handle_t *ring)
     return ring->notify();
 }
 
+/**
+ * Ask the writer of a ring buffer to notify us once it enqueues something.
+ * The reader must check the ring again after requesting, as the writer may
+ * have enqueued before it saw the request.
+ *
+ * @param ring ring buffer to request a notification for.
+ */
+static inline void request_signal(ring_buffer_t *ring)
+{
+    ring->notify_reader = true;
+    THREAD_MEMORY_FENCE();
+}
+
+/**
+ * Withdraw a request for notification.
+ *
+ * @param ring ring buffer to cancel the request for.
+ */
+static inline void cancel_signal(ring_buffer_t *ring)
+{
+    ring->notify_reader = false;
+}
+
+/**
+ * Check whether the reader of a ring buffer wants to be notified.
+ * Called by the writer after it has enqueued.
+ *
+ * @param ring ring buffer to check.
+ *
+ * @return true if the reader is waiting for a notification.
+ */
+static inline bool require_signal(ring_buffer_t *ring)
+{
+    THREAD_MEMORY_FENCE();
+    return ring->notify_reader;
+}
+
+/**
+ * Return the number of free slots in a ring buffer.
+ *
+ * @param ring ring buffer to check.
+ *
+ * @return number of elements that can be enqueued before the ring is full.
+ */
+static inline int ring_space(ring_buffer_t *ring)
+{
+    return SIZE - 1 - ring_size(ring);
+}
+
 /**
  * Enqueue an element to a ring buffer
  *
  * @param ring Ring buffer to enqueue into.
  * @param buffer address into shared memory where data is stored.
  * @param len length of data inside the buffer above.
+ * @param flags BUFF_DESC_* flags describing the element.
  * @param cookie optional pointer to data required on dequeueing.
  *
  * @return -1 when ring is empty, 0 on success.
  */
-static inline int enqueue(ring_buffer_t *ring, uintptr_t buffer, unsigned int len, void *cookie)
+static inline int enqueue_flags(ring_buffer_t *ring, uintptr_t buffer, unsigned int len, unsigned int flags, void *cookie)
 {
     if (ring_full(ring)) {
         sel4cp_dbg_puts("Ring full");
         return -1;
     }
 
-    ring->buffers[ring->write_idx % SIZE].encoded_addr = buffer;
-    ring->buffers[ring->write_idx % SIZE].len = len;
-    ring->buffers[ring->write_idx % SIZE].cookie = cookie;
+    uint32_t write_idx = ring->write_idx;
+    ring->buffers[write_idx % SIZE].encoded_addr = buffer;
+    ring->buffers[write_idx % SIZE].len = len;
+    ring->buffers[write_idx % SIZE].flags = flags;
+    ring->buffers[write_idx % SIZE].cookie = cookie;
 
-    THREAD_MEMORY_RELEASE();
-    ring->write_idx++;
+    ring_store_idx(&ring->write_idx, write_idx + 1);
 
     return 0;
 }
 
+/**
+ * Enqueue a single descriptor packet to a ring buffer
+ *
+ * @param ring Ring buffer to enqueue into.
+ * @param buffer address into shared memory where data is stored.
+ * @param len length of data inside the buffer above.
+ * @param cookie optional pointer to data required on dequeueing.
+ *
+ * @return -1 when ring is empty, 0 on success.
+ */
+static inline int enqueue(ring_buffer_t *ring, uintptr_t buffer, unsigned int len, void *cookie)
+{
+    return enqueue_flags(ring, buffer, len, 0, cookie);
+}
+
 /**
  * Dequeue an element to a ring buffer.
  *
@@ -134,12 +227,12 @@ static inline int dequeue(ring_buffer_t *ring, uintptr_t *addr, unsigned int *le
         return -1;
     }
 
-    *addr = ring->buffers[ring->read_idx % SIZE].encoded_addr;
-    *len = ring->buffers[ring->read_idx % SIZE].len;
-    *cookie = ring->buffers[ring->read_idx % SIZE].cookie;
+    uint32_t read_idx = ring->read_idx;
+    *addr = ring->buffers[read_idx % SIZE].encoded_addr;
+    *len = ring->buffers[read_idx % SIZE].len;
+    *cookie = ring->buffers[read_idx % SIZE].cookie;
 
-    THREAD_MEMORY_RELEASE();
-    ring->read_idx++;
+    ring_store_idx(&ring->read_idx, read_idx + 1);
 
     return 0;
 }
@@ -176,6 +269,24 @@ static inline int enqueue_used(ring_handle_t *ring, uintptr_t addr, unsigned int
     return enqueue(ring->used_ring, addr, len, cookie);
 }
 
+/**
+ * Enqueue one descriptor of a packet that spans several descriptors into a used ring buffer.
+ * Every descriptor except the last must set more, and the whole packet should only be
+ * signalled to the other side once all of its descriptors have been enqueued.
+ *
+ * @param ring Ring handle to enqueue into.
+ * @param buffer address into shared memory where data is stored.
+ * @param len length of data inside the buffer above.
+ * @param cookie optional pointer to data required on dequeueing.
+ * @param more non-zero if the next descriptor belongs to the same packet.
+ *
+ * @return -1 when ring is empty, 0 on success.
+ */
+static inline int enqueue_used_chain(ring_handle_t *ring, uintptr_t addr, unsigned int len, void *cookie, int more)
+{
+    return enqueue_flags(ring->used_ring, addr, len, more ? BUFF_DESC_MORE : 0, cookie);
+}
+
 /**
  * Dequeue an element from the free ring buffer.
  *
@@ -207,29 +318,27 @@ static inline int dequeue_used(ring_handle_t *ring, uintptr_t *addr, unsigned in
 }
 
 /**
- * Dequeue an element from a ring buffer.
- * This function is intended for use by the driver, to collect a pointer
- * into this structure to be passed around as a cookie.
+ * Count the descriptors making up the packet at the head of a ring buffer.
+ * This function is intended for use by the driver, to ensure a packet spanning
+ * several descriptors has been completely enqueued before it is dequeued.
  *
- * @param ring Ring buffer to dequeue from.
- * @param addr pointer to the address of where to store buffer address.
- * @param len pointer to variable to store length of data dequeueing.
- * @param cookie pointer to store a pointer to this particular entry.
+ * @param ring Ring buffer to inspect.
  *
- * @return -1 when ring is empty, 0 on success.
+ * @return number of descriptors in the packet, 0 if the ring is empty or the
+ *         packet has not been completely enqueued yet.
  */
-static int driver_dequeue(ring_buffer_t *ring, uintptr_t *addr, unsigned int *len, void **cookie)
+static inline unsigned int ring_chain_length(ring_buffer_t *ring)
 {
-    if (!((ring->write_idx - ring->read_idx) % SIZE)) {
-        return -1;
-    }
+    uint32_t idx = ring->read_idx;
+    unsigned int num = 0;
 
-    *addr = ring->buffers[ring->read_idx % SIZE].encoded_addr;
-    *len = ring->buffers[ring->read_idx % SIZE].len;
-    *cookie = &ring->buffers[ring->read_idx % SIZE];
-
-    THREAD_MEMORY_RELEASE();
-    ring->read_idx++;
+    while ((ring_load_idx(&ring->write_idx) - idx) % SIZE) {
+        num++;
+        if (!(ring->buffers[idx % SIZE].flags & BUFF_DESC_MORE)) {
+            return num;
+        }
+        idx++;
+    }
 
     return 0;
 }
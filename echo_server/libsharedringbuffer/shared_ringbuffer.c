@@ -16,5 +16,7 @@ void ring_init(ring_handle_t *ring, ring_buffer_t *free, ring_buffer_t *used, no
         ring->free_ring->read_idx = 0;
         ring->used_ring->write_idx = 0;
         ring->used_ring->read_idx = 0;
+        ring->free_ring->notify_reader = false;
+        ring->used_ring->notify_reader = false;
     }
 }
@@ -16,20 +16,37 @@
 #include "lwip/snmp.h"
 #include "lwip/sys.h"
 #include "lwip/dhcp.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/ip4.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
 
 #include "shared_ringbuffer.h"
+#include "mux.h"
 #include "echo.h"
+#include "gro.h"
+#include "net_stats.h"
 #include "timer.h"
+#include "trace.h"
+#include "tx_queue.h"
 
 #define IRQ    1
-#define TX_CH  2
 #define RX_CH  2
 #define INIT   4
+#define TX_CH  6
 
 #define LINK_SPEED 1000000000 // Gigabit
 #define ETHER_MTU 1500
-#define NUM_BUFFERS 512
-#define BUF_SIZE 2048
+
+/* Transmit segments shorter than this are cheaper to copy than to hand to the
+ * driver as a separate descriptor. */
+#define TX_COPY_THRESHOLD 256
+/* The ENET uDMA requires transmit buffers to be 16 byte aligned */
+#define TX_ALIGN 16
+/* Frames that can wait in software for a TX buffer before being dropped */
+#define TX_QUEUE_SIZE 256
 
 /* Memory regions. These all have to be here to keep compiler happy */
 uintptr_t rx_free;
@@ -38,6 +55,7 @@ uintptr_t tx_free;
 uintptr_t tx_used;
 uintptr_t copy_rx;
 uintptr_t shared_dma_vaddr;
+uintptr_t trace_buffer;
 uintptr_t uart_base;
 
 typedef enum {
@@ -46,22 +64,31 @@ typedef enum {
 } ethernet_buffer_origin_t;
 
 typedef struct ethernet_buffer {
+    /* pbuf handed to lwIP when the buffer holds a received frame. This must
+     * be the first member so the pbuf can be cast back to its buffer. */
+    struct pbuf_custom custom;
     /* The acutal underlying memory of the buffer */
     uintptr_t buffer;
+    /* pbuf referenced by a scatter-gather transmit, released on completion */
+    struct pbuf *pbuf;
     /* The physical size of the buffer */
     size_t size;
-    /* Queue from which the buffer was allocated */
-    char origin;
     /* Index into buffer_metadata array */
     unsigned int index;
+    /* Queue from which the buffer was allocated */
+    char origin;
     /* in use */
     bool in_use;
-} ethernet_buffer_t;
+} __attribute__((aligned(64))) ethernet_buffer_t;
+
+_Static_assert(sizeof(ethernet_buffer_t) == 64, "Expect buffer metadata to fill a single cache line");
 
 typedef struct state {
     struct netif netif;
     /* mac address for this client */
     uint8_t mac[6];
+    /* index of this client at the multiplexers */
+    unsigned int client;
 
     /* Pointers to shared buffers */
     ring_handle_t rx_ring;
@@ -70,28 +97,30 @@ typedef struct state {
      * Metadata associated with buffers
      */
     ethernet_buffer_t buffer_metadata[NUM_BUFFERS * 2];
+    /* TX buffers reclaimed from the free ring */
+    ethernet_buffer_t *tx_free_list[NUM_BUFFERS];
+    unsigned int tx_free_count;
+    /* Frames waiting for TX buffers, oldest at tx_queue_head */
+    struct pbuf *tx_queue[TX_QUEUE_SIZE];
+    unsigned int tx_queue_head;
+    unsigned int tx_queue_tail;
+    tx_queue_stats_t tx_queue_stats;
+    net_stats_t net_stats;
 } state_t;
 
 state_t state;
 
-/* LWIP mempool declare literally just initialises an array big enough with the correct alignment */
-typedef struct lwip_custom_pbuf {
-    struct pbuf_custom custom;
-    ethernet_buffer_t *buffer;
-    state_t *state;
-} lwip_custom_pbuf_t;
-LWIP_MEMPOOL_DECLARE(
-    RX_POOL,
-    NUM_BUFFERS * 2,
-    sizeof(lwip_custom_pbuf_t),
-    "Zero-copy RX pool"
-);
-
 static inline void return_buffer(state_t *state, ethernet_buffer_t *buffer)
 {
     /* As the rx free ring is the size of the number of buffers we have,
     the ring should never be full. */
     enqueue_free(&(state->rx_ring), buffer->buffer, BUF_SIZE, buffer);
+
+    /* The multiplexer is waiting on buffers for the driver */
+    if (require_signal(state->rx_ring.free_ring)) {
+        cancel_signal(state->rx_ring.free_ring);
+        sel4cp_notify(RX_CH);
+    }
 }
 
 /**
@@ -105,41 +134,60 @@ static void interface_free_buffer(struct pbuf *buf)
 {
     SYS_ARCH_DECL_PROTECT(old_level);
 
-    lwip_custom_pbuf_t *custom_pbuf = (lwip_custom_pbuf_t *) buf;
+    ethernet_buffer_t *buffer = (ethernet_buffer_t *) buf;
 
     SYS_ARCH_PROTECT(old_level);
-    return_buffer(custom_pbuf->state, custom_pbuf->buffer);
-    LWIP_MEMPOOL_FREE(RX_POOL, custom_pbuf);
+    return_buffer(&state, buffer);
     SYS_ARCH_UNPROTECT(old_level);
 }
 
 /**
  * Create a pbuf structure to pass to the network interface.
+ * The pbuf is embedded in the buffer's metadata, so this never allocates.
  *
- * @param state client state data.
  * @param buffer ethernet buffer containing metadata for the actual buffer
  * @param length length of data
  * 
  * @return the newly created pbuf.
  */
-static struct pbuf *create_interface_buffer(state_t *state, ethernet_buffer_t *buffer, size_t length)
+static struct pbuf *create_interface_buffer(ethernet_buffer_t *buffer, size_t length)
 {
-    lwip_custom_pbuf_t *custom_pbuf = (lwip_custom_pbuf_t *) LWIP_MEMPOOL_ALLOC(RX_POOL);
-
-    custom_pbuf->state = state;
-    custom_pbuf->buffer = buffer;
-    custom_pbuf->custom.custom_free_function = interface_free_buffer;
-
     return pbuf_alloced_custom(
         PBUF_RAW,
         length,
         PBUF_REF,
-        &custom_pbuf->custom,
+        &buffer->custom,
         (void *)buffer->buffer,
         buffer->size
     );
 }
 
+/**
+ * Collect the TX buffers the driver has finished with, releasing
+ * any pbufs that were held for a scatter-gather transmit.
+ *
+ * @param state client state data.
+ *
+ */
+static void reclaim_tx_buffers(state_t *state)
+{
+    uintptr_t addr;
+    unsigned int len;
+    ethernet_buffer_t *buffer;
+
+    while (!dequeue_free(&state->tx_ring, &addr, &len, (void **)&buffer)) {
+        if (!buffer) {
+            print("lwip: dequeued a null ethernet buffer\n");
+            continue;
+        }
+        if (buffer->pbuf) {
+            pbuf_free(buffer->pbuf);
+            buffer->pbuf = NULL;
+        }
+        state->tx_free_list[state->tx_free_count++] = buffer;
+    }
+}
+
 /**
  * Allocate an empty TX buffer from the empty pool
  *
@@ -154,61 +202,311 @@ static inline ethernet_buffer_t *alloc_tx_buffer(state_t *state, size_t length)
         return NULL;
     }
 
-    uintptr_t addr;
-    unsigned int len;
-    ethernet_buffer_t *buffer;
+    if (!state->tx_free_count) {
+        reclaim_tx_buffers(state);
+        if (!state->tx_free_count) {
+            return NULL;
+        }
+    }
 
-    dequeue_free(&state->tx_ring, &addr, &len, (void **)&buffer);
-    if (!buffer) {
-        print("lwip: dequeued a null ethernet buffer\n");
+    return state->tx_free_list[--state->tx_free_count];
+}
+
+static inline void free_tx_buffer(state_t *state, ethernet_buffer_t *buffer)
+{
+    state->tx_free_list[state->tx_free_count++] = buffer;
+}
+
+static inline bool dma_addressable(uintptr_t addr, size_t length)
+{
+    return addr >= shared_dma_vaddr && addr + length <= shared_dma_vaddr + DMA_SIZE;
+}
+
+typedef struct tx_frame {
+    uintptr_t addr[BUFF_DESC_MAX_CHAIN];
+    unsigned int len[BUFF_DESC_MAX_CHAIN];
+    /* Number of segments */
+    unsigned int num;
+    /* Bytes used in the TX buffer */
+    unsigned int copied;
+    /* Whether the last segment is the end of the TX buffer */
+    bool copying;
+} tx_frame_t;
+
+/**
+ * Append data to a frame by copying it into the frame's TX buffer.
+ * Consecutive copies are merged into the same segment.
+ */
+static inline void tx_frame_copy(tx_frame_t *frame, ethernet_buffer_t *buffer, const void *data, unsigned int length)
+{
+    if (!frame->copying) {
+        /* Start a new segment at an aligned offset into the TX buffer */
+        frame->copied = (frame->copied + TX_ALIGN - 1) & ~(TX_ALIGN - 1);
+        frame->addr[frame->num] = buffer->buffer + frame->copied;
+        frame->len[frame->num] = 0;
+        frame->num++;
+        frame->copying = true;
     }
 
-    return buffer;
+    unsigned char *dest = (unsigned char *)buffer->buffer + frame->copied;
+    if ((uintptr_t)dest != (uintptr_t)data) {
+        /* Don't copy memory back into the same location */
+        memcpy(dest, data, length);
+    }
+    frame->copied += length;
+    frame->len[frame->num - 1] += length;
 }
 
-static err_t lwip_eth_send(struct netif *netif, struct pbuf *p)
+/**
+ * Append data to a frame by handing its address straight to the driver.
+ */
+static inline void tx_frame_reference(tx_frame_t *frame, uintptr_t data, unsigned int length)
+{
+    int err = seL4_ARM_VSpace_Clean_Data(3, data, data + length);
+    if (err) {
+        print("ARM Vspace clean failed\n");
+    }
+
+    frame->addr[frame->num] = data;
+    frame->len[frame->num] = length;
+    frame->num++;
+    frame->copying = false;
+}
+
+/**
+ * Copy part of a pbuf chain like pbuf_copy_partial(), checksumming the
+ * data as it is copied.
+ *
+ * @param p pbuf chain to copy from.
+ * @param dest where to copy to.
+ * @param len number of bytes to copy.
+ * @param offset offset into the chain to copy from.
+ *
+ * @return the non-inverted Internet sum of the copied data.
+ */
+static u16_t pbuf_copy_chksum(struct pbuf *p, void *dest, u16_t len, u16_t offset)
+{
+    u32_t acc = 0;
+    u16_t copied = 0;
+
+    for (struct pbuf *q = p; q != NULL && copied < len; q = q->next) {
+        if (offset >= q->len) {
+            offset -= q->len;
+            continue;
+        }
+
+        u16_t n = LWIP_MIN((u16_t)(q->len - offset), (u16_t)(len - copied));
+        u16_t chksum = LWIP_CHKSUM_COPY((u8_t *)dest + copied, (u8_t *)q->payload + offset, n);
+        /* Data at an odd offset pairs up the other way round */
+        if (copied & 1) {
+            chksum = SWAP_BYTES_IN_WORD(chksum);
+        }
+        acc = FOLD_U32T(acc + chksum);
+        copied += n;
+        offset = 0;
+    }
+
+    return (u16_t)FOLD_U32T(acc);
+}
+
+/**
+ * Calculate the TCP checksum of a frame cut from a GSO segment.
+ *
+ * @param iphdr IP header of the frame, with its length already set.
+ * @param tcphdr TCP header of the frame, followed by its payload.
+ * @param payload_chksum sum of the payload, from pbuf_copy_chksum().
+ *
+ * @return the checksum to put in the TCP header.
+ */
+static u16_t gso_tcp_chksum(struct ip_hdr *iphdr, struct tcp_hdr *tcphdr, u16_t payload_chksum)
+{
+    /* The TCP length of the pseudo-header */
+    u16_t len = lwip_ntohs(IPH_LEN(iphdr)) - IPH_HL_BYTES(iphdr);
+    u32_t src = ip4_addr_get_u32(&iphdr->src);
+    u32_t dest = ip4_addr_get_u32(&iphdr->dest);
+    /* The header is a multiple of 4 bytes, so the payload sum lines up */
+    u32_t acc = (u16_t)~inet_chksum(tcphdr, TCPH_HDRLEN_BYTES(tcphdr));
+
+    acc += payload_chksum;
+    acc += (src & 0xffff) + (src >> 16);
+    acc += (dest & 0xffff) + (dest >> 16);
+    acc += lwip_htons(IP_PROTO_TCP);
+    acc += lwip_htons(len);
+    acc = FOLD_U32T(acc);
+    acc = FOLD_U32T(acc);
+
+    return (u16_t)~acc;
+}
+
+/**
+ * Transmit a TCP segment larger than the MTU by cutting it into frames,
+ * one TX buffer each. The headers of the segment are replicated into every
+ * frame and patched for its length, IP id, sequence number and checksums.
+ * Either all frames are queued or none.
+ *
+ * @param state client state data.
+ * @param p ethernet frame holding the segment.
+ *
+ * @return ERR_OK if the frames were queued.
+ */
+static err_t lwip_eth_send_gso(state_t *state, struct pbuf *p)
+{
+    struct eth_hdr *ethhdr = (struct eth_hdr *)p->payload;
+    struct ip_hdr *iphdr = (struct ip_hdr *)(ethhdr + 1);
+
+    if (p->len < SIZEOF_ETH_HDR + IP_HLEN || ethhdr->type != PP_HTONS(ETHTYPE_IP) ||
+        IPH_PROTO(iphdr) != IP_PROTO_TCP) {
+        return ERR_VAL;
+    }
+
+    struct tcp_hdr *tcphdr = (struct tcp_hdr *)((u8_t *)iphdr + IPH_HL_BYTES(iphdr));
+    u16_t ip_hlen = IPH_HL_BYTES(iphdr);
+    u16_t hdr_len = SIZEOF_ETH_HDR + ip_hlen + TCPH_HDRLEN_BYTES(tcphdr);
+    if (p->len < hdr_len) {
+        return ERR_VAL;
+    }
+
+    u16_t max_payload = state->netif.mtu - (hdr_len - SIZEOF_ETH_HDR);
+    u16_t payload_len = p->tot_len - hdr_len;
+    unsigned int frames = (payload_len + max_payload - 1) / max_payload;
+
+    if (state->tx_free_count < frames) {
+        reclaim_tx_buffers(state);
+    }
+    if (state->tx_free_count < frames || ring_space(state->tx_ring.used_ring) < frames) {
+        return ERR_MEM;
+    }
+
+    u16_t id = lwip_ntohs(IPH_ID(iphdr));
+    u32_t seqno = lwip_ntohl(tcphdr->seqno);
+    u8_t flags = TCPH_FLAGS(tcphdr);
+
+    for (unsigned int i = 0; i < frames; i++) {
+        u16_t offset = i * max_payload;
+        u16_t len = LWIP_MIN(max_payload, payload_len - offset);
+        ethernet_buffer_t *buffer = alloc_tx_buffer(state, hdr_len + len);
+
+        unsigned char *frame = (unsigned char *)buffer->buffer;
+        memcpy(frame, p->payload, hdr_len);
+        u16_t payload_chksum = pbuf_copy_chksum(p, frame + hdr_len, len, hdr_len + offset);
+
+        struct ip_hdr *frame_iphdr = (struct ip_hdr *)(frame + SIZEOF_ETH_HDR);
+        IPH_LEN_SET(frame_iphdr, lwip_htons(hdr_len - SIZEOF_ETH_HDR + len));
+        IPH_ID_SET(frame_iphdr, lwip_htons(id + i));
+        IPH_CHKSUM_SET(frame_iphdr, 0);
+        IPH_CHKSUM_SET(frame_iphdr, inet_chksum(frame_iphdr, ip_hlen));
+
+        /* Only the last frame ends the segment */
+        struct tcp_hdr *frame_tcphdr = (struct tcp_hdr *)((u8_t *)frame_iphdr + ip_hlen);
+        frame_tcphdr->seqno = lwip_htonl(seqno + offset);
+        if (i + 1 < frames) {
+            TCPH_FLAGS_SET(frame_tcphdr, flags & ~(TCP_PSH | TCP_FIN));
+        }
+        frame_tcphdr->chksum = 0;
+        frame_tcphdr->chksum = gso_tcp_chksum(frame_iphdr, frame_tcphdr, payload_chksum);
+
+        int err = seL4_ARM_VSpace_Clean_Data(3, buffer->buffer, buffer->buffer + hdr_len + len);
+        if (err) {
+            print("ARM Vspace clean failed\n");
+        }
+
+        TRACE(TRACE_CLI_TX, buffer->index);
+        enqueue_used(&state->tx_ring, buffer->buffer, hdr_len + len, buffer);
+    }
+    state->net_stats.tx_frames += frames;
+    /* The frames took IDs id..id + frames - 1, lwIP only counted the first */
+    ip4_skip_ids(frames - 1);
+
+    /* Notify the server for next time we recv() */
+    have_signal = true;
+    signal_msg = seL4_MessageInfo_new(0, 0, 0, 0);
+    signal = (BASE_OUTPUT_NOTIFICATION_CAP + TX_CH);
+
+    return ERR_OK;
+}
+
+/**
+ * Hand a frame to the driver.
+ *
+ * @param state client state data.
+ * @param p frame to transmit.
+ *
+ * @return ERR_MEM if there are not enough TX buffers or ring slots,
+ *         ERR_VAL if the frame can never be sent.
+ */
+static err_t lwip_eth_transmit(state_t *state, struct pbuf *p)
 {
-    /* Grab an available TX buffer, copy pbuf data over,
+    /* Grab an available TX buffer, copy over or reference the pbuf data,
     add to used tx ring, notify server */
     err_t ret = ERR_OK;
+    struct netif *netif = &state->netif;
 
-    if (p->tot_len > BUF_SIZE) {
-        return ERR_MEM;
+    if (p->tot_len > SIZEOF_ETH_HDR + netif->mtu) {
+        return lwip_eth_send_gso(state, p);
     }
 
-    state_t *state = (state_t *)netif->state;
+    if (p->tot_len > BUF_SIZE) {
+        return ERR_VAL;
+    }
 
     ethernet_buffer_t *buffer = alloc_tx_buffer(state, p->tot_len);
     if (buffer == NULL) {
         return ERR_MEM;
     }
-    unsigned char *frame = (unsigned char *)buffer->buffer;
 
-    /* Copy all buffers that need to be copied */
-    unsigned int copied = 0;
+    tx_frame_t frame = { .num = 0, .copied = 0, .copying = false };
+    bool referenced = false;
+
     for (struct pbuf *curr = p; curr != NULL; curr = curr->next) {
-        unsigned char *buffer_dest = &frame[copied];
-        if ((uintptr_t)buffer_dest != (uintptr_t)curr->payload) {
-            /* Don't copy memory back into the same location */
-            memcpy(buffer_dest, curr->payload, curr->len);
+        uintptr_t payload = (uintptr_t)curr->payload;
+        unsigned int len = curr->len;
+
+        /* A reference may need a segment for its unaligned head, itself
+         * and one for whatever is copied after it. */
+        if (len >= TX_COPY_THRESHOLD && frame.num + 3 <= BUFF_DESC_MAX_CHAIN &&
+            dma_addressable(payload, len)) {
+            unsigned int head = (TX_ALIGN - (payload % TX_ALIGN)) % TX_ALIGN;
+            if (head) {
+                tx_frame_copy(&frame, buffer, curr->payload, head);
+            }
+            tx_frame_reference(&frame, payload + head, len - head);
+            referenced = true;
+        } else if (len) {
+            tx_frame_copy(&frame, buffer, curr->payload, len);
         }
-        copied += curr->len;
     }
 
-    int err = seL4_ARM_VSpace_Clean_Data(3, (uintptr_t)frame, (uintptr_t)frame + copied);
-    if (err) {
-        print("ARM Vspace clean failed\n");
-        print(err);
+    if (!frame.num) {
+        free_tx_buffer(state, buffer);
+        return ERR_OK;
+    }
+
+    if (frame.copied) {
+        int err = seL4_ARM_VSpace_Clean_Data(3, buffer->buffer, buffer->buffer + frame.copied);
+        if (err) {
+            print("ARM Vspace clean failed\n");
+        }
     }
 
     /* insert into the used tx queue */
-    int error = enqueue_used(&state->tx_ring, (uintptr_t)frame, copied, buffer);
-    if (error) {
-        print("TX used ring full\n");
-        enqueue_free(&(state->tx_ring), (uintptr_t)frame, BUF_SIZE, buffer);
+    if (ring_space(state->tx_ring.used_ring) < frame.num) {
+        free_tx_buffer(state, buffer);
         return ERR_MEM;
     }
 
+    /* Keep referenced payloads alive until the driver has sent them */
+    if (referenced) {
+        pbuf_ref(p);
+        buffer->pbuf = p;
+    }
+
+    TRACE(TRACE_CLI_TX, TRACE_BUF_ID(frame.addr[0]));
+    for (unsigned int i = 0; i < frame.num; i++) {
+        /* The first descriptor carries the TX buffer back to us on completion */
+        enqueue_used_chain(&state->tx_ring, frame.addr[i], frame.len[i], i ? NULL : buffer, i + 1 < frame.num);
+    }
+    state->net_stats.tx_frames++;
+
     /* Notify the server for next time we recv() */
     have_signal = true;
     signal_msg = seL4_MessageInfo_new(0, 0, 0, 0);
@@ -218,34 +516,178 @@ static err_t lwip_eth_send(struct netif *netif, struct pbuf *p)
     return ret;
 }
 
+static inline unsigned int tx_queue_depth(state_t *state)
+{
+    return state->tx_queue_tail - state->tx_queue_head;
+}
+
+/**
+ * Transmit the frames waiting in the TX queue for as long as there are
+ * TX buffers. If the queue cannot be emptied, ask the driver to notify us
+ * when it returns buffers.
+ *
+ * @param state client state data.
+ */
+static void tx_queue_drain(state_t *state)
+{
+    while (tx_queue_depth(state)) {
+        struct pbuf *p = state->tx_queue[state->tx_queue_head % TX_QUEUE_SIZE];
+
+        err_t err = lwip_eth_transmit(state, p);
+        if (err == ERR_MEM) {
+            request_signal(state->tx_ring.free_ring);
+            /* Buffers may have come back before the driver saw the request */
+            if (ring_empty(state->tx_ring.free_ring)) {
+                break;
+            }
+            cancel_signal(state->tx_ring.free_ring);
+            reclaim_tx_buffers(state);
+            continue;
+        }
+        if (err != ERR_OK) {
+            /* The frame can never be sent */
+            LINK_STATS_INC(link.drop);
+            state->tx_queue_stats.dropped++;
+        }
+
+        pbuf_free(p);
+        state->tx_queue_head++;
+    }
+
+    state->tx_queue_stats.depth = tx_queue_depth(state);
+}
+
+/**
+ * Queue a frame to be transmitted once TX buffers are available.
+ * The frame is copied, as lwIP may modify the pbuf after we return.
+ *
+ * @param state client state data.
+ * @param p frame to queue.
+ *
+ * @return ERR_MEM if the frame was dropped.
+ */
+static err_t tx_queue_push(state_t *state, struct pbuf *p)
+{
+    struct pbuf *q = NULL;
+
+    if (tx_queue_depth(state) < TX_QUEUE_SIZE) {
+        q = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+    }
+    if (q == NULL) {
+        LINK_STATS_INC(link.drop);
+        state->tx_queue_stats.dropped++;
+        return ERR_MEM;
+    }
+
+    state->tx_queue[state->tx_queue_tail++ % TX_QUEUE_SIZE] = q;
+    state->tx_queue_stats.queued++;
+    state->tx_queue_stats.depth = tx_queue_depth(state);
+    if (state->tx_queue_stats.depth > state->tx_queue_stats.max_depth) {
+        state->tx_queue_stats.max_depth = state->tx_queue_stats.depth;
+    }
+
+    return ERR_OK;
+}
+
+static err_t lwip_eth_send(struct netif *netif, struct pbuf *p)
+{
+    state_t *state = (state_t *)netif->state;
+
+    /* Keep frames in order behind any that are already waiting */
+    if (tx_queue_depth(state)) {
+        tx_queue_drain(state);
+    }
+
+    if (!tx_queue_depth(state)) {
+        err_t err = lwip_eth_transmit(state, p);
+        if (err != ERR_MEM) {
+            return err;
+        }
+    }
+
+    err_t err = tx_queue_push(state, p);
+    if (err == ERR_OK) {
+        tx_queue_drain(state);
+    }
+
+    return err;
+}
+
+void tx_queue_get_stats(tx_queue_stats_t *stats)
+{
+    *stats = state.tx_queue_stats;
+}
+
+void net_get_stats(net_stats_t *stats)
+{
+    *stats = state.net_stats;
+    stats->rx_free = ring_size(state.rx_ring.free_ring);
+    stats->rx_used = ring_size(state.rx_ring.used_ring);
+    stats->tx_free = ring_size(state.tx_ring.free_ring);
+    stats->tx_used = ring_size(state.tx_ring.used_ring);
+}
+
+void net_reset_stats(void)
+{
+    state.net_stats = (net_stats_t) { 0 };
+}
+
+void tx_queue_reset_stats(void)
+{
+    state.tx_queue_stats = (tx_queue_stats_t) {
+        .depth = tx_queue_depth(&state),
+        .max_depth = tx_queue_depth(&state),
+    };
+}
+
 void process_rx_queue(void) 
 {
+    reclaim_tx_buffers(&state);
+    tx_queue_drain(&state);
+
+    uint32_t batch = ring_size(state.rx_ring.used_ring);
+    if (batch > state.net_stats.rx_batch_max) {
+        state.net_stats.rx_batch_max = batch;
+    }
+
     while(!ring_empty(state.rx_ring.used_ring)) {
         uintptr_t addr;
         unsigned int len;
-        ethernet_buffer_t *buffer;
+        void *cookie;
 
-        dequeue_used(&state.rx_ring, &addr, &len, (void **)&buffer);
+        if (dequeue_used(&state.rx_ring, &addr, &len, &cookie)) {
+            break;
+        }
 
-        if (addr != buffer->buffer) {
+        /* The multiplexer hands out receive buffers by address */
+        uintptr_t index = (addr - shared_dma_vaddr) / BUF_SIZE;
+        if (addr < shared_dma_vaddr || index >= NUM_BUFFERS) {
             print("sanity check failed\n");
+            continue;
         }
+        ethernet_buffer_t *buffer = &state.buffer_metadata[index];
+        TRACE(TRACE_CLI_RX, index);
+        state.net_stats.rx_frames++;
 
         /* Invalidate the memory */
         int err = seL4_ARM_VSpace_Invalidate_Data(3, buffer->buffer, buffer->buffer + ETHER_MTU);
         if (err) {
-            print("ARM Vspace invalidate failed\n");
-            print(err);
+            print("ARM Vspace invalidate failed: ");
+            puthex64(err);
+            print("\n");
         }
 
-        struct pbuf *p = create_interface_buffer(&state, (void *)buffer, len);
-
-        if (state.netif.input(p, &state.netif) != ERR_OK) {
-            // If it is successfully received, the receiver controls whether or not it gets freed.
-            print("netif.input() != ERR_OK");
-            pbuf_free(p);
+        struct pbuf *p = create_interface_buffer(buffer, len);
+        if (p == NULL) {
+            print("lwip: received frame larger than its buffer\n");
+            return_buffer(&state, buffer);
+            continue;
         }
+
+        gro_receive(&state.netif, p);
     }
+
+    gro_flush(&state.netif);
 }
 
 /**
@@ -273,6 +715,10 @@ static err_t ethernet_init(struct netif *netif)
     netif->linkoutput = lwip_eth_send;
     NETIF_INIT_SNMP(netif, snmp_ifType_ethernet_csmacd, LINK_SPEED);
     netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_IGMP;
+#if TCP_GSO
+    /* Oversized TCP segments are cut into frames by lwip_eth_send_gso() */
+    netif->flags |= NETIF_FLAG_GSO;
+#endif
 
     return ERR_OK;
 }
@@ -299,6 +745,7 @@ static void get_mac(void)
     state.mac[3] = palr & 0xff;
     state.mac[4] = paur >> 24;
     state.mac[5] = paur >> 16 & 0xff;
+    state.client = sel4cp_mr_get(2);
 }
 
 void init_post(void)
@@ -311,7 +758,10 @@ void init_post(void)
     }
 
     setup_udp_socket();
-    setup_utilization_socket();
+    /* Only the first client is connected to the benchmark PDs */
+    if (state.client == 0) {
+        setup_utilization_socket();
+    }
 
     sel4cp_dbg_puts(sel4cp_name);
     sel4cp_dbg_puts(": init complete -- waiting for notification\n");
@@ -322,11 +772,11 @@ void init(void)
     sel4cp_dbg_puts(sel4cp_name);
     sel4cp_dbg_puts(": elf PD init function running\n");
 
-    /* Set up shared memory regions */
-    ring_init(&state.rx_ring, (ring_buffer_t *)rx_free, (ring_buffer_t *)rx_used, NULL, 1);
-    ring_init(&state.tx_ring, (ring_buffer_t *)tx_free, (ring_buffer_t *)tx_used, NULL, 1);
-
+    /* Set up shared memory regions, the multiplexers initialise them */
+    ring_init(&state.rx_ring, (ring_buffer_t *)rx_free, (ring_buffer_t *)rx_used, NULL, 0);
+    ring_init(&state.tx_ring, (ring_buffer_t *)tx_free, (ring_buffer_t *)tx_used, NULL, 0);
 
+    /* Receive buffers are lent to us by the RX multiplexer */
     for (int i = 0; i < NUM_BUFFERS - 1; i++) {
         ethernet_buffer_t *buffer = &state.buffer_metadata[i];
         *buffer = (ethernet_buffer_t) {
@@ -335,10 +785,16 @@ void init(void)
             .origin = ORIGIN_RX_QUEUE,
             .index = i,
             .in_use = false,
+            .pbuf = NULL,
         };
-        enqueue_free(&state.rx_ring, buffer->buffer, BUF_SIZE, buffer);
+        buffer->custom.custom_free_function = interface_free_buffer;
     }
 
+    /* Transmit buffers are shared out between the clients by the TX multiplexer */
+    sel4cp_ppcall(TX_CH, sel4cp_msginfo_new(0, 0));
+    unsigned int tx_first = sel4cp_mr_get(0);
+    unsigned int tx_count = sel4cp_mr_get(1);
+
     for (int i = 0; i < NUM_BUFFERS - 1; i++) {
         ethernet_buffer_t *buffer = &state.buffer_metadata[i + NUM_BUFFERS];
         *buffer = (ethernet_buffer_t) {
@@ -347,17 +803,18 @@ void init(void)
             .origin = ORIGIN_TX_QUEUE,
             .index = i + NUM_BUFFERS,
             .in_use = false,
+            .pbuf = NULL,
         };
 
-        enqueue_free(&state.tx_ring, buffer->buffer, BUF_SIZE, buffer);
+        if (i >= tx_first && i < tx_first + tx_count) {
+            free_tx_buffer(&state, buffer);
+        }
     }
 
     lwip_init();
 
     gpt_init();
 
-    LWIP_MEMPOOL_INIT(RX_POOL);
-
     get_mac();
 
     /* Set some dummy IP configuration values to get lwIP bootstrapped  */
@@ -377,7 +834,7 @@ void init(void)
 
     netif_set_default(&(state.netif));
 
-    sel4cp_notify(INIT);
+    /* The RX multiplexer notifies INIT once the driver is up */
 }
 
 void notified(sel4cp_channel ch)
@@ -386,6 +843,11 @@ void notified(sel4cp_channel ch)
         case RX_CH:
             process_rx_queue();
             return;
+        case TX_CH:
+            /* Transmit buffers have been returned */
+            reclaim_tx_buffers(&state);
+            tx_queue_drain(&state);
+            return;
         case INIT:
             init_post();
             return;
@@ -160,6 +160,9 @@ PACK_STRUCT_END
 #if (LWIP_TCP && ((TCP_MAXRTX > 12) || (TCP_SYNMAXRTX > 12)))
 #error "If you want to use TCP, TCP_MAXRTX and TCP_SYNMAXRTX must less or equal to 12 (due to tcp_backoff table), so, you have to reduce them in your lwipopts.h"
 #endif
+#if (LWIP_TCP && TCP_TIMER_LISTS && !LWIP_TIMERS)
+#error "TCP_TIMER_LISTS sends delayed ACKs from a timeout, so it needs LWIP_TIMERS"
+#endif
 #if (LWIP_TCP && TCP_LISTEN_BACKLOG && ((TCP_DEFAULT_LISTEN_BACKLOG < 0) || (TCP_DEFAULT_LISTEN_BACKLOG > 0xff)))
 #error "If you want to use TCP backlog, TCP_DEFAULT_LISTEN_BACKLOG must fit into an u8_t"
 #endif
@@ -169,6 +172,9 @@ PACK_STRUCT_END
 #if (LWIP_TCP && LWIP_TCP_SACK_OUT && (LWIP_TCP_MAX_SACK_NUM < 1))
 #error "LWIP_TCP_MAX_SACK_NUM must be greater than 0"
 #endif
+#if (LWIP_TCP && LWIP_TCP_SACK_IN && !LWIP_TCP_SACK_OUT)
+#error "To use LWIP_TCP_SACK_IN, LWIP_TCP_SACK_OUT needs to be enabled"
+#endif
 #if (LWIP_NETIF_API && (NO_SYS==1))
 #error "If you want to use NETIF API, you have to define NO_SYS=0 in your lwipopts.h"
 #endif
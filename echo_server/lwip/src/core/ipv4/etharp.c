@@ -100,10 +100,30 @@ struct etharp_entry {
   struct eth_addr ethaddr;
   u16_t ctime;
   u8_t state;
+#if ETHARP_TABLE_HASH
+  /* Links of the hash chain and the LRU list, as index + 1 (0 ends a list) */
+  netif_addr_idx_t hash_next;
+  netif_addr_idx_t lru_prev;
+  netif_addr_idx_t lru_next;
+#endif /* ETHARP_TABLE_HASH */
 };
 
 static struct etharp_entry arp_table[ARP_TABLE_SIZE];
 
+#if ETHARP_TABLE_HASH
+/** Entries in use, hashed by IP address */
+static netif_addr_idx_t etharp_hash[ETHARP_HASH_SIZE];
+/** Entries in use, from the most to the least recently updated */
+static netif_addr_idx_t etharp_lru_head, etharp_lru_tail;
+/** Freed entries, linked through hash_next */
+static netif_addr_idx_t etharp_free_list;
+/** Entries from this one on have never been used */
+static netif_addr_idx_t etharp_unused;
+
+#define ETHARP_ENTRY(link) (&arp_table[(link) - 1])
+#define ETHARP_LINK(i)     ((netif_addr_idx_t)((i) + 1))
+#endif /* ETHARP_TABLE_HASH */
+
 #if !LWIP_NETIF_HWADDRHINT
 static netif_addr_idx_t etharp_cached_entry;
 #endif /* !LWIP_NETIF_HWADDRHINT */
@@ -163,6 +183,94 @@ free_etharp_q(struct etharp_q_entry *q)
 
 #endif /* ARP_QUEUEING */
 
+#if ETHARP_TABLE_HASH
+static netif_addr_idx_t *
+etharp_hash_bucket(const ip4_addr_t *ipaddr)
+{
+  /* fold the halves together, so that every byte reaches the bucket bits */
+  u32_t h = ip4_addr_get_u32(ipaddr);
+  h = (h ^ (h >> 16)) * 0x9e3779b1UL;
+  return &etharp_hash[(h ^ (h >> 16)) & (ETHARP_HASH_SIZE - 1)];
+}
+
+static void
+etharp_lru_unlink(int i)
+{
+  struct etharp_entry *entry = &arp_table[i];
+  if (entry->lru_prev) {
+    ETHARP_ENTRY(entry->lru_prev)->lru_next = entry->lru_next;
+  } else {
+    etharp_lru_head = entry->lru_next;
+  }
+  if (entry->lru_next) {
+    ETHARP_ENTRY(entry->lru_next)->lru_prev = entry->lru_prev;
+  } else {
+    etharp_lru_tail = entry->lru_prev;
+  }
+}
+
+static void
+etharp_lru_push(int i)
+{
+  struct etharp_entry *entry = &arp_table[i];
+  entry->lru_prev = 0;
+  entry->lru_next = etharp_lru_head;
+  if (etharp_lru_head) {
+    ETHARP_ENTRY(etharp_lru_head)->lru_prev = ETHARP_LINK(i);
+  } else {
+    etharp_lru_tail = ETHARP_LINK(i);
+  }
+  etharp_lru_head = ETHARP_LINK(i);
+}
+
+/** Reset the age of an entry in use, and make it the most recent one */
+static void
+etharp_touch_entry(int i)
+{
+  arp_table[i].ctime = 0;
+  etharp_lru_unlink(i);
+  etharp_lru_push(i);
+}
+
+static void
+etharp_hash_remove(int i)
+{
+  netif_addr_idx_t *link = etharp_hash_bucket(&arp_table[i].ipaddr);
+  while (*link != ETHARP_LINK(i)) {
+    LWIP_ASSERT("etharp_hash_remove: entry not hashed", *link != 0);
+    link = &ETHARP_ENTRY(*link)->hash_next;
+  }
+  *link = arp_table[i].hash_next;
+}
+
+/**
+ * Find the stable entry for ipaddr on netif through the hash table.
+ *
+ * @return the entry's index, or ARP_TABLE_SIZE if there is none.
+ */
+static netif_addr_idx_t
+etharp_hash_find_stable(const ip4_addr_t *ipaddr, struct netif *netif)
+{
+  netif_addr_idx_t link;
+  LWIP_UNUSED_ARG(netif);
+  for (link = *etharp_hash_bucket(ipaddr); link != 0; link = ETHARP_ENTRY(link)->hash_next) {
+    struct etharp_entry *entry = ETHARP_ENTRY(link);
+    if ((entry->state >= ETHARP_STATE_STABLE) &&
+#if ETHARP_TABLE_MATCH_NETIF
+        (entry->netif == netif) &&
+#endif
+        ip4_addr_cmp(ipaddr, &entry->ipaddr)) {
+      return (netif_addr_idx_t)(link - 1);
+    }
+  }
+  return ARP_TABLE_SIZE;
+}
+
+#define ETHARP_TOUCH_ENTRY(i) etharp_touch_entry(i)
+#else /* ETHARP_TABLE_HASH */
+#define ETHARP_TOUCH_ENTRY(i) (arp_table[i].ctime = 0)
+#endif /* ETHARP_TABLE_HASH */
+
 /** Clean up ARP table entries */
 static void
 etharp_free_entry(int i)
@@ -176,6 +284,12 @@ etharp_free_entry(int i)
     free_etharp_q(arp_table[i].q);
     arp_table[i].q = NULL;
   }
+#if ETHARP_TABLE_HASH
+  etharp_hash_remove(i);
+  etharp_lru_unlink(i);
+  arp_table[i].hash_next = etharp_free_list;
+  etharp_free_list = ETHARP_LINK(i);
+#endif /* ETHARP_TABLE_HASH */
   /* recycle entry for re-use */
   arp_table[i].state = ETHARP_STATE_EMPTY;
 #ifdef LWIP_DEBUG
@@ -197,11 +311,23 @@ void
 etharp_tmr(void)
 {
   int i;
+#if ETHARP_TABLE_HASH
+  netif_addr_idx_t link, next;
+#endif /* ETHARP_TABLE_HASH */
 
   LWIP_DEBUGF(ETHARP_DEBUG, ("etharp_timer\n"));
   /* remove expired entries from the ARP table */
+#if ETHARP_TABLE_HASH
+  /* only the entries in use are on the LRU list */
+  for (link = etharp_lru_head; link != 0; link = next) {
+    u8_t state;
+    next = ETHARP_ENTRY(link)->lru_next;
+    i = link - 1;
+    state = arp_table[i].state;
+#else /* ETHARP_TABLE_HASH */
   for (i = 0; i < ARP_TABLE_SIZE; ++i) {
     u8_t state = arp_table[i].state;
+#endif /* ETHARP_TABLE_HASH */
     if (state != ETHARP_STATE_EMPTY
 #if ETHARP_SUPPORT_STATIC_ENTRIES
         && (state != ETHARP_STATE_STATIC)
@@ -245,6 +371,10 @@ etharp_tmr(void)
  * empty entries are available and ETHARP_FLAG_TRY_HARD flag is set, recycle
  * old entries. Heuristic choose the least important entry for recycling.
  *
+ * With ETHARP_TABLE_HASH, the address is looked up in its hash chain, and
+ * the candidates for recycling are taken from the least recently updated
+ * end of the LRU list, in the same order of importance.
+ *
  * @param ipaddr IP address to find in ARP cache, or to add if not found.
  * @param flags See @ref etharp_state
  * @param netif netif related to this address (used for NETIF_HWADDRHINT)
@@ -252,6 +382,102 @@ etharp_tmr(void)
  * @return The ARP entry index that matched or is created, ERR_MEM if no
  * entry is found or could be recycled.
  */
+#if ETHARP_TABLE_HASH
+static s16_t
+etharp_find_entry(const ip4_addr_t *ipaddr, u8_t flags, struct netif *netif)
+{
+  netif_addr_idx_t link;
+  s16_t i, old_pending = ARP_TABLE_SIZE, old_stable = ARP_TABLE_SIZE;
+  s16_t old_queue = ARP_TABLE_SIZE;
+
+  LWIP_UNUSED_ARG(netif);
+
+  if (ipaddr != NULL) {
+    for (link = *etharp_hash_bucket(ipaddr); link != 0; link = ETHARP_ENTRY(link)->hash_next) {
+      struct etharp_entry *entry = ETHARP_ENTRY(link);
+      if (ip4_addr_cmp(ipaddr, &entry->ipaddr)
+#if ETHARP_TABLE_MATCH_NETIF
+          && ((netif == NULL) || (netif == entry->netif))
+#endif /* ETHARP_TABLE_MATCH_NETIF */
+         ) {
+        LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: found matching entry %d\n", (int)(link - 1)));
+        return (s16_t)(link - 1);
+      }
+    }
+  }
+
+  /* don't create new entry, only search? */
+  if ((flags & ETHARP_FLAG_FIND_ONLY) != 0) {
+    return (s16_t)ERR_MEM;
+  }
+
+  if (etharp_free_list != 0) {
+    i = (s16_t)(etharp_free_list - 1);
+    etharp_free_list = arp_table[i].hash_next;
+  } else if (etharp_unused < ARP_TABLE_SIZE) {
+    i = (s16_t)etharp_unused++;
+  } else if ((flags & ETHARP_FLAG_TRY_HARD) == 0) {
+    LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: no empty entry found and not allowed to recycle\n"));
+    return (s16_t)ERR_MEM;
+  } else {
+    /* the first candidate of each kind from the tail is the oldest one;
+       stop at the first stable entry, the one to recycle first */
+    for (link = etharp_lru_tail; link != 0; link = ETHARP_ENTRY(link)->lru_prev) {
+      struct etharp_entry *entry = ETHARP_ENTRY(link);
+      if (entry->state == ETHARP_STATE_PENDING) {
+        if (entry->q != NULL) {
+          if (old_queue == ARP_TABLE_SIZE) {
+            old_queue = (s16_t)(link - 1);
+          }
+        } else if (old_pending == ARP_TABLE_SIZE) {
+          old_pending = (s16_t)(link - 1);
+        }
+      } else if (entry->state >= ETHARP_STATE_STABLE
+#if ETHARP_SUPPORT_STATIC_ENTRIES
+                 && entry->state < ETHARP_STATE_STATIC
+#endif /* ETHARP_SUPPORT_STATIC_ENTRIES */
+                ) {
+        old_stable = (s16_t)(link - 1);
+        break;
+      }
+    }
+    if (old_stable < ARP_TABLE_SIZE) {
+      i = old_stable;
+      LWIP_ASSERT("arp_table[i].q == NULL", arp_table[i].q == NULL);
+    } else if (old_pending < ARP_TABLE_SIZE) {
+      i = old_pending;
+    } else if (old_queue < ARP_TABLE_SIZE) {
+      i = old_queue;
+    } else {
+      LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: no empty or recyclable entries found\n"));
+      return (s16_t)ERR_MEM;
+    }
+    LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: recycling entry %d\n", (int)i));
+    etharp_free_entry(i);
+    /* and take it back off the free list */
+    etharp_free_list = arp_table[i].hash_next;
+  }
+
+  LWIP_ASSERT("arp_table[i].state == ETHARP_STATE_EMPTY",
+              arp_table[i].state == ETHARP_STATE_EMPTY);
+
+  /* the entry is in use from here on, even if the caller leaves it empty */
+  if (ipaddr != NULL) {
+    ip4_addr_copy(arp_table[i].ipaddr, *ipaddr);
+  } else {
+    ip4_addr_set_zero(&arp_table[i].ipaddr);
+  }
+  link = *etharp_hash_bucket(&arp_table[i].ipaddr);
+  arp_table[i].hash_next = link;
+  *etharp_hash_bucket(&arp_table[i].ipaddr) = ETHARP_LINK(i);
+  etharp_lru_push(i);
+  arp_table[i].ctime = 0;
+#if ETHARP_TABLE_MATCH_NETIF
+  arp_table[i].netif = netif;
+#endif /* ETHARP_TABLE_MATCH_NETIF */
+  return i;
+}
+#else /* ETHARP_TABLE_HASH */
 static s16_t
 etharp_find_entry(const ip4_addr_t *ipaddr, u8_t flags, struct netif *netif)
 {
@@ -399,6 +625,7 @@ etharp_find_entry(const ip4_addr_t *ipaddr, u8_t flags, struct netif *netif)
 #endif /* ETHARP_TABLE_MATCH_NETIF */
   return (s16_t)i;
 }
+#endif /* ETHARP_TABLE_HASH */
 
 /**
  * Update (or insert) a IP/MAC address pair in the ARP cache.
@@ -464,7 +691,7 @@ etharp_update_arp_entry(struct netif *netif, const ip4_addr_t *ipaddr, struct et
   /* update address */
   SMEMCPY(&arp_table[i].ethaddr, ethaddr, ETH_HWADDR_LEN);
   /* reset time stamp */
-  arp_table[i].ctime = 0;
+  ETHARP_TOUCH_ENTRY(i);
   /* this is where we will send out queued packets! */
 #if ARP_QUEUEING
   while (arp_table[i].q != NULL) {
@@ -874,6 +1101,13 @@ etharp_output(struct netif *netif, struct pbuf *q, const ip4_addr_t *ipaddr)
 
     /* find stable entry: do this here since this is a critical path for
        throughput and etharp_find_entry() is kind of slow */
+#if ETHARP_TABLE_HASH
+    i = etharp_hash_find_stable(dst_addr, netif);
+    if (i < ARP_TABLE_SIZE) {
+      ETHARP_SET_ADDRHINT(netif, i);
+      return etharp_output_to_arp_index(netif, q, i);
+    }
+#else /* ETHARP_TABLE_HASH */
     for (i = 0; i < ARP_TABLE_SIZE; i++) {
       if ((arp_table[i].state >= ETHARP_STATE_STABLE) &&
 #if ETHARP_TABLE_MATCH_NETIF
@@ -885,6 +1119,7 @@ etharp_output(struct netif *netif, struct pbuf *q, const ip4_addr_t *ipaddr)
         return etharp_output_to_arp_index(netif, q, i);
       }
     }
+#endif /* ETHARP_TABLE_HASH */
     /* no stable entry found, use the (slower) query function:
        queue on destination Ethernet address belonging to ipaddr */
     return etharp_query(netif, dst_addr, q);
@@ -989,7 +1224,7 @@ etharp_query(struct netif *netif, const ip4_addr_t *ipaddr, struct pbuf *q)
         /* A new ARP request has been sent for a pending entry. Reset the ctime to
            not let it expire too fast. */
         LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_query: reset ctime for entry %"S16_F"\n", (s16_t)i));
-        arp_table[i].ctime = 0;
+        ETHARP_TOUCH_ENTRY(i);
       }
     }
     if (q == NULL) {
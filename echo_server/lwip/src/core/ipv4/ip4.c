@@ -1004,7 +1004,12 @@ ip4_output_if_opt_src(struct pbuf *p, const ip4_addr_t *src, const ip4_addr_t *d
 #endif /* ENABLE_LOOPBACK */
 #if IP_FRAG
   /* don't fragment if interface has mtu set to 0 [loopif] */
-  if (netif->mtu && (p->tot_len > netif->mtu)) {
+  if (netif->mtu && (p->tot_len > netif->mtu)
+#if TCP_GSO
+      /* the netif segments oversized TCP packets itself */
+      && !((netif->flags & NETIF_FLAG_GSO) && (IPH_PROTO((struct ip_hdr *)p->payload) == IP_PROTO_TCP))
+#endif /* TCP_GSO */
+     ) {
     return ip4_frag(p, netif, dest);
   }
 #endif /* IP_FRAG */
@@ -1091,6 +1096,19 @@ ip4_output_hinted(struct pbuf *p, const ip4_addr_t *src, const ip4_addr_t *dest,
 }
 #endif /* LWIP_NETIF_USE_HINTS*/
 
+/**
+ * Skip IP header IDs, for a netif that cuts one datagram into several
+ * frames numbered from its ID on, so that the next datagrams do not reuse
+ * the IDs of those frames.
+ *
+ * @param count the number of IDs to skip
+ */
+void
+ip4_skip_ids(u16_t count)
+{
+  ip_id = (u16_t)(ip_id + count);
+}
+
 #if IP_DEBUG
 /* Print an IP header by using LWIP_DEBUGF
  * @param p an IP packet, p->payload pointing to the IP header
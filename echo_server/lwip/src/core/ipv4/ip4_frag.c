@@ -110,9 +110,32 @@ PACK_STRUCT_END
    ip4_addr_cmp(&(iphdrA)->dest, &(iphdrB)->dest) && \
    IPH_ID(iphdrA) == IPH_ID(iphdrB)) ? 1 : 0
 
+#if IP_REASS_HASH
+/* RFC 791 identifies a datagram by its protocol too */
+#define IP_REASS_DATAGRAM_MATCH(iphdrA, iphdrB) \
+  ((IP_ADDRESSES_AND_ID_MATCH(iphdrA, iphdrB)) && (IPH_PROTO(iphdrA) == IPH_PROTO(iphdrB)))
+#else /* IP_REASS_HASH */
+#define IP_REASS_DATAGRAM_MATCH(iphdrA, iphdrB) IP_ADDRESSES_AND_ID_MATCH(iphdrA, iphdrB)
+#endif /* IP_REASS_HASH */
+
 /* global variables */
 static struct ip_reassdata *reassdatagrams;
 static u16_t ip_reass_pbufcount;
+#if IP_REASS_HASH
+/** The oldest datagram, at the end of reassdatagrams */
+static struct ip_reassdata *reassdatagrams_oldest;
+/** Datagrams hashed by ip_reass_hash_bucket() */
+static struct ip_reassdata *ip_reass_hash[IP_REASS_HASH_SIZE];
+
+static struct ip_reassdata **
+ip_reass_hash_bucket(const struct ip_hdr *iphdr)
+{
+  u32_t h = ip4_addr_get_u32(&iphdr->src) ^ ip4_addr_get_u32(&iphdr->dest);
+  h ^= ((u32_t)IPH_ID(iphdr) << 16) | IPH_PROTO(iphdr);
+  h *= 0x9e3779b1UL;
+  return &ip_reass_hash[(h ^ (h >> 16)) & (IP_REASS_HASH_SIZE - 1)];
+}
+#endif /* IP_REASS_HASH */
 
 /* function prototypes */
 static void ip_reass_dequeue_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev);
@@ -235,6 +258,26 @@ ip_reass_remove_oldest_datagram(struct ip_hdr *fraghdr, int pbufs_needed)
 
   /* Free datagrams until being allowed to enqueue 'pbufs_needed' pbufs,
    * but don't free the datagram that 'fraghdr' belongs to! */
+#if IP_REASS_HASH
+  LWIP_UNUSED_ARG(prev);
+  LWIP_UNUSED_ARG(oldest_prev);
+  LWIP_UNUSED_ARG(other_datagrams);
+  do {
+    /* the oldest is at the end, unless it is the one of fraghdr */
+    oldest = NULL;
+    for (r = reassdatagrams_oldest; r != NULL; r = r->prev) {
+      if (!IP_REASS_DATAGRAM_MATCH(&r->iphdr, fraghdr)) {
+        oldest = r;
+        break;
+      }
+    }
+    if (oldest == NULL) {
+      break;
+    }
+    pbufs_freed_current = ip_reass_free_complete_datagram(oldest, NULL);
+    pbufs_freed += pbufs_freed_current;
+  } while (pbufs_freed < pbufs_needed);
+#else /* IP_REASS_HASH */
   do {
     oldest = NULL;
     prev = NULL;
@@ -242,7 +285,7 @@ ip_reass_remove_oldest_datagram(struct ip_hdr *fraghdr, int pbufs_needed)
     other_datagrams = 0;
     r = reassdatagrams;
     while (r != NULL) {
-      if (!IP_ADDRESSES_AND_ID_MATCH(&r->iphdr, fraghdr)) {
+      if (!IP_REASS_DATAGRAM_MATCH(&r->iphdr, fraghdr)) {
         /* Not the same datagram as fraghdr */
         other_datagrams++;
         if (oldest == NULL) {
@@ -264,6 +307,7 @@ ip_reass_remove_oldest_datagram(struct ip_hdr *fraghdr, int pbufs_needed)
       pbufs_freed += pbufs_freed_current;
     }
   } while ((pbufs_freed < pbufs_needed) && (other_datagrams > 1));
+#endif /* IP_REASS_HASH */
   return pbufs_freed;
 }
 #endif /* IP_REASS_FREE_OLDEST */
@@ -302,10 +346,24 @@ ip_reass_enqueue_new_datagram(struct ip_hdr *fraghdr, int clen)
 
   /* enqueue the new structure to the front of the list */
   ipr->next = reassdatagrams;
+#if IP_REASS_HASH
+  if (reassdatagrams != NULL) {
+    reassdatagrams->prev = ipr;
+  } else {
+    reassdatagrams_oldest = ipr;
+  }
+#endif /* IP_REASS_HASH */
   reassdatagrams = ipr;
   /* copy the ip header for later tests and input */
   /* @todo: no ip options supported? */
   SMEMCPY(&(ipr->iphdr), fraghdr, IP_HLEN);
+#if IP_REASS_HASH
+  {
+    struct ip_reassdata **bucket = ip_reass_hash_bucket(fraghdr);
+    ipr->hash_next = *bucket;
+    *bucket = ipr;
+  }
+#endif /* IP_REASS_HASH */
   return ipr;
 }
 
@@ -316,6 +374,27 @@ ip_reass_enqueue_new_datagram(struct ip_hdr *fraghdr, int clen)
 static void
 ip_reass_dequeue_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev)
 {
+#if IP_REASS_HASH
+  struct ip_reassdata **link = ip_reass_hash_bucket(&ipr->iphdr);
+  while (*link != ipr) {
+    LWIP_ASSERT("ip_reass_dequeue_datagram: datagram not hashed", *link != NULL);
+    link = &(*link)->hash_next;
+  }
+  *link = ipr->hash_next;
+
+  /* the list is doubly linked, so prev is not needed */
+  LWIP_UNUSED_ARG(prev);
+  if (ipr->prev != NULL) {
+    ipr->prev->next = ipr->next;
+  } else {
+    reassdatagrams = ipr->next;
+  }
+  if (ipr->next != NULL) {
+    ipr->next->prev = ipr->prev;
+  } else {
+    reassdatagrams_oldest = ipr->prev;
+  }
+#else /* IP_REASS_HASH */
   /* dequeue the reass struct  */
   if (reassdatagrams == ipr) {
     /* it was the first in the list */
@@ -325,6 +404,7 @@ ip_reass_dequeue_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev)
     LWIP_ASSERT("sanity check linked list", prev != NULL);
     prev->next = ipr->next;
   }
+#endif /* IP_REASS_HASH */
 
   /* now we can free the ip_reassdata struct */
   memp_free(MEMP_REASSDATA, ipr);
@@ -340,6 +420,89 @@ ip_reass_dequeue_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev)
  * @param is_last is 1 if this pbuf has MF==0 (ipr->flags not updated yet)
  * @return see IP_REASS_VALIDATE_* defines
  */
+#if IP_REASS_HASH
+static int
+ip_reass_chain_frag_into_datagram_and_validate(struct ip_reassdata *ipr, struct pbuf *new_p, int is_last)
+{
+  struct ip_reass_helper *iprh, *iprh_tmp, *iprh_prev = NULL;
+  struct pbuf *q;
+  u16_t offset, len, datagram_len;
+  u8_t hlen;
+  struct ip_hdr *fraghdr;
+
+  /* Extract length and fragment offset from current fragment */
+  fraghdr = (struct ip_hdr *)new_p->payload;
+  len = lwip_ntohs(IPH_LEN(fraghdr));
+  hlen = IPH_HL_BYTES(fraghdr);
+  if (hlen > len) {
+    /* invalid datagram */
+    return IP_REASS_VALIDATE_PBUF_DROPPED;
+  }
+  len = (u16_t)(len - hlen);
+  offset = IPH_OFFSET_BYTES(fraghdr);
+  if ((u16_t)(offset + len) < offset) {
+    /* u16_t overflow, cannot handle this */
+    return IP_REASS_VALIDATE_PBUF_DROPPED;
+  }
+
+  /* The end of the datagram, once the last fragment is seen, bounds all
+     fragments */
+  if ((ipr->flags & IP_REASS_FLAG_LASTFRAG) != 0) {
+    if (is_last ? (offset + len != ipr->datagram_len) : (offset + len > ipr->datagram_len)) {
+      return IP_REASS_VALIDATE_PBUF_DROPPED;
+    }
+  } else if (is_last && (ipr->last != NULL) &&
+             (((struct ip_reass_helper *)ipr->last->payload)->end > offset + len)) {
+    return IP_REASS_VALIDATE_PBUF_DROPPED;
+  }
+
+  /* Find where the fragment goes before touching it, as the helper
+     overwrites its header. Fragments mostly come in order, so try after
+     the last one first. Overlapping and duplicate fragments are dropped,
+     which the byte count relies on. */
+  if ((ipr->last == NULL) ||
+      (((struct ip_reass_helper *)ipr->last->payload)->end <= offset)) {
+    q = NULL;
+    iprh_prev = (ipr->last != NULL) ? (struct ip_reass_helper *)ipr->last->payload : NULL;
+  } else {
+    for (q = ipr->p; q != NULL; q = iprh_tmp->next_pbuf) {
+      iprh_tmp = (struct ip_reass_helper *)q->payload;
+      if (offset < iprh_tmp->start) {
+        break;
+      }
+      iprh_prev = iprh_tmp;
+    }
+    if (((q != NULL) && (offset + len > ((struct ip_reass_helper *)q->payload)->start)) ||
+        ((iprh_prev != NULL) && (offset < iprh_prev->end))) {
+      return IP_REASS_VALIDATE_PBUF_DROPPED;
+    }
+  }
+
+  LWIP_ASSERT("sizeof(struct ip_reass_helper) <= IP_HLEN",
+              sizeof(struct ip_reass_helper) <= IP_HLEN);
+  iprh = (struct ip_reass_helper *)new_p->payload;
+  iprh->next_pbuf = q;
+  iprh->start = offset;
+  iprh->end = (u16_t)(offset + len);
+  if (iprh_prev != NULL) {
+    iprh_prev->next_pbuf = new_p;
+  } else {
+    ipr->p = new_p;
+  }
+  if (q == NULL) {
+    ipr->last = new_p;
+  }
+  ipr->recv_len = (u16_t)(ipr->recv_len + len);
+
+  /* Disjoint fragments within the datagram that add up to its length
+     cover all of it */
+  datagram_len = is_last ? iprh->end : ipr->datagram_len;
+  if ((is_last || ((ipr->flags & IP_REASS_FLAG_LASTFRAG) != 0)) && (ipr->recv_len == datagram_len)) {
+    return IP_REASS_VALIDATE_TELEGRAM_FINISHED;
+  }
+  return IP_REASS_VALIDATE_PBUF_QUEUED;
+}
+#else /* IP_REASS_HASH */
 static int
 ip_reass_chain_frag_into_datagram_and_validate(struct ip_reassdata *ipr, struct pbuf *new_p, int is_last)
 {
@@ -492,6 +655,7 @@ ip_reass_chain_frag_into_datagram_and_validate(struct ip_reassdata *ipr, struct
   /* If we come here, not all fragments were received, yet! */
   return IP_REASS_VALIDATE_PBUF_QUEUED; /* not yet valid! */
 }
+#endif /* IP_REASS_HASH */
 
 /**
  * Reassembles incoming IP fragments into an IP datagram.
@@ -531,6 +695,20 @@ ip4_reass(struct pbuf *p)
   }
   len = (u16_t)(len - hlen);
 
+#if IP_REASS_COPY
+  if (PBUF_NEEDS_COPY(p)) {
+    /* don't keep a receive buffer for as long as reassembly takes */
+    struct pbuf *q = pbuf_clone(PBUF_RAW, PBUF_POOL, p);
+    if (q == NULL) {
+      IPFRAG_STATS_INC(ip_frag.memerr);
+      goto nullreturn;
+    }
+    pbuf_free(p);
+    p = q;
+    fraghdr = (struct ip_hdr *)p->payload;
+  }
+#endif /* IP_REASS_COPY */
+
   /* Check if we are allowed to enqueue more datagrams. */
   clen = pbuf_clen(p);
   if ((ip_reass_pbufcount + clen) > IP_REASS_MAX_PBUFS) {
@@ -551,11 +729,15 @@ ip4_reass(struct pbuf *p)
 
   /* Look for the datagram the fragment belongs to in the current datagram queue,
    * remembering the previous in the queue for later dequeueing. */
+#if IP_REASS_HASH
+  for (ipr = *ip_reass_hash_bucket(fraghdr); ipr != NULL; ipr = ipr->hash_next) {
+#else /* IP_REASS_HASH */
   for (ipr = reassdatagrams; ipr != NULL; ipr = ipr->next) {
+#endif /* IP_REASS_HASH */
     /* Check if the incoming fragment matches the one currently present
        in the reassembly buffer. If so, we proceed with copying the
        fragment into the buffer. */
-    if (IP_ADDRESSES_AND_ID_MATCH(&ipr->iphdr, fraghdr)) {
+    if (IP_REASS_DATAGRAM_MATCH(&ipr->iphdr, fraghdr)) {
       LWIP_DEBUGF(IP_REASS_DEBUG, ("ip4_reass: matching previous fragment ID=%"X16_F"\n",
                                    lwip_ntohs(IPH_ID(fraghdr))));
       IPFRAG_STATS_INC(ip_frag.cachehit);
@@ -649,7 +831,7 @@ ip4_reass(struct pbuf *p)
     }
 
     /* find the previous entry in the linked list */
-    if (ipr == reassdatagrams) {
+    if ((ipr == reassdatagrams) || IP_REASS_HASH) {
       ipr_prev = NULL;
     } else {
       for (ipr_prev = reassdatagrams; ipr_prev != NULL; ipr_prev = ipr_prev->next) {
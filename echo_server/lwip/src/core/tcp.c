@@ -111,6 +111,8 @@
 #include "lwip/ip6.h"
 #include "lwip/ip6_addr.h"
 #include "lwip/nd6.h"
+#include "lwip/sys.h"
+#include "lwip/timeouts.h"
 
 #include <string.h>
 
@@ -184,6 +186,179 @@ struct tcp_pcb **const tcp_pcb_lists[] = {&tcp_listen_pcbs.pcbs, &tcp_bound_pcbs
 
 u8_t tcp_active_pcbs_changed;
 
+#if TCP_PCB_HASH
+/** Active and TIME-WAIT pcbs, hashed by their 4-tuple */
+static struct tcp_pcb *tcp_pcb_hash[TCP_PCB_HASH_SIZE];
+/** Listening pcbs, hashed by their local port */
+static struct tcp_pcb_listen *tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+
+static u32_t
+tcp_hash_addr(const ip_addr_t *addr)
+{
+#if LWIP_IPV6
+  if (IP_IS_V6(addr)) {
+    return ip_2_ip6(addr)->addr[3];
+  }
+#endif /* LWIP_IPV6 */
+#if LWIP_IPV4
+  return ip4_addr_get_u32(ip_2_ip4(addr));
+#else /* LWIP_IPV4 */
+  return 0;
+#endif /* LWIP_IPV4 */
+}
+
+static struct tcp_pcb **
+tcp_pcb_hash_bucket(u16_t local_port, u16_t remote_port, const ip_addr_t *remote_ip)
+{
+  /* The local address is mostly the same for all pcbs, so leave it out */
+  u32_t h = tcp_hash_addr(remote_ip) ^ (((u32_t)local_port << 16) | remote_port);
+  h *= 0x9e3779b1UL;
+  return &tcp_pcb_hash[(h ^ (h >> 16)) & (TCP_PCB_HASH_SIZE - 1)];
+}
+
+static struct tcp_pcb_listen **
+tcp_listen_hash_bucket(u16_t local_port)
+{
+  return &tcp_listen_hash[local_port & (TCP_LISTEN_HASH_SIZE - 1)];
+}
+
+/**
+ * Add a pcb to the hash table for the list it has just been registered
+ * with. Pcbs in tcp_bound_pcbs are not hashed.
+ */
+void
+tcp_pcb_hash_add(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if ((pcbs == &tcp_active_pcbs) || (pcbs == &tcp_tw_pcbs)) {
+    struct tcp_pcb **bucket = tcp_pcb_hash_bucket(pcb->local_port, pcb->remote_port, &pcb->remote_ip);
+    pcb->hash_next = *bucket;
+    *bucket = pcb;
+  } else if (pcbs == &tcp_listen_pcbs.pcbs) {
+    struct tcp_pcb_listen *lpcb = (struct tcp_pcb_listen *)pcb;
+    struct tcp_pcb_listen **bucket = tcp_listen_hash_bucket(lpcb->local_port);
+    lpcb->hash_next = *bucket;
+    *bucket = lpcb;
+  }
+}
+
+/**
+ * Remove a pcb from the hash table for the list it is being removed from.
+ * Like TCP_RMV, this does nothing if the pcb is not there.
+ */
+void
+tcp_pcb_hash_remove(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if ((pcbs == &tcp_active_pcbs) || (pcbs == &tcp_tw_pcbs)) {
+    struct tcp_pcb **link;
+    for (link = tcp_pcb_hash_bucket(pcb->local_port, pcb->remote_port, &pcb->remote_ip);
+         *link != NULL; link = &(*link)->hash_next) {
+      if (*link == pcb) {
+        *link = pcb->hash_next;
+        break;
+      }
+    }
+    pcb->hash_next = NULL;
+  } else if (pcbs == &tcp_listen_pcbs.pcbs) {
+    struct tcp_pcb_listen *lpcb = (struct tcp_pcb_listen *)pcb;
+    struct tcp_pcb_listen **link;
+    for (link = tcp_listen_hash_bucket(lpcb->local_port); *link != NULL; link = &(*link)->hash_next) {
+      if (*link == lpcb) {
+        *link = lpcb->hash_next;
+        break;
+      }
+    }
+    lpcb->hash_next = NULL;
+  }
+}
+
+/**
+ * Find the active or TIME-WAIT pcb for a segment. As when walking the
+ * lists, an active pcb is preferred to one in TIME-WAIT.
+ *
+ * @param netif_idx index of the netif the segment arrived on.
+ * @return the pcb, or NULL if there is no connection for the segment.
+ */
+struct tcp_pcb *
+tcp_pcb_hash_lookup(u16_t local_port, u16_t remote_port,
+                    const ip_addr_t *local_ip, const ip_addr_t *remote_ip,
+                    u8_t netif_idx)
+{
+  struct tcp_pcb *pcb;
+  struct tcp_pcb *tw_pcb = NULL;
+
+  for (pcb = *tcp_pcb_hash_bucket(local_port, remote_port, remote_ip); pcb != NULL; pcb = pcb->hash_next) {
+    if ((pcb->netif_idx != NETIF_NO_INDEX) && (pcb->netif_idx != netif_idx)) {
+      continue;
+    }
+    if (pcb->remote_port == remote_port &&
+        pcb->local_port == local_port &&
+        ip_addr_cmp(&pcb->remote_ip, remote_ip) &&
+        ip_addr_cmp(&pcb->local_ip, local_ip)) {
+      if (pcb->state != TIME_WAIT) {
+        return pcb;
+      }
+      if (tw_pcb == NULL) {
+        tw_pcb = pcb;
+      }
+    }
+  }
+  return tw_pcb;
+}
+
+/**
+ * Find the listening pcb for a segment. A pcb listening on the segment's
+ * destination address is preferred to one listening on any address.
+ *
+ * @param netif_idx index of the netif the segment arrived on.
+ * @return the pcb, or NULL if nothing listens on the port.
+ */
+struct tcp_pcb_listen *
+tcp_listen_hash_lookup(u16_t local_port, const ip_addr_t *local_ip, u8_t netif_idx)
+{
+  struct tcp_pcb_listen *lpcb;
+  struct tcp_pcb_listen *lpcb_any = NULL;
+
+  for (lpcb = *tcp_listen_hash_bucket(local_port); lpcb != NULL; lpcb = lpcb->hash_next) {
+    if ((lpcb->netif_idx != NETIF_NO_INDEX) && (lpcb->netif_idx != netif_idx)) {
+      continue;
+    }
+    if (lpcb->local_port != local_port) {
+      continue;
+    }
+    if (IP_IS_ANY_TYPE_VAL(lpcb->local_ip)) {
+      /* found an ANY TYPE (IPv4/IPv6) match */
+      if (lpcb_any == NULL) {
+        lpcb_any = lpcb;
+      }
+    } else if (IP_ADDR_PCB_VERSION_MATCH_EXACT(lpcb, local_ip)) {
+      if (ip_addr_cmp(&lpcb->local_ip, local_ip)) {
+        /* found an exact match */
+        return lpcb;
+      } else if (ip_addr_isany(&lpcb->local_ip) && (lpcb_any == NULL)) {
+        /* found an ANY-match */
+        lpcb_any = lpcb;
+      }
+    }
+  }
+  return lpcb_any;
+}
+#endif /* TCP_PCB_HASH */
+
+#if TCP_TIMER_LISTS
+/** List of the active pcbs with timer work pending */
+struct tcp_pcb *tcp_timer_pcbs;
+/** List of the pcbs with a delayed ACK, in the order they are due */
+static struct tcp_pcb *tcp_delack_pcbs;
+static struct tcp_pcb **tcp_delack_tail = &tcp_delack_pcbs;
+static u8_t tcp_delack_timer_active;
+
+#define TCP_TIMER_FIRST tcp_timer_pcbs
+#define TCP_TIMER_NEXT(pcb) ((pcb)->timer_next)
+#else /* TCP_TIMER_LISTS */
+#define TCP_TIMER_FIRST tcp_active_pcbs
+#define TCP_TIMER_NEXT(pcb) ((pcb)->next)
+#endif /* TCP_TIMER_LISTS */
+
 /** Timer counter to handle calling slow-timer from tcp_tmr() */
 static u8_t tcp_timer;
 static u8_t tcp_timer_ctr;
@@ -205,11 +380,161 @@ tcp_init(void)
 #endif /* LWIP_RAND */
 }
 
+#if TCP_TIMER_LISTS
+/* Whether a pcb is in a state in which it is on tcp_active_pcbs */
+#define TCP_STATE_ACTIVE(pcb) (((pcb)->state != CLOSED) && ((pcb)->state != LISTEN) && \
+                               ((pcb)->state != TIME_WAIT))
+
+/**
+ * Put an active pcb on tcp_timer_pcbs if it is not there yet. Called
+ * wherever timer work can start: when the pcb is registered, has
+ * processed a segment, queues or sends data, starts the persist timer,
+ * fails to send a FIN or gets a poll callback.
+ */
+void
+tcp_timer_pending(struct tcp_pcb *pcb)
+{
+  if ((pcb->timer_pprev == NULL) && TCP_STATE_ACTIVE(pcb)) {
+    pcb->timer_next = tcp_timer_pcbs;
+    if (tcp_timer_pcbs != NULL) {
+      tcp_timer_pcbs->timer_pprev = &pcb->timer_next;
+    }
+    pcb->timer_pprev = &tcp_timer_pcbs;
+    tcp_timer_pcbs = pcb;
+  }
+}
+
+static void
+tcp_timer_unlink(struct tcp_pcb *pcb)
+{
+  if (pcb->timer_pprev != NULL) {
+    *pcb->timer_pprev = pcb->timer_next;
+    if (pcb->timer_next != NULL) {
+      pcb->timer_next->timer_pprev = pcb->timer_pprev;
+    }
+    pcb->timer_next = NULL;
+    pcb->timer_pprev = NULL;
+  }
+}
+
+static void
+tcp_delack_unlink(struct tcp_pcb *pcb)
+{
+  if (pcb->delack_pprev != NULL) {
+    *pcb->delack_pprev = pcb->delack_next;
+    if (pcb->delack_next != NULL) {
+      pcb->delack_next->delack_pprev = pcb->delack_pprev;
+    } else {
+      tcp_delack_tail = pcb->delack_pprev;
+    }
+    pcb->delack_next = NULL;
+    pcb->delack_pprev = NULL;
+  }
+}
+
+/**
+ * Take a pcb off the timer and delayed ACK lists, when it leaves
+ * tcp_active_pcbs or is freed.
+ */
+void
+tcp_timer_remove(struct tcp_pcb *pcb)
+{
+  tcp_timer_unlink(pcb);
+  tcp_delack_unlink(pcb);
+}
+
+/**
+ * Whether an active pcb has no timer work left, so that it can leave
+ * tcp_timer_pcbs until tcp_timer_pending() puts it back. Keepalive is
+ * checked here only, so a pcb on which SOF_KEEPALIVE is set while it is
+ * idle starts its keepalive timer with its next segment.
+ */
+static int
+tcp_timer_idle(struct tcp_pcb *pcb)
+{
+#if LWIP_EVENT_API
+  /* The poll event is sent whatever the pcb does */
+  LWIP_UNUSED_ARG(pcb);
+  return 0;
+#else /* LWIP_EVENT_API */
+  if ((pcb->state != ESTABLISHED) && (pcb->state != CLOSE_WAIT) &&
+      ((pcb->state != FIN_WAIT_2) || (pcb->flags & TF_RXCLOSED))) {
+    /* the other states time out */
+    return 0;
+  }
+  return (pcb->unsent == NULL) && (pcb->unacked == NULL) &&
+         (pcb->rtime < 0) && (pcb->persist_backoff == 0) &&
+         (pcb->refused_data == NULL) &&
+#if TCP_QUEUE_OOSEQ
+         (pcb->ooseq == NULL) &&
+#endif /* TCP_QUEUE_OOSEQ */
+         ((pcb->flags & (TF_ACK_NOW | TF_CLOSEPEND)) == 0) &&
+         !ip_get_option(pcb, SOF_KEEPALIVE) && (pcb->poll == NULL);
+#endif /* LWIP_EVENT_API */
+}
+
+/**
+ * Send the delayed ACKs that are due, and wait for the next one.
+ */
+static void
+tcp_delack_tmr(void *arg)
+{
+  struct tcp_pcb *pcb;
+  u32_t now = sys_now();
+
+  LWIP_UNUSED_ARG(arg);
+  tcp_delack_timer_active = 0;
+
+  while (((pcb = tcp_delack_pcbs) != NULL) && ((s32_t)(now - pcb->delack_due) >= 0)) {
+    tcp_delack_unlink(pcb);
+    /* The ACK may have gone out with data since */
+    if ((pcb->flags & TF_ACK_DELAY) && TCP_STATE_ACTIVE(pcb)) {
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_delack_tmr: delayed ACK\n"));
+      tcp_ack_now(pcb);
+      /* If this fails, the ACK is delayed again */
+      tcp_output(pcb);
+    }
+  }
+
+  if (pcb != NULL) {
+    tcp_delack_timer_active = 1;
+    sys_timeout(pcb->delack_due - now, tcp_delack_tmr, NULL);
+  }
+}
+
+/**
+ * Send an ACK TCP_ACK_DELAY_MS from now, unless it goes out with data
+ * before. Called when TF_ACK_DELAY is set.
+ */
+void
+tcp_delack_add(struct tcp_pcb *pcb)
+{
+  if (!TCP_STATE_ACTIVE(pcb)) {
+    return;
+  }
+  /* The ACK is due TCP_ACK_DELAY_MS after the latest segment to delay it */
+  tcp_delack_unlink(pcb);
+  pcb->delack_due = sys_now() + TCP_ACK_DELAY_MS;
+  pcb->delack_next = NULL;
+  pcb->delack_pprev = tcp_delack_tail;
+  *tcp_delack_tail = pcb;
+  tcp_delack_tail = &pcb->delack_next;
+
+  if (!tcp_delack_timer_active) {
+    tcp_delack_timer_active = 1;
+    sys_timeout(TCP_ACK_DELAY_MS, tcp_delack_tmr, NULL);
+  }
+}
+#endif /* TCP_TIMER_LISTS */
+
 /** Free a tcp pcb */
 void
 tcp_free(struct tcp_pcb *pcb)
 {
   LWIP_ASSERT("tcp_free: LISTEN", pcb->state != LISTEN);
+#if TCP_TIMER_LISTS
+  tcp_timer_remove(pcb);
+#endif /* TCP_TIMER_LISTS */
 #if LWIP_TCP_PCB_NUM_EXT_ARGS
   tcp_ext_arg_invoke_callbacks_destroyed(pcb->ext_args);
 #endif
@@ -449,6 +774,7 @@ tcp_close_shutdown_fin(struct tcp_pcb *pcb)
   } else if (err == ERR_MEM) {
     /* Mark this pcb for closing. Closing is retried from tcp_tmr. */
     tcp_set_flags(pcb, TF_CLOSEPEND);
+    TCP_TIMER_PENDING(pcb);
     /* We have to return ERR_OK from here to indicate to the callers that this
        pcb should not be used any more as it will be freed soon via tcp_tmr.
        This is OK here since sending FIN does not guarantee a time frime for
@@ -1193,7 +1519,6 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *prev;
-  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   u8_t pcb_reset;       /* flag if a RST should be sent when removing */
   err_t err;
@@ -1204,9 +1529,10 @@ tcp_slowtmr(void)
   ++tcp_timer_ctr;
 
 tcp_slowtmr_start:
-  /* Steps through all of the active PCBs. */
+  /* Steps through all of the active PCBs (with TCP_TIMER_LISTS, the ones
+     with timer work pending). */
   prev = NULL;
-  pcb = tcp_active_pcbs;
+  pcb = TCP_TIMER_FIRST;
   if (pcb == NULL) {
     LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: no active pcbs\n"));
   }
@@ -1218,7 +1544,7 @@ tcp_slowtmr_start:
     if (pcb->last_timer == tcp_timer_ctr) {
       /* skip this pcb, we have already processed it */
       prev = pcb;
-      pcb = pcb->next;
+      pcb = TCP_TIMER_NEXT(pcb);
       continue;
     }
     pcb->last_timer = tcp_timer_ctr;
@@ -1294,11 +1620,7 @@ tcp_slowtmr_start:
             pcb->rtime = 0;
 
             /* Reduce congestion window and ssthresh. */
-            eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
-            pcb->ssthresh = eff_wnd >> 1;
-            if (pcb->ssthresh < (tcpwnd_size_t)(pcb->mss << 1)) {
-              pcb->ssthresh = (tcpwnd_size_t)(pcb->mss << 1);
-            }
+            TCP_CC(pcb)->on_rto(pcb);
             pcb->cwnd = pcb->mss;
             LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
                                          " ssthresh %"TCPWNDSIZE_F"\n",
@@ -1386,6 +1708,13 @@ tcp_slowtmr_start:
       enum tcp_state last_state;
       tcp_pcb_purge(pcb);
       /* Remove PCB from tcp_active_pcbs list. */
+#if TCP_TIMER_LISTS
+      /* prev is on tcp_timer_pcbs, so search tcp_active_pcbs */
+      pcb2 = pcb->timer_next;
+      TCP_RMV(&tcp_active_pcbs, pcb);
+      pcb->next = pcb2;
+#else /* TCP_TIMER_LISTS */
+      TCP_HASH_RMV(&tcp_active_pcbs, pcb);
       if (prev != NULL) {
         LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_active_pcbs", pcb != tcp_active_pcbs);
         prev->next = pcb->next;
@@ -1394,6 +1723,7 @@ tcp_slowtmr_start:
         LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_active_pcbs", tcp_active_pcbs == pcb);
         tcp_active_pcbs = pcb->next;
       }
+#endif /* TCP_TIMER_LISTS */
 
       if (pcb_reset) {
         tcp_rst(pcb, pcb->snd_nxt, pcb->rcv_nxt, &pcb->local_ip, &pcb->remote_ip,
@@ -1414,7 +1744,7 @@ tcp_slowtmr_start:
     } else {
       /* get the 'next' element now and work with 'prev' below (in case of abort) */
       prev = pcb;
-      pcb = pcb->next;
+      pcb = TCP_TIMER_NEXT(pcb);
 
       /* We check if we should poll the connection. */
       ++prev->polltmr;
@@ -1431,6 +1761,11 @@ tcp_slowtmr_start:
           tcp_output(prev);
         }
       }
+#if TCP_TIMER_LISTS
+      if (tcp_timer_idle(prev)) {
+        tcp_timer_unlink(prev);
+      }
+#endif /* TCP_TIMER_LISTS */
     }
   }
 
@@ -1452,6 +1787,7 @@ tcp_slowtmr_start:
       struct tcp_pcb *pcb2;
       tcp_pcb_purge(pcb);
       /* Remove PCB from tcp_tw_pcbs list. */
+      TCP_HASH_RMV(&tcp_tw_pcbs, pcb);
       if (prev != NULL) {
         LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_tw_pcbs", pcb != tcp_tw_pcbs);
         prev->next = pcb->next;
@@ -1484,12 +1820,13 @@ tcp_fasttmr(void)
   ++tcp_timer_ctr;
 
 tcp_fasttmr_start:
-  pcb = tcp_active_pcbs;
+  pcb = TCP_TIMER_FIRST;
 
   while (pcb != NULL) {
     if (pcb->last_timer != tcp_timer_ctr) {
       struct tcp_pcb *next;
       pcb->last_timer = tcp_timer_ctr;
+#if !TCP_TIMER_LISTS
       /* send delayed ACKs */
       if (pcb->flags & TF_ACK_DELAY) {
         LWIP_DEBUGF(TCP_DEBUG, ("tcp_fasttmr: delayed ACK\n"));
@@ -1497,6 +1834,7 @@ tcp_fasttmr_start:
         tcp_output(pcb);
         tcp_clear_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
       }
+#endif /* !TCP_TIMER_LISTS */
       /* send pending FIN */
       if (pcb->flags & TF_CLOSEPEND) {
         LWIP_DEBUGF(TCP_DEBUG, ("tcp_fasttmr: pending FIN\n"));
@@ -1504,7 +1842,7 @@ tcp_fasttmr_start:
         tcp_close_shutdown_fin(pcb);
       }
 
-      next = pcb->next;
+      next = TCP_TIMER_NEXT(pcb);
 
       /* If there is data which was previously "refused" by upper layer */
       if (pcb->refused_data != NULL) {
@@ -1517,7 +1855,7 @@ tcp_fasttmr_start:
       }
       pcb = next;
     } else {
-      pcb = pcb->next;
+      pcb = TCP_TIMER_NEXT(pcb);
     }
   }
 }
@@ -1651,6 +1989,29 @@ tcp_setprio(struct tcp_pcb *pcb, u8_t prio)
   pcb->prio = prio;
 }
 
+#if LWIP_TCP_CC
+/**
+ * @ingroup tcp_raw
+ * Sets the congestion control algorithm of a connection, e.g. &tcp_cc_cubic.
+ * Connections accepted by a listener start with TCP_CC_DEFAULT, so set it
+ * from the accept callback to change it for those.
+ *
+ * @param pcb the tcp_pcb to manipulate
+ * @param cc the congestion control operations to use from now on
+ */
+void
+tcp_set_cc(struct tcp_pcb *pcb, const struct tcp_cc_ops *cc)
+{
+  LWIP_ASSERT_CORE_LOCKED();
+
+  LWIP_ERROR("tcp_set_cc: invalid pcb", pcb != NULL, return);
+  LWIP_ERROR("tcp_set_cc: invalid cc", cc != NULL, return);
+
+  pcb->cc = cc;
+  cc->init(pcb);
+}
+#endif /* LWIP_TCP_CC */
+
 #if TCP_QUEUE_OOSEQ
 /**
  * Returns a copy of the given TCP segment.
@@ -1912,6 +2273,10 @@ tcp_alloc(u8_t prio)
     connection is established. To avoid these complications, we set ssthresh to the
     largest effective cwnd (amount of in-flight data) that the sender can have. */
     pcb->ssthresh = TCP_SND_BUF;
+#if LWIP_TCP_CC
+    pcb->cc = TCP_CC_DEFAULT;
+    pcb->cc->init(pcb);
+#endif /* LWIP_TCP_CC */
 
 #if LWIP_CALLBACK_API
     pcb->recv = tcp_recv_null;
@@ -2119,6 +2484,7 @@ tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval)
   LWIP_UNUSED_ARG(poll);
 #endif /* LWIP_CALLBACK_API */
   pcb->pollinterval = interval;
+  TCP_TIMER_PENDING(pcb);
 }
 
 /**
@@ -0,0 +1,251 @@
+/**
+ * @file
+ * Transmission Control Protocol, congestion control
+ *
+ * The congestion control algorithms a pcb can use (see struct tcp_cc_ops).
+ * TCP calls them as data is acknowledged, and as it detects a loss by fast
+ * retransmit or by the retransmission timer.
+ *
+ */
+
+/*
+ * Copyright (c) 2022 UNSW
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP /* don't build if not configured for use in lwipopts.h */
+
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/tcp_cc.h"
+#include "lwip/def.h"
+#include "lwip/sys.h"
+
+#include <string.h>
+
+/* RFC 3465, section 2.2 Slow Start */
+static void
+tcp_cc_slow_start(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  tcpwnd_size_t increase;
+  /* limit to 1 SMSS segment during period following RTO */
+  u8_t num_seg = (pcb->flags & TF_RTO) ? 1 : 2;
+
+  increase = LWIP_MIN(acked, (tcpwnd_size_t)(num_seg * pcb->mss));
+  TCP_WND_INC(pcb->cwnd, increase);
+  LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
+}
+
+static void
+tcp_newreno_init(struct tcp_pcb *pcb)
+{
+  LWIP_UNUSED_ARG(pcb);
+}
+
+static void
+tcp_newreno_on_ack(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  if (pcb->cwnd < pcb->ssthresh) {
+    tcp_cc_slow_start(pcb, acked);
+  } else {
+    /* RFC 3465, section 2.1 Congestion Avoidance */
+    TCP_WND_INC(pcb->bytes_acked, acked);
+    if (pcb->bytes_acked >= pcb->cwnd) {
+      pcb->bytes_acked = (tcpwnd_size_t)(pcb->bytes_acked - pcb->cwnd);
+      TCP_WND_INC(pcb->cwnd, pcb->mss);
+    }
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
+  }
+}
+
+static void
+tcp_newreno_on_loss(struct tcp_pcb *pcb)
+{
+  /* Set ssthresh to half of the minimum of the current
+   * cwnd and the advertised window */
+  pcb->ssthresh = LWIP_MIN(pcb->cwnd, pcb->snd_wnd) / 2;
+
+  /* The minimum value for ssthresh should be 2 MSS */
+  if (pcb->ssthresh < (2U * pcb->mss)) {
+    LWIP_DEBUGF(TCP_FR_DEBUG,
+                ("tcp_receive: The minimum value for ssthresh %"TCPWNDSIZE_F
+                 " should be min 2 mss %"U16_F"...\n",
+                 pcb->ssthresh, (u16_t)(2 * pcb->mss)));
+    pcb->ssthresh = 2 * pcb->mss;
+  }
+}
+
+const struct tcp_cc_ops tcp_cc_newreno = {
+  "newreno",
+  tcp_newreno_init,
+  tcp_newreno_on_ack,
+  tcp_newreno_on_loss,
+  tcp_newreno_on_loss
+};
+
+#if LWIP_TCP_CC
+
+/* CUBIC (RFC 9438) in bytes and milliseconds: the window shrinks by BETA on
+   a loss, then follows W(t) = C * (t - K)^3 + origin, a curve that levels
+   off at the window of the last loss and grows past it. C is in MSS/s^3. */
+#define TCP_CUBIC_BETA_NUM   7
+#define TCP_CUBIC_BETA_DEN   10
+#define TCP_CUBIC_C_NUM      4
+#define TCP_CUBIC_C_DEN      10
+/* The NewReno-friendly increase per window, 3 * (1 - BETA) / (1 + BETA) */
+#define TCP_CUBIC_ALPHA_NUM  9
+#define TCP_CUBIC_ALPHA_DEN  17
+/* Keep (t - K)^3 * mss within 64 bits */
+#define TCP_CUBIC_MAX_T      (1UL << 20)
+
+/* The integer cube root, bit by bit */
+static u32_t
+tcp_cubic_cbrt(u64_t x)
+{
+  u64_t y = 0;
+  u64_t b;
+  int s;
+
+  for (s = 63; s >= 0; s -= 3) {
+    y <<= 1;
+    b = 3 * y * (y + 1) + 1;
+    if ((x >> s) >= b) {
+      x -= b << s;
+      y++;
+    }
+  }
+  return (u32_t)y;
+}
+
+static void
+tcp_cubic_init(struct tcp_pcb *pcb)
+{
+  memset(&pcb->cc_state.cubic, 0, sizeof(pcb->cc_state.cubic));
+}
+
+/* Start growing along a new curve from the current cwnd */
+static void
+tcp_cubic_start_epoch(struct tcp_pcb *pcb)
+{
+  struct tcp_cc_cubic_state *cubic = &pcb->cc_state.cubic;
+
+  cubic->in_epoch = 1;
+  cubic->epoch_start = sys_now();
+  cubic->w_est = pcb->cwnd;
+  pcb->bytes_acked = 0;
+  if (pcb->cwnd < cubic->w_max) {
+    /* K = cbrt((w_max - cwnd) / C), in ms */
+    cubic->k = tcp_cubic_cbrt((u64_t)(cubic->w_max - pcb->cwnd) *
+                              (1000000000ULL * TCP_CUBIC_C_DEN / TCP_CUBIC_C_NUM) / pcb->mss);
+    cubic->origin = cubic->w_max;
+  } else {
+    cubic->k = 0;
+    cubic->origin = pcb->cwnd;
+  }
+}
+
+static void
+tcp_cubic_on_ack(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  struct tcp_cc_cubic_state *cubic = &pcb->cc_state.cubic;
+  u32_t t, d, target, per_mss, n;
+  u64_t delta;
+
+  if (pcb->cwnd < pcb->ssthresh) {
+    tcp_cc_slow_start(pcb, acked);
+    return;
+  }
+  if (!cubic->in_epoch) {
+    tcp_cubic_start_epoch(pcb);
+  }
+
+  /* Aim for W(t + RTT), with lwIP's smoothed RTT (in slow timer ticks) */
+  t = sys_now() - cubic->epoch_start + (u32_t)(pcb->sa >> 3) * TCP_SLOW_INTERVAL;
+  d = (t > cubic->k) ? t - cubic->k : cubic->k - t;
+  d = LWIP_MIN(d, TCP_CUBIC_MAX_T);
+  delta = (u64_t)d * d * d / 1000000 * pcb->mss * TCP_CUBIC_C_NUM / (1000 * TCP_CUBIC_C_DEN);
+  if (t > cubic->k) {
+    target = (u32_t)LWIP_MIN((u64_t)cubic->origin + delta, 0xffffffffUL);
+  } else {
+    target = (delta < cubic->origin) ? (u32_t)(cubic->origin - delta) : 0;
+  }
+
+  /* Grow at least as fast as NewReno would, which it does by ALPHA MSS per
+     window while below w_max and by 1 MSS per window above it */
+  if (cubic->w_est < cubic->w_max) {
+    cubic->w_est += (u32_t)((u64_t)acked * pcb->mss * TCP_CUBIC_ALPHA_NUM / ((u64_t)TCP_CUBIC_ALPHA_DEN * pcb->cwnd));
+  } else {
+    cubic->w_est += (u32_t)((u64_t)acked * pcb->mss / pcb->cwnd);
+  }
+  target = LWIP_MAX(target, cubic->w_est);
+
+  /* At most by half a window per RTT */
+  target = LWIP_MIN(target, (u32_t)pcb->cwnd + pcb->cwnd / 2);
+  if (target > pcb->cwnd) {
+    /* (target - cwnd) / cwnd MSS for every MSS acked */
+    per_mss = (u32_t)((u64_t)pcb->cwnd * pcb->mss / (target - pcb->cwnd));
+    TCP_WND_INC(pcb->bytes_acked, acked);
+    n = pcb->bytes_acked / per_mss;
+    pcb->bytes_acked = (tcpwnd_size_t)(pcb->bytes_acked - n * per_mss);
+    TCP_WND_INC(pcb->cwnd, (tcpwnd_size_t)(n * pcb->mss));
+  }
+  LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: cubic cwnd %"TCPWNDSIZE_F" target %"U32_F"\n", pcb->cwnd, target));
+}
+
+static void
+tcp_cubic_on_loss(struct tcp_pcb *pcb)
+{
+  struct tcp_cc_cubic_state *cubic = &pcb->cc_state.cubic;
+  tcpwnd_size_t wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
+
+  /* Fast convergence: a flow losing below its last maximum releases
+     some of its share to newer flows */
+  if (wnd < cubic->w_max) {
+    cubic->w_max = (u32_t)((u64_t)wnd * (TCP_CUBIC_BETA_DEN + TCP_CUBIC_BETA_NUM) / (2 * TCP_CUBIC_BETA_DEN));
+  } else {
+    cubic->w_max = wnd;
+  }
+  pcb->ssthresh = (tcpwnd_size_t)((u64_t)wnd * TCP_CUBIC_BETA_NUM / TCP_CUBIC_BETA_DEN);
+  if (pcb->ssthresh < (2U * pcb->mss)) {
+    pcb->ssthresh = 2 * pcb->mss;
+  }
+  cubic->in_epoch = 0;
+}
+
+const struct tcp_cc_ops tcp_cc_cubic = {
+  "cubic",
+  tcp_cubic_init,
+  tcp_cubic_on_ack,
+  tcp_cubic_on_loss,
+  tcp_cubic_on_loss
+};
+
+#endif /* LWIP_TCP_CC */
+
+#endif /* LWIP_TCP */
@@ -65,6 +65,13 @@
 #include LWIP_HOOK_FILENAME
 #endif
 
+#if LWIP_TCP_SACK_IN
+/** SACK recovery goes on until all data outstanding at its start is acknowledged */
+#define TCP_RECOVERY_DONE(pcb, ackno) (!((pcb)->flags & TF_SACK) || TCP_SEQ_GEQ(ackno, (pcb)->recover))
+#else /* LWIP_TCP_SACK_IN */
+#define TCP_RECOVERY_DONE(pcb, ackno) 1
+#endif /* LWIP_TCP_SACK_IN */
+
 /** Initial CWND calculation as defined RFC 2581 */
 #define LWIP_TCP_CALC_INITIAL_CWND(mss) ((tcpwnd_size_t)LWIP_MIN((4U * (mss)), LWIP_MAX((2U * (mss)), 4380U)))
 
@@ -85,6 +92,13 @@ static u8_t flags;
 static u8_t recv_flags;
 static struct pbuf *recv_data;
 
+#if LWIP_TCP_SACK_IN
+/* The SACK blocks of the incoming segment: at most 4 fit in the options */
+#define TCP_SACK_IN_MAX 4
+static struct tcp_sack_range tcp_in_sacks[TCP_SACK_IN_MAX];
+static u8_t tcp_in_sack_num;
+#endif /* LWIP_TCP_SACK_IN */
+
 struct tcp_pcb *tcp_input_pcb;
 
 /* Forward declarations. */
@@ -104,6 +118,9 @@ static void tcp_remove_sacks_lt(struct tcp_pcb *pcb, u32_t seq);
 static void tcp_remove_sacks_gt(struct tcp_pcb *pcb, u32_t seq);
 #endif /* TCP_OOSEQ_BYTES_LIMIT || TCP_OOSEQ_PBUFS_LIMIT */
 #endif /* LWIP_TCP_SACK_OUT */
+#if LWIP_TCP_SACK_IN
+static int tcp_sack_update(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK_IN */
 
 /**
  * The initial input processing of TCP. It verifies the TCP header, demultiplexes
@@ -117,12 +134,15 @@ static void tcp_remove_sacks_gt(struct tcp_pcb *pcb, u32_t seq);
 void
 tcp_input(struct pbuf *p, struct netif *inp)
 {
-  struct tcp_pcb *pcb, *prev;
+  struct tcp_pcb *pcb;
   struct tcp_pcb_listen *lpcb;
+#if !TCP_PCB_HASH
+  struct tcp_pcb *prev;
 #if SO_REUSE
   struct tcp_pcb *lpcb_prev = NULL;
   struct tcp_pcb_listen *lpcb_any = NULL;
 #endif /* SO_REUSE */
+#endif /* !TCP_PCB_HASH */
   u8_t hdrlen_bytes;
   err_t err;
 
@@ -250,6 +270,22 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
   /* Demultiplex an incoming segment. First, we check if it is destined
      for an active connection. */
+#if TCP_PCB_HASH
+  pcb = tcp_pcb_hash_lookup(tcphdr->dest, tcphdr->src, ip_current_dest_addr(),
+                            ip_current_src_addr(), netif_get_index(ip_data.current_input_netif));
+  if ((pcb != NULL) && (pcb->state == TIME_WAIT)) {
+    LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for TIME_WAITing connection.\n"));
+#ifdef LWIP_HOOK_TCP_INPACKET_PCB
+    if (LWIP_HOOK_TCP_INPACKET_PCB(pcb, tcphdr, tcphdr_optlen, tcphdr_opt1len,
+                                   tcphdr_opt2, p) == ERR_OK)
+#endif
+    {
+      tcp_timewait_input(pcb);
+    }
+    pbuf_free(p);
+    return;
+  }
+#else /* TCP_PCB_HASH */
   prev = NULL;
 
   for (pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
@@ -284,8 +320,10 @@ tcp_input(struct pbuf *p, struct netif *inp)
     }
     prev = pcb;
   }
+#endif /* TCP_PCB_HASH */
 
   if (pcb == NULL) {
+#if !TCP_PCB_HASH
     /* If it did not go to an active connection, we check the connections
        in the TIME-WAIT state. */
     for (pcb = tcp_tw_pcbs; pcb != NULL; pcb = pcb->next) {
@@ -316,9 +354,14 @@ tcp_input(struct pbuf *p, struct netif *inp)
         return;
       }
     }
+#endif /* !TCP_PCB_HASH */
 
     /* Finally, if we still did not get a match, we check all PCBs that
        are LISTENing for incoming connections. */
+#if TCP_PCB_HASH
+    lpcb = tcp_listen_hash_lookup(tcphdr->dest, ip_current_dest_addr(),
+                                  netif_get_index(ip_data.current_input_netif));
+#else /* TCP_PCB_HASH */
     prev = NULL;
     for (lpcb = tcp_listen_pcbs.listen_pcbs; lpcb != NULL; lpcb = lpcb->next) {
       /* check if PCB is bound to specific netif */
@@ -362,7 +405,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
       prev = lpcb_prev;
     }
 #endif /* SO_REUSE */
+#endif /* TCP_PCB_HASH */
     if (lpcb != NULL) {
+#if !TCP_PCB_HASH
       /* Move this PCB to the front of the list so that subsequent
          lookups will be faster (we exploit locality in TCP segment
          arrivals). */
@@ -375,6 +420,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
       } else {
         TCP_STATS_INC(tcp.cachehit);
       }
+#endif /* !TCP_PCB_HASH */
 
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for LISTENing connection.\n"));
 #ifdef LWIP_HOOK_TCP_INPACKET_PCB
@@ -556,6 +602,8 @@ tcp_input(struct pbuf *p, struct netif *inp)
         }
         /* Try to send something out. */
         tcp_output(pcb);
+        /* Timers may have started or stopped with this segment */
+        TCP_TIMER_PENDING(pcb);
 #if TCP_INPUT_DEBUG
 #if TCP_DEBUG
         tcp_debug_print_state(pcb->state);
@@ -1149,6 +1197,9 @@ tcp_receive(struct tcp_pcb *pcb)
   s16_t m;
   u32_t right_wnd_edge;
   int found_dupack = 0;
+#if LWIP_TCP_SACK_IN
+  int sack_lost;
+#endif /* LWIP_TCP_SACK_IN */
 
   LWIP_ASSERT("tcp_receive: invalid pcb", pcb != NULL);
   LWIP_ASSERT("tcp_receive: wrong state", pcb->state >= ESTABLISHED);
@@ -1180,6 +1231,11 @@ tcp_receive(struct tcp_pcb *pcb)
 #endif /* TCP_WND_DEBUG */
     }
 
+#if LWIP_TCP_SACK_IN
+    /* Mark the SACKed segments before the ACK frees any */
+    sack_lost = tcp_sack_update(pcb);
+#endif /* LWIP_TCP_SACK_IN */
+
     /* (From Stevens TCP/IP Illustrated Vol II, p970.) Its only a
      * duplicate ack if:
      * 1) It doesn't ACK new data
@@ -1214,6 +1270,12 @@ tcp_receive(struct tcp_pcb *pcb)
               if ((u8_t)(pcb->dupacks + 1) > pcb->dupacks) {
                 ++pcb->dupacks;
               }
+#if LWIP_TCP_SACK_IN
+              if ((pcb->flags & (TF_INFR | TF_SACK)) == (TF_INFR | TF_SACK)) {
+                /* RFC 6675 sends by the pipe estimate instead of inflating cwnd */
+                tcp_rexmit_sack(pcb);
+              } else
+#endif /* LWIP_TCP_SACK_IN */
               if (pcb->dupacks > 3) {
                 /* Inflate the congestion window */
                 TCP_WND_INC(pcb->cwnd, pcb->mss);
@@ -1222,6 +1284,12 @@ tcp_receive(struct tcp_pcb *pcb)
                 /* Do fast retransmit (checked via TF_INFR, not via dupacks count) */
                 tcp_rexmit_fast(pcb);
               }
+#if LWIP_TCP_SACK_IN
+              else if (sack_lost) {
+                /* or as soon as SACKs show the first segment lost */
+                tcp_rexmit_fast(pcb);
+              }
+#endif /* LWIP_TCP_SACK_IN */
             }
           }
         }
@@ -1238,7 +1306,7 @@ tcp_receive(struct tcp_pcb *pcb)
       /* Reset the "IN Fast Retransmit" flag, since we are no longer
          in fast retransmit. Also reset the congestion window to the
          slow start threshold. */
-      if (pcb->flags & TF_INFR) {
+      if ((pcb->flags & TF_INFR) && TCP_RECOVERY_DONE(pcb, ackno)) {
         tcp_clear_flags(pcb, TF_INFR);
         pcb->cwnd = pcb->ssthresh;
         pcb->bytes_acked = 0;
@@ -1258,25 +1326,9 @@ tcp_receive(struct tcp_pcb *pcb)
       pcb->lastack = ackno;
 
       /* Update the congestion control variables (cwnd and
-         ssthresh). */
-      if (pcb->state >= ESTABLISHED) {
-        if (pcb->cwnd < pcb->ssthresh) {
-          tcpwnd_size_t increase;
-          /* limit to 1 SMSS segment during period following RTO */
-          u8_t num_seg = (pcb->flags & TF_RTO) ? 1 : 2;
-          /* RFC 3465, section 2.2 Slow Start */
-          increase = LWIP_MIN(acked, (tcpwnd_size_t)(num_seg * pcb->mss));
-          TCP_WND_INC(pcb->cwnd, increase);
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
-        } else {
-          /* RFC 3465, section 2.1 Congestion Avoidance */
-          TCP_WND_INC(pcb->bytes_acked, acked);
-          if (pcb->bytes_acked >= pcb->cwnd) {
-            pcb->bytes_acked = (tcpwnd_size_t)(pcb->bytes_acked - pcb->cwnd);
-            TCP_WND_INC(pcb->cwnd, pcb->mss);
-          }
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
-        }
+         ssthresh), unless still in (SACK) recovery. */
+      if ((pcb->state >= ESTABLISHED) && !(pcb->flags & TF_INFR)) {
+        TCP_CC(pcb)->on_ack(pcb, acked);
       }
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: ACK for %"U32_F", unacked->seqno %"U32_F":%"U32_F"\n",
                                     ackno,
@@ -1312,6 +1364,13 @@ tcp_receive(struct tcp_pcb *pcb)
       }
 #endif /* TCP_OVERSIZE */
 
+#if LWIP_TCP_SACK_IN
+      if (pcb->flags & TF_INFR) {
+        /* a partial ACK in SACK recovery */
+        tcp_rexmit_sack(pcb);
+      }
+#endif /* LWIP_TCP_SACK_IN */
+
 #if LWIP_IPV6 && LWIP_ND6_TCP_REACHABILITY_HINTS
       if (ip_current_is_v6()) {
         /* Inform neighbor reachability of forward progress. */
@@ -1903,6 +1962,17 @@ tcp_get_next_optbyte(void)
   }
 }
 
+#if LWIP_TCP_SACK_IN
+static u32_t
+tcp_get_next_optword(void)
+{
+  u32_t word = (u32_t)tcp_get_next_optbyte() << 24;
+  word |= (u32_t)tcp_get_next_optbyte() << 16;
+  word |= (u32_t)tcp_get_next_optbyte() << 8;
+  return word | tcp_get_next_optbyte();
+}
+#endif /* LWIP_TCP_SACK_IN */
+
 /**
  * Parses the options contained in the incoming segment.
  *
@@ -1922,6 +1992,10 @@ tcp_parseopt(struct tcp_pcb *pcb)
 
   LWIP_ASSERT("tcp_parseopt: invalid pcb", pcb != NULL);
 
+#if LWIP_TCP_SACK_IN
+  tcp_in_sack_num = 0;
+#endif /* LWIP_TCP_SACK_IN */
+
   /* Parse the TCP MSS option, if present. */
   if (tcphdr_optlen != 0) {
     for (tcp_optidx = 0; tcp_optidx < tcphdr_optlen; ) {
@@ -2014,6 +2088,27 @@ tcp_parseopt(struct tcp_pcb *pcb)
           }
           break;
 #endif /* LWIP_TCP_SACK_OUT */
+#if LWIP_TCP_SACK_IN
+        case LWIP_TCP_OPT_SACK:
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: SACK\n"));
+          data = tcp_get_next_optbyte();
+          if ((data < 2 + 8) || (((data - 2) % 8) != 0) || (tcp_optidx - 2 + data) > tcphdr_optlen) {
+            /* Bad length */
+            LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: bad length\n"));
+            return;
+          }
+          /* TCP SACK option with valid length: read the blocks */
+          for (data = (u8_t)((data - 2) / 8); data > 0; data--) {
+            u32_t left = tcp_get_next_optword();
+            u32_t right = tcp_get_next_optword();
+            if (tcp_in_sack_num < TCP_SACK_IN_MAX) {
+              tcp_in_sacks[tcp_in_sack_num].left = left;
+              tcp_in_sacks[tcp_in_sack_num].right = right;
+              tcp_in_sack_num++;
+            }
+          }
+          break;
+#endif /* LWIP_TCP_SACK_IN */
         default:
           LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: other\n"));
           data = tcp_get_next_optbyte();
@@ -2181,4 +2276,74 @@ tcp_remove_sacks_gt(struct tcp_pcb *pcb, u32_t seq)
 
 #endif /* LWIP_TCP_SACK_OUT */
 
+#if LWIP_TCP_SACK_IN
+/**
+ * Called by tcp_receive() to mark the unacked segments that the SACK blocks
+ * of the incoming ACK cover (the scoreboard of RFC 6675). Segments that a
+ * block covers in part, such as TCP_GSO segments, are split at its edge.
+ *
+ * @param pcb the tcp_pcb for which the ACK arrived
+ * @return 1 if the first segment the ACK leaves unacknowledged is now
+ *         presumed lost, 0 otherwise
+ */
+static int
+tcp_sack_update(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg, *first = NULL;
+  u32_t una, left, right, seq;
+  u32_t sacked = 0;
+  u16_t nsacked = 0;
+  u8_t i;
+
+  if (!(pcb->flags & TF_SACK) || (tcp_in_sack_num == 0)) {
+    return 0;
+  }
+
+  una = TCP_SEQ_BETWEEN(ackno, pcb->lastack, pcb->snd_nxt) ? ackno : pcb->lastack;
+  for (i = 0; i < tcp_in_sack_num; i++) {
+    left = tcp_in_sacks[i].left;
+    right = tcp_in_sacks[i].right;
+    /* Ignore D-SACKs and blocks beyond the data sent */
+    if (!TCP_SEQ_LT(una, left) || !TCP_SEQ_LT(left, right) || TCP_SEQ_GT(right, pcb->snd_nxt)) {
+      continue;
+    }
+    for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+      seq = lwip_ntohl(seg->tcphdr->seqno);
+      if (TCP_SEQ_GEQ(seq, right)) {
+        break;
+      }
+      if ((seg->len == 0) || (seg->flags & TF_SEG_SACKED) || TCP_SEQ_LEQ(seq + seg->len, left)) {
+        continue;
+      }
+      if (TCP_SEQ_LT(seq, left)) {
+        /* Split off the SACKed end, which the next round marks */
+        tcp_split_unacked_seg(pcb, seg, (u16_t)(left - seq));
+        continue;
+      }
+      if (TCP_SEQ_GT(seq + seg->len, right) &&
+          (tcp_split_unacked_seg(pcb, seg, (u16_t)(right - seq)) != ERR_OK)) {
+        break;
+      }
+      seg->flags |= TF_SEG_SACKED;
+    }
+  }
+
+  /* IsLost() for the first segment the ACK leaves unacknowledged */
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (first == NULL) {
+      if (TCP_SEQ_LEQ(lwip_ntohl(seg->tcphdr->seqno) + seg->len, una)) {
+        continue;
+      }
+      first = seg;
+    }
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked += seg->len;
+      nsacked++;
+    }
+  }
+  return (first != NULL) && !(first->flags & TF_SEG_SACKED) &&
+         TCP_SACK_IS_LOST(pcb, nsacked, sacked);
+}
+#endif /* LWIP_TCP_SACK_IN */
+
 #endif /* LWIP_TCP */
@@ -91,6 +91,11 @@
 #define LWIP_TCP_OPT_LENGTH_SEGMENT(flags, pcb) LWIP_TCP_OPT_LENGTH(flags)
 #endif
 
+#if TCP_GSO
+/* A segment larger than one MSS is a GSO segment, cut into frames by the netif */
+#define TCP_SEG_IS_GSO(pcb, seg) ((seg)->len + LWIP_TCP_OPT_LENGTH_SEGMENT((seg)->flags, pcb) > (pcb)->mss)
+#endif /* TCP_GSO */
+
 /* Define some copy-macros for checksum-on-copy so that the code looks
    nicer by preventing too many ifdef's. */
 #if TCP_CHECKSUM_ON_COPY
@@ -126,6 +131,8 @@
 
 /* Forward declarations.*/
 static err_t tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif);
+static int tcp_output_segment_busy(const struct tcp_seg *seg);
+static err_t tcp_split_seg(struct tcp_pcb *pcb, struct tcp_seg *useg, u16_t split);
 
 /* tcp_route: common code that returns a fixed bound netif or calls ip_route */
 static struct netif *
@@ -295,6 +302,49 @@ tcp_seg_add_chksum(u16_t chksum, u16_t len, u16_t *seg_chksum,
 }
 #endif /* TCP_CHECKSUM_ON_COPY */
 
+#if TCP_GSO
+/** Size segments for a netif that does segmentation offload.
+ *
+ * Called by tcp_write. If the pcb is routed over a GSO capable netif and
+ * sends full sized frames, segments are allowed to grow to as many frames
+ * as the send window currently has room for, up to TCP_GSO_MAX_SIZE.
+ *
+ * @param pcb the tcp_pcb being written to
+ * @param mss_local maximum segment size (including options) computed by tcp_write
+ * @param optlen length of the options carried by each segment
+ * @return the maximum segment size (including options) to use
+ */
+static u16_t
+tcp_gso_seg_size(struct tcp_pcb *pcb, u16_t mss_local, u8_t optlen)
+{
+  struct netif *netif;
+  u32_t wnd, queued, avail;
+  u16_t frame;
+
+  if ((mss_local != pcb->mss) || !IP_IS_V4(&pcb->remote_ip)) {
+    return mss_local;
+  }
+  netif = tcp_route(pcb, &pcb->local_ip, &pcb->remote_ip);
+  if ((netif == NULL) || !(netif->flags & NETIF_FLAG_GSO) ||
+      (pcb->mss != netif->mtu - IP_HLEN - TCP_HLEN)) {
+    return mss_local;
+  }
+
+  frame = (u16_t)(mss_local - optlen);
+  wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
+  queued = pcb->snd_lbb - pcb->lastack;
+  if (wnd <= queued) {
+    return mss_local;
+  }
+  avail = LWIP_MIN(wnd - queued, TCP_GSO_MAX_SIZE - optlen);
+  avail -= avail % frame;
+  if (avail <= frame) {
+    return mss_local;
+  }
+  return (u16_t)(avail + optlen);
+}
+#endif /* TCP_GSO */
+
 /** Checks if tcp_write is allowed or not (checks state, snd_buf and snd_queuelen).
  *
  * @param pcb the tcp pcb to check for
@@ -449,6 +499,9 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
     optlen = LWIP_TCP_OPT_LENGTH_SEGMENT(0, pcb);
   }
 
+#if TCP_GSO
+  mss_local = tcp_gso_seg_size(pcb, mss_local, optlen);
+#endif /* TCP_GSO */
 
   /*
    * TCP segmentation is done in three phases with increasing complexity:
@@ -483,8 +536,17 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 
     /* Usable space at the end of the last unsent segment */
     unsent_optlen = LWIP_TCP_OPT_LENGTH_SEGMENT(last_unsent->flags, pcb);
+#if TCP_GSO
+    /* The last segment may have been sized for a larger window, which the
+       room allocated at its end (oversize) still reflects */
+    space = LWIP_MAX(mss_local, last_unsent->len + unsent_optlen) - (last_unsent->len + unsent_optlen);
+#if TCP_OVERSIZE
+    space = LWIP_MAX(space, pcb->unsent_oversize);
+#endif /* TCP_OVERSIZE */
+#else /* TCP_GSO */
     LWIP_ASSERT("mss_local is too small", mss_local >= last_unsent->len + unsent_optlen);
     space = mss_local - (last_unsent->len + unsent_optlen);
+#endif /* TCP_GSO */
 
     /*
      * Phase 1: Copy data directly into an oversized pbuf.
@@ -792,9 +854,11 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
     TCPH_SET_FLAG(seg->tcphdr, TCP_PSH);
   }
 
+  TCP_TIMER_PENDING(pcb);
   return ERR_OK;
 memerr:
   tcp_set_flags(pcb, TF_NAGLEMEMERR);
+  TCP_TIMER_PENDING(pcb);
   TCP_STATS_INC(tcp.memerr);
 
   if (concat_p != NULL) {
@@ -826,7 +890,57 @@ memerr:
 err_t
 tcp_split_unsent_seg(struct tcp_pcb *pcb, u16_t split)
 {
-  struct tcp_seg *seg = NULL, *useg = NULL;
+  LWIP_ASSERT("tcp_split_unsent_seg: invalid pcb", pcb != NULL);
+
+  if (pcb->unsent == NULL) {
+    return ERR_MEM;
+  }
+  return tcp_split_seg(pcb, pcb->unsent, split);
+}
+
+#if LWIP_TCP_SACK_IN
+/**
+ * Split a segment on the unacked queue, so that SACK blocks can cover
+ * whole segments. If return is not ERR_OK, the segment remains intact.
+ *
+ * @param pcb the tcp_pcb for which to split the segment
+ * @param seg the segment to split, which stays on the queue in front of
+ *        the remainder
+ * @param split the amount of payload to remain in seg
+ */
+err_t
+tcp_split_unacked_seg(struct tcp_pcb *pcb, struct tcp_seg *seg, u16_t split)
+{
+  u16_t len;
+
+  LWIP_ASSERT("tcp_split_unacked_seg: invalid pcb", pcb != NULL);
+  LWIP_ASSERT("tcp_split_unacked_seg: invalid seg", seg != NULL);
+
+  /* The pbuf may still be queued by the netif driver */
+  if (tcp_output_segment_busy(seg)) {
+    return ERR_VAL;
+  }
+  /* Move the payload back to the TCP header, as tcp_output_segment() does
+     before sending the segment again */
+  len = (u16_t)((u8_t *)seg->tcphdr - (u8_t *)seg->p->payload);
+  seg->p->len -= len;
+  seg->p->tot_len -= len;
+  seg->p->payload = seg->tcphdr;
+  return tcp_split_seg(pcb, seg, split);
+}
+#endif /* LWIP_TCP_SACK_IN */
+
+/**
+ * Split a segment with its payload pointing at the TCP header.
+ *
+ * @param pcb the tcp_pcb for which to split the segment
+ * @param useg the segment to split, which stays in front of the remainder
+ * @param split the amount of payload to remain in useg
+ */
+static err_t
+tcp_split_seg(struct tcp_pcb *pcb, struct tcp_seg *useg, u16_t split)
+{
+  struct tcp_seg *seg = NULL;
   struct pbuf *p = NULL;
   u8_t optlen;
   u8_t optflags;
@@ -840,13 +954,6 @@ tcp_split_unsent_seg(struct tcp_pcb *pcb, u16_t split)
   struct pbuf *q;
 #endif /* TCP_CHECKSUM_ON_COPY */
 
-  LWIP_ASSERT("tcp_split_unsent_seg: invalid pcb", pcb != NULL);
-
-  useg = pcb->unsent;
-  if (useg == NULL) {
-    return ERR_MEM;
-  }
-
   if (split == 0) {
     LWIP_ASSERT("Can't split segment into length 0", 0);
     return ERR_VAL;
@@ -856,7 +963,9 @@ tcp_split_unsent_seg(struct tcp_pcb *pcb, u16_t split)
     return ERR_OK;
   }
 
+#if !TCP_GSO
   LWIP_ASSERT("split <= mss", split <= pcb->mss);
+#endif /* !TCP_GSO */
   LWIP_ASSERT("useg->len > 0", useg->len > 0);
 
   /* We should check that we don't exceed TCP_SND_QUEUELEN but we need
@@ -973,7 +1082,7 @@ tcp_split_unsent_seg(struct tcp_pcb *pcb, u16_t split)
 #if TCP_OVERSIZE
   /* If remainder is last segment on the unsent, ensure we clear the oversize amount
    * because the remainder is always sized to the exact remaining amount */
-  if (seg->next == NULL) {
+  if ((useg == pcb->unsent) && (seg->next == NULL)) {
     pcb->unsent_oversize = 0;
   }
 #endif /* TCP_OVERSIZE */
@@ -1127,6 +1236,7 @@ tcp_enqueue_flags(struct tcp_pcb *pcb, u8_t flags)
                 pcb->unacked != NULL || pcb->unsent != NULL);
   }
 
+  TCP_TIMER_PENDING(pcb);
   return ERR_OK;
 }
 
@@ -1226,6 +1336,38 @@ tcp_build_wnd_scale_option(u32_t *opts)
 }
 #endif
 
+#if TCP_GSO
+/** Split a GSO segment at the head of the unsent queue that does not fit
+ * into the send window, so that the frames which do fit can be sent.
+ *
+ * @param pcb the tcp_pcb to send from
+ * @param wnd the current send window
+ */
+static void
+tcp_gso_fit_window(struct tcp_pcb *pcb, u32_t wnd)
+{
+  struct tcp_seg *seg = pcb->unsent;
+  u32_t avail;
+  u16_t frame;
+
+  if ((seg == NULL) || !TCP_SEG_IS_GSO(pcb, seg)) {
+    return;
+  }
+  if (lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) {
+    return;
+  }
+  if (lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack >= wnd) {
+    return;
+  }
+  frame = (u16_t)(pcb->mss - LWIP_TCP_OPT_LENGTH_SEGMENT(seg->flags, pcb));
+  avail = wnd - (lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack);
+  avail -= avail % frame;
+  if (avail > 0) {
+    tcp_split_unsent_seg(pcb, (u16_t)avail);
+  }
+}
+#endif /* TCP_GSO */
+
 /**
  * @ingroup tcp_raw
  * Find out what we can send and send it
@@ -1261,6 +1403,15 @@ tcp_output(struct tcp_pcb *pcb)
   }
 
   wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
+#if LWIP_TCP_SACK_IN
+  if ((pcb->flags & (TF_INFR | TF_SACK)) == (TF_INFR | TF_SACK)) {
+    /* In SACK recovery, new data gets what the pipe estimate leaves of
+       cwnd. Retransmissions below snd_nxt always fit: tcp_rexmit_sack()
+       has counted them. */
+    wnd = LWIP_MIN(pcb->snd_wnd, (pcb->snd_nxt - pcb->lastack) +
+                   (pcb->cwnd > pcb->pipe ? (u32_t)(pcb->cwnd - pcb->pipe) : 0));
+  }
+#endif /* LWIP_TCP_SACK_IN */
 
   seg = pcb->unsent;
 
@@ -1302,6 +1453,11 @@ tcp_output(struct tcp_pcb *pcb)
     ip_addr_copy(pcb->local_ip, *local_ip);
   }
 
+#if TCP_GSO
+  tcp_gso_fit_window(pcb, wnd);
+  seg = pcb->unsent;
+#endif /* TCP_GSO */
+
   /* Handle the current segment not fitting within the window */
   if (lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > wnd) {
     /* We need to start the persistent timer when the next unsent segment does not fit
@@ -1314,6 +1470,7 @@ tcp_output(struct tcp_pcb *pcb)
       pcb->persist_cnt = 0;
       pcb->persist_backoff = 1;
       pcb->persist_probe = 0;
+      TCP_TIMER_PENDING(pcb);
     }
     /* We need an ACK, but can't send data now, so send an empty ACK */
     if (pcb->flags & TF_ACK_NOW) {
@@ -1362,11 +1519,18 @@ tcp_output(struct tcp_pcb *pcb)
     if (err != ERR_OK) {
       /* segment could not be sent, for whatever reason */
       tcp_set_flags(pcb, TF_NAGLEMEMERR);
+      TCP_TIMER_PENDING(pcb);
       return err;
     }
 #if TCP_OVERSIZE_DBGCHECK
     seg->oversize_left = 0;
 #endif /* TCP_OVERSIZE_DBGCHECK */
+#if LWIP_TCP_SACK_IN
+    if ((pcb->flags & TF_INFR) && TCP_SEQ_GEQ(lwip_ntohl(seg->tcphdr->seqno), pcb->snd_nxt)) {
+      /* new data sent in SACK recovery */
+      TCP_WND_INC(pcb->pipe, seg->len);
+    }
+#endif /* LWIP_TCP_SACK_IN */
     pcb->unsent = seg->next;
     if (pcb->state != SYN_SENT) {
       tcp_clear_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
@@ -1406,6 +1570,9 @@ tcp_output(struct tcp_pcb *pcb)
     } else {
       tcp_seg_free(seg);
     }
+#if TCP_GSO
+    tcp_gso_fit_window(pcb, wnd);
+#endif /* TCP_GSO */
     seg = pcb->unsent;
   }
 #if TCP_OVERSIZE
@@ -1534,6 +1701,7 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif
      This must be set before checking the route. */
   if (pcb->rtime < 0) {
     pcb->rtime = 0;
+    TCP_TIMER_PENDING(pcb);
   }
 
   if (pcb->rttest == 0) {
@@ -1565,6 +1733,10 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif
   LWIP_ASSERT("options not filled", (u8_t *)opts == ((u8_t *)(seg->tcphdr + 1)) + LWIP_TCP_OPT_LENGTH_SEGMENT(seg->flags, pcb));
 
 #if CHECKSUM_GEN_TCP
+#if TCP_GSO
+  /* The netif checksums each frame it cuts from a GSO segment */
+  if (!TCP_SEG_IS_GSO(pcb, seg))
+#endif /* TCP_GSO */
   IF__NETIF_CHECKSUM_ENABLED(netif, NETIF_CHECKSUM_GEN_TCP) {
 #if TCP_CHECKSUM_ON_COPY
     u32_t acc;
@@ -1653,6 +1825,17 @@ tcp_rexmit_rto_prepare(struct tcp_pcb *pcb)
     LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_rexmit_rto: segment busy\n"));
     return ERR_VAL;
   }
+#if LWIP_TCP_SACK_IN
+  if (pcb->flags & TF_SACK) {
+    struct tcp_seg *useg;
+    /* The receiver may have discarded SACKed data (RFC 2018, section 8),
+       so send it all again and leave loss recovery to slow start */
+    for (useg = pcb->unacked; useg != NULL; useg = useg->next) {
+      useg->flags &= (u8_t)~TF_SEG_SACKED;
+    }
+    tcp_clear_flags(pcb, TF_INFR);
+  }
+#endif /* LWIP_TCP_SACK_IN */
   /* concatenate unsent queue after unacked queue */
   seg->next = pcb->unsent;
 #if TCP_OVERSIZE_DBGCHECK
@@ -1715,26 +1898,17 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
 }
 
 /**
- * Requeue the first unacked segment for retransmission
- *
- * Called by tcp_receive() for fast retransmit.
+ * Move an unacked segment to the unsent queue for retransmission
  *
- * @param pcb the tcp_pcb for which to retransmit the first unacked segment
+ * @param pcb the tcp_pcb for which to retransmit the segment
+ * @param seg_ptr the link to the segment on the unacked queue
  */
-err_t
-tcp_rexmit(struct tcp_pcb *pcb)
+static err_t
+tcp_rexmit_unacked(struct tcp_pcb *pcb, struct tcp_seg **seg_ptr)
 {
-  struct tcp_seg *seg;
+  struct tcp_seg *seg = *seg_ptr;
   struct tcp_seg **cur_seg;
 
-  LWIP_ASSERT("tcp_rexmit: invalid pcb", pcb != NULL);
-
-  if (pcb->unacked == NULL) {
-    return ERR_VAL;
-  }
-
-  seg = pcb->unacked;
-
   /* Give up if the segment is still referenced by the netif driver
      due to deferred transmission. */
   if (tcp_output_segment_busy(seg)) {
@@ -1742,9 +1916,9 @@ tcp_rexmit(struct tcp_pcb *pcb)
     return ERR_VAL;
   }
 
-  /* Move the first unacked segment to the unsent queue */
+  /* Move the unacked segment to the unsent queue */
   /* Keep the unsent queue sorted. */
-  pcb->unacked = seg->next;
+  *seg_ptr = seg->next;
 
   cur_seg = &(pcb->unsent);
   while (*cur_seg &&
@@ -1774,6 +1948,103 @@ tcp_rexmit(struct tcp_pcb *pcb)
   return ERR_OK;
 }
 
+/**
+ * Requeue the first unacked segment for retransmission
+ *
+ * Called by tcp_receive() for fast retransmit.
+ *
+ * @param pcb the tcp_pcb for which to retransmit the first unacked segment
+ */
+err_t
+tcp_rexmit(struct tcp_pcb *pcb)
+{
+  LWIP_ASSERT("tcp_rexmit: invalid pcb", pcb != NULL);
+
+  if (pcb->unacked == NULL) {
+    return ERR_VAL;
+  }
+
+  return tcp_rexmit_unacked(pcb, &pcb->unacked);
+}
+
+#if LWIP_TCP_SACK_IN
+/**
+ * Retransmit the segments presumed lost during SACK loss recovery
+ * (RFC 6675, NextSeg() rule 1), as far as the congestion window allows.
+ *
+ * Called by tcp_receive() for each ACK while TF_INFR is set. This sets
+ * pcb->pipe, which tcp_output() leaves the rest of cwnd to new data by.
+ *
+ * @param pcb the tcp_pcb in loss recovery
+ */
+void
+tcp_rexmit_sack(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg, **seg_ptr;
+  u32_t seqno, pipe = 0;
+  u32_t sacked = 0, sacked_above;
+  u16_t nsacked = 0, nsacked_above;
+
+  LWIP_ASSERT("tcp_rexmit_sack: invalid pcb", pcb != NULL);
+
+  /* A segment is presumed lost with enough SACKed data above it (IsLost()) */
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked += seg->len;
+      nsacked++;
+    }
+  }
+
+  /* SetPipe(): data not SACKed is in flight unless lost, and a second
+     time if retransmitted */
+  sacked_above = sacked;
+  nsacked_above = nsacked;
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked_above -= seg->len;
+      nsacked_above--;
+      continue;
+    }
+    if (!TCP_SACK_IS_LOST(pcb, nsacked_above, sacked_above)) {
+      pipe += seg->len;
+    }
+    if (TCP_SEQ_LT(lwip_ntohl(seg->tcphdr->seqno), pcb->high_rxt)) {
+      pipe += seg->len;
+    }
+  }
+  /* and so are retransmissions that tcp_output() has yet to send */
+  for (seg = pcb->unsent; seg != NULL && TCP_SEQ_LT(lwip_ntohl(seg->tcphdr->seqno), pcb->snd_nxt);
+       seg = seg->next) {
+    pipe += seg->len;
+  }
+
+  /* Retransmit the lost segments above high_rxt while cwnd has room */
+  sacked_above = sacked;
+  nsacked_above = nsacked;
+  seg_ptr = &pcb->unacked;
+  while (((seg = *seg_ptr) != NULL) && (nsacked_above > 0) && (pipe + pcb->mss <= pcb->cwnd)) {
+    seqno = lwip_ntohl(seg->tcphdr->seqno);
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked_above -= seg->len;
+      nsacked_above--;
+    } else if (TCP_SEQ_GEQ(seqno, pcb->high_rxt) &&
+               TCP_SACK_IS_LOST(pcb, nsacked_above, sacked_above)) {
+      if (tcp_rexmit_unacked(pcb, seg_ptr) != ERR_OK) {
+        break;
+      }
+      LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_rexmit_sack: %"U32_F":%"U32_F"\n", seqno, seqno + seg->len));
+      pcb->high_rxt = seqno + seg->len;
+      pipe += seg->len;
+      /* seg_ptr now links the next segment */
+      continue;
+    }
+    seg_ptr = &seg->next;
+  }
+
+  pcb->pipe = (tcpwnd_size_t)LWIP_MIN(pipe, TCPWND_MAX);
+}
+#endif /* LWIP_TCP_SACK_IN */
+
 
 /**
  * Handle retransmission after three dupacks received
@@ -1793,21 +2064,21 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
                  (u16_t)pcb->dupacks, pcb->lastack,
                  lwip_ntohl(pcb->unacked->tcphdr->seqno)));
     if (tcp_rexmit(pcb) == ERR_OK) {
-      /* Set ssthresh to half of the minimum of the current
-       * cwnd and the advertised window */
-      pcb->ssthresh = LWIP_MIN(pcb->cwnd, pcb->snd_wnd) / 2;
-
-      /* The minimum value for ssthresh should be 2 MSS */
-      if (pcb->ssthresh < (2U * pcb->mss)) {
-        LWIP_DEBUGF(TCP_FR_DEBUG,
-                    ("tcp_receive: The minimum value for ssthresh %"TCPWNDSIZE_F
-                     " should be min 2 mss %"U16_F"...\n",
-                     pcb->ssthresh, (u16_t)(2 * pcb->mss)));
-        pcb->ssthresh = 2 * pcb->mss;
-      }
+      /* Reduce ssthresh */
+      TCP_CC(pcb)->on_loss(pcb);
 
       pcb->cwnd = pcb->ssthresh + 3 * pcb->mss;
       tcp_set_flags(pcb, TF_INFR);
+#if LWIP_TCP_SACK_IN
+      if (pcb->flags & TF_SACK) {
+        /* RFC 6675 sends by the pipe estimate instead of inflating cwnd.
+           The retransmitted segment is now the head of unsent. */
+        pcb->cwnd = pcb->ssthresh;
+        pcb->recover = pcb->snd_nxt;
+        pcb->high_rxt = lwip_ntohl(pcb->unsent->tcphdr->seqno) + pcb->unsent->len;
+        tcp_rexmit_sack(pcb);
+      }
+#endif /* LWIP_TCP_SACK_IN */
 
       /* Reset the retransmission timer to prevent immediate rto retransmissions */
       pcb->rtime = 0;
@@ -2042,8 +2313,9 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
 
   p = tcp_output_alloc_header(pcb, optlen, 0, lwip_htonl(pcb->snd_nxt));
   if (p == NULL) {
-    /* let tcp_fasttmr retry sending this ACK */
+    /* let the timers retry sending this ACK */
     tcp_set_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
+    TCP_DELACK_ADD(pcb);
     LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_output: (ACK) could not allocate pbuf\n"));
     return ERR_BUF;
   }
@@ -2057,8 +2329,9 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
               ("tcp_output: sending ACK for %"U32_F"\n", pcb->rcv_nxt));
   err = tcp_output_control_segment(pcb, p, &pcb->local_ip, &pcb->remote_ip);
   if (err != ERR_OK) {
-    /* let tcp_fasttmr retry sending this ACK */
+    /* let the timers retry sending this ACK */
     tcp_set_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
+    TCP_DELACK_ADD(pcb);
   } else {
     /* remove ACK flags from the PCB, as we sent an empty ACK now */
     tcp_clear_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
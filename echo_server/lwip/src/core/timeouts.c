@@ -118,12 +118,49 @@ const int lwip_num_cyclic_timers = LWIP_ARRAYSIZE(lwip_cyclic_timers);
 
 #if LWIP_TIMERS && !LWIP_TIMERS_CUSTOM
 
+#if LWIP_TIMER_WHEEL
+/* The timeouts are kept in a hierarchical timing wheel. Each level has
+ * WHEEL_SLOTS slots, and each slot of a level spans all the slots of the
+ * level below it: a slot of level 0 holds the timeouts due in one ms, one
+ * of level 1 those due in WHEEL_SLOTS ms, and so on up to the top level,
+ * which covers the whole u32_t range of times.
+ *
+ * A timeout goes into the level of the highest group of WHEEL_BITS bits in
+ * which its time differs from wheel_time, the time up to which the wheel
+ * has been processed, and into the slot given by those bits of its time.
+ * When wheel_time reaches the span of an occupied slot above level 0, the
+ * slot is cascaded: its timeouts are spread over the levels below. A slot
+ * of level 0 is only ever reached after every earlier slot, and each slot
+ * keeps its timeouts in the order they were added, so timeouts expire in
+ * the order of the sorted list that is used without LWIP_TIMER_WHEEL. */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS ((32 + WHEEL_BITS - 1) / WHEEL_BITS)
+#define WHEEL_INDEX(time, level) ((int)(((time) >> ((level) * WHEEL_BITS)) & (WHEEL_SLOTS - 1)))
+
+#define TIMEOUT_HASH_BITS 7
+#define TIMEOUT_HASH_SIZE (1 << TIMEOUT_HASH_BITS)
+
+struct wheel_slot {
+  struct sys_timeo *head;
+  struct sys_timeo *tail;
+};
+
+static struct wheel_slot wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+/** A bit for each slot of a level that holds a timeout */
+static u64_t wheel_occupied[WHEEL_LEVELS];
+static u32_t wheel_time;
+/** The timeouts hashed by handler and arg, so that sys_untimeout() does not
+ * need to search the wheel */
+static struct sys_timeo *timeout_hash[TIMEOUT_HASH_SIZE];
+#else /* LWIP_TIMER_WHEEL */
 /** The one and only timeout list */
 static struct sys_timeo *next_timeout;
+#endif /* LWIP_TIMER_WHEEL */
 
 static u32_t current_timeout_due_time;
 
-#if LWIP_TESTMODE
+#if LWIP_TESTMODE && !LWIP_TIMER_WHEEL
 struct sys_timeo**
 sys_timeouts_get_next_timeout(void)
 {
@@ -131,6 +168,204 @@ sys_timeouts_get_next_timeout(void)
 }
 #endif
 
+#if LWIP_TIMER_WHEEL
+static struct sys_timeo **
+timeout_hash_bucket(sys_timeout_handler handler, void *arg)
+{
+  u32_t key = (u32_t)((mem_ptr_t)handler ^ (mem_ptr_t)arg);
+  return &timeout_hash[(u32_t)(key * 0x9e3779b1UL) >> (32 - TIMEOUT_HASH_BITS)];
+}
+
+/** Return the first occupied slot of level at or after index, or -1 */
+static int
+wheel_next_slot(int level, int index)
+{
+  u64_t occupied;
+  if (index >= WHEEL_SLOTS) {
+    return -1;
+  }
+  occupied = wheel_occupied[level] >> index;
+  return occupied ? index + __builtin_ctzll(occupied) : -1;
+}
+
+static int
+wheel_empty(void)
+{
+  int level;
+  for (level = 0; level < WHEEL_LEVELS; level++) {
+    if (wheel_occupied[level]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/** Put a timeout at the end of its slot for the current wheel_time */
+static void
+wheel_link(struct sys_timeo *timeout)
+{
+  struct wheel_slot *slot;
+  u32_t time = timeout->time;
+  u32_t diff;
+  int level = 0;
+
+  if (TIME_LESS_THAN(time, wheel_time)) {
+    /* already due */
+    time = wheel_time;
+  }
+  for (diff = time ^ wheel_time; diff >= WHEEL_SLOTS; diff >>= WHEEL_BITS) {
+    level++;
+  }
+
+  timeout->slot = (u16_t)(level * WHEEL_SLOTS + WHEEL_INDEX(time, level));
+  slot = &wheel[0][0] + timeout->slot;
+  timeout->next = NULL;
+  timeout->prev = slot->tail;
+  if (slot->tail != NULL) {
+    slot->tail->next = timeout;
+  } else {
+    slot->head = timeout;
+    wheel_occupied[level] |= (u64_t)1 << WHEEL_INDEX(time, level);
+  }
+  slot->tail = timeout;
+}
+
+static void
+wheel_unlink(struct sys_timeo *timeout)
+{
+  struct wheel_slot *slot = &wheel[0][0] + timeout->slot;
+
+  if (timeout->prev != NULL) {
+    timeout->prev->next = timeout->next;
+  } else {
+    slot->head = timeout->next;
+  }
+  if (timeout->next != NULL) {
+    timeout->next->prev = timeout->prev;
+  } else {
+    slot->tail = timeout->prev;
+  }
+  if (slot->head == NULL) {
+    wheel_occupied[timeout->slot / WHEEL_SLOTS] &= ~((u64_t)1 << (timeout->slot % WHEEL_SLOTS));
+  }
+}
+
+static void
+wheel_remove(struct sys_timeo *timeout)
+{
+  wheel_unlink(timeout);
+  *timeout->hash_pprev = timeout->hash_next;
+  if (timeout->hash_next != NULL) {
+    timeout->hash_next->hash_pprev = timeout->hash_pprev;
+  }
+}
+
+/**
+ * Find the occupied slot above level 0 whose span comes first after the
+ * span of level 0 that wheel_time is in.
+ *
+ * @return the index of the slot in *level, or -1 if the wheel is empty
+ *         above level 0
+ */
+static int
+wheel_next_span(int *level)
+{
+  int index;
+  for (*level = 1; *level < WHEEL_LEVELS; (*level)++) {
+    index = wheel_next_slot(*level, WHEEL_INDEX(wheel_time, *level) + 1);
+    if (index >= 0) {
+      return index;
+    }
+  }
+  /* Times past the end of the u32_t range wrap around to the start of the
+     top level */
+  *level = WHEEL_LEVELS - 1;
+  return wheel_next_slot(*level, 0);
+}
+
+/** Return the time at which the span of a slot starts */
+static u32_t
+wheel_span_start(int level, int index)
+{
+  int shift = level * WHEEL_BITS;
+  u32_t upper = 0;
+  if (shift + WHEEL_BITS < 32) {
+    upper = wheel_time & ~(((u32_t)1 << (shift + WHEEL_BITS)) - 1);
+  }
+  return upper | ((u32_t)index << shift);
+}
+
+/**
+ * Return the timeout that expires first, if it is due at now, cascading
+ * the slots that wheel_time moves into on the way.
+ */
+static struct sys_timeo *
+wheel_expired(u32_t now)
+{
+  struct sys_timeo *timeout, *next;
+  int level, index;
+  u32_t start;
+
+  while (1) {
+    index = wheel_next_slot(0, WHEEL_INDEX(wheel_time, 0));
+    if (index >= 0) {
+      start = wheel_span_start(0, index);
+      if (TIME_LESS_THAN(now, start)) {
+        return NULL;
+      }
+      wheel_time = start;
+      return wheel[0][index].head;
+    }
+
+    index = wheel_next_span(&level);
+    if (index < 0) {
+      return NULL;
+    }
+    start = wheel_span_start(level, index);
+    if (TIME_LESS_THAN(now, start)) {
+      return NULL;
+    }
+
+    /* Move to the start of the slot's span and cascade it */
+    wheel_time = start;
+    timeout = wheel[level][index].head;
+    wheel[level][index].head = wheel[level][index].tail = NULL;
+    wheel_occupied[level] &= ~((u64_t)1 << index);
+    for (; timeout != NULL; timeout = next) {
+      next = timeout->next;
+      wheel_link(timeout);
+    }
+  }
+}
+
+/** Return the timeout that expires first, or NULL if there is none */
+static struct sys_timeo *
+wheel_first(void)
+{
+  struct sys_timeo *timeout, *first;
+  int level, index;
+
+  index = wheel_next_slot(0, WHEEL_INDEX(wheel_time, 0));
+  if (index >= 0) {
+    return wheel[0][index].head;
+  }
+
+  /* A slot above level 0 holds a span of times, in the order they were
+     added */
+  index = wheel_next_span(&level);
+  if (index < 0) {
+    return NULL;
+  }
+  first = wheel[level][index].head;
+  for (timeout = first->next; timeout != NULL; timeout = timeout->next) {
+    if (TIME_LESS_THAN(timeout->time, first->time)) {
+      first = timeout;
+    }
+  }
+  return first;
+}
+#endif /* LWIP_TIMER_WHEEL */
+
 #if LWIP_TCP
 /** global variable that shows if the tcp timer is currently scheduled or not */
 static int tcpip_tcp_timer_active;
@@ -202,6 +437,22 @@ sys_timeout_abs(u32_t abs_time, sys_timeout_handler handler, void *arg)
                              (void *)timeout, abs_time, handler_name, (void *)arg));
 #endif /* LWIP_DEBUG_TIMERNAMES */
 
+#if LWIP_TIMER_WHEEL
+  LWIP_UNUSED_ARG(t);
+  if (wheel_empty()) {
+    /* Nothing holds wheel_time back, so catch up with the clock. Times
+       are placed relative to it, and must not be half the u32_t range
+       ahead of it. */
+    wheel_time = sys_now();
+  }
+  wheel_link(timeout);
+  timeout->hash_pprev = timeout_hash_bucket(handler, arg);
+  timeout->hash_next = *timeout->hash_pprev;
+  if (timeout->hash_next != NULL) {
+    timeout->hash_next->hash_pprev = &timeout->hash_next;
+  }
+  *timeout->hash_pprev = timeout;
+#else /* LWIP_TIMER_WHEEL */
   if (next_timeout == NULL) {
     next_timeout = timeout;
     return;
@@ -218,6 +469,7 @@ sys_timeout_abs(u32_t abs_time, sys_timeout_handler handler, void *arg)
       }
     }
   }
+#endif /* LWIP_TIMER_WHEEL */
 }
 
 /**
@@ -316,6 +568,24 @@ sys_timeout(u32_t msecs, sys_timeout_handler handler, void *arg)
 void
 sys_untimeout(sys_timeout_handler handler, void *arg)
 {
+#if LWIP_TIMER_WHEEL
+  struct sys_timeo *t, *match = NULL;
+
+  LWIP_ASSERT_CORE_LOCKED();
+
+  /* The first matching entry is the one due first, and of those due at the
+     same time the one added first, which is further down the bucket */
+  for (t = *timeout_hash_bucket(handler, arg); t != NULL; t = t->hash_next) {
+    if ((t->h == handler) && (t->arg == arg) &&
+        ((match == NULL) || !TIME_LESS_THAN(match->time, t->time))) {
+      match = t;
+    }
+  }
+  if (match != NULL) {
+    wheel_remove(match);
+    memp_free(MEMP_SYS_TIMEOUT, match);
+  }
+#else /* LWIP_TIMER_WHEEL */
   struct sys_timeo *prev_t, *t;
 
   LWIP_ASSERT_CORE_LOCKED();
@@ -338,6 +608,7 @@ sys_untimeout(sys_timeout_handler handler, void *arg)
     }
   }
   return;
+#endif /* LWIP_TIMER_WHEEL */
 }
 
 /**
@@ -365,6 +636,15 @@ sys_check_timeouts(void)
 
     PBUF_CHECK_FREE_OOSEQ();
 
+#if LWIP_TIMER_WHEEL
+    tmptimeout = wheel_expired(now);
+    if (tmptimeout == NULL) {
+      return;
+    }
+
+    /* Timeout has expired */
+    wheel_remove(tmptimeout);
+#else /* LWIP_TIMER_WHEEL */
     tmptimeout = next_timeout;
     if (tmptimeout == NULL) {
       return;
@@ -376,6 +656,7 @@ sys_check_timeouts(void)
 
     /* Timeout has expired */
     next_timeout = tmptimeout->next;
+#endif /* LWIP_TIMER_WHEEL */
     handler = tmptimeout->h;
     arg = tmptimeout->arg;
     current_timeout_due_time = tmptimeout->time;
@@ -406,7 +687,44 @@ sys_restart_timeouts(void)
   u32_t now;
   u32_t base;
   struct sys_timeo *t;
+#if LWIP_TIMER_WHEEL
+  struct sys_timeo *all = NULL, *next;
+  int level, index;
+
+  t = wheel_first();
+  if (t == NULL) {
+    return;
+  }
 
+  now = sys_now();
+  base = t->time;
+
+  /* Take every timeout off the wheel and put it back for its new time.
+     Timeouts due at the same time share a slot, so they keep their order. */
+  for (level = 0; level < WHEEL_LEVELS; level++) {
+    for (index = 0; index < WHEEL_SLOTS; index++) {
+      for (t = wheel[level][index].head; t != NULL; t = next) {
+        next = t->next;
+        t->next = all;
+        all = t;
+      }
+      wheel[level][index].head = wheel[level][index].tail = NULL;
+    }
+    wheel_occupied[level] = 0;
+  }
+  wheel_time = now;
+  /* all is in reverse, so relink it in order first */
+  for (t = NULL; all != NULL; all = next) {
+    next = all->next;
+    all->next = t;
+    t = all;
+  }
+  for (; t != NULL; t = next) {
+    next = t->next;
+    t->time = (t->time - base) + now;
+    wheel_link(t);
+  }
+#else /* LWIP_TIMER_WHEEL */
   if (next_timeout == NULL) {
     return;
   }
@@ -417,6 +735,7 @@ sys_restart_timeouts(void)
   for (t = next_timeout; t != NULL; t = t->next) {
     t->time = (t->time - base) + now;
   }
+#endif /* LWIP_TIMER_WHEEL */
 }
 
 /** Return the time left before the next timeout is due. If no timeouts are
@@ -426,6 +745,9 @@ u32_t
 sys_timeouts_sleeptime(void)
 {
   u32_t now;
+#if LWIP_TIMER_WHEEL
+  struct sys_timeo *next_timeout = wheel_first();
+#endif /* LWIP_TIMER_WHEEL */
 
   LWIP_ASSERT_CORE_LOCKED();
 
@@ -80,6 +80,58 @@ static u16_t udp_port = UDP_LOCAL_PORT_RANGE_START;
 /* exported in udp.h (was static) */
 struct udp_pcb *udp_pcbs;
 
+#if UDP_PCB_HASH
+/* The pcbs of udp_pcbs, hashed by local port. Within a bucket, pcbs with
+ * the same port are kept in the order they would have in udp_pcbs. */
+static struct udp_pcb *udp_pcb_hash[UDP_PCB_HASH_SIZE];
+/* Stamped on a pcb that goes to the front of its bucket. A bucket is
+ * ordered by it, newest first. */
+static u32_t udp_hash_seq;
+
+#define udp_hash_bucket(port) (&udp_pcb_hash[(port) & (UDP_PCB_HASH_SIZE - 1)])
+/* Iterate over the pcbs that may have a local port */
+#define UDP_PCB_FIRST(port) (*udp_hash_bucket(port))
+#define UDP_PCB_NEXT(pcb) ((pcb)->hash_next)
+
+static void
+udp_hash_add(struct udp_pcb *pcb)
+{
+  struct udp_pcb **bucket = udp_hash_bucket(pcb->local_port);
+  pcb->hash_seq = ++udp_hash_seq;
+  pcb->hash_next = *bucket;
+  *bucket = pcb;
+}
+
+static void
+udp_hash_remove(struct udp_pcb *pcb)
+{
+  struct udp_pcb **link;
+  for (link = udp_hash_bucket(pcb->local_port); *link != NULL; link = &(*link)->hash_next) {
+    if (*link == pcb) {
+      *link = pcb->hash_next;
+      break;
+    }
+  }
+  pcb->hash_next = NULL;
+}
+
+/* Link a pcb that was rebound without moving in udp_pcbs into the bucket
+ * of its new port, behind the pcbs that went to the front after it */
+static void
+udp_hash_insert(struct udp_pcb *pcb)
+{
+  struct udp_pcb **link = udp_hash_bucket(pcb->local_port);
+  while (*link != NULL && (s32_t)((*link)->hash_seq - pcb->hash_seq) > 0) {
+    link = &(*link)->hash_next;
+  }
+  pcb->hash_next = *link;
+  *link = pcb;
+}
+#else /* UDP_PCB_HASH */
+#define UDP_PCB_FIRST(port) udp_pcbs
+#define UDP_PCB_NEXT(pcb) ((pcb)->next)
+#endif /* UDP_PCB_HASH */
+
 /**
  * Initialize this module.
  */
@@ -107,7 +159,7 @@ again:
     udp_port = UDP_LOCAL_PORT_RANGE_START;
   }
   /* Check all PCBs. */
-  for (pcb = udp_pcbs; pcb != NULL; pcb = pcb->next) {
+  for (pcb = UDP_PCB_FIRST(udp_port); pcb != NULL; pcb = UDP_PCB_NEXT(pcb)) {
     if (pcb->local_port == udp_port) {
       if (++n > (UDP_LOCAL_PORT_RANGE_END - UDP_LOCAL_PORT_RANGE_START)) {
         return 0;
@@ -250,7 +302,7 @@ udp_input(struct pbuf *p, struct netif *inp)
    * 'Perfect match' pcbs (connected to the remote port & ip address) are
    * preferred. If no perfect match is found, the first unconnected pcb that
    * matches the local port and ip address gets the datagram. */
-  for (pcb = udp_pcbs; pcb != NULL; pcb = pcb->next) {
+  for (pcb = UDP_PCB_FIRST(dest); pcb != NULL; pcb = UDP_PCB_NEXT(pcb)) {
     /* print the PCB local and remote address */
     LWIP_DEBUGF(UDP_DEBUG, ("pcb ("));
     ip_addr_debug_print_val(UDP_DEBUG, pcb->local_ip);
@@ -291,11 +343,21 @@ udp_input(struct pbuf *p, struct netif *inp)
            ip_addr_cmp(&pcb->remote_ip, ip_current_src_addr()))) {
         /* the first fully matching PCB */
         if (prev != NULL) {
+#if UDP_PCB_HASH
+          /* move the pcb to the front of its bucket, as it would be
+             moved to the front of udp_pcbs */
+          struct udp_pcb **bucket = udp_hash_bucket(dest);
+          prev->hash_next = pcb->hash_next;
+          pcb->hash_seq = ++udp_hash_seq;
+          pcb->hash_next = *bucket;
+          *bucket = pcb;
+#else /* UDP_PCB_HASH */
           /* move the pcb to the front of udp_pcbs so that is
              found faster next time */
           prev->next = pcb->next;
           pcb->next = udp_pcbs;
           udp_pcbs = pcb;
+#endif /* UDP_PCB_HASH */
         } else {
           UDP_STATS_INC(udp.cachehit);
         }
@@ -380,7 +442,7 @@ udp_input(struct pbuf *p, struct netif *inp)
         /* pass broadcast- or multicast packets to all multicast pcbs
            if SOF_REUSEADDR is set on the first match */
         struct udp_pcb *mpcb;
-        for (mpcb = udp_pcbs; mpcb != NULL; mpcb = mpcb->next) {
+        for (mpcb = UDP_PCB_FIRST(dest); mpcb != NULL; mpcb = UDP_PCB_NEXT(mpcb)) {
           if (mpcb != pcb) {
             /* compare PCB local addr+port to UDP destination addr+port */
             if ((mpcb->local_port == dest) &&
@@ -956,7 +1018,7 @@ udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
 
   rebind = 0;
   /* Check for double bind and rebind of the same pcb */
-  for (ipcb = udp_pcbs; ipcb != NULL; ipcb = ipcb->next) {
+  for (ipcb = UDP_PCB_FIRST(pcb->local_port); ipcb != NULL; ipcb = UDP_PCB_NEXT(ipcb)) {
     /* is this UDP PCB already on active list? */
     if (pcb == ipcb) {
       rebind = 1;
@@ -985,7 +1047,7 @@ udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
       return ERR_USE;
     }
   } else {
-    for (ipcb = udp_pcbs; ipcb != NULL; ipcb = ipcb->next) {
+    for (ipcb = UDP_PCB_FIRST(port); ipcb != NULL; ipcb = UDP_PCB_NEXT(ipcb)) {
       if (pcb != ipcb) {
         /* By default, we don't allow to bind to a port that any other udp
            PCB is already bound to, unless *all* PCBs with that port have tha
@@ -1014,6 +1076,13 @@ udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
     }
   }
 
+#if UDP_PCB_HASH
+  if (rebind) {
+    /* the pcb may move to another bucket */
+    udp_hash_remove(pcb);
+  }
+#endif /* UDP_PCB_HASH */
+
   ip_addr_set_ipaddr(&pcb->local_ip, ipaddr);
 
   pcb->local_port = port;
@@ -1023,6 +1092,11 @@ udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
     /* place the PCB on the active list if not already there */
     pcb->next = udp_pcbs;
     udp_pcbs = pcb;
+#if UDP_PCB_HASH
+    udp_hash_add(pcb);
+  } else {
+    udp_hash_insert(pcb);
+#endif /* UDP_PCB_HASH */
   }
   LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, ("udp_bind: bound to "));
   ip_addr_debug_print_val(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, pcb->local_ip);
@@ -1107,7 +1181,7 @@ udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
   LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, (", port %"U16_F")\n", pcb->remote_port));
 
   /* Insert UDP PCB into the list of active UDP PCBs. */
-  for (ipcb = udp_pcbs; ipcb != NULL; ipcb = ipcb->next) {
+  for (ipcb = UDP_PCB_FIRST(pcb->local_port); ipcb != NULL; ipcb = UDP_PCB_NEXT(ipcb)) {
     if (pcb == ipcb) {
       /* already on the list, just return */
       return ERR_OK;
@@ -1116,6 +1190,9 @@ udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
   /* PCB not yet on the list, add PCB now */
   pcb->next = udp_pcbs;
   udp_pcbs = pcb;
+#if UDP_PCB_HASH
+  udp_hash_add(pcb);
+#endif /* UDP_PCB_HASH */
   return ERR_OK;
 }
 
@@ -1189,6 +1266,9 @@ udp_remove(struct udp_pcb *pcb)
   LWIP_ERROR("udp_remove: invalid pcb", pcb != NULL, return);
 
   mib2_udp_unbind(pcb);
+#if UDP_PCB_HASH
+  udp_hash_remove(pcb);
+#endif /* UDP_PCB_HASH */
   /* pcb to be removed is first in list? */
   if (udp_pcbs == pcb) {
     /* make list start at 2nd pcb */
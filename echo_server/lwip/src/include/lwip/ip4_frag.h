@@ -65,6 +65,15 @@ struct ip_reassdata {
   u16_t datagram_len;
   u8_t flags;
   u8_t timer;
+#if IP_REASS_HASH
+  /** the next younger datagram, reassdatagrams being the youngest */
+  struct ip_reassdata *prev;
+  struct ip_reassdata *hash_next;
+  /** the fragment with the highest offset */
+  struct pbuf *last;
+  /** bytes received, which never overlap */
+  u16_t recv_len;
+#endif /* IP_REASS_HASH */
 };
 
 void ip_reass_init(void);
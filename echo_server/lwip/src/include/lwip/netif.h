@@ -105,6 +105,10 @@ extern "C" {
 /** If set, the netif has MLD6 capability.
  * Set by the netif driver in its init function. */
 #define NETIF_FLAG_MLD6         0x40U
+/** If set, the netif splits TCP segments larger than its MTU into
+ * MTU sized frames itself (see TCP_GSO).
+ * Set by the netif driver in its init function. */
+#define NETIF_FLAG_GSO          0x80U
 
 /**
  * @}
@@ -120,6 +120,16 @@
 #if !defined LWIP_TIMERS_CUSTOM || defined __DOXYGEN__
 #define LWIP_TIMERS_CUSTOM              0
 #endif
+
+/**
+ * LWIP_TIMER_WHEEL==1: Keep the timeouts of sys_timeout() in a hierarchical
+ * timing wheel instead of a sorted list, so that sys_timeout() and
+ * sys_untimeout() take constant time however many timeouts are pending.
+ * Timeouts still expire in the same order.
+ */
+#if !defined LWIP_TIMER_WHEEL || defined __DOXYGEN__
+#define LWIP_TIMER_WHEEL                0
+#endif
 /**
  * @}
  */
@@ -636,6 +646,24 @@
 #define ARP_TABLE_SIZE                  10
 #endif
 
+/**
+ * ETHARP_TABLE_HASH==1: Find ARP entries through a hash table of their IP
+ * addresses instead of scanning the whole table, and recycle the least
+ * recently updated entry from an LRU list when the table is full. This
+ * keeps lookups constant time with a large ARP_TABLE_SIZE.
+ */
+#if !defined ETHARP_TABLE_HASH || defined __DOXYGEN__
+#define ETHARP_TABLE_HASH               0
+#endif
+
+/**
+ * ETHARP_HASH_SIZE: Number of buckets with ETHARP_TABLE_HASH. Must be a
+ * power of 2.
+ */
+#if !defined ETHARP_HASH_SIZE || defined __DOXYGEN__
+#define ETHARP_HASH_SIZE                64
+#endif
+
 /** the time an ARP entry stays valid after its last update,
  *  for ARP_TMR_INTERVAL = 1000, this is
  *  (60 * 5) seconds = 5 minutes.
@@ -794,6 +822,37 @@
 #define IP_REASS_MAX_PBUFS              10
 #endif
 
+/**
+ * IP_REASS_HASH==1: Find the datagram of an incoming fragment through a
+ * hash table of (source, destination, ID, protocol), and keep the
+ * datagrams in age order, so that neither the lookup nor freeing the
+ * oldest datagram walks the datagrams in reassembly. Each datagram keeps
+ * its last fragment and the number of bytes received, so that fragments
+ * arriving in order are appended and completion is detected without
+ * walking its fragments.
+ */
+#if !defined IP_REASS_HASH || defined __DOXYGEN__
+#define IP_REASS_HASH                   0
+#endif
+
+/**
+ * IP_REASS_HASH_SIZE: Number of buckets with IP_REASS_HASH. Must be a
+ * power of 2.
+ */
+#if !defined IP_REASS_HASH_SIZE || defined __DOXYGEN__
+#define IP_REASS_HASH_SIZE              32
+#endif
+
+/**
+ * IP_REASS_COPY==1: Copy fragments received in PBUF_REF pbufs, such as
+ * driver buffers, into PBUF_POOL pbufs before queueing them, so that
+ * reassembly never holds on to receive buffers, and IP_REASS_MAX_PBUFS
+ * bounds the pool pbufs it uses instead.
+ */
+#if !defined IP_REASS_COPY || defined __DOXYGEN__
+#define IP_REASS_COPY                   0
+#endif
+
 /**
  * IP_DEFAULT_TTL: Default value for Time-To-Live used by transport layers.
  */
@@ -1194,6 +1253,23 @@
 #define UDP_TTL                         IP_DEFAULT_TTL
 #endif
 
+/**
+ * UDP_PCB_HASH==1: Find the pcbs for an incoming datagram, and check ports
+ * in udp_bind(), through a table of pcbs hashed by local port instead of
+ * walking udp_pcbs. Which pcb receives a datagram is unchanged.
+ */
+#if !defined UDP_PCB_HASH || defined __DOXYGEN__
+#define UDP_PCB_HASH                    0
+#endif
+
+/**
+ * UDP_PCB_HASH_SIZE: Number of buckets with UDP_PCB_HASH. Must be a power
+ * of 2.
+ */
+#if !defined UDP_PCB_HASH_SIZE || defined __DOXYGEN__
+#define UDP_PCB_HASH_SIZE               256
+#endif
+
 /**
  * LWIP_NETBUF_RECVINFO==1: append destination addr and port to every netbuf.
  */
@@ -1282,6 +1358,40 @@
 #define LWIP_TCP_MAX_SACK_NUM           4
 #endif
 
+/**
+ * LWIP_TCP_SACK_IN==1: TCP will process the SACK blocks of incoming ACKs on
+ * connections that negotiated SACK (which needs LWIP_TCP_SACK_OUT). The
+ * sender keeps a scoreboard of the SACKed segments on the unacked queue,
+ * splitting TCP_GSO segments at the block edges, and recovers from loss as
+ * in RFC 6675: only the segments presumed lost are retransmitted, and new
+ * data is sent as the estimate of the data in flight ("pipe") allows,
+ * until everything outstanding at the loss is acknowledged.
+ */
+#if !defined LWIP_TCP_SACK_IN || defined __DOXYGEN__
+#define LWIP_TCP_SACK_IN                0
+#endif
+
+/**
+ * LWIP_TCP_CC==1: Each TCP pcb grows and cuts its congestion window through
+ * a table of congestion control operations (struct tcp_cc_ops in
+ * lwip/tcp_cc.h), chosen per pcb with tcp_set_cc(). NewReno (tcp_cc_newreno)
+ * behaves as lwIP always has; CUBIC (tcp_cc_cubic, RFC 9438) grows the
+ * window by the time since the last loss instead of by round trips, so it
+ * refills paths with a large bandwidth-delay product sooner, and backs off
+ * less on loss. With LWIP_TCP_CC==0, every pcb uses NewReno.
+ */
+#if !defined LWIP_TCP_CC || defined __DOXYGEN__
+#define LWIP_TCP_CC                     0
+#endif
+
+/**
+ * TCP_CC_DEFAULT: The congestion control new pcbs start with when
+ * LWIP_TCP_CC==1.
+ */
+#if !defined TCP_CC_DEFAULT || defined __DOXYGEN__
+#define TCP_CC_DEFAULT                  (&tcp_cc_newreno)
+#endif
+
 /**
  * TCP_MSS: TCP Maximum segment size. (default is 536, a conservative default,
  * you might want to increase this.)
@@ -1420,6 +1530,75 @@
 #define TCP_OVERSIZE                    TCP_MSS
 #endif
 
+/**
+ * TCP_GSO==1: Let tcp_write() queue segments of several MSS (up to
+ * TCP_GSO_MAX_SIZE bytes of payload) when the route goes through a netif
+ * that sets NETIF_FLAG_GSO and the connection uses that netif's full MTU.
+ * Such a super-segment is passed down the stack in one go: its TCP checksum
+ * is not calculated and it is not fragmented by IP. Instead the netif must
+ * split it into frames of netif->mtu, replicating the headers and adjusting
+ * the IP length, id and checksum and the TCP sequence number, flags and
+ * checksum of each frame.
+ */
+#if !defined TCP_GSO || defined __DOXYGEN__
+#define TCP_GSO                         0
+#endif
+
+/**
+ * TCP_GSO_MAX_SIZE: The maximum payload of a TCP super-segment queued with
+ * TCP_GSO. Together with the headers this must fit the 16 bit IP length.
+ */
+#if !defined TCP_GSO_MAX_SIZE || defined __DOXYGEN__
+#define TCP_GSO_MAX_SIZE                0xff00
+#endif
+
+/**
+ * TCP_PCB_HASH==1: Find the pcb for an incoming segment through hash tables
+ * kept alongside the pcb lists instead of walking them: active and
+ * TIME-WAIT pcbs are hashed by their 4-tuple, listening pcbs by their
+ * local port. This keeps demultiplexing constant time with many
+ * connections.
+ */
+#if !defined TCP_PCB_HASH || defined __DOXYGEN__
+#define TCP_PCB_HASH                    0
+#endif
+
+/**
+ * TCP_PCB_HASH_SIZE: Number of buckets for active and TIME-WAIT pcbs with
+ * TCP_PCB_HASH. Must be a power of 2.
+ */
+#if !defined TCP_PCB_HASH_SIZE || defined __DOXYGEN__
+#define TCP_PCB_HASH_SIZE               1024
+#endif
+
+/**
+ * TCP_LISTEN_HASH_SIZE: Number of buckets for listening pcbs with
+ * TCP_PCB_HASH. Must be a power of 2.
+ */
+#if !defined TCP_LISTEN_HASH_SIZE || defined __DOXYGEN__
+#define TCP_LISTEN_HASH_SIZE            32
+#endif
+
+/**
+ * TCP_TIMER_LISTS==1: tcp_fasttmr() and tcp_slowtmr() only visit the pcbs
+ * that have timer work pending, such as a running retransmission timer or
+ * a state with a timeout, instead of every active pcb, so that idle
+ * connections cost nothing per tick. Delayed ACKs are kept on a list of
+ * their own and sent TCP_ACK_DELAY_MS after they were delayed, rather than
+ * on the next tcp_fasttmr(). Needs LWIP_TIMERS.
+ */
+#if !defined TCP_TIMER_LISTS || defined __DOXYGEN__
+#define TCP_TIMER_LISTS                 0
+#endif
+
+/**
+ * TCP_ACK_DELAY_MS: How long an ACK is delayed with TCP_TIMER_LISTS, in
+ * milliseconds. Without TCP_TIMER_LISTS it is up to TCP_FAST_INTERVAL.
+ */
+#if !defined TCP_ACK_DELAY_MS || defined __DOXYGEN__
+#define TCP_ACK_DELAY_MS                40
+#endif
+
 /**
  * LWIP_TCP_TIMESTAMPS==1: support the TCP timestamp option.
  * The timestamp option is currently only used to help remote hosts, it is not
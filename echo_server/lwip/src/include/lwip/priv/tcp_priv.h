@@ -85,6 +85,9 @@ err_t            tcp_rexmit_rto_prepare(struct tcp_pcb *pcb);
 void             tcp_rexmit_rto_commit(struct tcp_pcb *pcb);
 void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
 void             tcp_rexmit_fast (struct tcp_pcb *pcb);
+#if LWIP_TCP_SACK_IN
+void             tcp_rexmit_sack (struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK_IN */
 u32_t            tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb);
 err_t            tcp_process_refused_data(struct tcp_pcb *pcb);
 
@@ -116,6 +119,22 @@ err_t            tcp_process_refused_data(struct tcp_pcb *pcb);
 #endif
 #define TCP_SEQ_BETWEEN(a,b,c) (TCP_SEQ_GEQ(a,b) && TCP_SEQ_LEQ(a,c))
 
+#if LWIP_TCP_SACK_IN
+/* RFC 6675 IsLost(): a segment with DupThresh segments, or more than
+   (DupThresh - 1) * SMSS bytes, SACKed above it is presumed lost */
+#define TCP_SACK_DUPTHRESH 3
+#define TCP_SACK_IS_LOST(pcb, nsacked_above, sacked_above) \
+  (((nsacked_above) >= TCP_SACK_DUPTHRESH) || \
+   ((sacked_above) > (u32_t)(TCP_SACK_DUPTHRESH - 1) * (pcb)->mss))
+#endif /* LWIP_TCP_SACK_IN */
+
+/* The congestion control operations of a pcb */
+#if LWIP_TCP_CC
+#define TCP_CC(pcb) ((pcb)->cc)
+#else /* LWIP_TCP_CC */
+#define TCP_CC(pcb) (&tcp_cc_newreno)
+#endif /* LWIP_TCP_CC */
+
 #ifndef TCP_TMR_INTERVAL
 #define TCP_TMR_INTERVAL       250  /* The TCP timer interval in milliseconds. */
 #endif /* TCP_TMR_INTERVAL */
@@ -270,6 +289,8 @@ struct tcp_seg {
                                                checksummed into 'chksum' */
 #define TF_SEG_OPTS_WND_SCALE   (u8_t)0x08U /* Include WND SCALE option (only used in SYN segments) */
 #define TF_SEG_OPTS_SACK_PERM   (u8_t)0x10U /* Include SACK Permitted option (only used in SYN segments) */
+#define TF_SEG_SACKED           (u8_t)0x20U /* All data was selectively acknowledged
+                                               by the remote host (LWIP_TCP_SACK_IN) */
   struct tcp_hdr *tcphdr;  /* the TCP header */
 };
 
@@ -278,6 +299,7 @@ struct tcp_seg {
 #define LWIP_TCP_OPT_MSS        2
 #define LWIP_TCP_OPT_WS         3
 #define LWIP_TCP_OPT_SACK_PERM  4
+#define LWIP_TCP_OPT_SACK       5
 #define LWIP_TCP_OPT_TS         8
 
 #define LWIP_TCP_OPT_LEN_MSS    4
@@ -349,6 +371,39 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
    3) All PCBs in the tcp_listen_pcbs list is in LISTEN state.
    4) All PCBs in the tcp_tw_pcbs list is in TIME-WAIT state.
 */
+#if TCP_PCB_HASH
+/* Hash tables kept alongside the lists, see TCP_PCB_HASH */
+void tcp_pcb_hash_add(struct tcp_pcb **pcbs, struct tcp_pcb *pcb);
+void tcp_pcb_hash_remove(struct tcp_pcb **pcbs, struct tcp_pcb *pcb);
+struct tcp_pcb *tcp_pcb_hash_lookup(u16_t local_port, u16_t remote_port,
+                                    const ip_addr_t *local_ip, const ip_addr_t *remote_ip,
+                                    u8_t netif_idx);
+struct tcp_pcb_listen *tcp_listen_hash_lookup(u16_t local_port, const ip_addr_t *local_ip,
+                                              u8_t netif_idx);
+#define TCP_HASH_ADD(pcbs, npcb) tcp_pcb_hash_add(pcbs, npcb)
+#define TCP_HASH_RMV(pcbs, npcb) tcp_pcb_hash_remove(pcbs, npcb)
+#else /* TCP_PCB_HASH */
+#define TCP_HASH_ADD(pcbs, npcb)
+#define TCP_HASH_RMV(pcbs, npcb)
+#endif /* TCP_PCB_HASH */
+
+#if TCP_TIMER_LISTS
+/* The active pcbs with timer work pending, see TCP_TIMER_LISTS */
+extern struct tcp_pcb *tcp_timer_pcbs;
+void tcp_timer_pending(struct tcp_pcb *pcb);
+void tcp_timer_remove(struct tcp_pcb *pcb);
+void tcp_delack_add(struct tcp_pcb *pcb);
+#define TCP_TIMER_REG(pcbs, npcb) do { if ((pcbs) == &tcp_active_pcbs) tcp_timer_pending(npcb); } while (0)
+#define TCP_TIMER_RMV(pcbs, npcb) do { if ((pcbs) == &tcp_active_pcbs) tcp_timer_remove(npcb); } while (0)
+#define TCP_TIMER_PENDING(pcb) tcp_timer_pending(pcb)
+#define TCP_DELACK_ADD(pcb) tcp_delack_add(pcb)
+#else /* TCP_TIMER_LISTS */
+#define TCP_TIMER_REG(pcbs, npcb)
+#define TCP_TIMER_RMV(pcbs, npcb)
+#define TCP_TIMER_PENDING(pcb)
+#define TCP_DELACK_ADD(pcb)
+#endif /* TCP_TIMER_LISTS */
+
 /* Define two macros, TCP_REG and TCP_RMV that registers a TCP PCB
    with a PCB list or removes a PCB from a list, respectively. */
 #ifndef TCP_DEBUG_PCB_LISTS
@@ -367,6 +422,8 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
                             (npcb)->next = *(pcbs); \
                             LWIP_ASSERT("TCP_REG: npcb->next != npcb", (npcb)->next != (npcb)); \
                             *(pcbs) = (npcb); \
+                            TCP_HASH_ADD(pcbs, npcb); \
+                            TCP_TIMER_REG(pcbs, npcb); \
                             LWIP_ASSERT("TCP_REG: tcp_pcbs sane", tcp_pcbs_sane()); \
               tcp_timer_needed(); \
                             } while(0)
@@ -374,6 +431,8 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
                             struct tcp_pcb *tcp_tmp_pcb; \
                             LWIP_ASSERT("TCP_RMV: pcbs != NULL", *(pcbs) != NULL); \
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_RMV: removing %p from %p\n", (void *)(npcb), (void *)(*(pcbs)))); \
+                            TCP_HASH_RMV(pcbs, npcb); \
+                            TCP_TIMER_RMV(pcbs, npcb); \
                             if(*(pcbs) == (npcb)) { \
                                *(pcbs) = (*pcbs)->next; \
                             } else for (tcp_tmp_pcb = *(pcbs); tcp_tmp_pcb != NULL; tcp_tmp_pcb = tcp_tmp_pcb->next) { \
@@ -393,11 +452,15 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
   do {                                             \
     (npcb)->next = *pcbs;                          \
     *(pcbs) = (npcb);                              \
+    TCP_HASH_ADD(pcbs, npcb);                      \
+    TCP_TIMER_REG(pcbs, npcb);                     \
     tcp_timer_needed();                            \
   } while (0)
 
 #define TCP_RMV(pcbs, npcb)                        \
   do {                                             \
+    TCP_HASH_RMV(pcbs, npcb);                      \
+    TCP_TIMER_RMV(pcbs, npcb);                     \
     if(*(pcbs) == (npcb)) {                        \
       (*(pcbs)) = (*pcbs)->next;                   \
     }                                              \
@@ -453,6 +516,7 @@ struct tcp_seg *tcp_seg_copy(struct tcp_seg *seg);
     }                                              \
     else {                                         \
       tcp_set_flags(pcb, TF_ACK_DELAY);            \
+      TCP_DELACK_ADD(pcb);                         \
     }                                              \
   } while (0)
 
@@ -472,6 +536,9 @@ u32_t tcp_next_iss(struct tcp_pcb *pcb);
 
 err_t tcp_keepalive(struct tcp_pcb *pcb);
 err_t tcp_split_unsent_seg(struct tcp_pcb *pcb, u16_t split);
+#if LWIP_TCP_SACK_IN
+err_t tcp_split_unacked_seg(struct tcp_pcb *pcb, struct tcp_seg *seg, u16_t split);
+#endif /* LWIP_TCP_SACK_IN */
 err_t tcp_zero_window_probe(struct tcp_pcb *pcb);
 void  tcp_trigger_input_pcb_close(void);
 
@@ -43,6 +43,7 @@
 #if LWIP_TCP /* don't build if not configured for use in lwipopts.h */
 
 #include "lwip/tcpbase.h"
+#include "lwip/tcp_cc.h"
 #include "lwip/mem.h"
 #include "lwip/pbuf.h"
 #include "lwip/ip.h"
@@ -209,8 +210,15 @@ typedef u16_t tcpflags_t;
 /**
  * members common to struct tcp_pcb and struct tcp_listen_pcb
  */
+#if TCP_PCB_HASH
+#define TCP_PCB_HASH_NEXT(type) type *hash_next; /* for the hash bucket */
+#else
+#define TCP_PCB_HASH_NEXT(type)
+#endif
+
 #define TCP_PCB_COMMON(type) \
   type *next; /* for the linked list */ \
+  TCP_PCB_HASH_NEXT(type) \
   void *callback_arg; \
   TCP_PCB_EXTARGS \
   enum tcp_state state; /* TCP state */ \
@@ -278,6 +286,15 @@ struct tcp_pcb {
   u8_t polltmr, pollinterval;
   u8_t last_timer;
   u32_t tmr;
+#if TCP_TIMER_LISTS
+  /* on tcp_timer_pcbs while there is timer work pending */
+  struct tcp_pcb *timer_next;
+  struct tcp_pcb **timer_pprev;
+  /* on the list of delayed ACKs, to be sent at delack_due */
+  struct tcp_pcb *delack_next;
+  struct tcp_pcb **delack_pprev;
+  u32_t delack_due;
+#endif /* TCP_TIMER_LISTS */
 
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
@@ -311,10 +328,21 @@ struct tcp_pcb {
   /* congestion avoidance/control variables */
   tcpwnd_size_t cwnd;
   tcpwnd_size_t ssthresh;
+#if LWIP_TCP_CC
+  const struct tcp_cc_ops *cc;
+  union tcp_cc_state cc_state;
+#endif /* LWIP_TCP_CC */
 
   /* first byte following last rto byte */
   u32_t rto_end;
 
+#if LWIP_TCP_SACK_IN
+  /* SACK loss recovery (RFC 6675), while TF_INFR is set: */
+  u32_t recover;  /* snd_nxt when recovery started, ending it once acked */
+  u32_t high_rxt; /* first byte after the last retransmission */
+  tcpwnd_size_t pipe; /* estimate of the bytes in flight */
+#endif /* LWIP_TCP_SACK_IN */
+
   /* sender variables */
   u32_t snd_nxt;   /* next new seqno to be sent */
   u32_t snd_wl1, snd_wl2; /* Sequence and acknowledgement numbers of last
@@ -474,6 +502,9 @@ err_t            tcp_write   (struct tcp_pcb *pcb, const void *dataptr, u16_t le
                               u8_t apiflags);
 
 void             tcp_setprio (struct tcp_pcb *pcb, u8_t prio);
+#if LWIP_TCP_CC
+void             tcp_set_cc  (struct tcp_pcb *pcb, const struct tcp_cc_ops *cc);
+#endif /* LWIP_TCP_CC */
 
 err_t            tcp_output  (struct tcp_pcb *pcb);
 
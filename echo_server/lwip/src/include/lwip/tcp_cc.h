@@ -0,0 +1,97 @@
+/**
+ * @file
+ * TCP congestion control operations\n
+ * See also @ref tcp_raw
+ */
+
+/*
+ * Copyright (c) 2022 UNSW
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+#ifndef LWIP_HDR_TCP_CC_H
+#define LWIP_HDR_TCP_CC_H
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP /* don't build if not configured for use in lwipopts.h */
+
+#include "lwip/tcpbase.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct tcp_pcb;
+
+/**
+ * @ingroup tcp_raw
+ * A congestion control algorithm. TCP itself sets cwnd on entering and
+ * leaving fast recovery and after a retransmission timeout; the algorithm
+ * decides ssthresh at a loss and how cwnd grows as data is acknowledged.
+ */
+struct tcp_cc_ops {
+  const char *name;
+  /** Reset the algorithm's state in pcb->cc_state */
+  void (*init)(struct tcp_pcb *pcb);
+  /** Grow cwnd as 'acked' bytes are newly acknowledged, outside fast recovery */
+  void (*on_ack)(struct tcp_pcb *pcb, tcpwnd_size_t acked);
+  /** Set ssthresh as fast retransmit starts recovering from a loss */
+  void (*on_loss)(struct tcp_pcb *pcb);
+  /** Set ssthresh as the retransmission timer fires */
+  void (*on_rto)(struct tcp_pcb *pcb);
+};
+
+/** NewReno (RFC 5681 and RFC 3465), lwIP's congestion control without LWIP_TCP_CC */
+extern const struct tcp_cc_ops tcp_cc_newreno;
+
+#if LWIP_TCP_CC
+/** CUBIC (RFC 9438) */
+extern const struct tcp_cc_ops tcp_cc_cubic;
+
+struct tcp_cc_cubic_state {
+  u32_t epoch_start; /* sys_now() when the current growth epoch started */
+  u32_t k;           /* ms from the epoch start until the curve reaches origin */
+  u32_t origin;      /* cwnd at the plateau of the curve */
+  u32_t w_max;       /* cwnd at the last loss */
+  u32_t w_est;       /* the cwnd NewReno would have by now */
+  u8_t in_epoch;
+};
+
+/** The per pcb state of the congestion control algorithms */
+union tcp_cc_state {
+  struct tcp_cc_cubic_state cubic;
+};
+#endif /* LWIP_TCP_CC */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LWIP_TCP */
+
+#endif /* LWIP_HDR_TCP_CC_H */
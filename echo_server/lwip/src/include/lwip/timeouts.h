@@ -95,6 +95,14 @@ struct sys_timeo {
   u32_t time;
   sys_timeout_handler h;
   void *arg;
+#if LWIP_TIMER_WHEEL
+  /* next is the next timeout in the same wheel slot */
+  struct sys_timeo *prev;
+  /* timeouts whose handler and arg hash alike, for sys_untimeout() */
+  struct sys_timeo *hash_next;
+  struct sys_timeo **hash_pprev;
+  u16_t slot;
+#endif /* LWIP_TIMER_WHEEL */
 #if LWIP_DEBUG_TIMERNAMES
   const char* handler_name;
 #endif /* LWIP_DEBUG_TIMERNAMES */
@@ -115,7 +123,9 @@ void sys_check_timeouts(void);
 u32_t sys_timeouts_sleeptime(void);
 
 #if LWIP_TESTMODE
+#if !LWIP_TIMER_WHEEL
 struct sys_timeo** sys_timeouts_get_next_timeout(void);
+#endif /* !LWIP_TIMER_WHEEL */
 void lwip_cyclic_timer(void *arg);
 #endif
 
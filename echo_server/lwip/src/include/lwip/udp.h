@@ -85,6 +85,12 @@ struct udp_pcb {
 /* Protocol specific PCB members */
 
   struct udp_pcb *next;
+#if UDP_PCB_HASH
+  /* for the hash bucket of local_port */
+  struct udp_pcb *hash_next;
+  /* when the pcb went to the front of its bucket, to keep bucket order */
+  u32_t hash_seq;
+#endif /* UDP_PCB_HASH */
 
   u8_t flags;
   /** ports are in host byte order */
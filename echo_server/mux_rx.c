@@ -0,0 +1,339 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * RX multiplexer. Received frames are handed to the client whose MAC
+ * address they are sent to, without copying. Broadcast and multicast
+ * frames go to every client, each additional client receiving a copy in
+ * a buffer from a small reserve. Every client may only hold a quota of
+ * the receive buffers, so a client that stops processing frames has its
+ * frames dropped instead of starving the other clients.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sel4cp.h>
+#include <sel4/sel4.h>
+
+#include "mux.h"
+#include "shared_ringbuffer.h"
+#include "trace.h"
+#include "util.h"
+
+#define DRIVER_CH 1
+#define DRIVER_INIT_CH 2
+#define CLIENT_CH(c) (3 + (c))
+#define CLIENT_INIT_CH(c) (3 + NUM_CLIENTS + (c))
+
+#define ETH_HWADDR_LEN 6
+
+/* Buffers held back for copies of broadcast frames */
+#define RX_RESERVE (8 * NUM_CLIENTS)
+/* Buffers a single client may hold at once */
+#define RX_CLIENT_QUOTA ((NUM_BUFFERS - 1 - RX_RESERVE) / NUM_CLIENTS)
+/* Ask clients to signal returned buffers when the driver is down to this many */
+#define RX_REFILL_WATERMARK 64
+
+_Static_assert(NUM_CLIENTS == 2, "Client rings are listed for two clients");
+
+/* Memory regions. These all have to be here to keep compiler happy */
+uintptr_t rx_free;
+uintptr_t rx_used;
+uintptr_t rx_free_cli0;
+uintptr_t rx_used_cli0;
+uintptr_t rx_free_cli1;
+uintptr_t rx_used_cli1;
+uintptr_t shared_dma_vaddr;
+uintptr_t trace_buffer;
+uintptr_t uart_base;
+
+typedef struct client {
+    ring_handle_t rx_ring;
+    uint8_t mac[ETH_HWADDR_LEN];
+    /* Number of buffers the client currently holds */
+    unsigned int outstanding;
+    /* Frames dropped because the client was over its quota */
+    uint64_t dropped;
+} client_t;
+
+typedef struct state {
+    ring_handle_t rx_ring;
+    client_t clients[NUM_CLIENTS];
+    /* Hardware MAC address, reported in the ENET PALR/PAUR layout */
+    uint32_t palr;
+    uint32_t paur;
+    uintptr_t reserve[RX_RESERVE];
+    unsigned int reserve_count;
+} state_t;
+
+state_t state;
+
+static inline bool is_rx_buffer(uintptr_t addr)
+{
+    return addr >= shared_dma_vaddr && addr < shared_dma_vaddr + NUM_BUFFERS * BUF_SIZE &&
+           !((addr - shared_dma_vaddr) % BUF_SIZE);
+}
+
+/**
+ * Give a buffer back to the driver, or keep it in the reserve if that has
+ * run low.
+ *
+ * @param addr address of the buffer.
+ */
+static void return_buffer(uintptr_t addr)
+{
+    if (state.reserve_count < RX_RESERVE) {
+        state.reserve[state.reserve_count++] = addr;
+        return;
+    }
+
+    enqueue_free(&state.rx_ring, addr, BUF_SIZE, NULL);
+}
+
+/**
+ * Hand a frame to a client, or drop it if the client holds its quota.
+ *
+ * @param client client to deliver to.
+ * @param addr address of the buffer holding the frame.
+ * @param len length of the frame.
+ *
+ * @return true if the client now owns the buffer.
+ */
+static bool deliver(client_t *client, uintptr_t addr, unsigned int len)
+{
+    if (client->outstanding >= RX_CLIENT_QUOTA || ring_full(client->rx_ring.used_ring)) {
+        client->dropped++;
+        return false;
+    }
+
+    TRACE(TRACE_MUX_RX, TRACE_BUF_ID(addr));
+    enqueue_used(&client->rx_ring, addr, len, NULL);
+    client->outstanding++;
+    return true;
+}
+
+/**
+ * Copy a broadcast frame into a reserve buffer for a client.
+ *
+ * @return true if the client received a copy.
+ */
+static bool deliver_copy(client_t *client, uintptr_t addr, unsigned int len)
+{
+    if (!state.reserve_count) {
+        client->dropped++;
+        return false;
+    }
+
+    uintptr_t copy = state.reserve[--state.reserve_count];
+    memcpy((void *)copy, (void *)addr, len);
+    int err = seL4_ARM_VSpace_Clean_Data(3, copy, copy + len);
+    if (err) {
+        print("ARM Vspace clean failed\n");
+    }
+
+    if (!deliver(client, copy, len)) {
+        state.reserve[state.reserve_count++] = copy;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Move the buffers clients have finished with back to the driver.
+ */
+static void process_client_free(void)
+{
+    bool reprocess = true;
+
+    while (reprocess) {
+        reprocess = false;
+
+        for (int c = 0; c < NUM_CLIENTS; c++) {
+            client_t *client = &state.clients[c];
+            uintptr_t addr;
+            unsigned int len;
+            void *cookie;
+
+            while (!dequeue_free(&client->rx_ring, &addr, &len, &cookie)) {
+                if (!is_rx_buffer(addr) || !client->outstanding) {
+                    print("MUX RX: client returned an invalid buffer\n");
+                    continue;
+                }
+                client->outstanding--;
+                return_buffer(addr);
+            }
+        }
+
+        /* If the driver is running out, have clients tell us when they return buffers */
+        bool low = ring_size(state.rx_ring.free_ring) < RX_REFILL_WATERMARK;
+        for (int c = 0; c < NUM_CLIENTS; c++) {
+            client_t *client = &state.clients[c];
+            if (low && client->outstanding) {
+                request_signal(client->rx_ring.free_ring);
+                if (!ring_empty(client->rx_ring.free_ring)) {
+                    cancel_signal(client->rx_ring.free_ring);
+                    reprocess = true;
+                }
+            } else {
+                cancel_signal(client->rx_ring.free_ring);
+            }
+        }
+    }
+
+    if (require_signal(state.rx_ring.free_ring)) {
+        cancel_signal(state.rx_ring.free_ring);
+        sel4cp_notify(DRIVER_CH);
+    }
+}
+
+/**
+ * Demultiplex the frames received by the driver to the clients.
+ */
+static void process_rx_complete(void)
+{
+    bool notify_clients[NUM_CLIENTS] = { false };
+    uintptr_t addr;
+    unsigned int len;
+    void *cookie;
+
+    while (!dequeue_used(&state.rx_ring, &addr, &len, &cookie)) {
+        if (!is_rx_buffer(addr)) {
+            print("MUX RX: driver returned an invalid buffer\n");
+            continue;
+        }
+
+        /* We read the destination address, so drop any stale cache lines */
+        int err = seL4_ARM_VSpace_Invalidate_Data(3, addr, addr + len);
+        if (err) {
+            print("ARM Vspace invalidate failed\n");
+        }
+
+        const uint8_t *dest = (const uint8_t *)addr;
+        bool owned = false;
+
+        if (len < ETH_HWADDR_LEN) {
+            /* Runt frame, drop it */
+        } else if (dest[0] & 1) {
+            /* Broadcast or multicast: the buffer itself goes to the first client
+             * that takes it, the others get copies. */
+            for (int c = 0; c < NUM_CLIENTS; c++) {
+                bool delivered;
+                if (!owned) {
+                    delivered = owned = deliver(&state.clients[c], addr, len);
+                } else {
+                    delivered = deliver_copy(&state.clients[c], addr, len);
+                }
+                notify_clients[c] |= delivered;
+            }
+        } else {
+            for (int c = 0; c < NUM_CLIENTS; c++) {
+                if (!memcmp(dest, state.clients[c].mac, ETH_HWADDR_LEN)) {
+                    owned = deliver(&state.clients[c], addr, len);
+                    notify_clients[c] |= owned;
+                    break;
+                }
+            }
+        }
+
+        if (!owned) {
+            return_buffer(addr);
+        }
+    }
+
+    for (int c = 0; c < NUM_CLIENTS; c++) {
+        if (notify_clients[c]) {
+            sel4cp_notify(CLIENT_CH(c));
+        }
+    }
+
+    process_client_free();
+}
+
+/**
+ * Derive the MAC address of each client from the hardware address. The
+ * first client uses the hardware address, the others locally administered
+ * addresses based on it.
+ */
+static void setup_client_macs(void)
+{
+    sel4cp_ppcall(DRIVER_INIT_CH, sel4cp_msginfo_new(0, 0));
+    state.palr = sel4cp_mr_get(0);
+    state.paur = sel4cp_mr_get(1);
+
+    for (int c = 0; c < NUM_CLIENTS; c++) {
+        uint8_t *mac = state.clients[c].mac;
+        mac[0] = state.palr >> 24;
+        mac[1] = state.palr >> 16 & 0xff;
+        mac[2] = state.palr >> 8 & 0xff;
+        mac[3] = state.palr & 0xff;
+        mac[4] = state.paur >> 24;
+        mac[5] = state.paur >> 16 & 0xff;
+        if (c) {
+            mac[0] |= 0x2;
+            mac[5] ^= c;
+        }
+    }
+}
+
+void init(void)
+{
+    sel4cp_dbg_puts(sel4cp_name);
+    sel4cp_dbg_puts(": elf PD init function running\n");
+
+    ring_init(&state.rx_ring, (ring_buffer_t *)rx_free, (ring_buffer_t *)rx_used, NULL, 1);
+    ring_init(&state.clients[0].rx_ring, (ring_buffer_t *)rx_free_cli0, (ring_buffer_t *)rx_used_cli0, NULL, 1);
+    ring_init(&state.clients[1].rx_ring, (ring_buffer_t *)rx_free_cli1, (ring_buffer_t *)rx_used_cli1, NULL, 1);
+
+    /* The receive buffers are owned by us, lend them to the driver */
+    for (int i = 0; i < NUM_BUFFERS - 1; i++) {
+        return_buffer(shared_dma_vaddr + (BUF_SIZE * i));
+    }
+
+    setup_client_macs();
+
+    sel4cp_notify(DRIVER_INIT_CH);
+}
+
+seL4_MessageInfo_t protected(sel4cp_channel ch, sel4cp_msginfo msginfo)
+{
+    for (int c = 0; c < NUM_CLIENTS; c++) {
+        if (ch == CLIENT_INIT_CH(c)) {
+            uint8_t *mac = state.clients[c].mac;
+            sel4cp_mr_set(0, (mac[0] << 24) | (mac[1] << 16) | (mac[2] << 8) | mac[3]);
+            sel4cp_mr_set(1, (mac[4] << 24) | (mac[5] << 16));
+            sel4cp_mr_set(2, c);
+            return sel4cp_msginfo_new(0, 3);
+        }
+    }
+
+    sel4cp_dbg_puts("MUX RX: received ppc on unexpected channel\n");
+    return sel4cp_msginfo_new(0, 0);
+}
+
+void notified(sel4cp_channel ch)
+{
+    if (ch == DRIVER_CH) {
+        process_rx_complete();
+        return;
+    }
+
+    if (ch == DRIVER_INIT_CH) {
+        /* The driver is up, let the clients start */
+        for (int c = 0; c < NUM_CLIENTS; c++) {
+            sel4cp_notify(CLIENT_INIT_CH(c));
+        }
+        return;
+    }
+
+    for (int c = 0; c < NUM_CLIENTS; c++) {
+        if (ch == CLIENT_CH(c)) {
+            process_client_free();
+            return;
+        }
+    }
+
+    sel4cp_dbg_puts("MUX RX: received notification on unexpected channel\n");
+}
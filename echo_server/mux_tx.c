@@ -0,0 +1,257 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * TX multiplexer. Frames queued by the clients are forwarded to the
+ * driver round robin, one frame per client at a time, and transmit buffers
+ * are handed back to the client they came from once sent. Every client
+ * may only have a quota of the driver's descriptors in flight, so a client
+ * sending at line rate cannot lock the others out of the driver's ring.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sel4cp.h>
+
+#include "mux.h"
+#include "shared_ringbuffer.h"
+#include "trace.h"
+#include "util.h"
+
+#define DRIVER_CH 1
+#define CLIENT_CH(c) (2 + (c))
+
+/* Driver descriptors a single client may have in flight */
+#define TX_CLIENT_QUOTA ((SIZE - 1) / NUM_CLIENTS)
+
+_Static_assert(NUM_CLIENTS == 2, "Client rings are listed for two clients");
+_Static_assert(TX_CLIENT_QUOTA >= BUFF_DESC_MAX_CHAIN, "Clients must be able to send their largest frames");
+
+/* Memory regions. These all have to be here to keep compiler happy */
+uintptr_t tx_free;
+uintptr_t tx_used;
+uintptr_t tx_free_cli0;
+uintptr_t tx_used_cli0;
+uintptr_t tx_free_cli1;
+uintptr_t tx_used_cli1;
+uintptr_t shared_dma_vaddr;
+uintptr_t trace_buffer;
+uintptr_t uart_base;
+
+/* A frame in flight at the driver */
+typedef struct tx_frame {
+    /* Client the frame belongs to */
+    unsigned int client;
+    /* Cookie the client passed with the frame */
+    void *cookie;
+    /* Number of descriptors making up the frame */
+    unsigned int num;
+} tx_frame_t;
+
+typedef struct client {
+    ring_handle_t tx_ring;
+    /* Driver descriptors in flight for this client */
+    unsigned int in_flight;
+} client_t;
+
+typedef struct state {
+    ring_handle_t tx_ring;
+    client_t clients[NUM_CLIENTS];
+    /* Bookkeeping for the frames in flight, passed to the driver as cookies */
+    tx_frame_t frames[SIZE];
+    tx_frame_t *free_frames[SIZE];
+    unsigned int free_frame_count;
+    /* Client to consider first the next time frames are forwarded */
+    unsigned int next_client;
+} state_t;
+
+state_t state;
+
+static inline bool dma_addressable(uintptr_t addr, unsigned int len)
+{
+    return addr >= shared_dma_vaddr && addr + len <= shared_dma_vaddr + DMA_SIZE;
+}
+
+/**
+ * Forward one frame from a client to the driver.
+ *
+ * @param c index of the client.
+ * @param num number of descriptors making up the frame.
+ */
+static void forward_frame(unsigned int c, unsigned int num)
+{
+    client_t *client = &state.clients[c];
+    uintptr_t addr[BUFF_DESC_MAX_CHAIN];
+    unsigned int len[BUFF_DESC_MAX_CHAIN];
+    void *cookie = NULL;
+    bool valid = num <= BUFF_DESC_MAX_CHAIN;
+
+    for (unsigned int i = 0; i < num; i++) {
+        void *desc_cookie;
+        uintptr_t desc_addr;
+        unsigned int desc_len;
+        dequeue_used(&client->tx_ring, &desc_addr, &desc_len, &desc_cookie);
+        if (i == 0) {
+            cookie = desc_cookie;
+        }
+        if (i < BUFF_DESC_MAX_CHAIN) {
+            addr[i] = desc_addr;
+            len[i] = desc_len;
+            valid = valid && dma_addressable(desc_addr, desc_len);
+        }
+    }
+
+    if (!valid) {
+        /* Never let the device at memory outside the DMA region */
+        print("MUX TX: dropping invalid frame\n");
+        enqueue_free(&client->tx_ring, addr[0], len[0], cookie);
+        return;
+    }
+
+    tx_frame_t *frame = state.free_frames[--state.free_frame_count];
+    *frame = (tx_frame_t) { .client = c, .cookie = cookie, .num = num };
+    client->in_flight += num;
+
+    TRACE(TRACE_MUX_TX, TRACE_BUF_ID(addr[0]));
+    for (unsigned int i = 0; i < num; i++) {
+        enqueue_used_chain(&state.tx_ring, addr[i], len[i], i ? NULL : frame, i + 1 < num);
+    }
+}
+
+/**
+ * Forward the frames queued by the clients, round robin, for as long as
+ * the driver has room and the clients are within their quotas.
+ */
+static void process_tx_ready(void)
+{
+    bool forwarded = false;
+    bool progress = true;
+
+    while (progress) {
+        progress = false;
+
+        for (unsigned int i = 0; i < NUM_CLIENTS; i++) {
+            unsigned int c = (state.next_client + i) % NUM_CLIENTS;
+            client_t *client = &state.clients[c];
+            unsigned int num = ring_chain_length(client->tx_ring.used_ring);
+
+            if (!num || client->in_flight + num > TX_CLIENT_QUOTA) {
+                continue;
+            }
+            if (ring_space(state.tx_ring.used_ring) < num || !state.free_frame_count) {
+                progress = false;
+                break;
+            }
+
+            forward_frame(c, num);
+            forwarded = progress = true;
+        }
+
+        state.next_client = (state.next_client + 1) % NUM_CLIENTS;
+    }
+
+    if (forwarded) {
+        /* Have the driver tell us when it has sent them */
+        request_signal(state.tx_ring.free_ring);
+
+        have_signal = true;
+        signal_msg = seL4_MessageInfo_new(0, 0, 0, 0);
+        signal = (BASE_OUTPUT_NOTIFICATION_CAP + DRIVER_CH);
+    }
+}
+
+/**
+ * Hand the buffers of the frames the driver has sent back to their clients.
+ */
+static void process_tx_complete(void)
+{
+    bool notify_clients[NUM_CLIENTS] = { false };
+    bool reprocess = true;
+
+    while (reprocess) {
+        uintptr_t addr;
+        unsigned int len;
+        tx_frame_t *frame;
+
+        while (!dequeue_free(&state.tx_ring, &addr, &len, (void **)&frame)) {
+            client_t *client = &state.clients[frame->client];
+
+            enqueue_free(&client->tx_ring, addr, len, frame->cookie);
+            client->in_flight -= frame->num;
+
+            /* The client holds references to the rest of a scatter-gather
+             * frame until it learns the frame has been sent. */
+            if (frame->num > 1 || require_signal(client->tx_ring.free_ring)) {
+                cancel_signal(client->tx_ring.free_ring);
+                notify_clients[frame->client] = true;
+            }
+
+            state.free_frames[state.free_frame_count++] = frame;
+        }
+
+        /* Have the driver tell us when it sends the frames still in flight */
+        reprocess = false;
+        if (state.free_frame_count < SIZE) {
+            request_signal(state.tx_ring.free_ring);
+            if (!ring_empty(state.tx_ring.free_ring)) {
+                cancel_signal(state.tx_ring.free_ring);
+                reprocess = true;
+            }
+        }
+    }
+
+    for (int c = 0; c < NUM_CLIENTS; c++) {
+        if (notify_clients[c]) {
+            sel4cp_notify(CLIENT_CH(c));
+        }
+    }
+}
+
+void init(void)
+{
+    sel4cp_dbg_puts(sel4cp_name);
+    sel4cp_dbg_puts(": elf PD init function running\n");
+
+    ring_init(&state.tx_ring, (ring_buffer_t *)tx_free, (ring_buffer_t *)tx_used, NULL, 1);
+    ring_init(&state.clients[0].tx_ring, (ring_buffer_t *)tx_free_cli0, (ring_buffer_t *)tx_used_cli0, NULL, 1);
+    ring_init(&state.clients[1].tx_ring, (ring_buffer_t *)tx_free_cli1, (ring_buffer_t *)tx_used_cli1, NULL, 1);
+
+    for (int i = 0; i < SIZE; i++) {
+        state.free_frames[i] = &state.frames[i];
+    }
+    state.free_frame_count = SIZE;
+}
+
+seL4_MessageInfo_t protected(sel4cp_channel ch, sel4cp_msginfo msginfo)
+{
+    for (int c = 0; c < NUM_CLIENTS; c++) {
+        if (ch == CLIENT_CH(c)) {
+            sel4cp_mr_set(0, c * TX_BUFFERS_PER_CLIENT);
+            sel4cp_mr_set(1, TX_BUFFERS_PER_CLIENT);
+            return sel4cp_msginfo_new(0, 2);
+        }
+    }
+
+    sel4cp_dbg_puts("MUX TX: received ppc on unexpected channel\n");
+    return sel4cp_msginfo_new(0, 0);
+}
+
+void notified(sel4cp_channel ch)
+{
+    if (ch == DRIVER_CH) {
+        process_tx_complete();
+        process_tx_ready();
+        return;
+    }
+
+    for (int c = 0; c < NUM_CLIENTS; c++) {
+        if (ch == CLIENT_CH(c)) {
+            process_tx_ready();
+            return;
+        }
+    }
+
+    sel4cp_dbg_puts("MUX TX: received notification on unexpected channel\n");
+}
@@ -0,0 +1,460 @@
+/*
+ * Copyright 2022, UNSW
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Packet generator. Takes the place of a network stack at the
+ * multiplexers and sends test frames addressed to itself, at the frame
+ * sizes and rates listed in pktgen_steps. With the driver in loopback
+ * (make ETH_LOOPBACK=1) the frames come straight back through the RX
+ * multiplexer, and the generator measures what returns: frames lost or
+ * reordered, throughput and round trip latency. Each step's results are
+ * printed on the serial console, so the driver and rings can be
+ * characterised without any external hosts.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sel4cp.h>
+#include <sel4/sel4.h>
+
+#include "bench.h"
+#include "mux.h"
+#include "shared_ringbuffer.h"
+#include "trace.h"
+#include "util.h"
+
+#define TIMER  1
+#define RX_CH  2
+#define INIT   4
+#define TX_CH  6
+
+/* Local experimental ethertype, so the frames are never taken for real traffic */
+#define PKTGEN_ETHERTYPE 0x88b5
+#define PKTGEN_MAGIC 0x706b7467
+#define ETH_HWADDR_LEN 6
+#define ETH_FCS_LEN 4
+#define ETH_MIN_FRAME 64
+#define ETH_MAX_FRAME 1518
+
+/* Time the link gets to come up before the first step */
+#define PKTGEN_WARMUP_MS 2000
+/* Time frames still in flight get to come back after a step */
+#define PKTGEN_DRAIN_MS 20
+#define PKTGEN_TICK_MS 1
+#define NS_IN_MS 1000000ULL
+
+/* GPT registers, as used by timer.c */
+#define GPT_CR 0
+#define GPT_SR 2
+#define GPT_IR 3
+#define GPT_OCR1 4
+#define GPT_CNT 9
+
+typedef struct pktgen_step {
+    /* Frame size on the wire, including the FCS */
+    unsigned int frame_size;
+    /* Frames per second to send, 0 to send as fast as buffers come back */
+    uint64_t rate;
+    unsigned int duration_ms;
+} pktgen_step_t;
+
+static const pktgen_step_t pktgen_steps[] = {
+    { 64, 0, 1000 },
+    { 128, 0, 1000 },
+    { 256, 0, 1000 },
+    { 512, 0, 1000 },
+    { 1024, 0, 1000 },
+    { 1518, 0, 1000 },
+    { 64, 10000, 1000 },
+    { 64, 100000, 1000 },
+    { 1518, 10000, 1000 },
+};
+
+/* Header of a test frame, the rest of the frame is padding */
+typedef struct pktgen_hdr {
+    uint8_t dest[ETH_HWADDR_LEN];
+    uint8_t src[ETH_HWADDR_LEN];
+    uint16_t type;
+    uint32_t magic;
+    uint32_t step;
+    uint64_t seq;
+    uint64_t cycles;
+} __attribute__((packed)) pktgen_hdr_t;
+
+_Static_assert(sizeof(pktgen_hdr_t) <= ETH_MIN_FRAME - ETH_FCS_LEN, "Test header must fit the smallest frame");
+
+typedef struct pktgen_stats {
+    uint64_t tx_frames;
+    /* Bytes of the frames on the wire, including the FCS */
+    uint64_t tx_bytes;
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+    /* Frames that came back with a lower sequence number than one before */
+    uint64_t reordered;
+    /* Frames that were not ours, or belong to an earlier step */
+    uint64_t foreign;
+    uint64_t latency_min;
+    uint64_t latency_max;
+    uint64_t latency_total;
+} pktgen_stats_t;
+
+typedef enum {
+    PKTGEN_WARMUP,
+    PKTGEN_SENDING,
+    PKTGEN_DRAINING,
+    PKTGEN_DONE,
+} pktgen_phase_t;
+
+/* Memory regions. These all have to be here to keep compiler happy */
+uintptr_t rx_free;
+uintptr_t rx_used;
+uintptr_t tx_free;
+uintptr_t tx_used;
+uintptr_t shared_dma_vaddr;
+uintptr_t gpt_regs;
+uintptr_t trace_buffer;
+uintptr_t uart_base;
+
+typedef struct state {
+    ring_handle_t rx_ring;
+    ring_handle_t tx_ring;
+    uint8_t mac[ETH_HWADDR_LEN];
+    /* TX buffers not in flight */
+    uintptr_t tx_free_list[NUM_BUFFERS];
+    unsigned int tx_free_count;
+
+    pktgen_phase_t phase;
+    unsigned int step;
+    /* Timer ticks when the current phase started */
+    uint64_t phase_start;
+    uint64_t next_seq;
+    uint64_t highest_seq;
+    pktgen_stats_t stats;
+} state_t;
+
+state_t state;
+
+static volatile uint32_t *gpt;
+
+/* The GPT counts nanoseconds, see timer.c */
+static uint64_t get_ticks(void)
+{
+    static uint64_t high;
+    static uint32_t last;
+    uint32_t cnt = gpt[GPT_CNT];
+    if (cnt < last) {
+        high += 1ULL << 32;
+    }
+    last = cnt;
+    return high | cnt;
+}
+
+static void set_timeout(void)
+{
+    gpt[GPT_IR] &= ~1;
+    gpt[GPT_OCR1] = (uint32_t)(get_ticks() + PKTGEN_TICK_MS * NS_IN_MS);
+    gpt[GPT_IR] |= 1;
+}
+
+static void gpt_init(void)
+{
+    gpt = (volatile uint32_t *)gpt_regs;
+    gpt[GPT_CR] = (1 << 9) | (1 << 6) | 1; /* Free run, peripheral clock, enable */
+    gpt[GPT_IR] = 0;
+    set_timeout();
+}
+
+static void put_u64(uint64_t n)
+{
+    char buf[21];
+    int i = sizeof(buf) - 1;
+    buf[i] = 0;
+    do {
+        buf[--i] = '0' + n % 10;
+    } while (n /= 10);
+    print(&buf[i]);
+}
+
+static void put_field(const char *name, uint64_t value)
+{
+    print(" ");
+    print(name);
+    print("=");
+    put_u64(value);
+}
+
+static void reclaim_tx_buffers(void)
+{
+    uintptr_t addr;
+    unsigned int len;
+    void *cookie;
+
+    while (!dequeue_free(&state.tx_ring, &addr, &len, &cookie)) {
+        state.tx_free_list[state.tx_free_count++] = addr;
+    }
+}
+
+/**
+ * Send the frames of the current step that are due by now, as far as
+ * there are TX buffers for them.
+ *
+ * @param now timer ticks.
+ */
+static void send_frames(uint64_t now)
+{
+    const pktgen_step_t *step = &pktgen_steps[state.step];
+    unsigned int len = step->frame_size - ETH_FCS_LEN;
+    uint64_t due = UINT64_MAX;
+    if (step->rate) {
+        due = (now - state.phase_start) * step->rate / (NS_IN_MS * 1000);
+    }
+
+    bool sent = false;
+    while (state.next_seq < due) {
+        if (!state.tx_free_count) {
+            reclaim_tx_buffers();
+        }
+        if (!state.tx_free_count || ring_full(state.tx_ring.used_ring)) {
+            /* Have the multiplexer tell us when buffers come back */
+            request_signal(state.tx_ring.free_ring);
+            if (ring_empty(state.tx_ring.free_ring)) {
+                break;
+            }
+            cancel_signal(state.tx_ring.free_ring);
+            continue;
+        }
+
+        uintptr_t addr = state.tx_free_list[--state.tx_free_count];
+        pktgen_hdr_t *hdr = (pktgen_hdr_t *)addr;
+        memcpy(hdr->dest, state.mac, ETH_HWADDR_LEN);
+        memcpy(hdr->src, state.mac, ETH_HWADDR_LEN);
+        hdr->type = __builtin_bswap16(PKTGEN_ETHERTYPE);
+        hdr->magic = PKTGEN_MAGIC;
+        hdr->step = state.step;
+        hdr->seq = state.next_seq++;
+        hdr->cycles = bench_cycle_count();
+
+        int err = seL4_ARM_VSpace_Clean_Data(3, addr, addr + len);
+        if (err) {
+            print("ARM Vspace clean failed\n");
+        }
+        TRACE(TRACE_CLI_TX, TRACE_BUF_ID(addr));
+        enqueue_used(&state.tx_ring, addr, len, NULL);
+        state.stats.tx_frames++;
+        state.stats.tx_bytes += step->frame_size;
+        sent = true;
+    }
+
+    if (sent) {
+        have_signal = true;
+        signal_msg = seL4_MessageInfo_new(0, 0, 0, 0);
+        signal = (BASE_OUTPUT_NOTIFICATION_CAP + TX_CH);
+    }
+}
+
+static void receive_frames(void)
+{
+    uint64_t cycles = bench_cycle_count();
+    uintptr_t addr;
+    unsigned int len;
+    void *cookie;
+
+    while (!dequeue_used(&state.rx_ring, &addr, &len, &cookie)) {
+        TRACE(TRACE_CLI_RX, TRACE_BUF_ID(addr));
+        int err = seL4_ARM_VSpace_Invalidate_Data(3, addr, addr + sizeof(pktgen_hdr_t));
+        if (err) {
+            print("ARM Vspace invalidate failed\n");
+        }
+
+        pktgen_hdr_t *hdr = (pktgen_hdr_t *)addr;
+        if (len < sizeof(*hdr) || hdr->type != __builtin_bswap16(PKTGEN_ETHERTYPE) ||
+            hdr->magic != PKTGEN_MAGIC || hdr->step != state.step) {
+            state.stats.foreign++;
+        } else {
+            uint64_t latency = cycles - hdr->cycles;
+            state.stats.rx_frames++;
+            /* The driver strips the FCS (RCR_CRCFWD), count it as TX does */
+            state.stats.rx_bytes += len + ETH_FCS_LEN;
+            state.stats.latency_total += latency;
+            if (latency < state.stats.latency_min) {
+                state.stats.latency_min = latency;
+            }
+            if (latency > state.stats.latency_max) {
+                state.stats.latency_max = latency;
+            }
+            if (state.stats.rx_frames > 1 && hdr->seq < state.highest_seq) {
+                state.stats.reordered++;
+            } else {
+                state.highest_seq = hdr->seq;
+            }
+        }
+
+        enqueue_free(&state.rx_ring, addr, BUF_SIZE, cookie);
+    }
+
+    if (require_signal(state.rx_ring.free_ring)) {
+        cancel_signal(state.rx_ring.free_ring);
+        sel4cp_notify(RX_CH);
+    }
+}
+
+static void report_step(uint64_t duration)
+{
+    const pktgen_step_t *step = &pktgen_steps[state.step];
+    pktgen_stats_t *stats = &state.stats;
+    uint64_t us = duration / 1000 ? duration / 1000 : 1;
+
+    print("pktgen: step=");
+    put_u64(state.step);
+    put_field("size", step->frame_size);
+    put_field("rate", step->rate);
+    put_field("tx", stats->tx_frames);
+    put_field("rx", stats->rx_frames);
+    put_field("lost", stats->tx_frames > stats->rx_frames ? stats->tx_frames - stats->rx_frames : 0);
+    put_field("reordered", stats->reordered);
+    put_field("foreign", stats->foreign);
+    put_field("tx_pps", stats->tx_frames * 1000000 / us);
+    put_field("rx_pps", stats->rx_frames * 1000000 / us);
+    put_field("tx_mbps", stats->tx_bytes * 8 / us);
+    put_field("rx_mbps", stats->rx_bytes * 8 / us);
+    if (stats->rx_frames) {
+        put_field("lat_min", stats->latency_min);
+        put_field("lat_avg", stats->latency_total / stats->rx_frames);
+        put_field("lat_max", stats->latency_max);
+    }
+    print("\n");
+}
+
+static void start_phase(pktgen_phase_t phase, uint64_t now)
+{
+    state.phase = phase;
+    state.phase_start = now;
+}
+
+static void start_step(unsigned int step, uint64_t now)
+{
+    if (step >= ARRAY_SIZE(pktgen_steps)) {
+        print("pktgen: done\n");
+        start_phase(PKTGEN_DONE, now);
+        return;
+    }
+
+    unsigned int size = pktgen_steps[step].frame_size;
+    if (size < ETH_MIN_FRAME || size > ETH_MAX_FRAME) {
+        print("pktgen: skipping step with invalid frame size\n");
+        start_step(step + 1, now);
+        return;
+    }
+
+    state.step = step;
+    state.next_seq = 0;
+    state.highest_seq = 0;
+    state.stats = (pktgen_stats_t) { .latency_min = UINT64_MAX };
+    start_phase(PKTGEN_SENDING, now);
+}
+
+/**
+ * Move the generator on: send what is due, and end steps that have run
+ * their course.
+ */
+static void run(void)
+{
+    uint64_t now = get_ticks();
+    uint64_t elapsed = now - state.phase_start;
+
+    switch (state.phase) {
+        case PKTGEN_WARMUP:
+            if (elapsed >= PKTGEN_WARMUP_MS * NS_IN_MS) {
+                start_step(0, now);
+                send_frames(now);
+            }
+            break;
+        case PKTGEN_SENDING:
+            if (elapsed >= pktgen_steps[state.step].duration_ms * NS_IN_MS) {
+                start_phase(PKTGEN_DRAINING, now);
+            } else {
+                send_frames(now);
+            }
+            break;
+        case PKTGEN_DRAINING:
+            if (elapsed >= PKTGEN_DRAIN_MS * NS_IN_MS) {
+                /* Throughput is over the time spent sending */
+                report_step(pktgen_steps[state.step].duration_ms * NS_IN_MS);
+                start_step(state.step + 1, now);
+                if (state.phase == PKTGEN_SENDING) {
+                    send_frames(now);
+                }
+            }
+            break;
+        case PKTGEN_DONE:
+            break;
+    }
+}
+
+static void get_mac(void)
+{
+    sel4cp_ppcall(INIT, sel4cp_msginfo_new(0, 0));
+    uint32_t palr = sel4cp_mr_get(0);
+    uint32_t paur = sel4cp_mr_get(1);
+
+    state.mac[0] = palr >> 24;
+    state.mac[1] = palr >> 16 & 0xff;
+    state.mac[2] = palr >> 8 & 0xff;
+    state.mac[3] = palr & 0xff;
+    state.mac[4] = paur >> 24;
+    state.mac[5] = paur >> 16 & 0xff;
+}
+
+void init(void)
+{
+    sel4cp_dbg_puts(sel4cp_name);
+    sel4cp_dbg_puts(": elf PD init function running\n");
+
+    /* Set up shared memory regions, the multiplexers initialise them */
+    ring_init(&state.rx_ring, (ring_buffer_t *)rx_free, (ring_buffer_t *)rx_used, NULL, 0);
+    ring_init(&state.tx_ring, (ring_buffer_t *)tx_free, (ring_buffer_t *)tx_used, NULL, 0);
+
+    /* Transmit buffers are shared out between the clients by the TX multiplexer */
+    sel4cp_ppcall(TX_CH, sel4cp_msginfo_new(0, 0));
+    unsigned int tx_first = sel4cp_mr_get(0);
+    unsigned int tx_count = sel4cp_mr_get(1);
+    for (unsigned int i = tx_first; i < tx_first + tx_count; i++) {
+        state.tx_free_list[state.tx_free_count++] = shared_dma_vaddr + BUF_SIZE * (NUM_BUFFERS + i);
+    }
+
+    get_mac();
+
+    /* The RX multiplexer notifies INIT once the driver is up */
+}
+
+void notified(sel4cp_channel ch)
+{
+    switch(ch) {
+        case RX_CH:
+            receive_frames();
+            run();
+            return;
+        case TX_CH:
+            reclaim_tx_buffers();
+            run();
+            return;
+        case INIT:
+            gpt_init();
+            start_phase(PKTGEN_WARMUP, get_ticks());
+            sel4cp_dbg_puts(sel4cp_name);
+            sel4cp_dbg_puts(": init complete -- generating after warm-up\n");
+            return;
+        case TIMER:
+            gpt[GPT_SR] = gpt[GPT_SR];
+            set_timeout();
+            run();
+            sel4cp_irq_ack(ch);
+            return;
+        default:
+            sel4cp_dbg_puts("pktgen: received notification on unexpected channel\n");
+            break;
+    }
+}
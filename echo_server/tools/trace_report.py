@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022, UNSW
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+"""
+Reconstruct per-packet latency breakdowns from a packet trace dump.
+
+Build with PACKET_TRACE=1, run a measurement and capture the serial
+console. When the measurement stops, the benchmark PD dumps the trace ring
+of every PD in the pipeline. Pass the captured log to this script:
+
+    $ tools/trace_report.py console.log --mhz 1200
+
+Packets are followed from the driver receiving them to the driver
+finishing their transmission. An echoed frame is copied into a TX buffer
+and changes id, so the frame a client sends after an echo callback is
+taken to be that echo's reply.
+"""
+
+import argparse
+import bisect
+import collections
+import sys
+
+STAGES = [
+    "irq",
+    "drv_rx",
+    "mux_rx",
+    "cli_rx",
+    "echo",
+    "cli_tx",
+    "mux_tx",
+    "drv_tx",
+    "drv_tx_done",
+]
+IRQ, DRV_RX, MUX_RX, CLI_RX, ECHO, CLI_TX, MUX_TX, DRV_TX, DRV_TX_DONE = range(len(STAGES))
+NO_ID = 0xffffffff
+
+Record = collections.namedtuple("Record", "pd pos stage id cycles")
+
+
+def parse(lines):
+    """Parse a dump into a list of records per PD."""
+    traces = {}
+    current = None
+    for line in lines:
+        words = line.split()
+        if len(words) >= 2 and words[0] == "trace":
+            current = None if words[1] == "end" else traces.setdefault(words[1], [])
+            continue
+        if current is None or len(words) != 3:
+            continue
+        try:
+            stage, pkt, cycles = (int(w, 16) for w in words)
+        except ValueError:
+            continue
+        current.append((stage, pkt, cycles))
+
+    return {pd: [Record(pd, i, *r) for i, r in enumerate(recs)] for pd, recs in traces.items()}
+
+
+class Index:
+    """Times at which each packet id reached each stage."""
+
+    def __init__(self, traces):
+        self.events = collections.defaultdict(list)
+        for recs in traces.values():
+            for r in recs:
+                self.events[(r.stage, r.id)].append(r)
+        for evs in self.events.values():
+            evs.sort(key=lambda r: r.cycles)
+
+    def next(self, stage, pkt, after, before=None):
+        """First record of pkt at stage from cycle count after, if earlier than before."""
+        evs = self.events.get((stage, pkt), [])
+        i = bisect.bisect_left([r.cycles for r in evs], after)
+        if i == len(evs) or (before is not None and evs[i].cycles >= before):
+            return None
+        return evs[i]
+
+    def reuse(self, r):
+        """Cycle count at which r's packet id next reached r's stage."""
+        nxt = self.next(r.stage, r.id, r.cycles + 1)
+        return nxt.cycles if nxt else None
+
+
+def follow(traces, index, rx):
+    """Follow a received frame through the pipeline, returning its records by stage."""
+    path = {DRV_RX: rx}
+
+    eth = traces.get("eth", [])
+    for r in reversed(eth[:rx.pos]):
+        if r.stage == IRQ:
+            path[IRQ] = r
+            break
+
+    prev = rx
+    for stage in (MUX_RX, CLI_RX, ECHO):
+        r = index.next(stage, prev.id, prev.cycles, index.reuse(prev))
+        if r is None:
+            return path
+        path[stage] = prev = r
+
+    # The reply is the next frame the same client sends
+    for r in traces[prev.pd][prev.pos + 1:]:
+        if r.stage == ECHO:
+            return path
+        if r.stage == CLI_TX:
+            path[CLI_TX] = prev = r
+            break
+    else:
+        return path
+
+    for stage in (MUX_TX, DRV_TX, DRV_TX_DONE):
+        r = index.next(stage, prev.id, prev.cycles, index.reuse(prev))
+        if r is None:
+            return path
+        path[stage] = prev = r
+
+    return path
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def histogram(values, unit, scale):
+    """Print a log2 histogram of values."""
+    buckets = collections.Counter(max(v, 1).bit_length() - 1 for v in values)
+    top = max(buckets.values())
+    for b in range(min(buckets), max(buckets) + 1):
+        n = buckets.get(b, 0)
+        lo = (1 << b) / scale
+        print("  >= %10.2f %-6s %8d %s" % (lo, unit, n, "#" * (50 * n // top)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin,
+                        help="captured console output (default: stdin)")
+    parser.add_argument("--mhz", type=float, help="CPU clock, to report microseconds instead of cycles")
+    parser.add_argument("--histogram", default="drv_rx:drv_tx",
+                        help="span to print a histogram for, as first:last stage (default: %(default)s)")
+    args = parser.parse_args()
+
+    traces = parse(args.log)
+    if not traces:
+        sys.exit("no trace dump found")
+
+    for pd, recs in traces.items():
+        print("%-8s %8d records" % (pd, len(recs)))
+
+    index = Index(traces)
+    paths = [follow(traces, index, r) for recs in traces.values() for r in recs if r.stage == DRV_RX]
+    complete = sum(1 for p in paths if DRV_TX_DONE in p)
+    print("%d frames received, %d followed to transmit completion\n" % (len(paths), complete))
+
+    unit, scale = ("us", args.mhz) if args.mhz else ("cycles", 1.0)
+
+    print("%-24s %8s %10s %10s %10s %10s %10s  (%s)" %
+          ("stage", "count", "min", "median", "p90", "p99", "max", unit))
+    for first, last in zip(STAGES, STAGES[1:]):
+        a, b = STAGES.index(first), STAGES.index(last)
+        deltas = sorted(p[b].cycles - p[a].cycles for p in paths if a in p and b in p)
+        if not deltas:
+            continue
+        print("%-24s %8d %10.2f %10.2f %10.2f %10.2f %10.2f" % (
+            first + " -> " + last, len(deltas),
+            deltas[0] / scale, percentile(deltas, 50) / scale, percentile(deltas, 90) / scale,
+            percentile(deltas, 99) / scale, deltas[-1] / scale))
+
+    first, _, last = args.histogram.partition(":")
+    if first not in STAGES or last not in STAGES:
+        sys.exit("unknown stage in --histogram, expected one of: " + ", ".join(STAGES))
+    a, b = STAGES.index(first), STAGES.index(last)
+    deltas = [p[b].cycles - p[a].cycles for p in paths if a in p and b in p]
+    if deltas:
+        print("\n%s -> %s" % (first, last))
+        histogram(deltas, unit, scale)
+
+
+if __name__ == "__main__":
+    main()
@@ -17,6 +17,7 @@
 #include "lwip/udp.h"
 
 #include "echo.h"
+#include "trace.h"
 
 #define UDP_ECHO_PORT 1235
 
@@ -24,6 +25,7 @@ static struct udp_pcb *udp_socket;
 
 static void lwip_udp_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
 {
+    TRACE(TRACE_ECHO, TRACE_BUF_ID(p->payload));
     err_t error = udp_sendto(pcb, p, addr, port);
     if (error) {
         sel4cp_dbg_puts("Failed to send UDP packet through socket\n");
@@ -15,13 +15,26 @@
 
 #include "lwip/ip.h"
 #include "lwip/pbuf.h"
+#include "lwip/sys.h"
 #include "lwip/tcp.h"
+#include "lwip/timeouts.h"
 
 #include "echo.h"
 #include "bench.h"
+#include "bench_events.h"
+#include "net_stats.h"
+#include "tx_queue.h"
 
 #define START_PMU 3
 #define STOP_PMU 5
+#define ROTATE_PMU 7
+#define SETUP_PMU 8
+
+/* How often the PMU moves on to the next group of events */
+#define PMU_ROTATE_MS 20
+
+/* Samples of a time series kept for the results */
+#define MAX_SAMPLES 512
 
 /* This file implements a TCP based utilization measurment process that starts
  * and stops utilization measurements based on a client's requests.
@@ -32,13 +45,27 @@
  * - Server sends: 200 OK (Ready to go)\n
  * - Client sends: LOAD cpu_target_lukem\n
  * - Server sends: 200 OK\n
- * - Client sends: SETUP args::""\n
+ * - Client sends: SETUP args::"${events}"\n
  * - Server sends: 200 OK\n
+ *   where events lists the PMU events to count, by name (see
+ *   bench_events.h), by profile name or as hex event numbers, separated by
+ *   commas or spaces. No events selects the default profile. The list may
+ *   also hold format=csv or format=json, to have STOP return every result
+ *   (idle and total cycles, PMU events, per-PD utilisation, TX queue and
+ *   ring statistics) as a CSV header line and value line, or as a single
+ *   JSON object. Results are keyed like "pd.eth.kernel" in both formats.
+ *   With sample=${ms}, utilisation and traffic are also sampled every ms
+ *   milliseconds during the measurement. The samples are appended to CSV
+ *   and JSON results and, with stream, sent as "sample,${values}\n" lines
+ *   as they are taken.
  * - Client sends: START\n
  * - Client sends: STOP\n
  * - Server sends: 220 VALID DATA (Data to follow)\n
  *                                Content-length: %d\n
  *                                ${content}\n
+ *   where content is ",idle,total" followed by ",name,total,kernel,entries"
+ *   for every PD the benchmark PD collected utilisation for, unless another
+ *   format was selected in SETUP.
  * - Server closes socket.
  *
  * It is also possible for client to send QUIT\n during operation.
@@ -52,13 +79,14 @@
 static struct tcp_pcb *utiliz_socket;
 uintptr_t data_packet;
 uintptr_t cyclecounters_vaddr;
+uintptr_t bench_results_vaddr;
 
 #define WHOAMI "100 IPBENCH V1.0\n"
 #define HELLO "HELLO\n"
 #define OK_READY "200 OK (Ready to go)\n"
 #define LOAD "LOAD cpu_target_lukem\n"
 #define OK "200 OK\n"
-#define SETUP "SETUP args::\"\"\n"
+#define SETUP "SETUP args::"
 #define START "START\n"
 #define STOP "STOP\n"
 #define QUIT "QUIT\n"
@@ -81,9 +109,9 @@ uintptr_t cyclecounters_vaddr;
 
 struct bench *bench = (void *)(uintptr_t)0x5010000;
 
-uint64_t start;
-uint64_t idle_ccount_start;
-uint64_t idle_overflow_start;
+/* Idle counts of every core when the measurement started and stopped */
+static struct bench bench_start[BENCH_MAX_CORES];
+static struct bench bench_stop[BENCH_MAX_CORES];
 
 
 static inline void my_reverse(char s[])
@@ -115,14 +143,734 @@ static inline void my_itoa(uint64_t n, char s[])
     my_reverse(s);
 }
 
+/* Formats the results of a measurement can be returned in */
+typedef enum {
+    RESULTS_IPBENCH,
+    RESULTS_CSV,
+    RESULTS_JSON,
+} results_format_t;
+
+typedef struct setup_options {
+    results_format_t format;
+    /* Sampling interval in milliseconds, 0 to not sample */
+    unsigned int sample_ms;
+    /* Send samples as they are taken */
+    bool stream;
+} setup_options_t;
+
+static setup_options_t options;
+
+/* Utilisation and traffic over one sampling interval */
+typedef struct sample {
+    /* Milliseconds since the measurement started */
+    uint64_t time_ms;
+    /* Idle and total cycles over the interval */
+    uint64_t idle;
+    uint64_t total;
+    /* Frames received, sent and dropped by the TX queue over the interval */
+    uint64_t rx_frames;
+    uint64_t tx_frames;
+    uint64_t tx_dropped;
+    /* Frames waiting in the TX queue and free buffers on the RX ring */
+    uint32_t tx_queue_depth;
+    uint32_t rx_free;
+} sample_t;
+
+#define SAMPLE_FIELDS "time_ms,idle,total,rx_frames,tx_frames,tx_dropped,tx_queue_depth,rx_free"
+
+static struct {
+    sample_t samples[MAX_SAMPLES];
+    unsigned int count;
+    /* Samples that did not fit, or could not be streamed */
+    unsigned int lost;
+    struct tcp_pcb *pcb;
+    u32_t start_ms;
+    /* Counters at the previous sample */
+    uint64_t cycles;
+    struct bench bench[BENCH_MAX_CORES];
+    net_stats_t net;
+    tx_queue_stats_t tx_queue;
+} sampling;
+
+static char result_content[0x10000];
+static char result_buffer[sizeof(result_content) + 64];
+
+/* Connection that started the running measurement */
+static struct tcp_pcb *measuring;
+
+/*
+ * The part of the response to STOP not yet written to the connection. It
+ * can be longer than a single tcp_write, so the rest is written from the
+ * sent callback as the send buffer drains.
+ */
+static struct {
+    struct tcp_pcb *pcb;
+    const char *next;
+    size_t left;
+} response;
+
+static inline bool is_separator(char c)
+{
+    return c == ',' || c == ' ';
+}
+
+static int parse_pmu_events(const char *args, size_t len, uint32_t *events, int n_events,
+                            setup_options_t *options);
+
+/**
+ * Add a named event or profile, or an event number, to a list of events.
+ *
+ * @return the new number of events, or -1 if the name is not recognised
+ *         or there are too many events.
+ */
+static int add_pmu_event(const char *name, size_t len, uint32_t *events, int n_events)
+{
+    for (int i = 0; i < LWIP_ARRAYSIZE(bench_profiles); i++) {
+        const char *profile = bench_profiles[i].name;
+        if (strlen(profile) == len && !strncmp(profile, name, len)) {
+            const char *list = bench_profiles[i].events;
+            return parse_pmu_events(list, strlen(list), events, n_events, NULL);
+        }
+    }
+
+    if (n_events == BENCH_MAX_EVENTS) {
+        return -1;
+    }
+
+    for (int i = 0; i < LWIP_ARRAYSIZE(bench_event_names); i++) {
+        const char *event = bench_event_names[i].name;
+        if (strlen(event) == len && !strncmp(event, name, len)) {
+            events[n_events] = bench_event_names[i].event;
+            return n_events + 1;
+        }
+    }
+
+    if (len > 2 && name[0] == '0' && name[1] == 'x') {
+        uint32_t event = 0;
+        for (size_t i = 2; i < len; i++) {
+            char c = name[i];
+            if (c >= '0' && c <= '9') {
+                event = event * 16 + c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                event = event * 16 + c - 'a' + 10;
+            } else {
+                return -1;
+            }
+        }
+        events[n_events] = event;
+        return n_events + 1;
+    }
+
+    return -1;
+}
+
+/**
+ * Parse a list of PMU events and profiles.
+ *
+ * @param args list to parse, separated by commas or spaces.
+ * @param len length of the list.
+ * @param events array of BENCH_MAX_EVENTS events to add to.
+ * @param n_events number of events already in the array.
+ * @param options updated with the options in the list, NULL if the list may
+ *                not hold options.
+ *
+ * @return the new number of events, or -1 if the list is invalid.
+ */
+static int parse_pmu_events(const char *args, size_t len, uint32_t *events, int n_events,
+                            setup_options_t *options)
+{
+    size_t i = 0;
+
+    while (i < len && n_events >= 0) {
+        while (i < len && is_separator(args[i])) {
+            i++;
+        }
+        size_t start = i;
+        while (i < len && !is_separator(args[i])) {
+            i++;
+        }
+        const char *token = &args[start];
+        size_t token_len = i - start;
+        if (options && token_len > 7 && !strncmp(token, "format=", 7)) {
+            if (token_len == 10 && !strncmp(token + 7, "csv", 3)) {
+                options->format = RESULTS_CSV;
+            } else if (token_len == 11 && !strncmp(token + 7, "json", 4)) {
+                options->format = RESULTS_JSON;
+            } else if (token_len == 14 && !strncmp(token + 7, "ipbench", 7)) {
+                options->format = RESULTS_IPBENCH;
+            } else {
+                return -1;
+            }
+        } else if (options && token_len > 7 && !strncmp(token, "sample=", 7)) {
+            unsigned int ms = 0;
+            for (size_t j = 7; j < token_len; j++) {
+                if (token[j] < '0' || token[j] > '9' || ms > 60000) {
+                    return -1;
+                }
+                ms = ms * 10 + token[j] - '0';
+            }
+            options->sample_ms = ms;
+        } else if (options && token_len == 6 && !strncmp(token, "stream", 6)) {
+            options->stream = true;
+        } else if (token_len) {
+            n_events = add_pmu_event(token, token_len, events, n_events);
+        }
+    }
+
+    return n_events;
+}
+
+/**
+ * Select the PMU events counted during measurements, and the format of
+ * the results, from the SETUP arguments.
+ *
+ * @param msg SETUP message.
+ * @param len length of the message.
+ *
+ * @return 0 on success, -1 if the arguments are invalid.
+ */
+static int setup_measurement(const char *msg, size_t len)
+{
+    /* The arguments are quoted */
+    const char *args = msg + strlen(SETUP);
+    const char *end = msg + len;
+    if (args >= end || *args != '"') {
+        return -1;
+    }
+    args++;
+    const char *close = args;
+    while (close < end && *close != '"') {
+        close++;
+    }
+    if (close == end) {
+        return -1;
+    }
+
+    uint32_t events[BENCH_MAX_EVENTS];
+    setup_options_t new_options = { .format = RESULTS_IPBENCH };
+    int n_events = parse_pmu_events(args, close - args, events, 0, &new_options);
+    if (n_events < 0) {
+        return -1;
+    }
+    options = new_options;
+
+    for (int i = 0; i < n_events; i++) {
+        sel4cp_mr_set(i, events[i]);
+    }
+    sel4cp_msginfo reply = sel4cp_ppcall(SETUP_PMU, sel4cp_msginfo_new(n_events, n_events));
+    return sel4cp_msginfo_get_label(reply) ? -1 : 0;
+}
+
+/**
+ * Have the benchmark PD move on to the next group of PMU events, for as
+ * long as a measurement is running.
+ */
+static void rotate_pmu(void *arg)
+{
+    sel4cp_notify(ROTATE_PMU);
+    sys_timeout(PMU_ROTATE_MS, rotate_pmu, NULL);
+}
+
+static void print_tx_queue_stats(void)
+{
+    tx_queue_stats_t stats;
+    tx_queue_get_stats(&stats);
+
+    char buf[24];
+    sel4cp_dbg_puts("tx queue max depth: ");
+    my_itoa(stats.max_depth, buf);
+    sel4cp_dbg_puts(buf);
+    sel4cp_dbg_puts(", queued: ");
+    my_itoa(stats.queued, buf);
+    sel4cp_dbg_puts(buf);
+    sel4cp_dbg_puts(", dropped: ");
+    my_itoa(stats.dropped, buf);
+    sel4cp_dbg_puts(buf);
+    sel4cp_dbg_puts("\n");
+}
+
+typedef struct results_writer {
+    char *buf;
+    size_t len;
+    size_t size;
+    bool overflow;
+    /* Write the keys of the results instead of their values, for CSV */
+    bool keys;
+    unsigned int fields;
+} results_writer_t;
+
+static void put_str(results_writer_t *w, const char *s)
+{
+    size_t n = strlen(s);
+    if (w->len + n >= w->size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, s, n + 1);
+    w->len += n;
+}
+
+static void put_u64(results_writer_t *w, uint64_t value)
+{
+    char buf[24];
+    my_itoa(value, buf);
+    put_str(w, buf);
+}
+
+static void put_key(results_writer_t *w, const char *group, const char *name, const char *field)
+{
+    put_str(w, group);
+    if (name) {
+        put_str(w, ".");
+        put_str(w, name);
+    }
+    if (field) {
+        put_str(w, ".");
+        put_str(w, field);
+    }
+}
+
+/**
+ * Write one result in the selected format.
+ *
+ * @param w writer to write to.
+ * @param group, name, field parts of the result's key, name and field may
+ *                           be NULL.
+ * @param value value of the result.
+ */
+static void put_result(results_writer_t *w, const char *group, const char *name, const char *field,
+                       uint64_t value)
+{
+    if (w->fields++) {
+        put_str(w, ",");
+    }
+
+    if (options.format == RESULTS_JSON) {
+        put_str(w, "\"");
+        put_key(w, group, name, field);
+        put_str(w, "\":");
+        put_u64(w, value);
+    } else if (w->keys) {
+        put_key(w, group, name, field);
+    } else {
+        put_u64(w, value);
+    }
+}
+
+static void put_sample(results_writer_t *w, sample_t *sample)
+{
+    put_u64(w, sample->time_ms);
+    put_str(w, ",");
+    put_u64(w, sample->idle);
+    put_str(w, ",");
+    put_u64(w, sample->total);
+    put_str(w, ",");
+    put_u64(w, sample->rx_frames);
+    put_str(w, ",");
+    put_u64(w, sample->tx_frames);
+    put_str(w, ",");
+    put_u64(w, sample->tx_dropped);
+    put_str(w, ",");
+    put_u64(w, sample->tx_queue_depth);
+    put_str(w, ",");
+    put_u64(w, sample->rx_free);
+}
+
+/**
+ * Write the samples taken during the measurement, as CSV lines or as a
+ * JSON member.
+ */
+static void put_samples(results_writer_t *w)
+{
+    if (options.format == RESULTS_JSON) {
+        put_str(w, ",\"samples.lost\":");
+        put_u64(w, sampling.lost);
+        put_str(w, ",\"samples\":{\"fields\":[\"");
+        for (const char *c = SAMPLE_FIELDS; *c; c++) {
+            char s[2] = { *c, 0 };
+            put_str(w, *c == ',' ? "\",\"" : s);
+        }
+        put_str(w, "\"],\"values\":[");
+        for (int i = 0; i < sampling.count; i++) {
+            put_str(w, i ? ",[" : "[");
+            put_sample(w, &sampling.samples[i]);
+            put_str(w, "]");
+        }
+        put_str(w, "]}");
+    } else {
+        put_str(w, "\n\n" SAMPLE_FIELDS);
+        for (int i = 0; i < sampling.count; i++) {
+            put_str(w, "\n");
+            put_sample(w, &sampling.samples[i]);
+        }
+    }
+}
+
+/**
+ * Idle and total cycles between two snapshots of the idle counts, summed
+ * over the cores whose idle loop was counting in both.
+ */
+static void idle_cycles(struct bench *from, struct bench *to, uint64_t *idle, uint64_t *total)
+{
+    *idle = 0;
+    *total = 0;
+    for (int i = 0; i < BENCH_MAX_CORES; i++) {
+        if (!from[i].calibrated || !to[i].calibrated) {
+            continue;
+        }
+        *idle += to[i].ccount - from[i].ccount;
+        *total += to[i].ts - from[i].ts;
+        *total += ULONG_MAX * (to[i].overflows - from[i].overflows);
+    }
+}
+
+static unsigned int counting_cores(void)
+{
+    unsigned int cores = 0;
+    for (int i = 0; i < BENCH_MAX_CORES; i++) {
+        cores += !!bench[i].calibrated;
+    }
+    return cores;
+}
+
+/**
+ * Sample utilisation and traffic since the previous sample.
+ */
+static void take_sample(void *arg)
+{
+    /*
+     * An idle count only moves on while its core is idle, so the total
+     * comes from this core's cycle counter instead, as every core's clock
+     * runs at the same rate.
+     */
+    uint64_t cycles = bench_cycle_count();
+    uint64_t idle, total;
+    struct bench now[BENCH_MAX_CORES];
+    memcpy(now, bench, sizeof(now));
+    idle_cycles(sampling.bench, now, &idle, &total);
+    net_stats_t net;
+    tx_queue_stats_t tx_queue;
+    net_get_stats(&net);
+    tx_queue_get_stats(&tx_queue);
+
+    sample_t sample = {
+        .time_ms = sys_now() - sampling.start_ms,
+        .idle = idle,
+        .total = (cycles - sampling.cycles) * counting_cores(),
+        .rx_frames = net.rx_frames - sampling.net.rx_frames,
+        .tx_frames = net.tx_frames - sampling.net.tx_frames,
+        .tx_dropped = tx_queue.dropped - sampling.tx_queue.dropped,
+        .tx_queue_depth = tx_queue.depth,
+        .rx_free = net.rx_free,
+    };
+
+    sampling.cycles = cycles;
+    memcpy(sampling.bench, now, sizeof(now));
+    sampling.net = net;
+    sampling.tx_queue = tx_queue;
+
+    if (sampling.count < MAX_SAMPLES) {
+        sampling.samples[sampling.count++] = sample;
+    } else {
+        sampling.lost++;
+    }
+
+    if (options.stream) {
+        char line[200];
+        results_writer_t w = { .buf = line, .size = sizeof(line) };
+        put_str(&w, "sample,");
+        put_sample(&w, &sample);
+        put_str(&w, "\n");
+        if (tcp_write(sampling.pcb, line, w.len, TCP_WRITE_FLAG_COPY) == ERR_OK) {
+            tcp_output(sampling.pcb);
+        } else {
+            sampling.lost++;
+        }
+    }
+
+    sys_timeout(options.sample_ms, take_sample, NULL);
+}
+
+static void start_sampling(struct tcp_pcb *pcb)
+{
+    sampling.count = 0;
+    sampling.lost = 0;
+    sampling.pcb = pcb;
+    sampling.start_ms = sys_now();
+    sampling.cycles = bench_cycle_count();
+    memcpy(sampling.bench, bench, sizeof(sampling.bench));
+    net_get_stats(&sampling.net);
+    tx_queue_get_stats(&sampling.tx_queue);
+
+    sys_untimeout(take_sample, NULL);
+    sys_timeout(options.sample_ms, take_sample, NULL);
+}
+
+static void stop_sampling(void)
+{
+    sys_untimeout(take_sample, NULL);
+    sampling.pcb = NULL;
+}
+
+/**
+ * Stop rotating PMU events and sampling for the running measurement.
+ */
+static void stop_measurement(void)
+{
+    sys_untimeout(rotate_pmu, NULL);
+    stop_sampling();
+    measuring = NULL;
+}
+
+/**
+ * Forget a connection that is closed or lost, along with the measurement
+ * and response it may have running. The pcb must not be used afterwards.
+ *
+ * @param pcb the connection, only compared against.
+ */
+static void utilization_conn_gone(struct tcp_pcb *pcb)
+{
+    if (pcb == measuring) {
+        stop_measurement();
+    }
+    if (pcb == response.pcb) {
+        response.pcb = NULL;
+    }
+}
+
+/**
+ * Write how idle time was accounted on each core, with the bound on the
+ * idle cycles miscounted and the gaps the idle loop saw.
+ */
+static void put_idle_accounting(results_writer_t *w)
+{
+    uint64_t error = 0;
+
+    for (int i = 0; i < BENCH_MAX_CORES; i++) {
+        struct bench *from = &bench_start[i];
+        struct bench *to = &bench_stop[i];
+        if (!from->calibrated || !to->calibrated) {
+            continue;
+        }
+
+        char core[4];
+        my_itoa(i, core);
+        uint64_t preemptions = to->preemptions - from->preemptions;
+        uint64_t slow = to->slow - from->slow;
+        uint64_t core_error = bench_idle_error(to, preemptions, slow);
+        error += core_error;
+
+        put_result(w, "core", core, "idle", to->ccount - from->ccount);
+        put_result(w, "core", core, "total",
+                   to->ts - from->ts + ULONG_MAX * (to->overflows - from->overflows));
+        put_result(w, "core", core, "iteration", to->iteration);
+        put_result(w, "core", core, "threshold", to->threshold);
+        put_result(w, "core", core, "preemptions", preemptions);
+        put_result(w, "core", core, "slow", slow);
+        put_result(w, "core", core, "idle_error", core_error);
+        for (int bucket = 0; bucket < BENCH_GAP_BUCKETS; bucket++) {
+            uint64_t gaps = to->gaps[bucket] - from->gaps[bucket];
+            if (gaps) {
+                char field[8] = "gap";
+                my_itoa(bucket, field + 3);
+                put_result(w, "core", core, field, gaps);
+            }
+        }
+    }
+
+    put_result(w, "idle_error", NULL, NULL, error);
+}
+
+/**
+ * Write every result of a measurement.
+ *
+ * @param w writer to write to.
+ * @param idle idle cycles over the measurement.
+ * @param total cycles the measurement lasted.
+ */
+static void put_all_results(results_writer_t *w, uint64_t idle, uint64_t total)
+{
+    struct bench_results *results = (struct bench_results *)bench_results_vaddr;
+    tx_queue_stats_t tx_queue;
+    net_stats_t net;
+
+    tx_queue_get_stats(&tx_queue);
+    net_get_stats(&net);
+
+    put_result(w, "idle", NULL, NULL, idle);
+    put_result(w, "total", NULL, NULL, total);
+    put_idle_accounting(w);
+
+    put_result(w, "pmu", NULL, "cycles", results->cycles);
+    for (int i = 0; i < results->num_events && i < BENCH_MAX_EVENTS; i++) {
+        struct bench_event_count *event = &results->events[i];
+        const char *name = bench_event_name(event->event);
+        char hex[12] = "0x";
+        if (!name) {
+            for (int shift = 28, n = 2; shift >= 0; shift -= 4) {
+                unsigned int digit = (event->event >> shift) & 0xf;
+                if (digit || n > 2 || !shift) {
+                    hex[n++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+                    hex[n] = 0;
+                }
+            }
+            name = hex;
+        }
+        put_result(w, "pmu", name, "estimate", event->estimate);
+        put_result(w, "pmu", name, "count", event->count);
+        put_result(w, "pmu", name, "cycles", event->cycles);
+    }
+
+    for (int i = 0; i < results->num_pds && i < BENCH_MAX_PDS; i++) {
+        struct bench_pd_util *pd = &results->pds[i];
+        put_result(w, "pd", pd->name, "total", pd->total);
+        put_result(w, "pd", pd->name, "kernel", pd->kernel);
+        put_result(w, "pd", pd->name, "entries", pd->entries);
+        put_result(w, "pd", pd->name, "schedules", pd->schedules);
+    }
+
+    put_result(w, "tx_queue", NULL, "depth", tx_queue.depth);
+    put_result(w, "tx_queue", NULL, "max_depth", tx_queue.max_depth);
+    put_result(w, "tx_queue", NULL, "queued", tx_queue.queued);
+    put_result(w, "tx_queue", NULL, "dropped", tx_queue.dropped);
+
+    put_result(w, "ring", NULL, "rx_frames", net.rx_frames);
+    put_result(w, "ring", NULL, "tx_frames", net.tx_frames);
+    put_result(w, "ring", NULL, "rx_batch_max", net.rx_batch_max);
+    put_result(w, "ring", NULL, "rx_free", net.rx_free);
+    put_result(w, "ring", NULL, "rx_used", net.rx_used);
+    put_result(w, "ring", NULL, "tx_free", net.tx_free);
+    put_result(w, "ring", NULL, "tx_used", net.tx_used);
+}
+
+/**
+ * Write the results in the format ipbench's cpu_target_lukem expects,
+ * with the per-PD utilisation appended.
+ */
+static void put_ipbench_results(results_writer_t *w, uint64_t idle, uint64_t total)
+{
+    struct bench_results *results = (struct bench_results *)bench_results_vaddr;
+
+    put_str(w, ",");
+    put_u64(w, idle);
+    put_str(w, ",");
+    put_u64(w, total);
+
+    for (int i = 0; i < results->num_pds && i < BENCH_MAX_PDS; i++) {
+        struct bench_pd_util *pd = &results->pds[i];
+        put_str(w, ",");
+        put_str(w, pd->name);
+        put_str(w, ",");
+        put_u64(w, pd->total);
+        put_str(w, ",");
+        put_u64(w, pd->kernel);
+        put_str(w, ",");
+        put_u64(w, pd->entries);
+    }
+}
+
+/**
+ * Build the response to STOP.
+ *
+ * @param buf buffer to build the response in.
+ * @param size size of the buffer.
+ * @param idle idle cycles over the measurement.
+ * @param total cycles the measurement lasted.
+ *
+ * @return length of the response, 0 if it does not fit.
+ */
+static size_t format_results(char *buf, size_t size, uint64_t idle, uint64_t total)
+{
+    results_writer_t content = { .buf = result_content, .size = sizeof(result_content) };
+    content.buf[0] = 0;
+
+    switch (options.format) {
+        case RESULTS_IPBENCH:
+            put_ipbench_results(&content, idle, total);
+            break;
+        case RESULTS_CSV:
+            content.keys = true;
+            put_all_results(&content, idle, total);
+            put_str(&content, "\n");
+            content.keys = false;
+            content.fields = 0;
+            put_all_results(&content, idle, total);
+            if (options.sample_ms) {
+                put_samples(&content);
+            }
+            break;
+        case RESULTS_JSON:
+            put_str(&content, "{");
+            put_all_results(&content, idle, total);
+            if (options.sample_ms) {
+                put_samples(&content);
+            }
+            put_str(&content, "}");
+            break;
+    }
+
+    results_writer_t response = { .buf = buf, .size = size };
+    put_str(&response, "220 VALID DATA (Data to follow)\nContent-length: ");
+    put_u64(&response, content.len);
+    put_str(&response, "\n");
+    put_str(&response, content.buf);
+
+    return (content.overflow || response.overflow) ? 0 : response.len;
+}
+
+/**
+ * Write as much of the response as the send buffer takes, and close our
+ * side of the connection once all of it is written.
+ *
+ * @param pcb the connection the response is for.
+ */
+static void send_response(struct tcp_pcb *pcb)
+{
+    while (response.left) {
+        u16_t len = (u16_t)LWIP_MIN(LWIP_MIN(tcp_sndbuf(pcb), response.left), 0xffff);
+        if (!len) {
+            break;
+        }
+        u8_t flags = TCP_WRITE_FLAG_COPY | (len < response.left ? TCP_WRITE_FLAG_MORE : 0);
+        err_t error = tcp_write(pcb, response.next, len, flags);
+        if (error == ERR_MEM) {
+            /* Try again once some of what is queued has been acked */
+            break;
+        }
+        if (error) {
+            sel4cp_dbg_puts("Failed to send results through utilization peer\n");
+            response.left = 0;
+            break;
+        }
+        response.next += len;
+        response.left -= len;
+    }
+    tcp_output(pcb);
+
+    if (!response.left) {
+        response.pcb = NULL;
+        tcp_shutdown(pcb, 0, 1);
+    }
+}
+
 static err_t utilization_sent_callback(void *arg, struct tcp_pcb *pcb, u16_t len)
 {
+    if (pcb == response.pcb) {
+        send_response(pcb);
+    }
     return ERR_OK;
 }
 
+static void utilization_err_callback(void *arg, err_t err)
+{
+    /* lwIP has already freed the pcb, which was passed as arg */
+    utilization_conn_gone(arg);
+}
+
 static err_t utilization_recv_callback(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
 {
     if (p == NULL) {
+        utilization_conn_gone(pcb);
         tcp_close(pcb);
         return ERR_OK;
     }
@@ -141,52 +889,56 @@ static err_t utilization_recv_callback(void *arg, struct tcp_pcb *pcb, struct pb
             sel4cp_dbg_puts("Failed to send OK message through utilization peer");
         }
     } else if (msg_match(data_packet, SETUP)) {
-        error = tcp_write(pcb, OK, strlen(OK), TCP_WRITE_FLAG_COPY);
+        if (setup_measurement((const char *)data_packet, p->tot_len)) {
+            sel4cp_dbg_puts("Invalid PMU events in SETUP arguments\n");
+            error = tcp_write(pcb, ERROR, strlen(ERROR), TCP_WRITE_FLAG_COPY);
+        } else {
+            error = tcp_write(pcb, OK, strlen(OK), TCP_WRITE_FLAG_COPY);
+        }
         if (error) {
             sel4cp_dbg_puts("Failed to send OK message through utilization peer");
         }
     } else if (msg_match(data_packet, START)) {
         print("measurement starting... \n");
 
-        start = bench->ts;
-        idle_ccount_start = bench->ccount;
-        idle_overflow_start = bench->overflows;
+        memcpy(bench_start, bench, sizeof(bench_start));
+        tx_queue_reset_stats();
+        net_reset_stats();
 
         sel4cp_notify(START_PMU);
+        sys_untimeout(rotate_pmu, NULL);
+        sys_timeout(PMU_ROTATE_MS, rotate_pmu, NULL);
+        measuring = pcb;
+        if (options.sample_ms) {
+            start_sampling(pcb);
+        }
 
     } else if (msg_match(data_packet, STOP)) {        
         print("measurement finished \n");;
         
         uint64_t total, idle;
 
-        total = bench->ts - start;
-        total += ULONG_MAX * (bench->overflows - idle_overflow_start);
-        idle = bench->ccount - idle_ccount_start;
+        memcpy(bench_stop, bench, sizeof(bench_stop));
+        idle_cycles(bench_start, bench_stop, &idle, &total);
 
-        char tbuf[16];
-        my_itoa(total, tbuf);
+        stop_measurement();
 
-        char ibuf[16];
-        my_itoa(idle, ibuf);
+        /* The benchmark PD collects the per-PD utilisation before returning */
+        sel4cp_ppcall(STOP_PMU, sel4cp_msginfo_new(0, 0));
 
-        char buffer[100];
-
-        int len = strlen(tbuf) + strlen(ibuf) + 2;
-        char lbuf[16];
-        my_itoa(len, lbuf);
-
-        strcat(strcpy(buffer, "220 VALID DATA (Data to follow)\nContent-length: "), lbuf);
-        strcat(buffer, "\n,");
-        strcat(buffer, ibuf);
-        strcat(buffer, ",");
-        strcat(buffer, tbuf);
+        size_t len = format_results(result_buffer, sizeof(result_buffer), idle, total);
+        char *buffer = result_buffer;
+        if (!len) {
+            sel4cp_dbg_puts("Utilization results do not fit the response buffer\n");
+            buffer = ERROR;
+        }
 
-        // sel4cp_dbg_puts(buffer);
-        error = tcp_write(pcb, buffer, strlen(buffer), TCP_WRITE_FLAG_COPY);
+        response.pcb = pcb;
+        response.next = buffer;
+        response.left = strlen(buffer);
+        send_response(pcb);
 
-        tcp_shutdown(pcb, 0, 1);
-        
-        sel4cp_notify(STOP_PMU);
+        print_tx_queue_stats();
     } else if (msg_match(data_packet, QUIT)) {
         /* Do nothing for now */
     } else {
@@ -209,8 +961,10 @@ static err_t utilization_accept_callback(void *arg, struct tcp_pcb *newpcb, err_
     if (error) {
         sel4cp_dbg_puts("Failed to send WHOAMI message through utilization peer");
     }
+    tcp_arg(newpcb, newpcb);
     tcp_sent(newpcb, utilization_sent_callback);
     tcp_recv(newpcb, utilization_recv_callback);
+    tcp_err(newpcb, utilization_err_callback);
     
     return ERR_OK;
 }